@@ -0,0 +1,111 @@
+/** \file deviceDaemon.cpp
+  *  \brief A program which owns a set of devices and shares them with other processes
+  *
+  * This program connects to one or more k-cubes and serves them with a \ref tmcDaemon, so any number of other
+  * processes, e.g. a controller, a GUI, and a logger, can command them and read their status through a
+  * \ref tmcClient.
+  *
+  * Compile with
+  * \verbatim
+    g++ -O2 -o deviceDaemon deviceDaemon.cpp -I/usr/include/libftdi1/ -lftdi1 -lpthread
+    \endverbatim
+  * (change the include path as needed.  you may also need to add the -L library path)
+  *
+  * Run with
+  * \verbatim
+    ./deviceDaemon /dev/shm/tmcDaemon 29252712 [29252713 ...]
+   \endverbatim
+  * where you change the serial numbers to match the USB device serial numbers of your k-cubes.  The daemon runs
+  * until it receives SIGINT or SIGTERM.
+  *
+  */
+
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#include <cstdlib>
+#include <memory>
+
+#include <signal.h>
+
+#include "tmcDaemon.hpp"
+
+/** The device daemon main program.
+  */
+int main( int argc,    ///< [in] the number of command line arguments, at least 3
+          char **argv  ///< [in] the command line arguments. argv[1] is the region file, then the serial numbers.
+        )
+{
+    if(argc < 3 || static_cast<uint32_t>(argc - 2) > tmcDaemon::maxDevices)
+    {
+        std::cerr << "Usage: " << argv[0] << " region-file serial [serial ...]\n";
+        std::cerr << "At most " << tmcDaemon::maxDevices << " devices can be served.\n";
+        return EXIT_FAILURE;
+    }
+
+    //block the stop signals before any thread starts, so only sigwait below receives them
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    //the time in ms to wait for a response before a command fails with -320
+    const uint32_t readTimeout = 1000;
+
+    std::vector<std::unique_ptr<tmcController>> tmccs;
+    tmcDaemon daemon;
+
+    for(int n = 2; n < argc; ++n)
+    {
+        tmccs.emplace_back(new tmcController);
+
+        //a cube which stays on the bus but stops answering must fail its commands, not stall its ring forever
+        tmccs.back()->readTimeout(readTimeout);
+
+        //a device which is not connected now is served anyway, and is picked up by the reconnection thread
+        //a char * would select connect(bool), so the serial number must be passed as a std::string
+        if(tmccs.back()->connect(std::string(argv[n])) < 0)
+        {
+            std::cerr << "Device " << argv[n] << " is not connected\n";
+        }
+
+        if(tmccs.back()->startReconnect() < 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+        daemon.add(tmccs.back().get(), argv[n]);
+    }
+
+    if(daemon.start(argv[1]) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << "Serving " << argc - 2 << " device(s) at " << argv[1] << "\n";
+
+    int sig;
+    sigwait(&sigs, &sig);
+
+    daemon.stop();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+/** \file journalTest.cpp
+  *  \brief A test that the state journal round trips, and survives a torn write
+  *
+  * This program applies settings to a controller with a journal open, running against a synthetic \ref tmcTestDevice
+  * so no device is needed.  A second controller then opens the same journal and must load the
+  * same applied state.  Then the newest record is torn, as by a crash while it was written, and the previous
+  * state must be loaded instead.
+  *
+  * Compile with
+  * \verbatim
+    g++ -o journalTest journalTest.cpp -I/usr/include/libftdi1/ -lftdi1 -lpthread
+    \endverbatim
+  * (change the include path as needed.  you may also need to add the -L library path)
+  *
+  * Run with
+  * \verbatim
+    ./journalTest [directory]
+   \endverbatim
+  * where the optional directory holds the temporary journal and trace, /tmp by default.  They are removed on exit.
+  * The exit status is 0 if the test passes.
+  *
+  */
+
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#include "tmcTestDevice.hpp"
+
+/// A tmcController with access to the journal, to load it without a device and to tear its records
+class journalTester : public tmcController
+{
+public:
+
+    using tmcController::journalLoad;
+
+    /// Invalidate the newest record, as a crash while it was being written would
+    void tearNewest()
+    {
+        m_journal->slot[m_journalSeq & 1].seq = 0;
+    }
+
+    /// Invalidate both records
+    void tearAll()
+    {
+        m_journal->slot[0].seq = 0;
+        m_journal->slot[1].seq = 0;
+    }
+};
+
+/// Compare two applied states
+/**
+  * \returns true if every remembered setting is the same
+  */
+bool sameState( const tmcController::AppliedState & a, ///< [in] the first state
+                const tmcController::AppliedState & b  ///< [in] the second state
+              )
+{
+    if(a.mmiParams.has_value() != b.mmiParams.has_value())
+    {
+        return false;
+    }
+
+    if(a.mmiParams && (a.mmiParams->JSMode != b.mmiParams->JSMode || a.mmiParams->JSVoltStep != b.mmiParams->JSVoltStep ||
+                          a.mmiParams->DispBrightness != b.mmiParams->DispBrightness))
+    {
+        return false;
+    }
+
+    return a.updatesStopped == b.updatesStopped && a.chanIdent == b.chanIdent && a.chanEnable == b.chanEnable &&
+              a.posControlMode == b.posControlMode && a.dispIntensity == b.dispIntensity &&
+                 a.outputVolts == b.outputVolts && a.outputPos == b.outputPos;
+}
+
+/** The journal test main program.
+  */
+int main( int argc,    ///< [in] the number of command line arguments, 1 or 2
+          char **argv  ///< [in] the command line arguments. argv[1], if present, is the directory for the temporary files.
+        )
+{
+    std::string dir = (argc > 1) ? argv[1] : "/tmp";
+    std::string jpath = dir + "/journalTest.jrnl";
+    std::string tpath = dir + "/journalTest.trace";
+
+    unlink(jpath.c_str());
+
+    //The set commands only write, and the replay does not require the writes to match, so any frames will do
+    tmcTestDevice dev("journalTest");
+    if(dev.open(tpath, 1024) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    for(int n = 0; n < 100; ++n)
+    {
+        dev.write<tmcApt::PZ_SET_OUTPUTVOLTS>(1, 0);
+    }
+
+    dev.load();
+
+    tmcController::AppliedState before, after;
+    int bad = 0;
+
+    {
+        tmcController tmcc;
+        tmcc.postFlushSleep(0);
+        tmcc.replay(&dev.replay());
+
+        if(tmcc.journalOpen(jpath) < 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+        tmcController::KMMIParams par;
+        par.JSMode = 0x02;
+        par.JSVoltStep = 25;
+        par.DispBrightness = 7;
+
+        int rv = tmcc.hw_stop_updatemsgs();
+        rv |= tmcc.mod_set_chanenablestate(0x01, tmcController::EnableState::enabled);
+        rv |= tmcc.pz_set_poscontrolmode(tmcController::PosControlMode::openLoop);
+        rv |= tmcc.kpz_set_kcubemmiparams(par);
+        rv |= tmcc.pz_set_tpz_dispsettings(5);
+        rv |= tmcc.pz_set_outputvolts(0.4);
+        before = tmcc.appliedState();
+
+        rv |= tmcc.pz_set_outputvolts(0.2);
+        after = tmcc.appliedState();
+
+        if(rv != 0)
+        {
+            std::cerr << "Applying the settings failed: " << tmcc.lastError().legacy() << "\n";
+            ++bad;
+        }
+
+        tmcc.replay(nullptr);
+    }
+
+    journalTester jt;
+    if(jt.journalOpen(jpath) < 0)
+    {
+        unlink(jpath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    int rv = jt.journalLoad();
+    bool ok = (rv == 0 && sameState(jt.appliedState(), after));
+    std::cout << "round trip:     " << (ok ? "same" : "different") << "\n";
+    bad += !ok;
+
+    jt.tearNewest();
+    rv = jt.journalLoad();
+    ok = (rv == 0 && sameState(jt.appliedState(), before));
+    std::cout << "torn newest:    " << (ok ? "previous state" : "wrong state") << "\n";
+    bad += !ok;
+
+    jt.tearAll();
+    rv = jt.journalLoad();
+    std::cout << "both torn:      " << rv << "\n";
+    bad += (rv != -1);
+
+    jt.journalClose();
+    unlink(jpath.c_str());
+
+    return tmcTestResult(bad == 0);
+}
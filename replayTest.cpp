@@ -0,0 +1,169 @@
+/** \file replayTest.cpp
+  *  \brief A test that a recorded wire trace replays the same session
+  *
+  * This program runs a controller against a synthetic \ref tmcTestDevice, while recording its own wire trace with
+  * \ref tmcTrace.  A second controller then replays the recorded trace with the same commands, and must read the
+  * same values with every write matched and no event left over.  Finally a changed command must be counted as a
+  * mismatch.  No device is needed.
+  *
+  * Compile with
+  * \verbatim
+    g++ -o replayTest replayTest.cpp -I/usr/include/libftdi1/ -lftdi1 -lpthread
+    \endverbatim
+  * (change the include path as needed.  you may also need to add the -L library path)
+  *
+  * Run with
+  * \verbatim
+    ./replayTest [directory]
+   \endverbatim
+  * where the optional directory holds the temporary traces, /tmp by default.  They are removed on exit.
+  * The exit status is 0 if the test passes.
+  *
+  */
+
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#include "tmcTestDevice.hpp"
+
+/// The number of times the commands are run
+static constexpr int nLoops = 50;
+
+/// Run the commands of the test, and collect the values read
+/**
+  * \returns the bitwise or of the return values of the commands
+  */
+int runSession( tmcController & tmcc,      ///< [in] the controller, with the replay set
+                std::vector<float> & vals  ///< [out] the output volts and status voltages read
+              )
+{
+    vals.clear();
+
+    int rv = 0;
+    for(int n = 0; n < nLoops; ++n)
+    {
+        float ov;
+        tmcController::PZStatus pzs;
+
+        rv |= tmcc.pz_set_outputvolts(n/100.0);
+        rv |= tmcc.pz_req_outputvolts(ov);
+        rv |= tmcc.pz_req_pzstatusupdate(pzs);
+
+        vals.push_back(ov);
+        vals.push_back(pzs.voltage);
+    }
+
+    return rv;
+}
+
+/** The replay test main program.
+  */
+int main( int argc,    ///< [in] the number of command line arguments, 1 or 2
+          char **argv  ///< [in] the command line arguments. argv[1], if present, is the directory for the temporary files.
+        )
+{
+    std::string dir = (argc > 1) ? argv[1] : "/tmp";
+    std::string devPath = dir + "/replayTest.device.trace";
+    std::string recPath = dir + "/replayTest.recorded.trace";
+
+    //The synthetic device: each request is answered with a value that changes every loop
+    tmcTestDevice dev("replayTest");
+    if(dev.open(devPath) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    for(int n = 0; n < nLoops; ++n)
+    {
+        int16_t counts = (n/100.0)*32767;
+
+        dev.write<tmcApt::PZ_SET_OUTPUTVOLTS>(1, counts);
+
+        dev.write<tmcApt::PZ_REQ_OUTPUTVOLTS>(1);
+        dev.read<tmcApt::PZ_GET_OUTPUTVOLTS>(1, counts);
+
+        dev.write<tmcApt::PZ_REQ_PZSTATUSUPDATE>(1);
+
+        unsigned char frame[tmcApt::maxFrameSize];
+        tmcApt::encode<tmcApt::PZ_GET_PZSTATUSUPDATE>(frame);
+        tmcApt::put<tmcApt::PZ_GET_PZSTATUSUPDATE::OutputVoltage>(frame, counts);
+        dev.record(tmcTrace::dirRead, frame, tmcApt::PZ_GET_PZSTATUSUPDATE::size);
+    }
+
+    dev.load();
+
+    //The session is recorded into a second device, which is then replayed
+    tmcTestDevice rec("");
+    if(rec.open(recPath) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    int bad = 0;
+
+    //Record a session against the synthetic device
+    std::vector<float> recVals;
+    {
+        tmcController tmcc;
+        tmcc.postFlushSleep(0);
+        tmcc.replay(&dev.replay());
+        tmcc.wireTrace(&rec.trace());
+
+        int rv = runSession(tmcc, recVals);
+
+        std::cout << "recording:   rv " << rv << ", " << rec.trace().records() << " records\n";
+        bad += (rv != 0);
+
+        tmcc.wireTrace(nullptr);
+        tmcc.replay(nullptr);
+    }
+
+    //Replay the recorded trace with the same commands
+    rec.load();
+    tmcReplay & rp = rec.replay();
+
+    std::vector<float> repVals;
+    {
+        tmcController tmcc;
+        tmcc.postFlushSleep(0);
+        tmcc.replay(&rp);
+
+        int rv = runSession(tmcc, repVals);
+
+        std::cout << "replay:      rv " << rv << ", " << rp.writes() << " writes, " << rp.reads() << " reads, ";
+        std::cout << rp.mismatches() << " mismatches, " << rp.underruns() << " underruns\n";
+
+        bad += (rv != 0);
+        bad += (repVals != recVals);
+        bad += (rp.mismatches() != 0 || rp.underruns() != 0 || !rp.done());
+        bad += (rp.writes() != 3*nLoops || rp.reads() != 2*nLoops);
+
+        //A changed command must be noticed
+        rp.rewind();
+        tmcc.pz_set_outputvolts(0.9);
+
+        std::cout << "changed:     " << rp.mismatches() << " mismatches\n";
+        bad += (rp.mismatches() != 1);
+
+        tmcc.replay(nullptr);
+    }
+
+    return tmcTestResult(bad == 0);
+}
@@ -0,0 +1,206 @@
+/** \file rtAllocTest.cpp
+  *  \brief A test that the session commands do not allocate
+  *
+  * This program replaces the global operator new with one that counts calls, and runs the \ref
+  * tmcController::session commands against a synthetic \ref tmcTestDevice, so no device is needed.
+  * It covers the successful commands, a range error, NaN, and a failed write, and fails if any of them allocates.
+  * Only the \ref tmcReplay path is exercised, where there is no USB transfer, so the \libftdi1 calls of a real
+  * device are not covered.
+  *
+  * Compile with
+  * \verbatim
+    g++ -o rtAllocTest rtAllocTest.cpp -I/usr/include/libftdi1/ -lftdi1 -lpthread
+    \endverbatim
+  * (change the include path as needed.  you may also need to add the -L library path)
+  *
+  * Run with
+  * \verbatim
+    ./rtAllocTest [trace-file]
+   \endverbatim
+  * where the optional trace-file is the path of the temporary trace, /tmp/rtAllocTest.trace by default.  It is
+  * removed on exit.  The exit status is 0 if the test passes.
+  *
+  */
+
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#include <atomic>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+#include "tmcTestDevice.hpp"
+
+/// The number of calls to operator new while counting
+static std::atomic<long> allocs {0};
+
+/// Flag controlling whether calls to operator new are counted
+static std::atomic<bool> counting {false};
+
+void * operator new( size_t sz )
+{
+    if(counting)
+    {
+        ++allocs;
+    }
+
+    void * p = malloc(sz == 0 ? 1 : sz);
+    if(p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void operator delete( void * p ) noexcept
+{
+    free(p);
+}
+
+void operator delete( void * p,
+                      size_t
+                    ) noexcept
+{
+    free(p);
+}
+
+/// The number of times each command is run while counting
+static constexpr int nLoops = 100;
+
+/// Record one loop of the commands run by main into the synthetic device
+/** Each set is a write, each request a write followed by the response read.
+  */
+void recordLoop( tmcTestDevice & dev /**< [in] the synthetic device */)
+{
+    dev.write<tmcApt::PZ_SET_OUTPUTVOLTS>(1, 0);
+
+    dev.write<tmcApt::PZ_REQ_OUTPUTVOLTS>(1);
+    dev.read<tmcApt::PZ_GET_OUTPUTVOLTS>(1, 16384);
+
+    dev.write<tmcApt::PZ_REQ_PZSTATUSUPDATE>(1);
+    dev.read<tmcApt::PZ_GET_PZSTATUSUPDATE>();
+
+    dev.write<tmcApt::PZ_SET_OUTPUTPOS>(1, 0);
+}
+
+/** The allocation test main program.
+  */
+int main( int argc,    ///< [in] the number of command line arguments, 1 or 2
+          char **argv  ///< [in] the command line arguments. argv[1], if present, is the path of the trace.
+        )
+{
+    std::string path = (argc > 1) ? argv[1] : "/tmp/rtAllocTest.trace";
+
+    tmcTestDevice dev("rtAllocTest");
+    if(dev.open(path) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    //one loop to warm up, then the counted loops.  Nothing follows, so the write after them fails.
+    for(int n = 0; n < nLoops + 1; ++n)
+    {
+        recordLoop(dev);
+    }
+
+    dev.load();
+
+    tmcController tmcc;
+    tmcc.replay(&dev.replay());
+    tmcc.failFast(true);
+
+    std::optional<tmcController::session> ses;
+    if(tmcc.connect(ses) < 0)
+    {
+        std::cerr << "Unable to obtain a session\n";
+        return EXIT_FAILURE;
+    }
+
+    float ov;
+    tmcController::PZStatus pzs;
+
+    //the first call of each command may set up function-local state
+    int rv = ses->pz_set_outputvolts(0);
+    rv |= ses->pz_req_outputvolts(ov);
+    rv |= ses->pz_req_pzstatusupdate(pzs);
+    rv |= ses->pz_set_outputpos(0);
+
+    if(rv != 0)
+    {
+        std::cerr << "Warm up failed: " << tmcc.lastError().legacy() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    bool pass = true;
+
+    counting = true;
+    for(int n = 0; n < nLoops; ++n)
+    {
+        rv |= ses->pz_set_outputvolts(0);
+        rv |= ses->pz_req_outputvolts(ov);
+        rv |= ses->pz_req_pzstatusupdate(pzs);
+        rv |= ses->pz_set_outputpos(0);
+    }
+    counting = false;
+
+    std::cout << "success:      rv " << rv << ", " << allocs << " allocations\n";
+    pass = pass && (rv == 0) && (allocs == 0);
+
+    counting = true;
+    rv = ses->pz_set_outputvolts(2.0);
+    counting = false;
+
+    std::cout << "range error:  rv " << rv << ", " << allocs << " allocations\n";
+    pass = pass && (rv == -980) && (allocs == 0);
+
+    //NaN must be refused as out of range, not converted
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    counting = true;
+    rv = ses->pz_set_outputvolts(nan);
+    int rvpos = ses->pz_set_outputpos(nan);
+    counting = false;
+
+    int rvlut = tmcc.pz_set_outputlut(0, nan, false);
+
+    std::cout << "NaN:          rv " << rv << " " << rvpos << " " << rvlut << ", " << allocs << " allocations\n";
+    pass = pass && (rv == -980) && (rvpos == -980) && (rvlut == -980) && (allocs == 0);
+
+    counting = true;
+    rv = ses->pz_set_outputvolts(0);
+    counting = false;
+
+    std::cout << "failed write: rv " << rv << ", " << allocs << " allocations\n";
+    pass = pass && (rv < 0) && (allocs == 0);
+
+    //fail-fast took the link down, so the session now refuses the device
+    counting = true;
+    rv = ses->pz_set_outputvolts(0);
+    counting = false;
+
+    std::cout << "disconnected: rv " << rv << ", " << allocs << " allocations\n";
+    pass = pass && (rv == -900) && (allocs == 0);
+
+    tmcc.replay(nullptr);
+
+    return tmcTestResult(pass);
+}
@@ -24,13 +24,60 @@
 #ifndef tmcController_hpp
 #define tmcController_hpp
 
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <iostream>
+#include <fstream>
 #include <thread>
 #include <chrono>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include <ftdi.h>
+
+#include "tmcMessages.hpp"
+#include "tmcLog.hpp"
+#include "tmcTrace.hpp"
+#include "tmcTimeline.hpp"
+
+/* USDT static tracepoints, compiled in only if TMCC_USDT is defined (requires sys/sdt.h from systemtap-sdt-dev).
+   Each probe is a single nop until a tracer such as bpftrace or perf attaches to it.  The probes, in provider tmcc, are
+     cmd__entry(id)               a command starts, id is the APT message ID
+     cmd__exit(id, ns)            a command returns, after ns nanoseconds
+     error(rv, category, line)    a command fails, with its return value, ErrorCategory, and source line
+     write(id, size, rv)          bytes are written, id is the message ID of the first frame
+     read(size, rv)               bytes are read into a buffer of size
+     flush(rv)                    the device buffers are flushed
+     sleep(ms)                    a sleep starts
+     reconnect(attempts, rv)      the reconnection thread made an attempt
+*/
+#ifdef TMCC_USDT
+#include <sys/sdt.h>
+#define TMCC_PROBE1(name, a) DTRACE_PROBE1(tmcc, name, a)
+#define TMCC_PROBE2(name, a, b) DTRACE_PROBE2(tmcc, name, a, b)
+#define TMCC_PROBE3(name, a, b, c) DTRACE_PROBE3(tmcc, name, a, b, c)
+#else
+#define TMCC_PROBE1(name, a)
+#define TMCC_PROBE2(name, a, b)
+#define TMCC_PROBE3(name, a, b, c)
+#endif
  
 /*
 Links to FTDI docs defined in doxygen ALIASES
@@ -120,10 +167,10 @@ public:
 protected:
 
     ///Memory used for sending data to the device
-    unsigned char m_sndbuf[256];
+    unsigned char m_sndbuf[tmcApt::maxFrameSize];
 
     ///Memory used for reading data from the device
-    unsigned char m_rdbuf[256];
+    unsigned char m_rdbuf[tmcApt::maxFrameSize];
 
 ///@}
 
@@ -229,10 +276,15 @@ protected:
     uint32_t m_postFlushSleep {50};
 
     /// Flag indicating whether or not the USB device is open
-    bool m_opened {false};
+    /** Atomic since the reconnection thread closes and reopens the device while \ref close may run on another thread.
+      */
+    std::atomic<bool> m_opened {false};
 
     /// Flag indicating whether or not the TMC device is connected
-    bool m_connected {false};
+    /** Atomic so that the background reconnection thread can hand the connection back to the commands,
+      * see \ref startReconnect.
+      */
+    std::atomic<bool> m_connected {false};
 
     /// The chip ID of the FTDI on the TMC device.
     /** Read and set during \ref connect().
@@ -336,6 +388,7 @@ public:
       *  -# Calls \ftdi_usb_reset
       *  -# Calls \ftdi_setflowctrl to set SIO_RTS_CTS_HS
       *  -# Calls \ftdi_setrts to set RTS to 1
+      *  -# If \ref m_bumplessRestart is true, calls \ref seedState to read the output and settings from the device
       * 
       * The error code returned by each function is offset in steps of -10 to allow you to decipher which \libftdi1 function failed.
       * 
@@ -350,9 +403,21 @@ public:
       * \returns < -60 if \ftdi_usb_reset fails
       * \returns < -70 if \ftdi_setflowctrl fails
       * \returns < -80 if \ftdi_setrts fails
+      * \returns <= -100 if \ref seedState fails
       */
     int connect( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
 
+protected:
+
+    /// Perform the steps of \ref connect without setting \ref m_connected
+    /** Used by the reconnection thread to restore the device before handing it back.
+      *
+      * \returns as for \ref connect
+      */
+    int connectDevice( bool errmsg /**< [in] flag controlling if an error message is printed on failure*/);
+
+public:
+
     /// Set the USB serial number and connect to the device.
     /** \ref m_vendor and \ref m_product must already be set (see their defaults).
       * 
@@ -394,6 +459,195 @@ public:
 
 ///@}
 
+/** \name Reconnection Data
+  * @{
+  */
+
+public:
+
+    /// The states of the link to the device, as managed by the background reconnection thread
+    enum class LinkState : uint8_t { stopped = 0x00,     ///< The reconnection thread is not running
+                                     up = 0x01,          ///< Connected
+                                     down = 0x02,        ///< Disconnected, waiting for the next attempt
+                                     connecting = 0x03,  ///< A connection attempt is in progress
+                                     breakerOpen = 0x04  ///< Too many failed attempts, waiting for the cool down
+                                   };
+
+protected:
+
+    /// Flag controlling fail-fast mode
+    /** If true, commands return -900 immediately if the device is not connected instead of calling \ref connect, and
+      * a write or read error marks the device as disconnected.  Default is false.
+      */
+    std::atomic<bool> m_failFast {false};
+
+    /// The initial delay in milliseconds between reconnection attempts
+    /** Doubled after each failed attempt, up to \ref m_reconnectMaxBackoff.  Default is 100 ms.  It is also the
+      * period at which the thread checks the link while connected, so it is at least 1 ms.
+      *
+      * This and the other reconnection settings are atomic, since the setters may be called while the reconnection
+      * thread reads them.
+      */
+    std::atomic<uint32_t> m_reconnectMinBackoff {100};
+
+    /// The maximum delay in milliseconds between reconnection attempts
+    /** Default is 5000 ms.
+      */
+    std::atomic<uint32_t> m_reconnectMaxBackoff {5000};
+
+    /// The number of consecutive failed attempts after which the circuit breaker opens
+    /** Default is 10.
+      */
+    std::atomic<uint32_t> m_breakerThreshold {10};
+
+    /// The time in milliseconds the circuit breaker stays open before a single trial attempt
+    /** Default is 60000 ms.
+      */
+    std::atomic<uint32_t> m_breakerCoolDown {60000};
+
+    /// The background reconnection thread
+    std::thread m_reconnectThread;
+
+    /// The id of the reconnection thread while it runs, so that its errors are not recorded in \ref m_lastError
+    std::atomic<std::thread::id> m_reconnectThreadId;
+
+    /// Mutex for the reconnection thread's wait
+    std::mutex m_reconnectMutex;
+
+    /// Wakes the reconnection thread when the device is marked disconnected or the thread is stopped
+    std::condition_variable m_reconnectCV;
+
+    /// Flag telling the reconnection thread to exit
+    bool m_reconnectStop {false};
+
+    /// The current \ref LinkState
+    std::atomic<LinkState> m_linkState {LinkState::stopped};
+
+    /// The number of reconnection attempts made by the reconnection thread
+    std::atomic<uint64_t> m_reconnectAttempts {0};
+
+    /// The number of times the circuit breaker has opened
+    std::atomic<uint64_t> m_breakerTrips {0};
+
+    /// Mark the device as disconnected after a write or read error, in fail-fast mode
+    /** Wakes the reconnection thread if it is running.  Does nothing if not in fail-fast mode.  Does not take
+      * \ref m_reconnectMutex, so that a control loop is never blocked by the reconnection thread.
+      */
+    void linkDown() noexcept;
+
+    /// The body of the reconnection thread
+    void reconnectLoop();
+
+///@}
+
+/** \name Reconnection
+  * A fail-fast policy for running several devices from one control loop: commands on a device which is not
+  * connected fail immediately with -900, and a background thread reconnects it.
+  *
+  * The reconnection thread only touches the device while it is disconnected, and hands it back by setting
+  * \ref m_connected once \ref connect succeeds.  Commands see the disconnected state and return without touching
+  * the device in the meantime.  Commands on a \ref session skip the check and must not be used while the device
+  * may be reconnecting.
+  * @{
+  */
+
+public:
+
+    /// Set the fail-fast mode flag
+    /** \see m_failFast
+      */
+    void failFast( bool ff /**< [in] the new value of the flag */ );
+
+    /// Get the fail-fast mode flag
+    /** \see m_failFast
+      *
+      * \returns the current value of m_failFast
+      */
+    bool failFast();
+
+    /// Set the initial delay between reconnection attempts
+    /** \see m_reconnectMinBackoff
+      */
+    void reconnectMinBackoff( uint32_t ms /**< [in] the new delay in ms, values below 1 are set to 1 */ );
+
+    /// Get the initial delay between reconnection attempts
+    /** \see m_reconnectMinBackoff
+      *
+      * \returns the current value of m_reconnectMinBackoff
+      */
+    uint32_t reconnectMinBackoff();
+
+    /// Set the maximum delay between reconnection attempts
+    /** \see m_reconnectMaxBackoff
+      */
+    void reconnectMaxBackoff( uint32_t ms /**< [in] the new delay in ms, values below 1 are set to 1 */ );
+
+    /// Get the maximum delay between reconnection attempts
+    /** \see m_reconnectMaxBackoff
+      *
+      * \returns the current value of m_reconnectMaxBackoff
+      */
+    uint32_t reconnectMaxBackoff();
+
+    /// Set the number of consecutive failed attempts after which the circuit breaker opens
+    /** \see m_breakerThreshold
+      */
+    void breakerThreshold( uint32_t n /**< [in] the new threshold, must be > 0 */ );
+
+    /// Get the number of consecutive failed attempts after which the circuit breaker opens
+    /** \see m_breakerThreshold
+      *
+      * \returns the current value of m_breakerThreshold
+      */
+    uint32_t breakerThreshold();
+
+    /// Set the circuit breaker cool down time
+    /** \see m_breakerCoolDown
+      */
+    void breakerCoolDown( uint32_t ms /**< [in] the new cool down in ms */ );
+
+    /// Get the circuit breaker cool down time
+    /** \see m_breakerCoolDown
+      *
+      * \returns the current value of m_breakerCoolDown
+      */
+    uint32_t breakerCoolDown();
+
+    /// Start the background reconnection thread
+    /** Turns on fail-fast mode.  The thread waits until the device is disconnected, then calls \ref connect with
+      * exponential backoff between attempts.  After \ref m_breakerThreshold consecutive failures the circuit breaker
+      * opens and no attempts are made for \ref m_breakerCoolDown, after which one trial attempt is made.
+      *
+      * \returns 0 on success, including if already running
+      * \returns -700 if the thread could not be started
+      */
+    int startReconnect( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+
+    /// Stop the background reconnection thread
+    /** Waits for a connection attempt in progress to finish.  Fail-fast mode stays on.
+      */
+    void stopReconnect();
+
+    /// Get the current state of the link to the device
+    /**
+      * \returns the current \ref LinkState
+      */
+    LinkState linkState();
+
+    /// Get the number of reconnection attempts made by the reconnection thread
+    /**
+      * \returns the current value of m_reconnectAttempts
+      */
+    uint64_t reconnectAttempts();
+
+    /// Get the number of times the circuit breaker has opened
+    /**
+      * \returns the current value of m_breakerTrips
+      */
+    uint64_t breakerTrips();
+
+///@}
+
 /** \name Command Management Data
   *
   * Member data to manage the sending of commands.
@@ -592,6 +846,54 @@ public:
 
     };
 
+    /// Position control modes of a piezo channel
+    /** Used for the MGMSG_PZ_SET_POSCONTROLMODE (0x0640) and MGMSG_PZ_REQ_POSCONTROLMODE (0x0641) commands.
+      * Closed-loop modes require a strain gauge or other position feedback (see PZStatus::sgConnected).
+      */
+    enum class PosControlMode : uint8_t { INVALID = 0x00,          ///< For error detection only, not used by TMC
+                                          openLoop = 0x01,         ///< Open-loop, the output voltage is set directly
+                                          closedLoop = 0x02,       ///< Closed-loop, the position is held by the controller
+                                          openLoopSmooth = 0x03,   ///< Open-loop, with smoothed transitions between modes
+                                          closedLoopSmooth = 0x04  ///< Closed-loop, with smoothed transitions between modes
+                                        };
+
+    /// Output modes of the piezo output look-up table (LUT)
+    /** Used for the MGMSG_PZ_SET_OUTPUTLUTPARAMS (0x0703) command.
+      *
+      */
+    enum class LUTMode : uint16_t { INVALID = 0x00,    ///< For error detection only, not used by TMC
+                                    continuous = 0x01, ///< The waveform is output continuously until stopped
+                                    fixed = 0x02       ///< The waveform is output for LUTParams::NumCycles cycles
+                                  };
+
+    /// Output LUT parameters, filled in by \ref pz_req_outputlutparams
+    /** Used for the MGMSG_PZ_SET_OUTPUTLUTPARAMS (0x0703) and MGMSG_PZ_REQ_OUTPUTLUTPARAMS (0x0704) commands.
+      * All times are in milliseconds.
+      *
+      */
+    struct LUTParams
+    {
+        LUTMode Mode {LUTMode::continuous}; ///< The output mode
+        uint16_t CycleLength {0};           ///< The number of LUT entries in one cycle of the waveform, 1 to \ref lutMaxEntries
+        int32_t NumCycles {1};              ///< The number of cycles to output in LUTMode::fixed
+        int32_t DelayTime {1};              ///< The time each LUT entry is output for, i.e. the sample interval
+        int32_t PreCycleRest {0};           ///< The delay at the first entry before each cycle starts
+        int32_t PostCycleRest {0};          ///< The delay at the last entry after each cycle ends
+        uint16_t OPTrigStart {0};           ///< The LUT index at which the output trigger fires
+        int32_t OPTrigWidth {0};            ///< The width of the output trigger pulse
+        uint16_t TrigRepCycle {0};          ///< The number of cycles between repeated output triggers
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
+    /// The maximum number of entries in the output LUT
+    static constexpr uint16_t lutMaxEntries {512};
+
     /// Possible voltage limits for TPZ IO Settings
     /** See page 224 of the manual
       * 
@@ -644,1139 +946,5984 @@ public:
         void dump(streamT & ios /**< [out] the stream to dump to*/);
     };
 
+    /// Statistics of an output LUT upload, filled in by \ref pz_upload_outputlut
+    struct LUTUploadStats
+    {
+        uint16_t entries {0};     ///< The number of LUT entries uploaded
+        uint32_t bytes {0};       ///< The total number of bytes written, including the parameters and readback request
+        int writes {0};           ///< The number of calls to \ftdi_write_data
+        double seconds {0};       ///< The elapsed time of the upload, from the first write through the parameter readback
+        double entriesPerSec {0}; ///< The upload throughput
+        bool skipped {false};     ///< True if the upload was skipped because the table on the device already matched
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
+    /// Record of the last LUT uploaded to the device by \ref pz_upload_outputlut
+    struct LUTCacheRecord
+    {
+        bool valid {false};  ///< Whether or not this record describes the table on the device
+        std::string serial;  ///< The USB serial number of the device the table was uploaded to
+        uint64_t hash {0};   ///< The FNV-1a hash of the packed entry and parameter frames
+        uint16_t entries {0}; ///< The number of LUT entries uploaded
+        LUTParams params;    ///< The LUT parameters uploaded, with CycleLength == entries
+    };
+
+    /// The configuration and output last applied to the device, recorded by the set commands
+    /** Used to restore the device after the reconnection thread reconnects it, see \ref restoreOnReconnect.
+      * Output values are in device units.
+      */
+    struct AppliedState
+    {
+        bool updatesStopped {false};                  ///< Whether \ref hw_stop_updatemsgs has been sent
+        uint8_t chanIdent {0x01};                     ///< The channel of chanEnable
+        std::optional<EnableState> chanEnable;        ///< Set by \ref mod_set_chanenablestate
+        std::optional<PosControlMode> posControlMode; ///< Set by \ref pz_set_poscontrolmode
+        std::optional<TPZIOSettings> ioSettings;      ///< Set by \ref pz_set_tpz_iosettings
+        std::optional<KMMIParams> mmiParams;          ///< Set by \ref kpz_set_kcubemmiparams
+        std::optional<uint16_t> dispIntensity;        ///< Set by \ref pz_set_tpz_dispsettings
+        std::optional<int16_t> outputVolts;           ///< Set by \ref pz_set_outputvolts, cleared by \ref pz_set_outputpos
+        std::optional<uint16_t> outputPos;            ///< Set by \ref pz_set_outputpos, cleared by \ref pz_set_outputvolts
+    };
+
+    /// Report of the last reconnection by the reconnection thread
+    struct ReconnectReport
+    {
+        double downtime {0}; ///< Seconds from the device being marked disconnected until it was handed back
+        int attempts {0};    ///< The number of connection attempts it took
+        int checked {0};     ///< The number of remembered settings read back from the device
+        int restored {0};    ///< The number of settings the device had lost and that were reapplied
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
 ///@}
 
-/** \name APT Commands
-  * The actual Thorlabs Motion Controllers Host-Controller Communications Protocol implementations.
-  * Declared here in order in which they appear in the manual.  Page numbers refer to Issue 37 of the manual,
-  * dated 22 May 2023.
-  * 
-  * In each command, error codes by \libftdi1 functions are offset to allow you to decipher which \libftdi1 function failed.
-  * 
+/** \name State Restoration Data
   * @{
   */
 
-public:
+protected:
 
-    /// Instruct hardware unit to identify itself (by flashing its front panel LEDs).
-    /** Sends the MGMSG_MOD_IDENTIFY command (0x0223).  
-      * See page 46 of the APT Manual.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns -666 if device not available in \ftdi_write_data 
+    /// The configuration and output last applied to the device
+    AppliedState m_applied;
+
+    /// Mutex protecting \ref m_applied from the reconnection thread
+    /** Held by the reconnection thread while it restores the applied state, and by \ref appliedState,
+      * \ref clearAppliedState, and \ref lastOutputVolts, which may be called while it runs.  The commands do not
+      * take it: they only touch m_applied while connected, and the reconnection thread only while disconnected.
       */
-    int mod_identify( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+    std::mutex m_appliedMutex;
 
+    /// Flag controlling whether the reconnection thread restores \ref m_applied after reconnecting
+    /** Default is true.
+      */
+    std::atomic<bool> m_restoreOnReconnect {true};
 
-    /// Enable or disable the specified drive channel 
-    /** Sends the MGMSG_MOD_SET_CHANENABLESTATE command (0x0210)
-      * See page 47 of the APT Manual
-      * 
-      * The KPZ101 sends a 10 byte reponse, after a delay, if this command changes the state.  This is undocumented in the manual.  
-      * To account for this, after sending the command, this sleeps for \ref m_postChanEnableSleep milliseconds (default 500) and then flushes
-      * the line with a read.  Nothing is done with the result, and it being 0 is not an error.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
+    /// The time at which the device was marked disconnected
+    /** Set by \ref linkDown, or by the reconnection thread when it first finds the device down, e.g. if it was never
+      * connected.  Zero while the device is up.
+      */
+    std::atomic<std::chrono::steady_clock::time_point> m_downSince {std::chrono::steady_clock::time_point()};
+
+    /// The report of the last reconnection
+    ReconnectReport m_lastReconnect;
+
+    /// The total downtime in seconds over all reconnections
+    double m_totalDowntime {0};
+
+    /// Flag controlling bumpless restart
+    /** If true, \ref connect reads the current output, channel enable state, position control mode and I/O
+      * settings from the device with \ref seedState, so that a restarted program resumes from the device's actual
+      * state instead of commanding a default.  Default is false.
+      */
+    bool m_bumplessRestart {false};
+
+    /// Restore \ref m_applied on a device that has just been reconnected
+    /** Does not check the connection.  Sends MGMSG_HW_STOP_UPDATEMSGS if it was sent before, and all the requests for
+      * the remembered settings, in one write, and reads the responses.  Then writes every setting which differs,
+      * with the output and channel enable state last, in a second write.
+      *
+      * \returns 0 on success
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read, or a response was not the expected message
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      */
+    int restoreState( int & checked,  ///< [out] the number of settings read back
+                      int & restored, ///< [out] the number of settings reapplied
+                      bool errmsg     ///< [in] flag controlling if an error message is printed on failure
+                    );
+
+    /// The items of \ref m_applied, as bits for \ref writeApplied
+    enum appliedItem : uint32_t { applyStopUpdates = 0x01,    ///< MGMSG_HW_STOP_UPDATEMSGS, if it was sent
+                                  applyIOSettings = 0x02,     ///< The I/O settings
+                                  applyMMIParams = 0x04,      ///< The K-Cube MMI parameters
+                                  applyDispIntensity = 0x08,  ///< The TPZ display intensity
+                                  applyPosControlMode = 0x10, ///< The position control mode
+                                  applyOutputVolts = 0x20,    ///< The output volts
+                                  applyOutputPos = 0x40,      ///< The closed-loop position
+                                  applyChanEnable = 0x80,     ///< The channel enable state
+                                  applyAll = 0xFF             ///< Everything
+                                };
+
+    /// Write items of \ref m_applied to the device in a single write
+    /** Does not check the connection.  Items which have not been applied are skipped.  The output and channel
+      * enable state are written last, and if the enable state is written the undocumented response is discarded
+      * as in \ref mod_set_chanenablestate.
+      *
+      * \returns 0 on success
       * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
       * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
       * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
       * \returns -700 if sleep throws an exception
-      * \returns -1000 if \p ces is EnableState::invalid
-      * 
       */
-    int mod_set_chanenablestate( const uint8_t & chnum,   ///< [in] the channel number
-                                 const EnableState & ces, ///< [in] the desired channel enable state, EnableState::enabled or EnableState::disabled. 
-                                 bool errmsg = true       ///< [in] [optional] flag controlling if an error message is printed on failure
-                               );
-    
-    /// Request teh enable state of the specified drive channel
-    /** Sends the MGMSG_MOD_REQ_CHANENABLESTATE command (0x0211)
-      * See page 47 of the APT Manual
-      * 
-      * Note: KPZ101 will only return 0x01==enabled regardless of whether it is enabled or not.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
+    int writeApplied( uint32_t items, ///< [in] the \ref appliedItem bits to write
+                      bool errmsg     ///< [in] flag controlling if an error message is printed on failure
+                    );
+
+    /// Seed \ref m_applied and \ref m_voltLimit from the device
+    /** Does not check the connection.  Sends MGMSG_PZ_REQ_OUTPUTVOLTS, MGMSG_MOD_REQ_CHANENABLESTATE,
+      * MGMSG_PZ_REQ_POSCONTROLMODE and MGMSG_PZ_REQ_TPZ_IOSETTINGS in one write, reads the responses, and replaces
+      * the corresponding parts of \ref m_applied.  Nothing is written to the device's output.  These messages are
+      * accepted by both the KPZ101 and TPZ001.  The enable state is only seeded if the device reports disabled, since
+      * the KPZ101 always reports enabled.
+      *
+      * \returns 0 on success
       * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
       * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
-      * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
-      * \returns -1000 if \p ces is EnableState::invalid
+      * \returns -300 if not enough data read, or a response was not the expected message
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
       */
-    int mod_req_chanenablestate( EnableState & ces,     ///< [out] the channel enable state. 0x01 enabled, 0x02 disabled
-                                 const uint8_t & chnum, ///< [in] the channel number
-                                 bool errmsg = true     ///< [in] [optional] flag controlling if an error message is printed on failure
-                               );
+    int seedState( bool errmsg /**< [in] flag controlling if an error message is printed on failure */ );
 
-    /// Stop automatic status updates from the controller 
-    /** Sends the MGMSG_HW_STOP_UPDATEMSGS command (0x0012)
-      * See page 51 of the APT Manual. 
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns -666 if device not available in either \ftdi_write_data 
+///@}
+
+/** \name State Restoration
+  * @{
+  */
+
+public:
+
+    /// Set the flag controlling whether the reconnection thread restores the applied state
+    /** \see m_restoreOnReconnect
       */
-    int hw_stop_updatemsgs( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+    void restoreOnReconnect( bool r /**< [in] the new value of the flag */ );
 
-    /// Get hardware information from the device
-    /** Sends the MGMSG_HW_REQ_INFO command (0x0005) and parses the result into a \ref HWInfo structure.
-      * See page 52 of the APT manual.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
-      * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+    /// Get the flag controlling whether the reconnection thread restores the applied state
+    /** \see m_restoreOnReconnect
+      *
+      * \returns the current value of m_restoreOnReconnect
       */
-    int hw_req_info( HWInfo & hwi,      ///< [in] the \ref HWInfo structure to populate
-                     bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
-                   );
+    bool restoreOnReconnect();
 
-    /// Set the output voltage applied to the piezo actuator
-    /** Sends the MGMSG_PZ_SET_OUTPUTVOLTS command (0x0643).
-      * See page 198 of the manual.
-      *   
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns -666 if device not available in either \ftdi_write_data 
-      * \returns -980 if abs(ov) > 1
+    /// Get the configuration and output last applied to the device
+    /** Safe to call while the reconnection thread runs.  Waits for it to finish restoring the state, if it is.
+      *
+      * \returns a copy of m_applied
       */
-    int pz_set_outputvolts( const float & ov, ///< [in] the output volts to set, converted from a percentage of max value
-                            bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
-                          );
-    
-    /// Get the output voltage applied to the piezo actuator
-    /** Sends the MGMSG_PZ_REQ_OUTPUTVOLTS command (0x0644).
-      * See page 198 of the manual.
-      *   
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
-      * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+    AppliedState appliedState();
+
+    /// Forget the configuration and output last applied to the device
+    /** Nothing will be restored until set commands are called again.  Safe to call while the reconnection thread
+      * runs.  Waits for it to finish restoring the state, if it is.
       */
-    int pz_req_outputvolts( float & ov,      ///< [out] the output volts currently set, converted to a percentage of maximum value
-                            bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
-                          );
+    void clearAppliedState();
 
-    /// Get Piezo status
-    /** Sends the MGMSG_PZ_REQ_PZSTATUSUPDATE command (0x0660) and parses the result into a \ref PZstatus structure.
-      * See page 205 of the APT manual.
-      *  
-      * \note this currently only works for the TPZ001 KPZ101
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
-      * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+    /// Get the report of the last reconnection
+    /**
+      * \returns a copy of m_lastReconnect
       */
-    int pz_req_pzstatusupdate( PZStatus & pzs,    ///< [out] the \ref PZStatus structure to populate
-                               bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
-                             );
+    ReconnectReport lastReconnect();
 
-    /// Set the intensity of the LED display on the front of the TPZ unit
-    /** Sends the MGMSG_PZ_SET_TPZ_DISPSETTINGS command (0x07D1)
-      * See page 223 of the APT manual.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns -666 if device not available in either \ftdi_write_data 
+    /// Get the total downtime over all reconnections
+    /**
+      * \returns the total downtime in seconds
       */
-    int pz_set_tpz_dispsettings( const uint16_t & dispint, ///< [in] The value to set.  Manual says 0-255.  Devices tested have a more limited range of XX to XX.
-                                 bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
-                               );
+    double totalDowntime();
 
-    /// Get the intensity of the LED display on the front of the TPZ unit
-    /** Sends the MGMSG_PZ_REQ_TPZ_DISPSETTINGS command (0x07D2)
-      * See page 223 of the APT manual.
+    /// Set the flag controlling bumpless restart
+    /** \see m_bumplessRestart
+      */
+    void bumplessRestart( bool b /**< [in] the new value of the flag */ );
+
+    /// Get the flag controlling bumpless restart
+    /** \see m_bumplessRestart
       *
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
+      * \returns the current value of m_bumplessRestart
+      */
+    bool bumplessRestart();
+
+    /// Get the last output voltage applied to, or read from, the device
+    /** After a bumpless \ref connect this is the device's actual output, from which a trajectory can be resumed.
+      * Safe to call while the reconnection thread runs.
+      *
+      * \returns 0 on success
+      * \returns -1000 if the output is not known, e.g. the last command was \ref pz_set_outputpos
+      */
+    int lastOutputVolts( float & ov /**< [out] the output volts, as a percentage of max value */ );
+
+    /// Write everything in the applied state to the device
+    /** Sends MGMSG_HW_STOP_UPDATEMSGS if it was sent before, and the set command for every remembered setting, in a
+      * single write without reading anything back.  The output and channel enable state are written last.  While
+      * the reconnection thread has the device this fails with -900, as any command does in fail-fast mode.
+      *
+      * \returns 0 on success
       * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
       * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
-      * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
-      */  
-    int pz_req_tpz_dispsettings( uint16_t & dispint, ///< [out] the intensity value returned by the device.
-                                 bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
-                               );
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      * \returns -700 if sleep throws an exception
+      * \returns -900 if not connected and fail-fast is set
+      */
+    int reapplyState( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure */ );
 
-    /// Set voltage limit and hub analog input
-    /** Sends the MGMSG_PZ_SET_TPZ_IOSETTINGS command (0x07D4) 
-      * See page 224 of the manual.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns -666 if device not available in either \ftdi_write_data 
+///@}
+
+/** \name State Journal Data
+  * @{
+  */
+
+protected:
+
+    /// One copy of \ref m_applied in the journal file
+    struct JournalRecord
+    {
+        uint64_t seq {0};                                       ///< The write sequence number, 0 while the record is being written
+        uint32_t items {0};                                     ///< The \ref appliedItem bits present in this record
+        uint8_t chanIdent {0x01};                               ///< The channel of chanEnable
+        EnableState chanEnable {EnableState::invalid};          ///< The channel enable state
+        PosControlMode posControlMode {PosControlMode::INVALID}; ///< The position control mode
+        uint8_t reserved {0};                                   ///< Padding, always 0
+        TPZIOSettings ioSettings;                               ///< The I/O settings
+        KMMIParams mmiParams;                                   ///< The K-Cube MMI parameters
+        uint16_t dispIntensity {0};                             ///< The TPZ display intensity
+        int16_t outputVolts {0};                                ///< The output volts in counts
+        uint16_t outputPos {0};                                 ///< The closed-loop position
+    };
+
+    /// The layout of the journal file
+    /** The two records are written alternately, so that the one not being written is always whole.
       */
-    int pz_set_tpz_iosettings( const TPZIOSettings & tios, ///< [in] the \ref TPZIOSettings to set
-                                bool errmsg = true         ///< [in] [optional] flag controlling if an error message is printed on failure
-                             );
+    struct JournalFile
+    {
+        char magic[8];          ///< Always "TMCJRNL"
+        uint32_t version;       ///< The layout version, currently 1
+        uint32_t size;          ///< The size of this structure, to detect a layout change
+        char serial[32];        ///< The USB serial number of the device the records belong to
+        JournalRecord slot[2];  ///< The records
+    };
 
+    /// The path of the journal file, empty if no journal is open
+    std::string m_journalPath;
 
-    /// Set voltage limit and hub analog input
-    /** Sends the MGMSG_PZ_REQ_TPZ_IOSETTINGS command (0x07D5) 
-      * See page 224 of the manual.
-      * 
+    /// The file descriptor of the journal file
+    int m_journalFd {-1};
+
+    /// The memory mapping of the journal file
+    JournalFile * m_journal {nullptr};
+
+    /// The sequence number of the last record written
+    uint64_t m_journalSeq {0};
+
+    /// Flag indicating that the journal holds a record which \ref connect should restore
+    bool m_journalPending {false};
+
+    /// Write \ref m_applied to the next record in the journal
+    /** Called by everything that changes \ref m_applied.  This is only a copy to memory, there is no system call.
+      * Does nothing if no journal is open.
+      */
+    void journalApplied() noexcept;
+
+    /// Load the newest whole record in the journal into \ref m_applied
+    /**
+      * \returns 0 on success
+      * \returns -1 if the journal holds no whole record
+      */
+    int journalLoad();
+
+///@}
+
+/** \name State Journal
+  * The applied state can be kept in a small memory-mapped file, so that a restarted program restores the device
+  * from it immediately instead of querying the device.  Each change is copied into the mapping, and the kernel
+  * writes it back to the file.  So the journal survives a crash of the program with no cost in the set commands,
+  * but the last changes can be lost if the computer itself crashes.
+  *
+  * If a journal with a record for the same serial number is open when \ref connect is called, the record is loaded
+  * into the applied state and written to the device as with \ref reapplyState, right after the flush and
+  * post-flush sleep of connect, and \ref bumplessRestart is skipped since the journal already holds the state to
+  * restore.  If the journal belongs to another serial number its records are invalidated, and it is taken over for
+  * this device.
+  * @{
+  */
+
+public:
+
+    /// Open the journal file, creating it if needed
+    /** Closes any journal already open.  A file with the wrong layout is reinitialized.
+      *
+      * \returns 0 on success
+      * \returns -1 on error opening, resizing, or mapping the file
+      */
+    int journalOpen( const std::string & path, ///< [in] the path of the journal file
+                     bool errmsg = true        ///< [in] [optional] flag controlling if an error message is printed on failure
+                   );
+
+    /// Close the journal file
+    /** The applied state is kept.  Called by the destructor.
+      */
+    void journalClose();
+
+    /// Get the path of the journal file
+    /** \see m_journalPath
+      *
+      * \returns the current value of m_journalPath
+      */
+    std::string journalPath();
+
+///@}
+
+/** \name Voltage Conversion Data
+  *
+  * @{
+  */
+
+protected:
+
+    /// The voltage limit last set on or read from the device
+    /** Set by \ref pz_set_tpz_iosettings and \ref pz_req_tpz_iosettings.  Used by \ref volts2counts to
+      * convert absolute volts.
+      */
+    VoltLimit m_voltLimit {VoltLimit::INVALID};
+
+///@}
+
+/** \name Voltage Conversion
+  *
+  * @{
+  */
+
+public:
+
+    /// Get the voltage limit last set on or read from the device
+    /** \see m_voltLimit
+      *
+      * \returns VoltLimit::INVALID if the limit has not been set or read since construction
+      */
+    VoltLimit voltLimit();
+
+    /// Get the maximum output voltage in volts corresponding to a voltage limit
+    /**
+      * \returns 75, 100, or 150
+      * \returns 0 for VoltLimit::INVALID
+      */
+    static float voltLimitVolts( VoltLimit vl /**< [in] the voltage limit */ );
+
+    /// Convert an array of output volts to APT device units
+    /** Converts each value to the signed 16 bit device units used by MGMSG_PZ_SET_OUTPUTVOLTS and
+      * MGMSG_PZ_SET_OUTPUTLUT, with the same scaling as \ref pz_set_outputvolts: positive values are multiplied by
+      * 32767 and negative values by 32768, truncating toward zero.  The counts are stored little-endian, ready to be
+      * copied into a frame.
+      *
+      * Values outside -1 to 1 (or outside +/- the cached \ref m_voltLimit for absolute volts) are saturated to the
+      * limit, and NaNs are set to 0.  Both are counted in the return value.
+      *
+      * Uses AVX2 or SSE2 when compiled with them enabled, with a scalar loop for the remainder and for other targets.
+      * \p iov may point to the same memory as \p ov, in which case the conversion is done in place and the counts
+      * occupy the first half of the buffer.
+      *
+      * \returns the number of values that were out of range, >= 0
+      * \returns -1000 if \p absolute is true and \ref m_voltLimit is VoltLimit::INVALID
+      */
+    int volts2counts( int16_t * iov,         ///< [out] the converted values, n elements.  May be the same memory as \p ov.
+                      const float * ov,      ///< [in] the values to convert, n elements
+                      size_t n,              ///< [in] the number of values to convert
+                      bool absolute = false  ///< [in] [optional] if true \p ov is in volts, otherwise a fraction of max value
+                    );
+
+///@}
+
+/** \name LUT Upload Data
+  *
+  * Member data to manage bulk uploads of the output LUT.
+  *
+  * @{
+  */
+
+protected:
+
+    /// Memory used to assemble the frames of a bulk LUT upload
+    /** Holds one MGMSG_PZ_SET_OUTPUTLUT frame per entry, followed by the MGMSG_PZ_SET_OUTPUTLUTPARAMS frame
+      * and the MGMSG_PZ_REQ_OUTPUTLUTPARAMS readback request.
+      */
+    unsigned char m_lutbuf[lutMaxEntries*tmcApt::PZ_SET_OUTPUTLUT::size + tmcApt::PZ_SET_OUTPUTLUTPARAMS::size +
+                                                                              tmcApt::PZ_REQ_OUTPUTLUTPARAMS::size];
+
+    /// Memory used to convert a waveform to device units during a bulk upload
+    int16_t m_lutcounts[lutMaxEntries];
+
+    /// The number of LUT entry frames sent in each call to \ftdi_write_data during a bulk upload
+    /** Used during \ref pz_upload_outputlut().
+      * Default is 64.
+      */
+    uint16_t m_lutChunkEntries {64};
+
+    /// The number of entries read back with MGMSG_PZ_REQ_OUTPUTLUT (0x0701) to verify a bulk upload
+    /** Evenly spaced from the first to the last entry, or every entry of a shorter table.
+      */
+    static constexpr uint16_t lutVerifySamples = 8;
+
+    /// Read back a sample of the entries of the LUT and compare them to \ref m_lutcounts
+    /** Sends MGMSG_PZ_REQ_OUTPUTLUT (0x0701) for \ref lutVerifySamples entries.  See page 208 of the APT manual.
+      * When probing, e.g. to confirm a cache hit, an entry which does not match is an answer rather than an error,
+      * so it is not recorded in \ref lastError.
+      *
+      * \returns 0 if every entry read back matches
+      * \returns 1 if probe is true and an entry read back does not match
+      * \returns -1010 if probe is false and an entry read back does not match
+      * \returns <0 on a write or read error, see \ref pz_upload_outputlut
+      */
+    int lutVerifyEntries( uint16_t n,   ///< [in] the number of entries in the table
+                          bool probe,   ///< [in] if true a mismatch is returned as 1, without an error
+                          bool errmsg   ///< [in] flag controlling if an error message is printed on failure
+                        );
+
+    /// Fill in a MGMSG_PZ_SET_OUTPUTLUTPARAMS frame
+    static void lutParamsFrame( unsigned char * buf,   ///< [out] the buffer to fill in, at least tmcApt::PZ_SET_OUTPUTLUTPARAMS::size bytes
+                                const LUTParams & lutp ///< [in] the parameters to encode
+                              );
+
+    /// Parse a MGMSG_PZ_GET_OUTPUTLUTPARAMS frame
+    static void lutParamsParse( LUTParams & lutp,         ///< [out] the parameters to populate
+                                const unsigned char * buf ///< [in] the received frame, at least tmcApt::PZ_GET_OUTPUTLUTPARAMS::size bytes
+                              );
+
+    /// Compare two sets of LUT parameters
+    /**
+      * \returns true if every field is equal
+      */
+    static bool lutParamsMatch( const LUTParams & a, ///< [in] the first set of parameters
+                                const LUTParams & b  ///< [in] the second set of parameters
+                              );
+
+    /// The record of the last LUT uploaded to the device
+    LUTCacheRecord m_lutCache;
+
+    /// The path of the file used to persist \ref m_lutCache
+    /** If empty, the default, the record is not persisted.  The file holds one record per serial number, so
+      * controllers of several devices can share it.
+      */
+    std::string m_lutCachePath;
+
+    /// Flag controlling whether a cache hit is confirmed by reading back the LUT parameters and a sample of entries
+    /** Default is true.  The readback is \ref lutVerifySamples + 1 round trips, and catches a device which was power
+      * cycled or changed by another program since the record was made.
+      */
+    bool m_lutCacheVerify {true};
+
+    /// Invalidate \ref m_lutCache, e.g. after a single entry or the parameters are changed
+    void lutCacheInvalidate();
+
+    /// Read every record in \ref m_lutCachePath
+    /**
+      * \returns 0 on success, including if the file does not exist yet
+      * \returns -1 if the file exists but could not be parsed
+      */
+    int lutCacheRead( std::vector<LUTCacheRecord> & recs /**< [out] the records, one per serial number */ );
+
+    /// Load the record for the current serial number from \ref m_lutCachePath into \ref m_lutCache
+    /** \ref m_lutCache is cleared if there is no such record.
+      *
+      * \returns 0 on success, including if there is no record for this device
+      * \returns -1 if the file exists but could not be parsed
+      */
+    int lutCacheLoad();
+
+    /// Write \ref m_lutCache to \ref m_lutCachePath, replacing the record for its serial number
+    /** The records of other devices are kept.  Processes sharing the file are serialized with an flock on
+      * \ref m_lutCachePath with ".lock" appended, and the file is replaced with rename so it is never seen partly
+      * written.
+      *
+      * \returns 0 on success, or if \ref m_lutCachePath is empty
+      * \returns -1 if the file could not be written
+      */
+    int lutCacheSave();
+
+///@}
+
+/** \name LUT Upload
+  *
+  * @{
+  */
+
+public:
+
+    /// Set the number of LUT entry frames sent in each call to \ftdi_write_data during a bulk upload
+    /** \see m_lutChunkEntries
+      *
+      */
+    void lutChunkEntries( uint16_t n /**< [in] the number of entries per write, must be > 0 */ );
+
+    /// Get the number of LUT entry frames sent in each call to \ftdi_write_data during a bulk upload
+    /** \see m_lutChunkEntries
+      *
+      */
+    uint16_t lutChunkEntries();
+
+    /// Set the path of the file used to persist the LUT cache records, and load the one for this device
+    /** If the file exists and holds a record for the current serial number (see \ref serial), it is loaded so that
+      * the first upload after a restart can be skipped.  If the serial number changes later, the record for the new
+      * one is loaded by the next upload.  An empty path disables persistence.
+      *
+      * \see m_lutCachePath
+      *
+      * \returns 0 on success, including if the file does not exist yet
+      * \returns -1 if the file exists but could not be parsed
+      */
+    int lutCachePath( const std::string & path /**< [in] the path of the cache file */ );
+
+    /// Get the path of the file used to persist the LUT cache record
+    /** \see m_lutCachePath
+      *
+      */
+    std::string lutCachePath();
+
+    /// Set whether a LUT cache hit is confirmed by reading back the LUT parameters and a sample of entries
+    /** \see m_lutCacheVerify
+      *
+      */
+    void lutCacheVerify( bool v /**< [in] the new value of the flag */ );
+
+    /// Get whether a LUT cache hit is confirmed by reading back the LUT parameters and a sample of entries
+    /** \see m_lutCacheVerify
+      *
+      */
+    bool lutCacheVerify();
+
+    /// Get the record of the last LUT uploaded to the device
+    /** \see m_lutCache
+      *
+      */
+    const LUTCacheRecord & lutCache();
+
+    /// Forget the last LUT uploaded, so that the next upload is not skipped
+    void lutCacheClear();
+
+    /// Upload a complete waveform to the output LUT
+    /** Packs one MGMSG_PZ_SET_OUTPUTLUT frame per entry, followed by a MGMSG_PZ_SET_OUTPUTLUTPARAMS frame, into
+      * \ref m_lutbuf and sends them in calls to \ftdi_write_data of \ref m_lutChunkEntries frames each.  There is no
+      * flush or sleep between entries, only one \ftdi_tcioflush and \ref m_postFlushSleep before the first write.  Pacing
+      * is left to the RTS/CTS hardware flow control set by \ref connect, so the device is never overrun.
+      *
+      * The upload ends with a MGMSG_PZ_REQ_OUTPUTLUTPARAMS readback.  Since this request is queued behind all the
+      * entry frames, its response confirms that the device consumed the whole table, and the returned parameters
+      * are checked against those sent.  Then a sample of the entries is read back with MGMSG_PZ_REQ_OUTPUTLUT and
+      * checked against those sent, see \ref lutVerifySamples.  The throughput in \ref LUTUploadStats runs from the
+      * first write through the parameter readback, so it excludes the flush, sleep, and entry readback.
+      *
+      * The packed frames are hashed and compared to \ref m_lutCache.  If the same table and parameters were the
+      * last uploaded to this device the upload is skipped, and LUTUploadStats::skipped is set.  If \ref
+      * m_lutCacheVerify is true the skip is first confirmed by reading back the parameters and the same sample of
+      * entries, and the table is uploaded if they differ.
+      *
       * \returns 0 on succcess
       * \returns <0 on error from connect
       * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
       * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
       * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
-      */ 
-    int pz_req_tpz_iosettings( TPZIOSettings & tios, ///< [out] the \ref TPZIOSettings to populate
-                               bool errmsg = true    ///< [in] [optional] flag controlling if an error message is printed on failure
-                             );
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      * \returns -980 if abs(ov[i]) > 1 or is NaN for any entry
+      * \returns -1000 if \p n is 0 or > \ref lutMaxEntries, or \p lutp.Mode is LUTMode::INVALID
+      * \returns -1010 if the readback parameters or entries do not match those sent
+      */
+    int pz_upload_outputlut( const float * ov,               ///< [in] the output volts of each entry, as a percentage of max value
+                             uint16_t n,                     ///< [in] the number of entries in \p ov, which sets LUTParams::CycleLength
+                             const LUTParams & lutp,         ///< [in] the LUT output parameters.  CycleLength is ignored and set to \p n.
+                             LUTUploadStats * stats = nullptr, ///< [out] [optional] the statistics of the upload
+                             bool errmsg = true              ///< [in] [optional] flag controlling if an error message is printed on failure
+                           );
+
+///@}
+
+/** \name Latency Histograms Data
+  * @{
+  */
+
+public:
+
+    /// The number of linear sub-buckets in each power of 2 of the latency histograms
+    static constexpr uint32_t latencySubBuckets = 16;
+
+    /// The number of buckets in each latency histogram, covering 0 to 2^32-1 ns
+    static constexpr uint32_t latencyBuckets = (32 - 4 + 1)*latencySubBuckets;
+
+    /// The number of message IDs for which latency is recorded
+    static constexpr uint32_t latencySlots = 32;
+
+    /// A snapshot of the latency histogram of one APT message
+    /** Buckets are linear within each power of 2 nanoseconds, so values are recorded to within 1/16 (about 6%)
+      * from 16 ns to 4.3 s.  Longer latencies are recorded in the last bucket.
+      */
+    struct LatencyHistogram
+    {
+        uint16_t id {0};                        ///< The message ID of the command
+        uint64_t count {0};                     ///< The number of commands recorded
+        uint64_t totalNs {0};                   ///< The sum of the latencies in ns
+        uint64_t minNs {0};                     ///< The minimum latency in ns
+        uint64_t maxNs {0};                     ///< The maximum latency in ns
+        uint32_t buckets[latencyBuckets] {};    ///< The number of commands in each bucket
+
+        /// Get the mean latency
+        /**
+          * \returns the mean latency in seconds, 0 if nothing was recorded
+          */
+        double mean() const;
+
+        /// Get a percentile of the latency
+        /** The result is the highest value of the bucket holding the percentile, capped at the maximum.
+          *
+          * \returns the latency in seconds at the percentile, 0 if nothing was recorded
+          */
+        double percentile( double p /**< [in] the percentile, 0 to 100 */ ) const;
+
+        /// Get the number of commands with latency at or below a value
+        /** Counts whole buckets whose highest value is at or below the value, e.g. for a Prometheus histogram.
+          *
+          * \returns the number of commands
+          */
+        uint64_t countBelow( double s /**< [in] the latency in seconds */ ) const;
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
+protected:
+
+    /// The latency histogram of one APT message, as recorded by the commands
+    /** Only the thread issuing commands records, but a snapshot with reset zeroes the counters from another thread.
+      * So the counters are added to with relaxed fetch_add and taken with exchange, and a reset never loses a
+      * command recorded at the same time: it is counted either in the snapshot or after it.
+      */
+    struct latencySlot
+    {
+        std::atomic<uint16_t> id {0};                           ///< The message ID, 0 if the slot is unused
+        std::atomic<uint64_t> count {0};                        ///< The number of commands recorded
+        std::atomic<uint64_t> totalNs {0};                      ///< The sum of the latencies in ns
+        std::atomic<uint64_t> minNs {UINT64_MAX};               ///< The minimum latency in ns
+        std::atomic<uint64_t> maxNs {0};                        ///< The maximum latency in ns
+        std::atomic<uint32_t> buckets[latencyBuckets] {};       ///< The number of commands in each bucket
+    };
+
+    /// The latency histograms, looked up by message ID with linear probing
+    latencySlot m_latency[latencySlots];
+
+    /// Get the bucket of a latency
+    /**
+      * \returns the bucket index
+      */
+    static uint32_t latencyBucket( uint64_t ns /**< [in] the latency in ns */ ) noexcept;
+
+    /// Get the highest latency recorded in a bucket
+    /**
+      * \returns the latency in ns
+      */
+    static uint64_t latencyBucketValue( uint32_t b /**< [in] the bucket index */ ) noexcept;
+
+    /// Record the latency of a command
+    /** Does nothing if all slots are used by other messages.
+      */
+    void latencyRecord( uint16_t id, ///< [in] the message ID of the command
+                        uint64_t ns  ///< [in] the latency in ns
+                      ) noexcept;
+
+    /// Records the time from its construction to its destruction as the latency of a command
+    /** Declared by the TMCC_WRITE_REQUEST and TMCC_WRITE_COMMAND macros, so the latency runs from the start of the
+      * write to the return from the command, including any flush, sleep, and read of the response.  Also starts
+      * and ends the phase timing of the command, see \ref phaseTiming.
+      */
+    class latencyTimer
+    {
+        tmcController * m_tmcc;
+        uint16_t m_id;
+        std::chrono::steady_clock::time_point m_start;
+
+    public:
+        latencyTimer( tmcController * tmcc,
+                      uint16_t id
+                    ) noexcept : m_tmcc(tmcc), m_id(id), m_start(std::chrono::steady_clock::now())
+        {
+            TMCC_PROBE1(cmd__entry, m_id);
+            m_tmcc->phaseStart(m_id, m_start);
+        }
+
+        ~latencyTimer()
+        {
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count();
+            m_tmcc->latencyRecord(m_id, ns);
+            m_tmcc->phaseEnd(m_tmcc->m_lastPhases, true, end);
+            TMCC_PROBE2(cmd__exit, m_id, ns);
+        }
+    };
+
+///@}
+
+/** \name Latency Histograms
+  * Every command records its latency in a fixed histogram for its APT message ID, which can be read at any time with
+  * \ref latencySnapshot, e.g. to monitor the 99th percentile of \ref pz_set_outputvolts.  Multi-message operations,
+  * such as \ref connect and \ref pz_upload_outputlut, are not recorded.
+  * @{
+  */
+
+public:
+
+    /// Get a snapshot of the latency histogram of one message
+    /** Safe to call from another thread while commands are running.
+      *
+      * \returns 0 on success
+      * \returns -1000 if no latency has been recorded for \p id
+      */
+    int latencySnapshot( LatencyHistogram & hist, ///< [out] the snapshot
+                         uint16_t id,             ///< [in] the message ID of the command, e.g. tmcApt::PZ_SET_OUTPUTVOLTS::ID
+                         bool reset = false       ///< [in] [optional] if true the histogram is reset after the snapshot
+                       );
+
+    /// Get snapshots of the latency histograms of every message recorded
+    /**
+      * \returns a vector of the snapshots
+      */
+    std::vector<LatencyHistogram> latencySnapshot( bool reset = false /**< [in] [optional] if true the histograms are reset after the snapshot */ );
+
+    /// Reset all latency histograms
+    void latencyReset();
+
+///@}
+
+/** \name Phase Timing Data
+  * @{
+  */
+
+public:
+
+    /// The phases of a command or of \ref connect
+    enum class Phase : uint8_t { open,           ///< \ftdi_usb_open_desc_index, if the device was not open
+                                 chipId,         ///< \ftdi_read_chipid
+                                 baudRate,       ///< \ftdi_set_baudrate
+                                 lineProperty,   ///< \ftdi_set_line_property
+                                 preFlushSleep,  ///< The sleep of \ref m_preFlushSleep
+                                 flush,          ///< \ftdi_tcioflush
+                                 postFlushSleep, ///< The sleep of \ref m_postFlushSleep
+                                 reset,          ///< \ftdi_usb_reset
+                                 flowControl,    ///< \ftdi_setflowctrl
+                                 rts,            ///< \ftdi_setrts
+                                 restore,        ///< Writing the state loaded from the journal, in \ref connect
+                                 seed,           ///< Reading the device state for a bumpless restart, in \ref connect
+                                 write,          ///< \ftdi_write_data
+                                 read,           ///< \ftdi_read_data, until the whole response is read
+                                 decode          ///< Decoding the response and bookkeeping, until the command returns
+                               };
+
+    /// The number of phases
+    static constexpr uint32_t phaseCount = static_cast<uint32_t>(Phase::decode) + 1;
+
+    /// Get the name of a phase
+    /**
+      * \returns a string literal naming the phase
+      */
+    static const char * phaseName( Phase p /**< [in] the phase */ );
+
+    /// The time spent in each phase of one command or \ref connect
+    struct PhaseTimes
+    {
+        uint16_t id {0};             ///< The message ID of the command, 0 for \ref connect
+        uint64_t totalNs {0};        ///< The total time in ns
+        uint64_t ns[phaseCount] {};  ///< The time in ns in each phase, indexed by Phase
+
+        /// Get the time spent in a phase
+        /**
+          * \returns the time in seconds
+          */
+        double seconds( Phase p /**< [in] the phase */ ) const;
+
+        /// Dump details to a stream
+        /** Only the phases which took time are shown.
+          *
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
+protected:
+
+    /// Flag controlling whether phase timing is recorded.  Default is false.
+    bool m_phaseTiming {false};
+
+    /// The phases of the command or connect in progress
+    PhaseTimes m_phaseCur;
+
+    /// Whether a command or connect is being timed
+    bool m_phaseActive {false};
+
+    /// The start time of the command or connect being timed
+    std::chrono::steady_clock::time_point m_phaseStart;
+
+    /// The time of the last phase mark
+    std::chrono::steady_clock::time_point m_phaseLast;
+
+    /// The phases of the last command
+    PhaseTimes m_lastPhases;
+
+    /// The phases of the slowest command since the last reset
+    PhaseTimes m_worstPhases;
+
+    /// The phases of the last \ref connect
+    PhaseTimes m_connectPhases;
+
+    /// The timeline recording the spans of commands and phases, if any.  Not owned.
+    tmcTimeline * m_timeline {nullptr};
+
+    /// Convert a time point to ns for the timeline
+    /**
+      * \returns the ns since the steady_clock epoch
+      */
+    static uint64_t timelineNs( std::chrono::steady_clock::time_point tp /**< [in] the time point */ );
+
+    /// Start timing the phases of a command or connect
+    /** Does nothing unless \ref m_phaseTiming or \ref m_timeline is set, or on the reconnection thread.
+      */
+    void phaseStart( uint16_t id,                                ///< [in] the message ID, 0 for connect
+                     std::chrono::steady_clock::time_point start ///< [in] the start time
+                   ) noexcept;
+
+    /// End a phase, attributing the time since the last mark to it
+    void phaseMark( Phase p /**< [in] the phase which just ended */ ) noexcept;
+
+    /// Finish timing the phases of a command or connect
+    /** The total is the time from the start, so on failure it includes the phase which failed.
+      */
+    void phaseEnd( PhaseTimes & dest,                         ///< [out] where to store the phases
+                   bool command,                              ///< [in] if true the remaining time is decode, and the worst command is updated
+                   std::chrono::steady_clock::time_point end  ///< [in] the end time
+                 ) noexcept;
+
+    /// Times the phases of \ref connect from its construction to its destruction
+    class phaseScope
+    {
+        tmcController * m_tmcc;
+        PhaseTimes & m_dest;
+
+    public:
+        phaseScope( tmcController * tmcc,
+                    PhaseTimes & dest
+                  ) noexcept : m_tmcc(tmcc), m_dest(dest)
+        {
+            m_tmcc->phaseStart(0, std::chrono::steady_clock::now());
+        }
+
+        ~phaseScope()
+        {
+            m_tmcc->phaseEnd(m_dest, false, std::chrono::steady_clock::now());
+        }
+    };
+
+///@}
+
+/** \name Phase Timing
+  * When enabled, each command records the time it spends flushing, sleeping, writing, reading, and decoding, and
+  * \ref connect records the time of each of its steps.  Phase timing is off by default, and then costs one test
+  * at each phase.  The data should be read from the thread issuing commands.
+  * @{
+  */
+
+public:
+
+    /// Set the flag controlling whether phase timing is recorded
+    /** \see m_phaseTiming
+      */
+    void phaseTiming( bool pt /**< [in] the new value of the flag */ );
+
+    /// Get the flag controlling whether phase timing is recorded
+    /** \see m_phaseTiming
+      *
+      * \returns the current value of m_phaseTiming
+      */
+    bool phaseTiming();
+
+    /// Get the phases of the last command
+    /**
+      * \returns a copy of m_lastPhases
+      */
+    PhaseTimes lastPhases();
+
+    /// Get the phases of the slowest command since the last reset
+    /**
+      * \returns a copy of m_worstPhases
+      */
+    PhaseTimes worstPhases();
+
+    /// Get the phases of the last connect
+    /**
+      * \returns a copy of m_connectPhases
+      */
+    PhaseTimes connectPhases();
+
+    /// Reset the phase timing data
+    void phaseReset();
+
+    /// Set the timeline recording the spans of commands and phases
+    /** While a timeline is set, each command, \ref connect, and each of their phases is recorded in it as a span,
+      * whether or not \ref phaseTiming is enabled.  The timeline can be shared by several controllers, and must outlive
+      * them or be removed first.  See \ref tmcTimeline.
+      *
+      * \see m_timeline
+      */
+    void timeline( tmcTimeline * tl /**< [in] the timeline, nullptr for none */ );
+
+    /// Get the timeline recording the spans of commands and phases
+    /** \see m_timeline
+      *
+      * \returns the current value of m_timeline
+      */
+    tmcTimeline * timeline();
+
+///@}
+
+/** \name Device Counters Data
+  * @{
+  */
+
+public:
+
+    /// The number of message IDs for which frames and bytes are counted
+    static constexpr uint32_t counterSlots = 64;
+
+    /// A snapshot of the frames and bytes sent and received with one APT message ID
+    struct MessageCounters
+    {
+        uint16_t id {0};             ///< The message ID
+        uint64_t framesSent {0};     ///< The number of frames sent
+        uint64_t bytesSent {0};      ///< The number of bytes sent, including headers
+        uint64_t framesReceived {0}; ///< The number of frames received
+        uint64_t bytesReceived {0};  ///< The number of bytes received, including headers
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
+    /// A snapshot of the device counters
+    struct Counters
+    {
+        uint64_t framesSent {0};        ///< The number of frames sent
+        uint64_t bytesSent {0};         ///< The number of bytes sent
+        uint64_t framesReceived {0};    ///< The number of frames received in responses
+        uint64_t bytesReceived {0};     ///< The number of bytes read
+        uint64_t flushes {0};           ///< The number of calls to \ftdi_tcioflush
+        uint64_t timeouts {0};          ///< The number of reads which timed out, see \ref readTimeout
+        uint64_t reconnects {0};        ///< The number of successful reconnections by the reconnection thread
+        uint64_t reconnectAttempts {0}; ///< The number of reconnection attempts, see \ref reconnectAttempts
+        uint64_t sleepNs {0};           ///< The cumulative time requested in sleeps, in ns
+        double seconds {0};             ///< The time over which the counters were accumulated, since construction or \ref countersReset
+        uint32_t baud {0};              ///< The baud rate of the link
+
+        /// Get the fraction of the link capacity used for sending
+        /** Assumes 10 bits per byte on the line (8-N-1).
+          *
+          * \returns the average fraction of the baud rate used, 0 to 1
+          */
+        double sendUtilization() const;
+
+        /// Get the fraction of the link capacity used for receiving
+        /** Assumes 10 bits per byte on the line (8-N-1).
+          *
+          * \returns the average fraction of the baud rate used, 0 to 1
+          */
+        double receiveUtilization() const;
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump(streamT & ios /**< [out] the stream to dump to*/);
+    };
+
+protected:
+
+    /// The counters of one message ID, updated by the thread issuing commands
+    struct counterSlot
+    {
+        std::atomic<uint16_t> id {0};             ///< The message ID, 0 if unused
+        std::atomic<uint64_t> framesSent {0};     ///< The number of frames sent
+        std::atomic<uint64_t> bytesSent {0};      ///< The number of bytes sent
+        std::atomic<uint64_t> framesReceived {0}; ///< The number of frames received
+        std::atomic<uint64_t> bytesReceived {0};  ///< The number of bytes received
+    };
+
+    /// The per-message counters, looked up by message ID with linear probing
+    counterSlot m_msgCounters[counterSlots];
+
+    std::atomic<uint64_t> m_framesSent {0};     ///< The number of frames sent
+    std::atomic<uint64_t> m_bytesSent {0};      ///< The number of bytes sent
+    std::atomic<uint64_t> m_framesReceived {0}; ///< The number of frames received in responses
+    std::atomic<uint64_t> m_bytesReceived {0};  ///< The number of bytes read
+    std::atomic<uint64_t> m_flushes {0};        ///< The number of calls to \ftdi_tcioflush
+    std::atomic<uint64_t> m_timeouts {0};       ///< The number of reads which timed out
+    std::atomic<uint64_t> m_reconnects {0};     ///< The number of successful reconnections
+    std::atomic<uint64_t> m_sleepNs {0};        ///< The cumulative time requested in sleeps, in ns
+
+    /// The time at which the counters were last reset
+    std::atomic<std::chrono::steady_clock::time_point> m_countersSince {std::chrono::steady_clock::now()};
+
+    /// The time in ms to wait for a response before the read times out.  Default is 0, which waits indefinitely.
+    std::atomic<uint32_t> m_readTimeout {0};
+
+    /// The read timeout in ms used by the reconnection thread if \ref m_readTimeout is 0
+    /** A device which reenumerates but does not answer must not hang the reconnection thread.
+      */
+    static constexpr uint32_t reconnectReadTimeout = 1000;
+
+    /// The last status read by \ref pz_req_pzstatusupdate: the voltage, position, and status bits packed in 64 bits
+    std::atomic<uint64_t> m_lastStatus {0};
+
+    /// The CLOCK_REALTIME time in ns of the last status, 0 if none has been read
+    std::atomic<int64_t> m_lastStatusTime {0};
+
+    /// Increment a counter
+    /** Uses a relaxed fetch_add, since a load and store would overwrite a \ref countersReset made between them from
+      * another thread.
+      */
+    static void bump( std::atomic<uint64_t> & ctr, ///< [in/out] the counter
+                      uint64_t n                   ///< [in] the amount to add
+                    ) noexcept;
+
+    /// Count the APT frames in a buffer against their message IDs
+    /** A partial frame at the end counts its bytes only.
+      */
+    void countFrames( const unsigned char * buf, ///< [in] the bytes sent or received
+                      int sz,                    ///< [in] the number of bytes
+                      bool sent                  ///< [in] true if sent, false if received
+                    ) noexcept;
+
+    /// Count a call to \ftdi_tcioflush
+    void countFlush( int rv /**< [in] the return value of \ftdi_tcioflush */ ) noexcept;
+
+    /// Count a sleep, before it starts
+    void countSleep( uint32_t ms /**< [in] the time to sleep in ms */ ) noexcept;
+
+    /// Check if a read has timed out
+    /** Called after each read which returned no data.  The first call starts the clock.
+      *
+      * \returns true if \ref m_readTimeout, or \ref reconnectReadTimeout on the reconnection thread, has elapsed since
+      *          the first call
+      */
+    bool readTimedOut( std::chrono::steady_clock::time_point & start /**< [in/out] the start of the wait, zero before the first call */ ) noexcept;
+
+///@}
+
+/** \name Device Counters
+  * Each controller counts the frames and bytes it sends and receives, by message ID and in total, and its flushes,
+  * read timeouts, reconnections, and time spent sleeping.  The counters are always on, and can be read at any time
+  * from any thread with \ref counters, e.g. to see how close a device is to the capacity of its link.  The last
+  * piezo status is kept the same way, see \ref lastStatus.
+  * @{
+  */
+
+public:
+
+    /// Get a snapshot of the device counters
+    /** Does not allocate.  Safe to call from another thread while commands are running.
+      *
+      * \returns the snapshot
+      */
+    Counters counters();
+
+    /// Get a snapshot of the counters of one message
+    /**
+      * \returns 0 on success
+      * \returns -1000 if nothing has been counted for \p id
+      */
+    int messageCounters( MessageCounters & mc, ///< [out] the snapshot
+                         uint16_t id           ///< [in] the message ID
+                       );
+
+    /// Get snapshots of the counters of every message sent or received
+    /**
+      * \returns a vector of the snapshots
+      */
+    std::vector<MessageCounters> messageCounters();
+
+    /// Reset all counters, except the reconnection attempts
+    /** Safe to call from another thread while commands are running.  Counts made during the reset may land on either
+      * side of it, but none overwrite it.
+      */
+    void countersReset();
+
+    /// Get the last status read by \ref pz_req_pzstatusupdate
+    /** Does not touch the device.  Safe to call from another thread while commands are running.
+      *
+      * \returns 0 on success
+      * \returns -1000 if no status has been read
+      */
+    int lastStatus( PZStatus & pzs /**< [out] the last status, with the time it was read */ );
+
+    /// Set the time to wait for a response before the read times out
+    /** On a timeout the device buffers are flushed, so a late response is not taken as the response to the next
+      * command, and the command fails with ErrorCategory::timeout (-320).  0 waits indefinitely, except on the
+      * reconnection thread, which then uses \ref reconnectReadTimeout.
+      *
+      * \see m_readTimeout
+      */
+    void readTimeout( uint32_t to /**< [in] the new timeout in ms */ );
+
+    /// Get the time to wait for a response before the read times out
+    /** \see m_readTimeout
+      *
+      * \returns the current value of m_readTimeout
+      */
+    uint32_t readTimeout();
+
+///@}
+
+/** \name APT Commands
+  * The actual Thorlabs Motion Controllers Host-Controller Communications Protocol implementations.
+  * Declared here in order in which they appear in the manual.  Page numbers refer to Issue 37 of the manual,
+  * dated 22 May 2023.
+  * 
+  * In each command, error codes by \libftdi1 functions are offset to allow you to decipher which \libftdi1 function failed.
+  * 
+  * In fail-fast mode (see \ref failFast) each command returns -900 immediately if the device is not connected.
+  *
+  * @{
+  */
+
+public:
+
+    /// Instruct hardware unit to identify itself (by flashing its front panel LEDs).
+    /** Sends the MGMSG_MOD_IDENTIFY command (0x0223).  
+      * See page 46 of the APT Manual.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in \ftdi_write_data 
+      */
+    int mod_identify( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+
+
+    /// Enable or disable the specified drive channel 
+    /** Sends the MGMSG_MOD_SET_CHANENABLESTATE command (0x0210)
+      * See page 47 of the APT Manual
+      * 
+      * The KPZ101 sends a 10 byte reponse, after a delay, if this command changes the state.  This is undocumented in the manual.  
+      * To account for this, after sending the command, this sleeps for \ref m_postChanEnableSleep milliseconds (default 500) and then flushes
+      * the line with a read.  Nothing is done with the result, and it being 0 is not an error.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      * \returns -700 if sleep throws an exception
+      * \returns -1000 if \p ces is EnableState::invalid
+      * 
+      */
+    int mod_set_chanenablestate( const uint8_t & chnum,   ///< [in] the channel number
+                                 const EnableState & ces, ///< [in] the desired channel enable state, EnableState::enabled or EnableState::disabled. 
+                                 bool errmsg = true       ///< [in] [optional] flag controlling if an error message is printed on failure
+                               );
+    
+    /// Request teh enable state of the specified drive channel
+    /** Sends the MGMSG_MOD_REQ_CHANENABLESTATE command (0x0211)
+      * See page 47 of the APT Manual
+      * 
+      * Note: KPZ101 will only return 0x01==enabled regardless of whether it is enabled or not.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      * \returns -1000 if \p ces is EnableState::invalid
+      */
+    int mod_req_chanenablestate( EnableState & ces,     ///< [out] the channel enable state. 0x01 enabled, 0x02 disabled
+                                 const uint8_t & chnum, ///< [in] the channel number
+                                 bool errmsg = true     ///< [in] [optional] flag controlling if an error message is printed on failure
+                               );
+
+    /// Stop automatic status updates from the controller 
+    /** Sends the MGMSG_HW_STOP_UPDATEMSGS command (0x0012)
+      * See page 51 of the APT Manual. 
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data 
+      */
+    int hw_stop_updatemsgs( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+
+    /// Get hardware information from the device
+    /** Sends the MGMSG_HW_REQ_INFO command (0x0005) and parses the result into a \ref HWInfo structure.
+      * See page 52 of the APT manual.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      */
+    int hw_req_info( HWInfo & hwi,      ///< [in] the \ref HWInfo structure to populate
+                     bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                   );
+
+    /// Set the position control mode, open-loop or closed-loop
+    /** Sends the MGMSG_PZ_SET_POSCONTROLMODE command (0x0640).
+      * See page 196 of the APT manual.
+      *
+      * In a closed-loop mode the controller holds the position set with \ref pz_set_outputpos using its own
+      * feedback loop.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data
+      * \returns -1000 if \p pcm is PosControlMode::INVALID
+      */
+    int pz_set_poscontrolmode( const PosControlMode & pcm, ///< [in] the position control mode to set
+                               bool errmsg = true          ///< [in] [optional] flag controlling if an error message is printed on failure
+                             );
+
+    /// Get the position control mode
+    /** Sends the MGMSG_PZ_REQ_POSCONTROLMODE command (0x0641) and parses the result.
+      * See page 196 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      * \returns -1000 if the device returned an unknown mode
+      */
+    int pz_req_poscontrolmode( PosControlMode & pcm, ///< [out] the current position control mode
+                               bool errmsg = true    ///< [in] [optional] flag controlling if an error message is printed on failure
+                             );
+
+    /// Set the output voltage applied to the piezo actuator
+    /** Sends the MGMSG_PZ_SET_OUTPUTVOLTS command (0x0643).
+      * See page 198 of the manual.
+      *   
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data 
+      * \returns -980 if abs(ov) > 1 or ov is NaN
+      */
+    int pz_set_outputvolts( const float & ov, ///< [in] the output volts to set, converted from a percentage of max value
+                            bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
+                          );
+    
+    /// Get the output voltage applied to the piezo actuator
+    /** Sends the MGMSG_PZ_REQ_OUTPUTVOLTS command (0x0644).
+      * See page 198 of the manual.
+      *   
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      */
+    int pz_req_outputvolts( float & ov,      ///< [out] the output volts currently set, converted to a percentage of maximum value
+                            bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                          );
+
+    /// Set the position of the piezo actuator in closed-loop mode
+    /** Sends the MGMSG_PZ_SET_OUTPUTPOS command (0x0646).
+      * See page 200 of the APT manual.
+      *
+      * Only applies in a closed-loop mode, see \ref pz_set_poscontrolmode.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data
+      * \returns -980 if pos < 0, pos > 1, or pos is NaN
+      */
+    int pz_set_outputpos( const float & pos, ///< [in] the position to set, as a percentage of maximum travel (0 to 1)
+                          bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                        );
+
+    /// Get the position of the piezo actuator
+    /** Sends the MGMSG_PZ_REQ_OUTPUTPOS command (0x0647) and parses the result.
+      * See page 200 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      */
+    int pz_req_outputpos( float & pos,       ///< [out] the position, as a percentage of maximum travel (0 to 1)
+                          bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                        );
+
+    /// Get Piezo status
+    /** Sends the MGMSG_PZ_REQ_PZSTATUSUPDATE command (0x0660) and parses the result into a \ref PZstatus structure.
+      * See page 205 of the APT manual.
+      *  
+      * \note this currently only works for the TPZ001 KPZ101
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      */
+    int pz_req_pzstatusupdate( PZStatus & pzs,    ///< [out] the \ref PZStatus structure to populate
+                               bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                             );
+
+    /// Set one entry of the output voltage look-up table (LUT)
+    /** Sends the MGMSG_PZ_SET_OUTPUTLUT command (0x0700).
+      * See page 208 of the APT manual.
+      *
+      * A waveform is uploaded by setting entries 0 to LUTParams::CycleLength-1, and is then played by the
+      * controller at its own sample rate with \ref pz_start_lutoutput.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data
+      * \returns -980 if abs(ov) > 1 or ov is NaN
+      * \returns -1000 if \p index >= \ref lutMaxEntries
+      */
+    int pz_set_outputlut( const uint16_t & index, ///< [in] the LUT index to set, 0 to \ref lutMaxEntries-1
+                          const float & ov,       ///< [in] the output volts for this entry, as a percentage of max value
+                          bool errmsg = true      ///< [in] [optional] flag controlling if an error message is printed on failure
+                        );
+
+    /// Set the parameters controlling output of the LUT waveform
+    /** Sends the MGMSG_PZ_SET_OUTPUTLUTPARAMS command (0x0703).
+      * See page 210 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data
+      * \returns -1000 if \p lutp.Mode is LUTMode::INVALID or \p lutp.CycleLength is out of range
+      */
+    int pz_set_outputlutparams( const LUTParams & lutp, ///< [in] the \ref LUTParams to set
+                                bool errmsg = true      ///< [in] [optional] flag controlling if an error message is printed on failure
+                              );
+
+    /// Get the parameters controlling output of the LUT waveform
+    /** Sends the MGMSG_PZ_REQ_OUTPUTLUTPARAMS command (0x0704) and parses the result.
+      * See page 210 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data
+      */
+    int pz_req_outputlutparams( LUTParams & lutp,  ///< [out] the \ref LUTParams structure to populate
+                                bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                              );
+
+    /// Start output of the LUT waveform
+    /** Sends the MGMSG_PZ_START_LUTOUTPUT command (0x0706).
+      * See page 214 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data
+      */
+    int pz_start_lutoutput( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+
+    /// Stop output of the LUT waveform
+    /** Sends the MGMSG_PZ_STOP_LUTOUTPUT command (0x0707).
+      * See page 215 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data
+      */
+    int pz_stop_lutoutput( bool errmsg = true /**< [in] [optional] flag controlling if an error message is printed on failure*/);
+
+    /// Set the intensity of the LED display on the front of the TPZ unit
+    /** Sends the MGMSG_PZ_SET_TPZ_DISPSETTINGS command (0x07D1)
+      * See page 223 of the APT manual.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data 
+      */
+    int pz_set_tpz_dispsettings( const uint16_t & dispint, ///< [in] The value to set.  Manual says 0-255.  Devices tested have a more limited range of XX to XX.
+                                 bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                               );
+
+    /// Get the intensity of the LED display on the front of the TPZ unit
+    /** Sends the MGMSG_PZ_REQ_TPZ_DISPSETTINGS command (0x07D2)
+      * See page 223 of the APT manual.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      */  
+    int pz_req_tpz_dispsettings( uint16_t & dispint, ///< [out] the intensity value returned by the device.
+                                 bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                               );
+
+    /// Set voltage limit and hub analog input
+    /** Sends the MGMSG_PZ_SET_TPZ_IOSETTINGS command (0x07D4) 
+      * See page 224 of the manual.
+      * 
+      * On success the voltage limit is cached in \ref m_voltLimit.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data 
+      */
+    int pz_set_tpz_iosettings( const TPZIOSettings & tios, ///< [in] the \ref TPZIOSettings to set
+                                bool errmsg = true         ///< [in] [optional] flag controlling if an error message is printed on failure
+                             );
+
+
+    /// Set voltage limit and hub analog input
+    /** Sends the MGMSG_PZ_REQ_TPZ_IOSETTINGS command (0x07D5) 
+      * See page 224 of the manual.
+      * 
+      * On success the voltage limit is cached in \ref m_voltLimit.
+      *
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      */ 
+    int pz_req_tpz_iosettings( TPZIOSettings & tios, ///< [out] the \ref TPZIOSettings to populate
+                               bool errmsg = true    ///< [in] [optional] flag controlling if an error message is printed on failure
+                             );
+
+    /// Set top panel wheel and display parameters
+    /** Sends the MGMSG_KPZ_SET_KCUBEMMIPARAMS message (0x07F0).
+      * See page 235 of the APT manual.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns -666 if device not available in either \ftdi_write_data  
+      */
+    int kpz_set_kcubemmiparams( const KMMIParams & kmp, ///< [in] the \ref KMMIParams to set
+                                bool errmsg = true      ///< [in] [optional] flag controlling if an error message is printed on failure
+                              );
+
+    /// Get top panel wheel and display parameters
+    /** Sends the MGMSG_KPZ_REQ_KCUBEMMIPARAMS message (0x07F1) and parses the results.
+      * See page 235 of the APT manual.
+      * 
+      * \returns 0 on succcess
+      * \returns <0 on error from connect
+      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
+      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
+      * \returns -300 if not enough data read
+      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
+      */
+    int kpz_req_kcubemmiparams( KMMIParams & kmp,  ///< [out] the \ref KMMIParams structure to populate
+                                bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
+                              );
+
+
+///@}
+
+/** \name Unchecked Commands
+  * The hot-path commands without the connection check.  The public commands call these after checking the
+  * connection, and \ref session calls them directly.  The caller must know the device is connected.
+  * Return values are as for the public commands, without the errors from connect.
+  * @{
+  */
+
+protected:
+
+    /// Set the output voltage without checking the connection. See \ref pz_set_outputvolts
+    int do_pz_set_outputvolts( const float & ov, ///< [in] the output volts to set, converted from a percentage of max value
+                               bool errmsg,      ///< [in] flag controlling if an error message is printed on failure
+                               bool flush        ///< [in] flag controlling if the device is flushed, with the post-flush sleep, before the write
+                             ) noexcept;
+
+    /// Get the output voltage without checking the connection. See \ref pz_req_outputvolts
+    int do_pz_req_outputvolts( float & ov,  ///< [out] the output volts currently set, converted to a percentage of maximum value
+                               bool errmsg  ///< [in] flag controlling if an error message is printed on failure
+                             ) noexcept;
+
+    /// Set the closed-loop position without checking the connection. See \ref pz_set_outputpos
+    int do_pz_set_outputpos( const float & pos, ///< [in] the position to set, as a percentage of maximum travel (0 to 1)
+                             bool errmsg,       ///< [in] flag controlling if an error message is printed on failure
+                             bool flush         ///< [in] flag controlling if the device is flushed, with the post-flush sleep, before the write
+                           ) noexcept;
+
+    /// Get the position without checking the connection. See \ref pz_req_outputpos
+    int do_pz_req_outputpos( float & pos, ///< [out] the position, as a percentage of maximum travel (0 to 1)
+                             bool errmsg  ///< [in] flag controlling if an error message is printed on failure
+                           ) noexcept;
+
+    /// Get the piezo status without checking the connection. See \ref pz_req_pzstatusupdate
+    int do_pz_req_pzstatusupdate( PZStatus & pzs, ///< [out] the \ref PZStatus structure to populate
+                                  bool errmsg     ///< [in] flag controlling if an error message is printed on failure
+                                ) noexcept;
+
+///@}
+
+/** \name Connected Session
+  * @{
+  */
+
+protected:
+
+    /// Token restricting construction of a \ref session to tmcController
+    class sessionKey
+    {
+        sessionKey() {}
+        friend class tmcController;
+    };
+
+public:
+
+    /// Handle to a connected device, for use in control loops
+    /** Can only be obtained from \ref connect(std::optional<session>&, bool), so holding one means the connection
+      * succeeded.  The hot-path commands on the handle never start an unexpected \ref connect (with its sleeps and
+      * USB reset) in the middle of a loop.  They only check \ref m_connected, with one relaxed atomic load, and fail
+      * with ErrorCategory::disconnected (-900) if it is false, e.g. after an error in fail-fast mode has handed the
+      * device to the reconnection thread.  So a session never touches the USB handle while it is being reopened.
+      *
+      * The handle refers to the tmcController, and must not be used after it is closed or destroyed.  As with
+      * tmcController, it is not thread safe.
+      *
+      * The session commands are the real-time subset of the API.  They are noexcept, do not allocate, and take no
+      * lock, including on their error paths, and the applied state and journal are updated in place.  Unlike the
+      * public commands, the set commands do not flush the device buffers and take the post-flush sleep (see \ref
+      * m_postFlushSleep, 50 ms by default) before each write.  A set command has no response for stale data to be
+      * mistaken for, and the sleep would bound a loop to 20 set points per second.  Each command is then one write,
+      * and for a request one read, which block for the USB transfers and at most \ref readTimeout.  An error
+      * message is only the call of \ref otherErrmsg or \ref ftdiErrmsg, whose default versions write to std::cerr,
+      * so pass errmsg=false or override them in a real-time thread.
+      */
+    class session
+    {
+    protected:
+        tmcController * m_tmcc; ///< The connected controller
+
+    public:
+        /// C'tor, only callable by tmcController
+        session( tmcController & tmcc, ///< [in] the connected controller
+                 sessionKey            ///< [in] the construction token
+               ) : m_tmcc(&tmcc)
+        {
+        }
+
+        /// Get the controller this session refers to
+        /**
+          * \returns a reference to the controller
+          */
+        tmcController & controller()
+        {
+            return *m_tmcc;
+        }
+
+        /// Set the output voltage. See \ref tmcController::pz_set_outputvolts
+        int pz_set_outputvolts( const float & ov,   ///< [in] the output volts to set, converted from a percentage of max value
+                                bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
+                              ) noexcept;
+
+        /// Get the output voltage. See \ref tmcController::pz_req_outputvolts
+        int pz_req_outputvolts( float & ov,         ///< [out] the output volts currently set, converted to a percentage of maximum value
+                                bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
+                              ) noexcept;
+
+        /// Set the closed-loop position. See \ref tmcController::pz_set_outputpos
+        int pz_set_outputpos( const float & pos,  ///< [in] the position to set, as a percentage of maximum travel (0 to 1)
+                              bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
+                            ) noexcept;
+
+        /// Get the position. See \ref tmcController::pz_req_outputpos
+        int pz_req_outputpos( float & pos,        ///< [out] the position, as a percentage of maximum travel (0 to 1)
+                              bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
+                            ) noexcept;
+
+        /// Get the piezo status. See \ref tmcController::pz_req_pzstatusupdate
+        int pz_req_pzstatusupdate( PZStatus & pzs,     ///< [out] the \ref PZStatus structure to populate
+                                   bool errmsg = true  ///< [in] [optional] flag controlling if an error message is printed on failure
+                                 ) noexcept;
+    };
+
+    /// Connect to the device and obtain a \ref session handle
+    /** Calls \ref connect(bool) if not already connected.  On success \p ses is set to a session for this
+      * controller, on failure it is reset.
+      *
+      * \returns 0 on success
+      * \returns < 0 on error from \ref connect(bool)
+      */
+    int connect( std::optional<session> & ses, ///< [out] the session, set only if connected
+                 bool errmsg = true            ///< [in] [optional] flag controlling if an error message is printed on failure
+               );
+
+///@}
+
+/** \name Error Handling
+  * Every error is recorded as an \ref Error, which holds the category, the \libftdi1 return value, and where it
+  * happened, and can be retrieved with \ref lastError.  Nothing is formatted until \ref Error::message is called.
+  * The commands still return the int codes, which are \ref Error::legacy of the recorded error.
+  *
+  * If errmsg is true the error is also passed to \ref ftdiErrmsg or \ref otherErrmsg.  The arguments are plain C
+  * strings, and messages with values in them are formatted into a buffer on the stack, so nothing is allocated to
+  * report an error.
+  * @{ 
+  */
+
+public:
+
+    /// Categories of error, see \ref Error
+    /** Every int error code in this library, including those of the helper classes, is listed here.  The codes
+      * returned by tmcController are \ref Error::legacy of the recorded error.
+      *
+      * | Code                    | Category     | Meaning                                                                        |
+      * |-------------------------|--------------|--------------------------------------------------------------------------------|
+      * | 0                       | none         | Success                                                                        |
+      * | \<0, the return value   | open         | \ftdi_usb_open_desc_index failed in \ref open                                  |
+      * | \<0, the return value   | close        | \ftdi_usb_close failed in \ref close                                            |
+      * | -10*step + return value | connect      | A \libftdi1 call in \ref connect failed, step 2 (chip id) to 8 (RTS)           |
+      * | -10*step + 1            | exception    | A sleep in \ref connect threw, step 5 (pre-flush) or 6 (post-flush)             |
+      * | -1                      | file         | A file could not be opened, read, written, or mapped, or a socket or region could not be created.  Also tmcTrace, tmcTimeline, tmcExporter, and tmcDaemon |
+      * | -100 + return value     | write        | \ftdi_write_data failed                                                         |
+      * | -200 + return value     | read         | \ftdi_read_data failed                                                          |
+      * | -300                    | response     | Not enough data read, or the response was not the expected message             |
+      * | -320                    | timeout      | No response within \ref readTimeout, or a tmcClient command did not complete    |
+      * | -666                    | unavailable  | The device was not available, or a tmcReplay ran out of recorded events        |
+      * | -700                    | exception    | An exception was caught, e.g. starting a thread, also in tmcLog, tmcExporter, and tmcDaemon |
+      * | -900                    | disconnected | Not connected in fail-fast mode, a session used after the link went down, or no daemon region open |
+      * | -950                    | busy         | A command queue was full, \ref tmcClient::submit                                |
+      * | -980                    | range        | A value was out of range                                                       |
+      * | -1000                   | parameter    | A parameter was invalid, nothing recorded yet for a snapshot, or a helper already running |
+      * | -1010                   | mismatch     | A readback did not match what was written                                      |
+      */
+    enum class ErrorCategory : uint8_t { none = 0,     ///< No error
+                                         open,         ///< \ftdi_usb_open_desc_index failed, legacy code is the return value
+                                         close,        ///< \ftdi_usb_close failed, legacy code is the return value
+                                         connect,      ///< A \libftdi1 call in \ref connect failed, legacy code is -10*step + the return value
+                                         write,        ///< \ftdi_write_data failed, legacy code is -100 + the return value
+                                         read,         ///< \ftdi_read_data failed, legacy code is -200 + the return value
+                                         response,     ///< Not enough data read, or a response was not the expected message (-300)
+                                         timeout,      ///< No response within the read timeout (-320)
+                                         unavailable,  ///< The device was not available (-666)
+                                         exception,    ///< An exception was caught (-700, or -10*step + 1 in \ref connect)
+                                         disconnected, ///< Not connected in fail-fast mode (-900)
+                                         range,        ///< A value was out of range (-980)
+                                         parameter,    ///< A parameter was invalid (-1000)
+                                         mismatch,     ///< A readback did not match what was written (-1010)
+                                         file,         ///< A file could not be read, written, or mapped (-1)
+                                         busy          ///< A command queue was full, e.g. \ref tmcClient::submit (-950)
+                                       };
+
+    /// Get the name of an error category
+    /**
+      * \returns a string literal naming the category
+      */
+    static const char * errorCategoryName( ErrorCategory cat /**< [in] the category */ );
+
+    /// A structured error code
+    /** Recording an error only copies these few fields, so the error context costs nothing unless it is looked at.
+      */
+    struct Error
+    {
+        ErrorCategory category {ErrorCategory::none}; ///< The category of the error
+        uint8_t step {0};                             ///< The step of \ref connect which failed, 2 (chip id) to 8 (RTS), 0 otherwise
+        int16_t code {0};                             ///< The return value of the \libftdi1 function, 0 if none
+        const char * src {nullptr};                   ///< The function in which the error occurred, a string literal
+        const char * ftdiStr {nullptr};               ///< The \libftdi1 error string at the time, if there is a return value
+        int line {0};                                 ///< The line number at which the error was recorded
+
+        /// Check if this is an error
+        /**
+          * \returns true if category is not ErrorCategory::none
+          */
+        explicit operator bool() const noexcept
+        {
+            return category != ErrorCategory::none;
+        }
+
+        /// Get the int error code returned by the commands for this error
+        /**
+          * \returns the legacy code, see \ref ErrorCategory
+          */
+        int legacy() const noexcept;
+
+        /// Format a message describing the error
+        /**
+          * \returns the message
+          */
+        std::string message() const;
+    };
+
+protected:
+
+    /// The last error recorded by the commands
+    Error m_lastError;
+
+    /// Record an error in \ref m_lastError
+    /** Errors in the reconnection thread are not recorded, so that the commands' error is not overwritten.
+      *
+      * \returns the legacy code of the error
+      */
+    int fail( ErrorCategory cat, ///< [in] the category of the error
+              int code,          ///< [in] the return value of the \libftdi1 function, 0 if none
+              const char * src,  ///< [in] the function in which the error occurred, a string literal
+              int line,          ///< [in] the line number
+              uint8_t step = 0   ///< [in] [optional] the step of \ref connect
+            ) noexcept;
+
+public:
+
+    /// Get the last error recorded by the commands
+    /** \see m_lastError
+      *
+      * \returns a copy of m_lastError
+      */
+    Error lastError();
+
+    /// Clear the last error
+    void clearError();
+
+protected:
+
+    /// The asynchronous log sink, if any.  Not owned.
+    tmcLog * m_logSink {nullptr};
+
+    /// Push an event, such as a link state change, to the log sink
+    /** Lock-free.  Does nothing unless the log sink is running.
+      */
+    void logEvent( const char * src, ///< [in] The source of the event (the tmcController function)
+                   const char * msg  ///< [in] The message describing the event
+                 ) noexcept;
+
+public:
+
+    /// Set the asynchronous log sink
+    /** While the sink is running, the default \ref ftdiErrmsg and \ref otherErrmsg push the message into it
+      * instead of writing to std::cerr, and link state changes are logged as events.  The sink can be shared by
+      * several controllers, and must outlive them or be removed first.
+      *
+      * \see m_logSink
+      */
+    void logSink( tmcLog * ls /**< [in] the log sink, nullptr for none */ );
+
+    /// Get the asynchronous log sink
+    /** \see m_logSink
+      *
+      * \returns the current value of m_logSink
+      */
+    tmcLog * logSink();
+
+protected:
+
+    /// The wire-level tracer, if any.  Not owned.
+    tmcTrace * m_wireTrace {nullptr};
+
+    /// The trace replay standing in for the device, if any.  Not owned.
+    tmcReplay * m_replay {nullptr};
+
+    /// Write bytes to the device, recording them in the wire trace if one is set
+    /** All writes to the device go through this function.  Writes to the replay instead if one is set.
+      *
+      * \returns the return value of \ftdi_write_data
+      */
+    int writeData( const unsigned char * buf, ///< [in] the bytes to write
+                   int sz                     ///< [in] the number of bytes
+                 ) noexcept;
+
+    /// Read bytes from the device, recording them in the wire trace if one is set
+    /** All reads from the device go through this function.  Reads from the replay instead if one is set.
+      *
+      * \returns the return value of \ftdi_read_data
+      */
+    int readData( unsigned char * buf, ///< [out] the buffer to read into
+                  int sz               ///< [in] the size of the buffer
+                ) noexcept;
+
+    /// Flush the device buffers, counting the flush
+    /** All flushes go through this function.  Does nothing if a replay is set, since there is no device, so replay
+      * counters and probes are not polluted by flushes of an unopened context.
+      *
+      * \returns the return value of \ftdi_tcioflush, 0 if a replay is set
+      */
+    int flushData() noexcept;
+
+public:
+
+    /// Set the wire-level tracer
+    /** Every frame written to the device and every chunk read from it is recorded in the tracer's ring file.  The
+      * tracer can be shared by several controllers, and must outlive them or be removed first.
+      *
+      * \see m_wireTrace
+      */
+    void wireTrace( tmcTrace * wt /**< [in] the tracer, nullptr for none */ );
+
+    /// Get the wire-level tracer
+    /** \see m_wireTrace
+      *
+      * \returns the current value of m_wireTrace
+      */
+    tmcTrace * wireTrace();
+
+    /// Set a trace replay to stand in for the device
+    /** While a replay is set, writes and reads go to it instead of the device, and the controller is marked
+      * connected without opening the device.  Removing it marks the controller disconnected.  See \ref tmcReplay.
+      *
+      * \see m_replay
+      */
+    void replay( tmcReplay * rp /**< [in] the replay, nullptr to use the device */ );
+
+    /// Get the trace replay standing in for the device
+    /** \see m_replay
+      *
+      * \returns the current value of m_replay
+      */
+    tmcReplay * replay();
+
+    /// Print a message to std::cerr describing an error from an \libftdi1 function
+    /** Pushed to the log sink instead if it is running, see \ref logSink.
+      * Intended to be overriden in a derived class to provide custom error messaging.
+      */
+    virtual void ftdiErrmsg( const char * src,  ///< [in] The source of the error (the tmcController function)
+                             const char * msg,  ///< [in] The message describing the error
+                             int rv,            ///< [in] The return value of the \libftdi1 function
+                             const char * file, ///< [in] The file name of this file
+                             int line           ///< [in] The line number at which the error was recorded
+                           );
+
+    /// Print a message to std::cerr describing an error 
+    /** Pushed to the log sink instead if it is running, see \ref logSink.
+      * Intended to be overriden in a derived class to provide custom error messaging.
+      */
+    virtual void otherErrmsg( const char * src,  ///< [in] The source of the error (the tmcController function)
+                              const char * msg,  ///< [in] The message describing the error
+                              const char * file, ///< [in] The file name of this file
+                              int line           ///< [in] The line number at which the error was recorded
+                            );
+
+    /// The former std::string signatures of \ref ftdiErrmsg and \ref otherErrmsg, deleted
+    /** A derived class which still overrides these fails to compile, instead of silently no longer being called.
+      * Change the override to take const char *.
+      */
+    virtual void ftdiErrmsg( const std::string & src,
+                             const std::string & msg,
+                             int rv,
+                             const std::string & file,
+                             int line
+                           ) final = delete;
+
+    /// \copydoc ftdiErrmsg(const std::string &, const std::string &, int, const std::string &, int)
+    virtual void otherErrmsg( const std::string & src,
+                              const std::string & msg,
+                              const std::string & file,
+                              int line
+                            ) final = delete;
+
+ ///@}                   
+
+
+};
+
+inline
+tmcController::tmcController()
+{
+    m_ftdi = ftdi_new();
+
+    ///\todo throw on failure
+}
+
+inline
+tmcController::~tmcController()
+{
+    stopReconnect();
+    close();
+    journalClose();
+    ftdi_free(m_ftdi);
+}
+
+inline
+const ftdi_context * tmcController::ftdi() const
+{
+    return m_ftdi;
+}
+
+inline
+void tmcController::vendor( uint16_t v )
+{
+    m_vendor = v;
+}
+
+inline
+uint16_t tmcController::vendor()
+{
+    return m_vendor;
+}
+
+inline   
+void tmcController::product( uint16_t p )
+{
+    m_product = p;
+}
+
+inline   
+uint16_t tmcController::product()
+{
+    return m_product;
+}
+
+inline    
+void tmcController::serial(const std::string & s )
+{
+    m_serial = s;
+}
+
+inline    
+std::string tmcController::serial()
+{
+    return m_serial;
+}
+
+inline
+void tmcController::baud( uint32_t b /* [in] the new baud rate*/ )
+{
+    m_baud = b;
+}
+
+inline
+uint32_t tmcController::baud()
+{
+    return m_baud;
+}
+
+inline
+void tmcController::preFlushSleep( uint32_t s /* [in] the pre-flush sleep time in ms */ )
+{
+    m_preFlushSleep = s;
+}
+
+inline
+uint32_t tmcController::preFlushSleep()
+{
+    return m_preFlushSleep;
+}
+
+inline
+void tmcController::postFlushSleep( uint32_t s /* [in] the post-flush sleep time in ms */ )
+{
+    m_postFlushSleep = s;
+}
+
+inline
+uint32_t tmcController::postFlushSleep()
+{
+    return m_postFlushSleep;
+}
+
+inline
+int tmcController::open(bool errmsg /*default=true*/)
+{
+    int rv;
+
+    if((rv = ftdi_usb_open_desc_index(m_ftdi, m_vendor, m_product, NULL, m_serial.c_str(), 0)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::open", "unable to open ftdi device", rv, __FILE__, __LINE__-4);
+        }
+
+        m_opened = false;
+
+        return fail(ErrorCategory::open, rv, "tmcController::open", __LINE__);
+    }
+
+    m_opened = true;
+
+    return 0;
+}
+
+inline
+int tmcController::open( const std::string & s,
+                         bool errmsg /*default=true*/
+                       )
+{
+    serial(s);
+    return open(errmsg);
+}
+
+inline
+int tmcController::open( uint16_t v,
+                         uint16_t p,
+                         const std::string & s,
+                         bool errmsg /*default=true*/
+                       )
+{
+    vendor(v);
+    product(p);
+    serial(s);
+    return open(errmsg);
+}
+
+inline
+int tmcController::close( bool errmsg /*default=true*/)
+{
+    if(!m_opened) 
+    {
+        return 0;
+    }
+
+    int rv;
+    if((rv = ftdi_usb_close(m_ftdi)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::close", "unable to close device", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::close, rv, "tmcController::close", __LINE__);
+    }
+
+    m_opened = false;
+    m_connected = false;
+
+    return 0;
+}
+
+inline
+int tmcController::connect(bool errmsg /*default=true*/)
+{
+    phaseScope ps(this, m_connectPhases);
+
+    int rv = connectDevice(errmsg);
+    if(rv < 0)
+    {
+        return rv;
+    }
+
+    if(m_journalPending)
+    {
+        m_journalPending = false;
+
+        //Written like seedState, as the first thing after connectDevice's flush and post-flush sleep, so no flush is
+        //needed.  Bumpless restart is skipped on purpose: the journal is the state this program last applied, and
+        //restoring it is the point of the journal.
+        if(m_serial == m_journal->serial && journalLoad() == 0)
+        {
+            rv = writeApplied(applyAll, errmsg);
+            phaseMark(Phase::restore);
+            if(rv < 0)
+            {
+                return rv;
+            }
+
+            m_connected = true;
+
+            return 0;
+        }
+    }
+
+    if(m_journal && m_serial != m_journal->serial)
+    {
+        //The records belong to another device.  Invalidate them, so that a crash before the next change can't have
+        //the next start restore them to this device.
+        m_journal->slot[0].seq = 0;
+        m_journal->slot[1].seq = 0;
+        m_journalSeq = 0;
+
+        memset(m_journal->serial, 0, sizeof(m_journal->serial));
+        m_serial.copy(m_journal->serial, sizeof(m_journal->serial) - 1);
+    }
+
+    if(m_bumplessRestart)
+    {
+        rv = seedState(errmsg);
+        phaseMark(Phase::seed);
+        if(rv < 0)
+        {
+            return rv;
+        }
+    }
+
+    m_connected = true;
+
+    return 0;
+}
+
+inline
+int tmcController::connectDevice(bool errmsg)
+{
+    if(!m_opened)
+    {
+        int rv = open(errmsg);
+        if( (rv < 0) || !m_opened)
+        {
+            if(errmsg)
+            {
+                ftdiErrmsg("tmcController::connect", "open failed", rv, __FILE__, __LINE__-5);
+            }
+            return rv;
+        }
+    }
+
+    phaseMark(Phase::open);
+
+    int rv;
+    if((rv = ftdi_read_chipid(m_ftdi, &m_chipid)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to read chip id", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 2);
+    }
+
+    phaseMark(Phase::chipId);
+
+    if((rv = ftdi_set_baudrate(m_ftdi, m_baud)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to set baud rate", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 3);
+    }
+
+    phaseMark(Phase::baudRate);
+
+    if((rv = ftdi_set_line_property(m_ftdi, BITS_8, STOP_BIT_1, NONE)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to set line property", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 4);
+    }
+
+    phaseMark(Phase::lineProperty);
+
+    countSleep(m_preFlushSleep);
+
+    try
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_preFlushSleep));
+    }
+    catch(const std::exception& e)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "exception from sleep_for: %s", e.what());
+            otherErrmsg("tmcController::connect", msg, __FILE__, __LINE__-8);
+        }
+        return fail(ErrorCategory::exception, 0, "tmcController::connect", __LINE__, 5);
+    }
+
+    phaseMark(Phase::preFlushSleep);
+
+    rv = flushData();
+    if(rv < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to tcio flush", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 5);
+    }
+
+    phaseMark(Phase::flush);
+
+    countSleep(m_postFlushSleep);
+
+    try
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_postFlushSleep));
+    }
+    catch(const std::exception& e)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "exception from sleep_for: %s", e.what());
+            otherErrmsg("tmcController::connect", msg, __FILE__, __LINE__-8);
+        }
+        return fail(ErrorCategory::exception, 0, "tmcController::connect", __LINE__, 6);
+    }
+
+    phaseMark(Phase::postFlushSleep);
+
+    if((rv = ftdi_usb_reset(m_ftdi)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to reset device", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 6);
+    }
+
+    phaseMark(Phase::reset);
+
+    if((rv = ftdi_setflowctrl(m_ftdi, SIO_RTS_CTS_HS)) < 0)
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to set flow control", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 7);
+    }
+
+    phaseMark(Phase::flowControl);
+
+    if((rv = ftdi_setrts(m_ftdi, 1)) < 0 )
+    {
+        if(errmsg)
+        {
+            ftdiErrmsg("tmcController::connect", "unable to set RTS", rv, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::connect, rv, "tmcController::connect", __LINE__, 8);
+    }
+
+    phaseMark(Phase::rts);
+
+    return 0;
+}
+
+inline
+int tmcController::connect( const std::string & s,
+                            bool errmsg /*default=true*/
+                          )
+{
+    serial(s);
+    return connect(errmsg);
+}
+
+inline
+int tmcController::connect( uint16_t v,
+                            uint16_t p,
+                            const std::string & s,
+                            bool errmsg /*default=true*/
+                          )
+{
+    vendor(v);
+    product(p);
+    serial(s);
+    return connect(errmsg);
+}
+
+inline
+bool tmcController::opened()
+{
+    return m_opened;
+}
+
+inline
+bool tmcController::connected()
+{
+    return m_connected;
+}
+
+inline
+void tmcController::failFast( bool ff )
+{
+    m_failFast = ff;
+}
+
+inline
+bool tmcController::failFast()
+{
+    return m_failFast;
+}
+
+inline
+void tmcController::reconnectMinBackoff( uint32_t ms )
+{
+    //0 would make the thread spin on the wait while connected, and never back off
+    m_reconnectMinBackoff = (ms < 1) ? 1 : ms;
+}
+
+inline
+uint32_t tmcController::reconnectMinBackoff()
+{
+    return m_reconnectMinBackoff;
+}
+
+inline
+void tmcController::reconnectMaxBackoff( uint32_t ms )
+{
+    m_reconnectMaxBackoff = (ms < 1) ? 1 : ms;
+}
+
+inline
+uint32_t tmcController::reconnectMaxBackoff()
+{
+    return m_reconnectMaxBackoff;
+}
+
+inline
+void tmcController::breakerThreshold( uint32_t n )
+{
+    if(n == 0)
+    {
+        n = 1;
+    }
+
+    m_breakerThreshold = n;
+}
+
+inline
+uint32_t tmcController::breakerThreshold()
+{
+    return m_breakerThreshold;
+}
+
+inline
+void tmcController::breakerCoolDown( uint32_t ms )
+{
+    m_breakerCoolDown = ms;
+}
+
+inline
+uint32_t tmcController::breakerCoolDown()
+{
+    return m_breakerCoolDown;
+}
+
+inline
+void tmcController::linkDown() noexcept
+{
+    if(!m_failFast)
+    {
+        return;
+    }
+
+    //No lock is taken here.  A wakeup lost while the thread is about to wait is caught by its periodic check.
+    bool up = true;
+    if(m_connected.compare_exchange_strong(up, false))
+    {
+        m_downSince = std::chrono::steady_clock::now();
+        logEvent("tmcController::linkDown", "device marked disconnected");
+    }
+
+    m_reconnectCV.notify_one();
+}
+
+inline
+void tmcController::reconnectLoop()
+{
+    m_reconnectThreadId = std::this_thread::get_id();
+
+    uint32_t backoff = m_reconnectMinBackoff;
+    uint32_t failures = 0;
+    int attempts = 0;
+
+    std::unique_lock<std::mutex> lock(m_reconnectMutex);
+
+    while(!m_reconnectStop)
+    {
+        if(m_connected)
+        {
+            m_linkState = LinkState::up;
+            backoff = m_reconnectMinBackoff;
+            failures = 0;
+
+            //linkDown does not take the lock, so its wakeup can be missed: check again after the minimum backoff
+            m_reconnectCV.wait_for(lock, std::chrono::milliseconds(m_reconnectMinBackoff),
+                                                    [this]{ return m_reconnectStop || !m_connected; });
+            continue;
+        }
+
+        if(m_downSince.load() == std::chrono::steady_clock::time_point())
+        {
+            //down without linkDown, e.g. never connected: count the downtime from now
+            m_downSince = std::chrono::steady_clock::now();
+        }
+
+        if(failures >= m_breakerThreshold)
+        {
+            m_linkState = LinkState::breakerOpen;
+            ++m_breakerTrips;
+
+            if(m_reconnectCV.wait_for(lock, std::chrono::milliseconds(m_breakerCoolDown), [this]{ return m_reconnectStop; }))
+            {
+                break;
+            }
+
+            //half-open: allow a single trial attempt
+            failures = m_breakerThreshold - 1;
+        }
+
+        m_linkState = LinkState::connecting;
+        lock.unlock();
+
+        //The old handle is stale after the device drops off the bus
+        if(m_opened)
+        {
+            ftdi_usb_close(m_ftdi);
+            m_opened = false;
+        }
+
+        int checked = 0;
+        int restored = 0;
+
+        int rv = connectDevice(false);
+        if(rv == 0 && m_restoreOnReconnect)
+        {
+            std::lock_guard<std::mutex> alock(m_appliedMutex);
+            rv = restoreState(checked, restored, false);
+        }
+
+        lock.lock();
+        ++m_reconnectAttempts;
+        ++attempts;
+
+        TMCC_PROBE2(reconnect, attempts, rv);
+
+        if(rv == 0)
+        {
+            m_lastReconnect.downtime = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_downSince.load()).count();
+            m_lastReconnect.attempts = attempts;
+            m_lastReconnect.checked = checked;
+            m_lastReconnect.restored = restored;
+            m_totalDowntime += m_lastReconnect.downtime;
+            m_downSince = std::chrono::steady_clock::time_point();
+
+            char msg[sizeof(tmcLogRecord::msg)];
+            snprintf(msg, sizeof(msg), "reconnected after %d attempts, restored %d of %d settings", attempts, restored, checked);
+            logEvent("tmcController::reconnectLoop", msg);
+
+            attempts = 0;
+            bump(m_reconnects, 1);
+
+            //hand the device back to the commands
+            m_connected = true;
+            continue;
+        }
+
+        ++failures;
+        m_linkState = LinkState::down;
+
+        if(failures < m_breakerThreshold)
+        {
+            m_reconnectCV.wait_for(lock, std::chrono::milliseconds(backoff), [this]{ return m_reconnectStop; });
+
+            backoff *= 2;
+            if(backoff > m_reconnectMaxBackoff)
+            {
+                backoff = m_reconnectMaxBackoff;
+            }
+        }
+    }
+
+    m_linkState = LinkState::stopped;
+    m_reconnectThreadId = std::thread::id();
+}
+
+inline
+int tmcController::startReconnect( bool errmsg )
+{
+    if(m_reconnectThread.joinable())
+    {
+        return 0;
+    }
+
+    m_failFast = true;
+    m_reconnectStop = false;
+
+    try
+    {
+        m_reconnectThread = std::thread(&tmcController::reconnectLoop, this);
+    }
+    catch(const std::exception & e)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "exception starting thread: %s", e.what());
+            otherErrmsg("tmcController::startReconnect", msg, __FILE__, __LINE__-8);
+        }
+        return fail(ErrorCategory::exception, 0, "tmcController::startReconnect", __LINE__);
+    }
+
+    return 0;
+}
+
+inline
+void tmcController::stopReconnect()
+{
+    if(!m_reconnectThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_reconnectMutex);
+        m_reconnectStop = true;
+    }
+
+    m_reconnectCV.notify_one();
+    m_reconnectThread.join();
+}
+
+inline
+tmcController::LinkState tmcController::linkState()
+{
+    return m_linkState;
+}
+
+inline
+uint64_t tmcController::reconnectAttempts()
+{
+    return m_reconnectAttempts;
+}
+
+inline
+uint64_t tmcController::breakerTrips()
+{
+    return m_breakerTrips;
+}
+
+inline
+void tmcController::restoreOnReconnect( bool r )
+{
+    m_restoreOnReconnect = r;
+}
+
+inline
+bool tmcController::restoreOnReconnect()
+{
+    return m_restoreOnReconnect;
+}
+
+inline
+tmcController::AppliedState tmcController::appliedState()
+{
+    std::lock_guard<std::mutex> lock(m_appliedMutex);
+    return m_applied;
+}
+
+inline
+void tmcController::clearAppliedState()
+{
+    std::lock_guard<std::mutex> lock(m_appliedMutex);
+    m_applied = AppliedState();
+    journalApplied();
+}
+
+inline
+tmcController::ReconnectReport tmcController::lastReconnect()
+{
+    std::lock_guard<std::mutex> lock(m_reconnectMutex);
+    return m_lastReconnect;
+}
+
+inline
+double tmcController::totalDowntime()
+{
+    std::lock_guard<std::mutex> lock(m_reconnectMutex);
+    return m_totalDowntime;
+}
+
+inline
+void tmcController::bumplessRestart( bool b )
+{
+    m_bumplessRestart = b;
+}
+
+inline
+bool tmcController::bumplessRestart()
+{
+    return m_bumplessRestart;
+}
+
+inline
+int tmcController::lastOutputVolts( float & ov )
+{
+    std::unique_lock<std::mutex> lock(m_appliedMutex);
+
+    if(!m_applied.outputVolts)
+    {
+        lock.unlock();
+        return fail(ErrorCategory::parameter, 0, "tmcController::lastOutputVolts", __LINE__);
+    }
+
+    int16_t iov = *m_applied.outputVolts;
+    lock.unlock();
+    if(iov > 0)
+    {
+        ov = iov/32767.0;
+    }
+    else
+    {
+        ov = iov/32768.0;
+    }
+
+    return 0;
+}
+
+inline
+void tmcController::journalApplied() noexcept
+{
+    if(m_journal == nullptr)
+    {
+        return;
+    }
+
+    JournalRecord rec;
+
+    if(m_applied.updatesStopped)
+    {
+        rec.items |= applyStopUpdates;
+    }
+
+    rec.chanIdent = m_applied.chanIdent;
+
+    if(m_applied.chanEnable)
+    {
+        rec.items |= applyChanEnable;
+        rec.chanEnable = *m_applied.chanEnable;
+    }
+
+    if(m_applied.posControlMode)
+    {
+        rec.items |= applyPosControlMode;
+        rec.posControlMode = *m_applied.posControlMode;
+    }
+
+    if(m_applied.ioSettings)
+    {
+        rec.items |= applyIOSettings;
+        rec.ioSettings = *m_applied.ioSettings;
+    }
+
+    if(m_applied.mmiParams)
+    {
+        rec.items |= applyMMIParams;
+        rec.mmiParams = *m_applied.mmiParams;
+    }
+
+    if(m_applied.dispIntensity)
+    {
+        rec.items |= applyDispIntensity;
+        rec.dispIntensity = *m_applied.dispIntensity;
+    }
+
+    if(m_applied.outputVolts)
+    {
+        rec.items |= applyOutputVolts;
+        rec.outputVolts = *m_applied.outputVolts;
+    }
+
+    if(m_applied.outputPos)
+    {
+        rec.items |= applyOutputPos;
+        rec.outputPos = *m_applied.outputPos;
+    }
+
+    //Mark the older record as being written, fill it, then give it the new sequence number.
+    //The fences keep the compiler from moving the stores across each other.
+    uint64_t seq = ++m_journalSeq;
+    JournalRecord & slot = m_journal->slot[seq & 1];
+
+    slot.seq = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    memcpy(&slot, &rec, sizeof(JournalRecord));
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    slot.seq = seq;
+}
+
+inline
+int tmcController::journalLoad()
+{
+    const JournalRecord & s0 = m_journal->slot[0];
+    const JournalRecord & s1 = m_journal->slot[1];
+
+    if(s0.seq == 0 && s1.seq == 0)
+    {
+        return -1;
+    }
+
+    const JournalRecord & rec = (s0.seq > s1.seq) ? s0 : s1;
+
+    m_applied = AppliedState();
+
+    m_applied.updatesStopped = (rec.items & applyStopUpdates);
+    m_applied.chanIdent = rec.chanIdent;
+
+    if(rec.items & applyChanEnable)
+    {
+        m_applied.chanEnable = rec.chanEnable;
+    }
+
+    if(rec.items & applyPosControlMode)
+    {
+        m_applied.posControlMode = rec.posControlMode;
+    }
+
+    if(rec.items & applyIOSettings)
+    {
+        m_applied.ioSettings = rec.ioSettings;
+        m_voltLimit = rec.ioSettings.VoltageLimit;
+    }
+
+    if(rec.items & applyMMIParams)
+    {
+        m_applied.mmiParams = rec.mmiParams;
+    }
+
+    if(rec.items & applyDispIntensity)
+    {
+        m_applied.dispIntensity = rec.dispIntensity;
+    }
+
+    if(rec.items & applyOutputVolts)
+    {
+        m_applied.outputVolts = rec.outputVolts;
+    }
+
+    if(rec.items & applyOutputPos)
+    {
+        m_applied.outputPos = rec.outputPos;
+    }
+
+    m_journalSeq = rec.seq;
+
+    return 0;
+}
+
+inline
+int tmcController::journalOpen( const std::string & path,
+                                bool errmsg
+                              )
+{
+    journalClose();
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "unable to open %s: %s", path.c_str(), strerror(errno));
+            otherErrmsg("tmcController::journalOpen", msg, __FILE__, __LINE__-7);
+        }
+        return fail(ErrorCategory::file, 0, "tmcController::journalOpen", __LINE__);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "unable to stat %s: %s", path.c_str(), strerror(errno));
+            otherErrmsg("tmcController::journalOpen", msg, __FILE__, __LINE__-6);
+        }
+        ::close(fd);
+        return fail(ErrorCategory::file, 0, "tmcController::journalOpen", __LINE__);
+    }
+
+    bool init = (st.st_size != sizeof(JournalFile));
+
+    if(init && ftruncate(fd, sizeof(JournalFile)) < 0)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "unable to resize %s: %s", path.c_str(), strerror(errno));
+            otherErrmsg("tmcController::journalOpen", msg, __FILE__, __LINE__-6);
+        }
+        ::close(fd);
+        return fail(ErrorCategory::file, 0, "tmcController::journalOpen", __LINE__);
+    }
+
+    void * map = mmap(nullptr, sizeof(JournalFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "unable to map %s: %s", path.c_str(), strerror(errno));
+            otherErrmsg("tmcController::journalOpen", msg, __FILE__, __LINE__-7);
+        }
+        ::close(fd);
+        return fail(ErrorCategory::file, 0, "tmcController::journalOpen", __LINE__);
+    }
+
+    m_journalFd = fd;
+    m_journal = static_cast<JournalFile *>(map);
+    m_journalPath = path;
+    m_journalSeq = 0;
+
+    if(!init && (memcmp(m_journal->magic, "TMCJRNL", 8) != 0 || m_journal->version != 1 ||
+                    m_journal->size != sizeof(JournalFile)))
+    {
+        init = true;
+    }
+
+    if(init)
+    {
+        memset(static_cast<void *>(m_journal), 0, sizeof(JournalFile));
+        memcpy(m_journal->magic, "TMCJRNL", 8);
+        m_journal->version = 1;
+        m_journal->size = sizeof(JournalFile);
+        m_serial.copy(m_journal->serial, sizeof(m_journal->serial) - 1);
+    }
+
+    //Don't start over from 1, which would make the next record older than the last one
+    m_journalSeq = std::max(m_journal->slot[0].seq, m_journal->slot[1].seq);
+
+    m_journalPending = (m_journalSeq > 0);
+
+    return 0;
+}
+
+inline
+void tmcController::journalClose()
+{
+    if(m_journal)
+    {
+        munmap(m_journal, sizeof(JournalFile));
+        m_journal = nullptr;
+    }
+
+    if(m_journalFd >= 0)
+    {
+        ::close(m_journalFd);
+        m_journalFd = -1;
+    }
+
+    m_journalPath = "";
+    m_journalPending = false;
+}
+
+inline
+std::string tmcController::journalPath()
+{
+    return m_journalPath;
+}
+
+inline
+unsigned int tmcController::chipid()
+{
+    return m_chipid;
+}
+
+inline
+int tmcController::totrd()
+{
+    return m_totrd;
+}
+
+inline
+void tmcController::postChanEnableSleep( uint32_t s )
+{
+    m_postChanEnableSleep = s;
+}
+
+inline
+uint32_t tmcController::postChanEnableSleep()
+{
+    return m_postChanEnableSleep;
+}
+
+inline
+void tmcController::lutChunkEntries( uint16_t n )
+{
+    if(n == 0)
+    {
+        n = 1;
+    }
+
+    m_lutChunkEntries = n;
+}
+
+inline
+uint16_t tmcController::lutChunkEntries()
+{
+    return m_lutChunkEntries;
+}
+
+inline
+tmcController::VoltLimit tmcController::voltLimit()
+{
+    return m_voltLimit;
+}
+
+inline
+float tmcController::voltLimitVolts( VoltLimit vl )
+{
+    if(vl == VoltLimit::V75) return 75;
+    if(vl == VoltLimit::V100) return 100;
+    if(vl == VoltLimit::V150) return 150;
+
+    return 0;
+}
+
+inline
+int tmcController::volts2counts( int16_t * iov,
+                                 const float * ov,
+                                 size_t n,
+                                 bool absolute
+                               )
+{
+    float norm = 1.0;
+
+    if(absolute)
+    {
+        float vmax = voltLimitVolts(m_voltLimit);
+        if(vmax == 0)
+        {
+            return fail(ErrorCategory::parameter, 0, "tmcController::volts2counts", __LINE__);
+        }
+        norm = 1.0/vmax;
+    }
+
+    int nsat = 0;
+    size_t i = 0;
+
+    //Each block reads its floats before storing its counts, and the counts of one block end before the floats
+    //of the next block start, so converting in place is safe.
+#if defined(__AVX2__)
+    const __m256 vnorm = _mm256_set1_ps(norm);
+    const __m256 vone = _mm256_set1_ps(1.0f);
+    const __m256 vmone = _mm256_set1_ps(-1.0f);
+    const __m256 vzero = _mm256_setzero_ps();
+    const __m256 vpos = _mm256_set1_ps(32767.0f);
+    const __m256 vneg = _mm256_set1_ps(32768.0f);
+
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256 x[2] = {_mm256_mul_ps(_mm256_loadu_ps(ov + i), vnorm), _mm256_mul_ps(_mm256_loadu_ps(ov + i + 8), vnorm)};
+        __m256i c[2];
+
+        for(int k = 0; k < 2; ++k)
+        {
+            //out of range, or NaN
+            __m256 nan = _mm256_cmp_ps(x[k], x[k], _CMP_UNORD_Q);
+            __m256 bad = _mm256_or_ps(_mm256_cmp_ps(x[k], vone, _CMP_GT_OQ), _mm256_or_ps(_mm256_cmp_ps(x[k], vmone, _CMP_LT_OQ), nan));
+            nsat += __builtin_popcount(_mm256_movemask_ps(bad));
+
+            __m256 y = _mm256_andnot_ps(nan, x[k]);
+            y = _mm256_min_ps(_mm256_max_ps(y, vmone), vone);
+            y = _mm256_mul_ps(y, _mm256_blendv_ps(vneg, vpos, _mm256_cmp_ps(y, vzero, _CMP_GT_OQ)));
+            c[k] = _mm256_cvttps_epi32(y);
+        }
+
+        //packs works within 128 bit lanes, so restore the order with a 64 bit permute
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(c[0], c[1]), 0xD8);
+        _mm256_storeu_si256((__m256i *) (iov + i), p);
+    }
+#elif defined(__SSE2__)
+    const __m128 vnorm = _mm_set1_ps(norm);
+    const __m128 vone = _mm_set1_ps(1.0f);
+    const __m128 vmone = _mm_set1_ps(-1.0f);
+    const __m128 vzero = _mm_setzero_ps();
+    const __m128 vpos = _mm_set1_ps(32767.0f);
+    const __m128 vneg = _mm_set1_ps(32768.0f);
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128 x[2] = {_mm_mul_ps(_mm_loadu_ps(ov + i), vnorm), _mm_mul_ps(_mm_loadu_ps(ov + i + 4), vnorm)};
+        __m128i c[2];
+
+        for(int k = 0; k < 2; ++k)
+        {
+            //out of range, or NaN
+            __m128 nan = _mm_cmpunord_ps(x[k], x[k]);
+            __m128 bad = _mm_or_ps(_mm_cmpgt_ps(x[k], vone), _mm_or_ps(_mm_cmplt_ps(x[k], vmone), nan));
+            nsat += __builtin_popcount(_mm_movemask_ps(bad));
+
+            __m128 y = _mm_andnot_ps(nan, x[k]);
+            y = _mm_min_ps(_mm_max_ps(y, vmone), vone);
+            __m128 gt = _mm_cmpgt_ps(y, vzero);
+            y = _mm_mul_ps(y, _mm_or_ps(_mm_and_ps(gt, vpos), _mm_andnot_ps(gt, vneg)));
+            c[k] = _mm_cvttps_epi32(y);
+        }
+
+        _mm_storeu_si128((__m128i *) (iov + i), _mm_packs_epi32(c[0], c[1]));
+    }
+#endif
+
+    for(; i < n; ++i)
+    {
+        float x = ov[i]*norm;
+        if(!(x >= -1.0f && x <= 1.0f))
+        {
+            ++nsat;
+
+            if(x != x)
+            {
+                x = 0;
+            }
+            else if(x > 1.0f)
+            {
+                x = 1.0f;
+            }
+            else
+            {
+                x = -1.0f;
+            }
+        }
+
+        int16_t c;
+        if(x > 0)
+        {
+            c = x*32767;
+        }
+        else
+        {
+            c = x*32768;
+        }
+
+        //store little-endian, and through memcpy since iov may alias ov
+        unsigned char b[2] = { static_cast<unsigned char>(static_cast<uint16_t>(c) & 0xFF),
+                               static_cast<unsigned char>(static_cast<uint16_t>(c) >> 8) };
+        memcpy(iov + i, b, 2);
+    }
+
+    return nsat;
+}
+
+inline
+void tmcController::lutParamsFrame( unsigned char * buf,
+                                    const LUTParams & lutp
+                                  )
+{
+    tmcApt::encode<tmcApt::PZ_SET_OUTPUTLUTPARAMS>(buf, 0x01, static_cast<uint16_t>(lutp.Mode), lutp.CycleLength, lutp.NumCycles,
+                                                        lutp.DelayTime, lutp.PreCycleRest, lutp.PostCycleRest, lutp.OPTrigStart,
+                                                           lutp.OPTrigWidth, lutp.TrigRepCycle);
+}
+
+inline
+void tmcController::lutParamsParse( LUTParams & lutp,
+                                    const unsigned char * buf
+                                  )
+{
+    typedef tmcApt::PZ_GET_OUTPUTLUTPARAMS msgT;
+
+    uint16_t md = tmcApt::get<msgT::Mode>(buf);
+    if(md == 0x01)
+    {
+        lutp.Mode = LUTMode::continuous;
+    }
+    else if(md == 0x02)
+    {
+        lutp.Mode = LUTMode::fixed;
+    }
+    else
+    {
+        lutp.Mode = LUTMode::INVALID;
+    }
+
+    lutp.CycleLength = tmcApt::get<msgT::CycleLength>(buf);
+    lutp.NumCycles = tmcApt::get<msgT::NumCycles>(buf);
+    lutp.DelayTime = tmcApt::get<msgT::DelayTime>(buf);
+    lutp.PreCycleRest = tmcApt::get<msgT::PreCycleRest>(buf);
+    lutp.PostCycleRest = tmcApt::get<msgT::PostCycleRest>(buf);
+    lutp.OPTrigStart = tmcApt::get<msgT::OPTrigStart>(buf);
+    lutp.OPTrigWidth = tmcApt::get<msgT::OPTrigWidth>(buf);
+    lutp.TrigRepCycle = tmcApt::get<msgT::TrigRepCycle>(buf);
+}
+
+inline
+bool tmcController::lutParamsMatch( const LUTParams & a,
+                                    const LUTParams & b
+                                  )
+{
+    return a.Mode == b.Mode && a.CycleLength == b.CycleLength && a.NumCycles == b.NumCycles &&
+              a.DelayTime == b.DelayTime && a.PreCycleRest == b.PreCycleRest && a.PostCycleRest == b.PostCycleRest &&
+                 a.OPTrigStart == b.OPTrigStart && a.OPTrigWidth == b.OPTrigWidth && a.TrigRepCycle == b.TrigRepCycle;
+}
+
+inline
+void tmcController::lutCacheInvalidate()
+{
+    //It is the table of the current device which changes
+    if(m_lutCache.serial != m_serial)
+    {
+        lutCacheLoad();
+    }
+
+    if(!m_lutCache.valid)
+    {
+        return;
+    }
+
+    m_lutCache.valid = false;
+    lutCacheSave();
+}
+
+inline
+int tmcController::lutCacheSave()
+{
+    if(m_lutCachePath == "")
+    {
+        return 0;
+    }
+
+    //Other processes may share the file, so the read-modify-write is done holding an exclusive lock.  The lock is
+    //on a separate file, since the rename below replaces the cache file itself.
+    std::string lockPath = m_lutCachePath + ".lock";
+    int lfd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if(lfd < 0)
+    {
+        return fail(ErrorCategory::file, 0, "tmcController::lutCacheSave", __LINE__);
+    }
+
+    if(flock(lfd, LOCK_EX) < 0)
+    {
+        ::close(lfd);
+        return fail(ErrorCategory::file, 0, "tmcController::lutCacheSave", __LINE__);
+    }
+
+    //Keep the records of other devices.  An unreadable file is replaced.
+    std::vector<LUTCacheRecord> recs;
+    if(lutCacheRead(recs) < 0)
+    {
+        recs.clear();
+    }
+
+    size_t n = 0;
+    while(n < recs.size() && recs[n].serial != m_lutCache.serial)
+    {
+        ++n;
+    }
+
+    if(n == recs.size())
+    {
+        recs.push_back(m_lutCache);
+    }
+    else
+    {
+        recs[n] = m_lutCache;
+    }
+
+    //Readers never see a partly written file: it is written in full under another name, then renamed into place
+    std::string tmpPath = m_lutCachePath + ".tmp";
+    std::ofstream fout(tmpPath, std::ios::trunc);
+
+    fout << "tmcController-lut-cache 2\n";
+
+    for(n = 0; n < recs.size(); ++n)
+    {
+        const LUTParams & p = recs[n].params;
+
+        //an empty serial number, when connected to the first device found, is written as -
+        fout << ((recs[n].serial == "") ? "-" : recs[n].serial) << " " << recs[n].valid << " ";
+        fout << std::hex << recs[n].hash << std::dec << " ";
+        fout << recs[n].entries << " " << static_cast<uint16_t>(p.Mode) << " " << p.CycleLength << " " << p.NumCycles << " ";
+        fout << p.DelayTime << " " << p.PreCycleRest << " " << p.PostCycleRest << " " << p.OPTrigStart << " ";
+        fout << p.OPTrigWidth << " " << p.TrigRepCycle << "\n";
+    }
+
+    fout.close();
+
+    int rv = 0;
+    if(fout.fail() || rename(tmpPath.c_str(), m_lutCachePath.c_str()) < 0)
+    {
+        unlink(tmpPath.c_str());
+        rv = fail(ErrorCategory::file, 0, "tmcController::lutCacheSave", __LINE__);
+    }
+
+    ::close(lfd); //releases the lock
+
+    return rv;
+}
+
+inline
+int tmcController::lutCacheRead( std::vector<LUTCacheRecord> & recs )
+{
+    recs.clear();
+
+    std::ifstream fin(m_lutCachePath);
+    if(!fin.good())
+    {
+        return 0; //Not created yet
+    }
+
+    std::string magic;
+    int vers = 0;
+
+    //version 1 files hold a single record in the same format
+    fin >> magic >> vers;
+    if(fin.fail() || magic != "tmcController-lut-cache" || (vers != 1 && vers != 2))
+    {
+        return fail(ErrorCategory::file, 0, "tmcController::lutCacheRead", __LINE__);
+    }
+
+    while(!(fin >> std::ws).eof())
+    {
+        LUTCacheRecord rec;
+        uint16_t md;
+
+        fin >> rec.serial >> rec.valid >> std::hex >> rec.hash >> std::dec >> rec.entries >> md >> rec.params.CycleLength;
+        fin >> rec.params.NumCycles >> rec.params.DelayTime >> rec.params.PreCycleRest >> rec.params.PostCycleRest;
+        fin >> rec.params.OPTrigStart >> rec.params.OPTrigWidth >> rec.params.TrigRepCycle;
+
+        if(fin.fail())
+        {
+            recs.clear();
+            return fail(ErrorCategory::file, 0, "tmcController::lutCacheRead", __LINE__);
+        }
+
+        if(rec.serial == "-")
+        {
+            rec.serial = "";
+        }
+
+        rec.params.Mode = static_cast<LUTMode>(md);
+        recs.push_back(rec);
+    }
+
+    return 0;
+}
+
+inline
+int tmcController::lutCacheLoad()
+{
+    m_lutCache = LUTCacheRecord();
+    m_lutCache.serial = m_serial;
+
+    if(m_lutCachePath == "")
+    {
+        return 0;
+    }
+
+    std::vector<LUTCacheRecord> recs;
+    if(lutCacheRead(recs) < 0)
+    {
+        return -1;
+    }
+
+    for(size_t n = 0; n < recs.size(); ++n)
+    {
+        if(recs[n].serial == m_serial)
+        {
+            m_lutCache = recs[n];
+            break;
+        }
+    }
+
+    return 0;
+}
+
+inline
+int tmcController::lutCachePath( const std::string & path )
+{
+    m_lutCachePath = path;
+
+    return lutCacheLoad();
+}
+
+inline
+std::string tmcController::lutCachePath()
+{
+    return m_lutCachePath;
+}
+
+inline
+void tmcController::lutCacheVerify( bool v )
+{
+    m_lutCacheVerify = v;
+}
+
+inline
+bool tmcController::lutCacheVerify()
+{
+    return m_lutCacheVerify;
+}
+
+inline
+const tmcController::LUTCacheRecord & tmcController::lutCache()
+{
+    return m_lutCache;
+}
+
+inline
+void tmcController::lutCacheClear()
+{
+    lutCacheInvalidate();
+}
+
+#define TMCC_CHECK_CONNECTED(fxn)                                                                \
+    if(!m_connected)                                                                             \
+    {                                                                                            \
+        if(m_failFast)                                                                           \
+        {                                                                                        \
+            return fail(ErrorCategory::disconnected, 0, "tmcController::" fxn, __LINE__);        \
+        }                                                                                        \
+        int rv = connect(errmsg);                                                                \
+        if( (rv < 0) || !m_connected)                                                            \
+        {                                                                                        \
+            if(errmsg)                                                                           \
+            {                                                                                    \
+                otherErrmsg("tmcController::" fxn, "connect failed", __FILE__, __LINE__);        \
+            }                                                                                    \
+            return rv;                                                                           \
+        }                                                                                        \
+    }             
+
+template<class streamT>
+void tmcController::HWInfo::dump(streamT & ios)
+{
+    ios << "Connected to: \n";
+    ios << "      Model: " << modelNumber << "\n";
+    ios << "       Type: " << type << "\n";
+    ios << "    Ser Num: " << serialNumber << "\n";
+    ios << "     HW Ver: " << hwVer << "\n";
+    ios << "     HW Mod: " << hwMod << "\n";
+    ios << "   Num. Ch.: " << nChannels << "\n";
+    ios << "   F/W Ver.: " << fwMaj << "." << fwMin << "." << fwInt << "\n";
+}
+
+double tmcController::PZStatus::age()
+{
+  timespec tsp;
+  clock_gettime(CLOCK_REALTIME, &tsp);
+  return (tsp.tv_sec + ((1.0*tsp.tv_nsec)/1e9)) - (statusTime.tv_sec + ((1.0*statusTime.tv_nsec)/1e9));
+}
+
+template<class streamT>
+void tmcController::PZStatus::dump(streamT & ios)
+{
+    ios << "PZ Status: \n";
+    ios << "    Voltage: " << voltage << "\n";
+    ios << "   Position: " << position << "\n";
+    ios << "  Connected: " << connected << "\n";
+    ios << "     Zeroed: " << zeroed << "\n";
+    ios << "    Zeroing: " << zeroing << "\n";
+    ios << "   SG Conn.: " << sgConnected << "\n";
+    ios << "  P.C. Mode: " << pcMode << "\n";
+    ios << "        Age: " << age() << " sec\n";
+}
+
+template<class streamT>
+void tmcController::LUTParams::dump(streamT & ios)
+{
+    ios << "Output LUT Params: \n";
+    ios << "           Mode: " << static_cast<uint16_t>(Mode) << "\n";
+    ios << "    CycleLength: " << CycleLength << "\n";
+    ios << "      NumCycles: " << NumCycles << "\n";
+    ios << "      DelayTime: " << DelayTime << "\n";
+    ios << "   PreCycleRest: " << PreCycleRest << "\n";
+    ios << "  PostCycleRest: " << PostCycleRest << "\n";
+    ios << "    OPTrigStart: " << OPTrigStart << "\n";
+    ios << "    OPTrigWidth: " << OPTrigWidth << "\n";
+    ios << "   TrigRepCycle: " << TrigRepCycle << "\n";
+}
+
+template<class streamT>
+void tmcController::TPZIOSettings::dump(streamT & ios)
+{
+    ios << "TPZ IO Settings: \n";
+    int vl;
+    if(VoltageLimit == VoltLimit::V75) vl = 75;
+    if(VoltageLimit == VoltLimit::V100) vl = 100;
+    if(VoltageLimit == VoltLimit::V150) vl = 150;
+
+    ios << "     VoltageLimit: " << vl << "\n";
+    ios << "   HubAnalogInput: " << HubAnalogInput << "\n";
+}
+
+template<class streamT>
+void tmcController::LUTUploadStats::dump(streamT & ios)
+{
+    ios << "LUT Upload: \n";
+    ios << "        Entries: " << entries << "\n";
+    ios << "          Bytes: " << bytes << "\n";
+    ios << "         Writes: " << writes << "\n";
+    ios << "        Seconds: " << seconds << "\n";
+    ios << "    Entries/sec: " << entriesPerSec << "\n";
+    ios << "        Skipped: " << skipped << "\n";
+}
+
+template<class streamT>
+void tmcController::ReconnectReport::dump(streamT & ios)
+{
+    ios << "Reconnect: \n";
+    ios << "    Downtime: " << downtime << "\n";
+    ios << "    Attempts: " << attempts << "\n";
+    ios << "     Checked: " << checked << "\n";
+    ios << "    Restored: " << restored << "\n";
+}
+
+template<class streamT>
+void tmcController::LatencyHistogram::dump(streamT & ios)
+{
+    ios << "Latency of 0x" << std::hex << id << std::dec << ": \n";
+    ios << "      Count: " << count << "\n";
+    ios << "       Mean: " << mean() << " sec\n";
+    ios << "        Min: " << 1e-9*minNs << " sec\n";
+    ios << "        p50: " << percentile(50) << " sec\n";
+    ios << "        p90: " << percentile(90) << " sec\n";
+    ios << "        p99: " << percentile(99) << " sec\n";
+    ios << "      p99.9: " << percentile(99.9) << " sec\n";
+    ios << "        Max: " << 1e-9*maxNs << " sec\n";
+}
+
+template<class streamT>
+void tmcController::PhaseTimes::dump(streamT & ios)
+{
+    if(id == 0)
+    {
+        ios << "Connect phases: \n";
+    }
+    else
+    {
+        ios << "Phases of 0x" << std::hex << id << std::dec << ": \n";
+    }
+
+    for(uint32_t n = 0; n < phaseCount; ++n)
+    {
+        if(ns[n] > 0)
+        {
+            ios << "    " << phaseName(static_cast<Phase>(n)) << ": " << 1e-9*ns[n] << " sec\n";
+        }
+    }
+
+    ios << "    total: " << 1e-9*totalNs << " sec\n";
+}
+
+template<class streamT>
+void tmcController::KMMIParams::dump(streamT & ios)
+{
+    ios << "K-Cube MMI Params: \n";
+    ios << "             JSMode: " << JSMode << "\n";
+    ios << "      JSVoltGearBox: " << JSVoltGearBox << "\n";
+    ios << "         JSVoltStep: " << JSVoltStep << "\n";
+    ios << "           DirSense: " << DirSense << "\n";
+    ios << "        PresetVolt1: " << PresetVolt1 << "\n";
+    ios << "        PresetVolt2: " << PresetVolt2 << "\n";
+    ios << "     DispBrightness: " << DispBrightness << "\n";
+    ios << "        DispTimeout: " << DispTimeout << "\n";
+    ios << "       DispDimLevel: " << DispDimLevel << "\n";
+}
+
+inline
+double tmcController::LatencyHistogram::mean() const
+{
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    return (1e-9*totalNs)/count;
+}
+
+inline
+double tmcController::LatencyHistogram::percentile( double p ) const
+{
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t target = ceil(count*p/100.0);
+    if(target < 1)
+    {
+        target = 1;
+    }
+
+    uint64_t n = 0;
+    for(uint32_t b = 0; b < latencyBuckets; ++b)
+    {
+        n += buckets[b];
+        if(n >= target)
+        {
+            return 1e-9*std::min(latencyBucketValue(b), maxNs);
+        }
+    }
+
+    return 1e-9*maxNs;
+}
+
+inline
+uint64_t tmcController::LatencyHistogram::countBelow( double s ) const
+{
+    uint64_t n = 0;
+    for(uint32_t b = 0; b < latencyBuckets; ++b)
+    {
+        if(1e-9*latencyBucketValue(b) > s)
+        {
+            break;
+        }
+        n += buckets[b];
+    }
+
+    return n;
+}
+
+inline
+uint32_t tmcController::latencyBucket( uint64_t ns ) noexcept
+{
+    if(ns < latencySubBuckets)
+    {
+        return ns;
+    }
+
+    if(ns > UINT32_MAX)
+    {
+        ns = UINT32_MAX;
+    }
+
+    uint32_t shift = (63 - __builtin_clzll(ns)) - 4;
+
+    return (shift + 1)*latencySubBuckets + ((ns >> shift) - latencySubBuckets);
+}
+
+inline
+uint64_t tmcController::latencyBucketValue( uint32_t b ) noexcept
+{
+    if(b < latencySubBuckets)
+    {
+        return b;
+    }
+
+    uint32_t shift = b/latencySubBuckets - 1;
+    uint64_t sub = b % latencySubBuckets + latencySubBuckets;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+inline
+void tmcController::latencyRecord( uint16_t id,
+                                   uint64_t ns
+                                 ) noexcept
+{
+    uint32_t n = (id ^ (id >> 5)) & (latencySlots - 1);
+
+    for(uint32_t k = 0; k < latencySlots; ++k, n = (n + 1) & (latencySlots - 1))
+    {
+        latencySlot & s = m_latency[n];
+
+        uint16_t sid = s.id.load(std::memory_order_relaxed);
+        if(sid == 0)
+        {
+            s.id.store(id, std::memory_order_relaxed);
+        }
+        else if(sid != id)
+        {
+            continue;
+        }
+
+        //A load and store would overwrite a reset made between them, so add atomically
+        s.buckets[latencyBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        s.count.fetch_add(1, std::memory_order_relaxed);
+        s.totalNs.fetch_add(ns, std::memory_order_relaxed);
+
+        //A reset racing these can at worst leave one real sample as the extreme after it
+        if(ns < s.minNs.load(std::memory_order_relaxed))
+        {
+            s.minNs.store(ns, std::memory_order_relaxed);
+        }
+
+        if(ns > s.maxNs.load(std::memory_order_relaxed))
+        {
+            s.maxNs.store(ns, std::memory_order_relaxed);
+        }
+
+        return;
+    }
+}
+
+inline
+int tmcController::latencySnapshot( LatencyHistogram & hist,
+                                    uint16_t id,
+                                    bool reset
+                                  )
+{
+    for(uint32_t n = 0; n < latencySlots; ++n)
+    {
+        latencySlot & s = m_latency[n];
+
+        if(id == 0 || s.id.load(std::memory_order_relaxed) != id)
+        {
+            continue;
+        }
+
+        hist.id = id;
+
+        if(reset)
+        {
+            //take each counter and zero it in one step, so nothing recorded meanwhile is lost
+            hist.count = s.count.exchange(0, std::memory_order_relaxed);
+            hist.totalNs = s.totalNs.exchange(0, std::memory_order_relaxed);
+            hist.minNs = s.minNs.exchange(UINT64_MAX, std::memory_order_relaxed);
+            hist.maxNs = s.maxNs.exchange(0, std::memory_order_relaxed);
+
+            for(uint32_t b = 0; b < latencyBuckets; ++b)
+            {
+                hist.buckets[b] = s.buckets[b].exchange(0, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            hist.count = s.count.load(std::memory_order_relaxed);
+            hist.totalNs = s.totalNs.load(std::memory_order_relaxed);
+            hist.minNs = s.minNs.load(std::memory_order_relaxed);
+            hist.maxNs = s.maxNs.load(std::memory_order_relaxed);
+
+            for(uint32_t b = 0; b < latencyBuckets; ++b)
+            {
+                hist.buckets[b] = s.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+
+        if(hist.count == 0 || hist.minNs == UINT64_MAX)
+        {
+            hist.minNs = 0;
+        }
+
+        return 0;
+    }
+
+    return -1000;
+}
+
+inline
+std::vector<tmcController::LatencyHistogram> tmcController::latencySnapshot( bool reset )
+{
+    std::vector<LatencyHistogram> hists;
+
+    for(uint32_t n = 0; n < latencySlots; ++n)
+    {
+        uint16_t id = m_latency[n].id.load(std::memory_order_relaxed);
+        if(id == 0)
+        {
+            continue;
+        }
+
+        hists.emplace_back();
+        latencySnapshot(hists.back(), id, reset);
+    }
+
+    return hists;
+}
+
+inline
+void tmcController::latencyReset()
+{
+    latencySnapshot(true);
+}
+
+inline
+const char * tmcController::phaseName( Phase p )
+{
+    switch(p)
+    {
+        case Phase::open: return "open";
+        case Phase::chipId: return "chip id";
+        case Phase::baudRate: return "baud rate";
+        case Phase::lineProperty: return "line property";
+        case Phase::preFlushSleep: return "pre-flush sleep";
+        case Phase::flush: return "flush";
+        case Phase::postFlushSleep: return "post-flush sleep";
+        case Phase::reset: return "reset";
+        case Phase::flowControl: return "flow control";
+        case Phase::rts: return "RTS";
+        case Phase::restore: return "restore";
+        case Phase::seed: return "seed";
+        case Phase::write: return "write";
+        case Phase::read: return "read";
+        case Phase::decode: return "decode";
+    }
+
+    return "unknown";
+}
+
+inline
+double tmcController::PhaseTimes::seconds( Phase p ) const
+{
+    return 1e-9*ns[static_cast<uint32_t>(p)];
+}
+
+inline
+void tmcController::phaseStart( uint16_t id,
+                                std::chrono::steady_clock::time_point start
+                              ) noexcept
+{
+    if((!m_phaseTiming && !m_timeline) || std::this_thread::get_id() == m_reconnectThreadId.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    m_phaseCur = PhaseTimes();
+    m_phaseCur.id = id;
+    m_phaseStart = start;
+    m_phaseLast = start;
+    m_phaseActive = true;
+}
+
+inline
+void tmcController::phaseMark( Phase p ) noexcept
+{
+    if(!m_phaseActive || std::this_thread::get_id() == m_reconnectThreadId.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    m_phaseCur.ns[static_cast<uint32_t>(p)] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_phaseLast).count();
+
+    if(m_timeline)
+    {
+        m_timeline->span(tmcTimeline::catPhase, phaseName(p), m_phaseCur.id, m_serial.c_str(),
+                          timelineNs(m_phaseLast), timelineNs(now));
+    }
+
+    m_phaseLast = now;
+}
+
+inline
+void tmcController::phaseEnd( PhaseTimes & dest,
+                              bool command,
+                              std::chrono::steady_clock::time_point end
+                            ) noexcept
+{
+    if(!m_phaseActive || std::this_thread::get_id() == m_reconnectThreadId.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    if(command)
+    {
+        m_phaseCur.ns[static_cast<uint32_t>(Phase::decode)] +=
+                                   std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_phaseLast).count();
+    }
+
+    if(m_timeline)
+    {
+        if(command)
+        {
+            m_timeline->span(tmcTimeline::catPhase, phaseName(Phase::decode), m_phaseCur.id, m_serial.c_str(),
+                              timelineNs(m_phaseLast), timelineNs(end));
+            m_timeline->span(tmcTimeline::catCommand, nullptr, m_phaseCur.id, m_serial.c_str(),
+                              timelineNs(m_phaseStart), timelineNs(end));
+        }
+        else
+        {
+            m_timeline->span(tmcTimeline::catConnect, "connect", 0, m_serial.c_str(),
+                              timelineNs(m_phaseStart), timelineNs(end));
+        }
+    }
+
+    m_phaseCur.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_phaseStart).count();
+
+    dest = m_phaseCur;
+
+    if(command && m_phaseCur.totalNs > m_worstPhases.totalNs)
+    {
+        m_worstPhases = m_phaseCur;
+    }
+
+    m_phaseActive = false;
+}
+
+inline
+void tmcController::phaseTiming( bool pt )
+{
+    m_phaseTiming = pt;
+}
+
+inline
+bool tmcController::phaseTiming()
+{
+    return m_phaseTiming;
+}
+
+inline
+tmcController::PhaseTimes tmcController::lastPhases()
+{
+    return m_lastPhases;
+}
+
+inline
+tmcController::PhaseTimes tmcController::worstPhases()
+{
+    return m_worstPhases;
+}
+
+inline
+tmcController::PhaseTimes tmcController::connectPhases()
+{
+    return m_connectPhases;
+}
+
+inline
+void tmcController::phaseReset()
+{
+    m_lastPhases = PhaseTimes();
+    m_worstPhases = PhaseTimes();
+    m_connectPhases = PhaseTimes();
+}
+
+inline
+uint64_t tmcController::timelineNs( std::chrono::steady_clock::time_point tp )
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
+
+inline
+void tmcController::timeline( tmcTimeline * tl )
+{
+    m_timeline = tl;
+}
+
+inline
+tmcTimeline * tmcController::timeline()
+{
+    return m_timeline;
+}
+
+template<class streamT>
+void tmcController::MessageCounters::dump(streamT & ios)
+{
+    char idstr[8];
+    snprintf(idstr, sizeof(idstr), "0x%04X", id);
+
+    ios << "Counters of " << idstr << ":\n";
+    ios << "         Frames sent: " << framesSent << "\n";
+    ios << "          Bytes sent: " << bytesSent << "\n";
+    ios << "     Frames received: " << framesReceived << "\n";
+    ios << "      Bytes received: " << bytesReceived << "\n";
+}
+
+inline
+double tmcController::Counters::sendUtilization() const
+{
+    if(seconds <= 0 || baud == 0)
+    {
+        return 0;
+    }
+
+    return 10.0*bytesSent/(baud*seconds);
+}
+
+inline
+double tmcController::Counters::receiveUtilization() const
+{
+    if(seconds <= 0 || baud == 0)
+    {
+        return 0;
+    }
+
+    return 10.0*bytesReceived/(baud*seconds);
+}
+
+template<class streamT>
+void tmcController::Counters::dump(streamT & ios)
+{
+    ios << "Device Counters:\n";
+    ios << "         Frames sent: " << framesSent << "\n";
+    ios << "          Bytes sent: " << bytesSent << "\n";
+    ios << "     Frames received: " << framesReceived << "\n";
+    ios << "      Bytes received: " << bytesReceived << "\n";
+    ios << "             Flushes: " << flushes << "\n";
+    ios << "            Timeouts: " << timeouts << "\n";
+    ios << "          Reconnects: " << reconnects << " of " << reconnectAttempts << " attempts\n";
+    ios << "            Sleeping: " << 1e-9*sleepNs << " sec\n";
+    ios << "              Period: " << seconds << " sec\n";
+    ios << "    Send utilization: " << 100*sendUtilization() << "% of " << baud << " baud\n";
+    ios << " Receive utilization: " << 100*receiveUtilization() << "% of " << baud << " baud\n";
+}
+
+inline
+void tmcController::bump( std::atomic<uint64_t> & ctr,
+                          uint64_t n
+                        ) noexcept
+{
+    ctr.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline
+void tmcController::countFrames( const unsigned char * buf,
+                                 int sz,
+                                 bool sent
+                               ) noexcept
+{
+    int pos = 0;
+    while(sz - pos >= 6)
+    {
+        const unsigned char * h = buf + pos;
+        uint16_t id = h[0] | (h[1] << 8);
+        int fsz = 6 + ((h[4] & 0x80) ? (h[2] | (h[3] << 8)) : 0);
+        if(fsz > sz - pos)
+        {
+            break;
+        }
+
+        bump(sent ? m_framesSent : m_framesReceived, 1);
+
+        uint32_t n = (id ^ (id >> 5)) & (counterSlots - 1);
+        for(uint32_t k = 0; k < counterSlots; ++k, n = (n + 1) & (counterSlots - 1))
+        {
+            counterSlot & s = m_msgCounters[n];
+
+            uint16_t sid = s.id.load(std::memory_order_relaxed);
+            if(sid == 0)
+            {
+                s.id.store(id, std::memory_order_relaxed);
+            }
+            else if(sid != id)
+            {
+                continue;
+            }
+
+            if(sent)
+            {
+                bump(s.framesSent, 1);
+                bump(s.bytesSent, fsz);
+            }
+            else
+            {
+                bump(s.framesReceived, 1);
+                bump(s.bytesReceived, fsz);
+            }
+            break;
+        }
+
+        pos += fsz;
+    }
+}
+
+inline
+void tmcController::countFlush( [[maybe_unused]] int rv ) noexcept
+{
+    TMCC_PROBE1(flush, rv);
+    bump(m_flushes, 1);
+}
+
+inline
+void tmcController::countSleep( uint32_t ms ) noexcept
+{
+    TMCC_PROBE1(sleep, ms);
+    bump(m_sleepNs, static_cast<uint64_t>(ms)*1000000);
+}
+
+inline
+bool tmcController::readTimedOut( std::chrono::steady_clock::time_point & start ) noexcept
+{
+    uint32_t to = m_readTimeout.load(std::memory_order_relaxed);
+    if(to == 0)
+    {
+        if(std::this_thread::get_id() != m_reconnectThreadId.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        to = reconnectReadTimeout;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(start == std::chrono::steady_clock::time_point())
+    {
+        start = now;
+        return false;
+    }
+
+    if(now - start < std::chrono::milliseconds(to))
+    {
+        return false;
+    }
+
+    bump(m_timeouts, 1);
+    return true;
+}
+
+inline
+tmcController::Counters tmcController::counters()
+{
+    Counters c;
+    c.framesSent = m_framesSent.load(std::memory_order_relaxed);
+    c.bytesSent = m_bytesSent.load(std::memory_order_relaxed);
+    c.framesReceived = m_framesReceived.load(std::memory_order_relaxed);
+    c.bytesReceived = m_bytesReceived.load(std::memory_order_relaxed);
+    c.flushes = m_flushes.load(std::memory_order_relaxed);
+    c.timeouts = m_timeouts.load(std::memory_order_relaxed);
+    c.reconnects = m_reconnects.load(std::memory_order_relaxed);
+    c.reconnectAttempts = m_reconnectAttempts.load(std::memory_order_relaxed);
+    c.sleepNs = m_sleepNs.load(std::memory_order_relaxed);
+    c.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_countersSince.load()).count();
+    c.baud = m_baud;
+
+    return c;
+}
+
+inline
+int tmcController::messageCounters( MessageCounters & mc,
+                                    uint16_t id
+                                  )
+{
+    for(uint32_t n = 0; n < counterSlots; ++n)
+    {
+        counterSlot & s = m_msgCounters[n];
+        if(id == 0 || s.id.load(std::memory_order_relaxed) != id)
+        {
+            continue;
+        }
+
+        mc.id = id;
+        mc.framesSent = s.framesSent.load(std::memory_order_relaxed);
+        mc.bytesSent = s.bytesSent.load(std::memory_order_relaxed);
+        mc.framesReceived = s.framesReceived.load(std::memory_order_relaxed);
+        mc.bytesReceived = s.bytesReceived.load(std::memory_order_relaxed);
+
+        return 0;
+    }
+
+    return -1000;
+}
+
+inline
+std::vector<tmcController::MessageCounters> tmcController::messageCounters()
+{
+    std::vector<MessageCounters> mcs;
+
+    for(uint32_t n = 0; n < counterSlots; ++n)
+    {
+        uint16_t id = m_msgCounters[n].id.load(std::memory_order_relaxed);
+        if(id == 0)
+        {
+            continue;
+        }
+
+        MessageCounters mc;
+        messageCounters(mc, id);
+        mcs.push_back(mc);
+    }
+
+    std::sort(mcs.begin(), mcs.end(), [](const MessageCounters & a, const MessageCounters & b){ return a.id < b.id; });
+
+    return mcs;
+}
+
+inline
+void tmcController::countersReset()
+{
+    for(uint32_t n = 0; n < counterSlots; ++n)
+    {
+        counterSlot & s = m_msgCounters[n];
+        s.framesSent.store(0, std::memory_order_relaxed);
+        s.bytesSent.store(0, std::memory_order_relaxed);
+        s.framesReceived.store(0, std::memory_order_relaxed);
+        s.bytesReceived.store(0, std::memory_order_relaxed);
+    }
+
+    m_framesSent.store(0, std::memory_order_relaxed);
+    m_bytesSent.store(0, std::memory_order_relaxed);
+    m_framesReceived.store(0, std::memory_order_relaxed);
+    m_bytesReceived.store(0, std::memory_order_relaxed);
+    m_flushes.store(0, std::memory_order_relaxed);
+    m_timeouts.store(0, std::memory_order_relaxed);
+    m_reconnects.store(0, std::memory_order_relaxed);
+    m_sleepNs.store(0, std::memory_order_relaxed);
+    m_countersSince.store(std::chrono::steady_clock::now());
+}
+
+inline
+int tmcController::lastStatus( PZStatus & pzs )
+{
+    int64_t t = m_lastStatusTime.load(std::memory_order_acquire);
+    if(t == 0)
+    {
+        return -1000;
+    }
+
+    uint64_t st = m_lastStatus.load(std::memory_order_relaxed);
+
+    pzs.voltage = static_cast<int16_t>(st & 0xFFFF);
+    pzs.position = static_cast<int16_t>((st >> 16) & 0xFFFF);
+
+    uint32_t bits = st >> 32;
+    pzs.connected = bits & 0x00000001;
+    pzs.zeroed = bits & 0x00000010;
+    pzs.zeroing = bits & 0x00000020;
+    pzs.sgConnected = bits & 0x00000100;
+    pzs.pcMode = bits & 0x00000400;
+
+    pzs.statusTime.tv_sec = t / 1000000000;
+    pzs.statusTime.tv_nsec = t % 1000000000;
+
+    return 0;
+}
+
+inline
+void tmcController::readTimeout( uint32_t to )
+{
+    m_readTimeout = to;
+}
+
+inline
+uint32_t tmcController::readTimeout()
+{
+    return m_readTimeout;
+}
+
+// Frames are assembled in m_sndbuf with tmcApt::encode, and the sizes written and read come from the
+// tmcApt message descriptors.
+
+#define TMCC_WRITE_REQUEST(fxn, msgT)                                                                \
+    latencyTimer tmcc_latency(this, msgT::ID);                                                       \
+    int rv;                                                                                          \
+    rv = writeData(m_sndbuf, msgT::size);                                                            \
+    phaseMark(Phase::write);                                                                         \
+    if(rv < 0)                                                                                       \
+    {                                                                                                \
+        if(errmsg)                                                                                   \
+        {                                                                                            \
+            ftdiErrmsg("tmcController::" fxn, "unable to write data", rv, __FILE__, __LINE__);       \
+        }                                                                                            \
+        /* record the error before waking the reconnect thread, which may close m_ftdi */            \
+        rv = fail((rv == -666) ? ErrorCategory::unavailable : ErrorCategory::write, rv,              \
+                                                          "tmcController::" fxn, __LINE__);          \
+        linkDown();                                                                                  \
+        return rv;                                                                                   \
+    } 
+
+/* A command is preceded by a flush and the post-flush sleep, unless doFlush is false, as on the session path */
+#define TMCC_WRITE_COMMAND_FLUSH(fxn, msgT, doFlush)                                                 \
+    latencyTimer tmcc_latency(this, msgT::ID);                                                       \
+    int rv;                                                                                          \
+    if(doFlush)                                                                                      \
+    {                                                                                                \
+        rv = flushData();                                                                            \
+        phaseMark(Phase::flush);                                                                     \
+        countSleep(m_postFlushSleep);                                                                \
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_postFlushSleep));                    \
+        phaseMark(Phase::postFlushSleep);                                                            \
+    }                                                                                                \
+    rv = writeData(m_sndbuf, msgT::size);                                                            \
+    phaseMark(Phase::write);                                                                         \
+    if(rv < 0)                                                                                       \
+    {                                                                                                \
+        if(errmsg)                                                                                   \
+        {                                                                                            \
+            ftdiErrmsg("tmcController::" fxn, "unable to write data", rv, __FILE__, __LINE__);       \
+        }                                                                                            \
+        /* record the error before waking the reconnect thread, which may close m_ftdi */            \
+        rv = fail((rv == -666) ? ErrorCategory::unavailable : ErrorCategory::write, rv,              \
+                                                          "tmcController::" fxn, __LINE__);          \
+        linkDown();                                                                                  \
+        return rv;                                                                                   \
+    }
+
+#define TMCC_WRITE_COMMAND(fxn, msgT) TMCC_WRITE_COMMAND_FLUSH(fxn, msgT, true)
+
+#define TMCC_READ_RESPONSE(fxn, esz)                                                                           \
+    {                                                                                                          \
+        std::chrono::steady_clock::time_point tmcc_rdstart {};                                                 \
+        m_totrd = 0;                                                                                           \
+        do                                                                                                     \
+        {                                                                                                      \
+            int rd = readData(m_rdbuf + m_totrd, sizeof(m_rdbuf)-m_totrd);                                     \
+            if(rd < 0)                                                                                         \
+            {                                                                                                  \
+                if(errmsg)                                                                                     \
+                {                                                                                              \
+                    ftdiErrmsg("tmcController::" fxn, "unable to read data", rd, __FILE__, __LINE__);          \
+                }                                                                                              \
+                /* record the error before waking the reconnect thread, which may close m_ftdi */              \
+                rd = fail((rd == -666) ? ErrorCategory::unavailable : ErrorCategory::read, rd,                 \
+                                                                  "tmcController::" fxn, __LINE__);            \
+                linkDown();                                                                                    \
+                return rd;                                                                                     \
+            }                                                                                                  \
+            if(rd == 0 && esz > 0 && readTimedOut(tmcc_rdstart))                                               \
+            {                                                                                                  \
+                flushData();                                                                                   \
+                if(errmsg)                                                                                     \
+                {                                                                                              \
+                    otherErrmsg("tmcController::" fxn, "timed out waiting for response", __FILE__, __LINE__);  \
+                }                                                                                              \
+                return fail(ErrorCategory::timeout, 0, "tmcController::" fxn, __LINE__);                       \
+            }                                                                                                  \
+            m_totrd += rd;                                                                                     \
+        }                                                                                                      \
+        while(m_totrd < esz);                                                                                  \
+        phaseMark(Phase::read);                                                                                \
+        countFrames(m_rdbuf, m_totrd, false);                                                                  \
+                                                                                                               \
+        if(m_totrd != esz && esz > 0)                                                                          \
+        {                                                                                                      \
+            if(errmsg)                                                                                         \
+            {                                                                                                  \
+                char msg[128];                                                                                 \
+                snprintf(msg, sizeof(msg), "did not read correct amount of data, got %d", m_totrd);            \
+                otherErrmsg("tmcController::" fxn, msg, __FILE__, __LINE__);                                   \
+            }                                                                                                  \
+            return fail(ErrorCategory::response, 0, "tmcController::" fxn, __LINE__);                          \
+        }                                                                                                      \
+    } /*TMCC_READ_RESPONSE(fxn, esz)*/
+
+inline
+int tmcController::mod_identify(bool errmsg /*default=true*/)
+{
+    TMCC_CHECK_CONNECTED("mod_identify")
+
+    typedef tmcApt::MOD_IDENTIFY msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf);
+
+    TMCC_WRITE_REQUEST("mod_identify", msgT)
+
+    return 0;
+}
+
+inline
+int tmcController::mod_set_chanenablestate( const uint8_t & chnum,
+                                            const EnableState & ces,
+                                            bool errmsg
+                                          )
+{
+    if(ces == EnableState::invalid)
+    {
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::mod_set_chanenablestate", "EnableState is invalid", __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::mod_set_chanenablestate", __LINE__);
+    }
+
+    TMCC_CHECK_CONNECTED("mod_set_chanenablestate")
+
+    typedef tmcApt::MOD_SET_CHANENABLESTATE msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, chnum, static_cast<uint8_t>(ces));
+
+    TMCC_WRITE_REQUEST("mod_set_chanenablestate", msgT)
+
+    //Sleep to let the device send the undocumented 10 character response on a state change
+    countSleep(m_postChanEnableSleep);
+    try
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_postChanEnableSleep));
+    }
+    catch(const std::exception& e)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "exception from sleep_for: %s", e.what());
+            otherErrmsg("tmcController::mod_set_chanenablestate", msg, __FILE__, __LINE__-8);
+        }
+        return fail(ErrorCategory::exception, 0, "tmcController::mod_set_chanenablestate", __LINE__);
+    }
+
+    //Now do a 0 read to flush the line
+    TMCC_READ_RESPONSE("mod_set_chanenablestate", 0)
+
+    m_applied.chanIdent = chnum;
+    m_applied.chanEnable = ces;
+    journalApplied();
+
+    return 0;
+}
+
+inline   
+int tmcController::mod_req_chanenablestate( EnableState & ces,
+                                            const uint8_t & chnum,     
+                                            bool errmsg
+                                          )
+{
+    TMCC_CHECK_CONNECTED("mod_req_chanenablestate")
+
+    typedef tmcApt::MOD_REQ_CHANENABLESTATE msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, chnum);
+
+    TMCC_WRITE_REQUEST("mod_req_chanenablestate", msgT)
+
+    TMCC_READ_RESPONSE("mod_req_chanenablestate", msgT::response::size);
+
+    uint8_t st = tmcApt::get<msgT::response::EnableState>(m_rdbuf);
+    if(st == 0x01)
+    {
+        ces = EnableState::enabled;
+    }
+    else if(st == 0x02)
+    {
+        ces = EnableState::disabled;
+    }
+    else
+    {
+        ces = EnableState::invalid;
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::mod_req_chanenablestate", "EnableState is invalid", __FILE__, __LINE__-5);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::mod_req_chanenablestate", __LINE__);
+    }
+
+    return 0;
+}
+
+inline
+int tmcController::hw_stop_updatemsgs( bool errmsg )
+{
+    TMCC_CHECK_CONNECTED("hw_stop_updatemsgs")
+
+    typedef tmcApt::HW_STOP_UPDATEMSGS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf);
+
+    TMCC_WRITE_REQUEST("hw_stop_updatemsgs", msgT)
+
+    m_applied.updatesStopped = true;
+    journalApplied();
+
+    return 0;
+}
+
+inline
+int tmcController::hw_req_info( HWInfo & hwi,
+                                bool errmsg /*default=true*/
+                              )
+{
+    TMCC_CHECK_CONNECTED("hw_req_info")
+
+    typedef tmcApt::HW_REQ_INFO msgT;
+    typedef msgT::response respT;
+
+    tmcApt::encode<msgT>(m_sndbuf);
+
+    TMCC_WRITE_REQUEST("hw_req_info", msgT)
+
+    TMCC_READ_RESPONSE("hw_req_info", respT::size);
+
+    hwi.serialNumber = tmcApt::get<respT::SerialNumber>(m_rdbuf);
+    char modnum[sizeof(respT::ModelNumber::type)+1];
+    memcpy(modnum, &m_rdbuf[respT::ModelNumber::offset], sizeof(respT::ModelNumber::type));
+    modnum[sizeof(respT::ModelNumber::type)] = '\0';
+    hwi.modelNumber = modnum;
+
+    hwi.type = tmcApt::get<respT::Type>(m_rdbuf);
+    hwi.fwMin  = tmcApt::get<respT::FWMinor>(m_rdbuf);
+    hwi.fwInt = tmcApt::get<respT::FWInterim>(m_rdbuf);
+    hwi.fwMaj = tmcApt::get<respT::FWMajor>(m_rdbuf);
+    hwi.hwVer = tmcApt::get<respT::HWVersion>(m_rdbuf);
+    hwi.hwMod = tmcApt::get<respT::ModState>(m_rdbuf);
+    hwi.nChannels = tmcApt::get<respT::NumChannels>(m_rdbuf);
+
+    return 0;
+
+}
+
+inline
+int tmcController::pz_set_poscontrolmode( const PosControlMode & pcm,
+                                          bool errmsg
+                                        )
+{
+    if(pcm == PosControlMode::INVALID)
+    {
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::pz_set_poscontrolmode", "PosControlMode is invalid", __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::pz_set_poscontrolmode", __LINE__);
+    }
+
+    TMCC_CHECK_CONNECTED("pz_set_poscontrolmode")
+
+    typedef tmcApt::PZ_SET_POSCONTROLMODE msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01, static_cast<uint8_t>(pcm));
+
+    TMCC_WRITE_REQUEST("pz_set_poscontrolmode", msgT)
+
+    m_applied.posControlMode = pcm;
+    journalApplied();
+
+    return 0;
+}
+
+inline
+int tmcController::pz_req_poscontrolmode( PosControlMode & pcm,
+                                          bool errmsg
+                                        )
+{
+    TMCC_CHECK_CONNECTED("pz_req_poscontrolmode")
+
+    typedef tmcApt::PZ_REQ_POSCONTROLMODE msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_req_poscontrolmode", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_poscontrolmode", msgT::response::size)
+
+    uint8_t md = tmcApt::get<msgT::response::Mode>(m_rdbuf);
+    if(md >= 0x01 && md <= 0x04)
+    {
+        pcm = static_cast<PosControlMode>(md);
+    }
+    else
+    {
+        pcm = PosControlMode::INVALID;
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::pz_req_poscontrolmode", "PosControlMode is invalid", __FILE__, __LINE__-5);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::pz_req_poscontrolmode", __LINE__);
+    }
+
+    return 0;
+}
+
+inline
+int tmcController::pz_set_outputvolts( const float & ov,
+                                       bool errmsg
+                                     )
+{
+    TMCC_CHECK_CONNECTED("pz_set_outputvolts")
+
+    return do_pz_set_outputvolts(ov, errmsg, true);
+}
+
+inline
+int tmcController::do_pz_set_outputvolts( const float & ov,
+                                          bool errmsg,
+                                          bool flush
+                                        ) noexcept
+{
+    int16_t iov = 0x00;
+
+    if(!(fabs(ov) <= 1.0))
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "output volts > 1 (>100%% of max) or NaN: %f", ov);
+            otherErrmsg("tmcController::pz_set_outputvolts", msg, __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::range, 0, "tmcController::pz_set_outputvolts", __LINE__);
+    }
+
+    if(ov > 0)
+    {
+        iov = ov*32767;
+    }
+    else
+    {
+        iov = ov*32768;
+    }
+
+    typedef tmcApt::PZ_SET_OUTPUTVOLTS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01, iov);
+
+    TMCC_WRITE_COMMAND_FLUSH("pz_set_outputvolts", msgT, flush)
+
+    m_applied.outputVolts = iov;
+    m_applied.outputPos.reset();
+    journalApplied();
+
+    return 0;
+}
+
+inline
+int tmcController::pz_req_outputvolts( float & ov,
+                                       bool errmsg
+                                     )
+{
+    TMCC_CHECK_CONNECTED("pz_req_outputvolts")
+
+    return do_pz_req_outputvolts(ov, errmsg);
+}
+
+inline
+int tmcController::do_pz_req_outputvolts( float & ov,
+                                          bool errmsg
+                                        ) noexcept
+{
+    typedef tmcApt::PZ_REQ_OUTPUTVOLTS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_req_outputvolts", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_outputvolts", msgT::response::size)
+
+    int16_t iov = tmcApt::get<msgT::response::Voltage>(m_rdbuf);
+
+    if(iov > 0)
+    {
+        ov = iov/32767.0;
+    }
+    else
+    {
+        ov = iov/32768.0;
+    }
+
+    return 0;
+
+}
+
+inline
+int tmcController::pz_set_outputpos( const float & pos,
+                                     bool errmsg
+                                   )
+{
+    TMCC_CHECK_CONNECTED("pz_set_outputpos")
+
+    return do_pz_set_outputpos(pos, errmsg, true);
+}
+
+inline
+int tmcController::do_pz_set_outputpos( const float & pos,
+                                        bool errmsg,
+                                        bool flush
+                                      ) noexcept
+{
+    if(!(pos >= 0 && pos <= 1.0))
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "position out of range (0 to 100%% of max) or NaN: %f", pos);
+            otherErrmsg("tmcController::pz_set_outputpos", msg, __FILE__, __LINE__-6);
+        }
+        return fail(ErrorCategory::range, 0, "tmcController::pz_set_outputpos", __LINE__);
+    }
+
+    uint16_t ipos = pos*32767;
+
+    typedef tmcApt::PZ_SET_OUTPUTPOS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01, ipos);
+
+    TMCC_WRITE_COMMAND_FLUSH("pz_set_outputpos", msgT, flush)
+
+    m_applied.outputPos = ipos;
+    m_applied.outputVolts.reset();
+    journalApplied();
+
+    return 0;
+}
+
+inline
+int tmcController::pz_req_outputpos( float & pos,
+                                     bool errmsg
+                                   )
+{
+    TMCC_CHECK_CONNECTED("pz_req_outputpos")
+
+    return do_pz_req_outputpos(pos, errmsg);
+}
+
+inline
+int tmcController::do_pz_req_outputpos( float & pos,
+                                        bool errmsg
+                                      ) noexcept
+{
+    typedef tmcApt::PZ_REQ_OUTPUTPOS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_req_outputpos", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_outputpos", msgT::response::size)
+
+    uint16_t ipos = tmcApt::get<msgT::response::Position>(m_rdbuf);
+
+    pos = ipos/32767.0;
+
+    return 0;
+}
+
+inline
+int tmcController::pz_req_pzstatusupdate( PZStatus & pzs,
+                                          bool errmsg
+                                        )
+{
+    TMCC_CHECK_CONNECTED("pz_req_pzstatusupdate")
+
+    return do_pz_req_pzstatusupdate(pzs, errmsg);
+}
+
+inline
+int tmcController::do_pz_req_pzstatusupdate( PZStatus & pzs,
+                                             bool errmsg
+                                           ) noexcept
+{
+    typedef tmcApt::PZ_REQ_PZSTATUSUPDATE msgT;
+    typedef msgT::response respT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_req_pzstatusupdate", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_pzstatusupdate", respT::size)
+
+    clock_gettime(CLOCK_REALTIME, &pzs.statusTime);
+
+    pzs.voltage = tmcApt::get<respT::OutputVoltage>(m_rdbuf);
+    pzs.position = tmcApt::get<respT::Position>(m_rdbuf);
+
+    uint32_t bits = tmcApt::get<respT::StatusBits>(m_rdbuf);
+
+    pzs.connected = bits & 0x00000001;
+    pzs.zeroed = bits & 0x00000010;
+    pzs.zeroing = bits & 0x00000020;
+    pzs.sgConnected = bits & 0x00000100;
+    pzs.pcMode = bits & 0x00000400;
+
+    m_lastStatus.store(static_cast<uint64_t>(static_cast<uint16_t>(pzs.voltage)) |
+                          (static_cast<uint64_t>(static_cast<uint16_t>(pzs.position)) << 16) |
+                              (static_cast<uint64_t>(bits) << 32), std::memory_order_relaxed);
+    m_lastStatusTime.store(pzs.statusTime.tv_sec*1000000000LL + pzs.statusTime.tv_nsec, std::memory_order_release);
+
+    return 0;
+
+}
+
+inline
+int tmcController::pz_set_outputlut( const uint16_t & index,
+                                     const float & ov,
+                                     bool errmsg
+                                   )
+{
+    int16_t iov = 0x00;
+
+    if(index >= lutMaxEntries)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "LUT index out of range: %d", index);
+            otherErrmsg("tmcController::pz_set_outputlut", msg, __FILE__, __LINE__-6);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::pz_set_outputlut", __LINE__);
+    }
+
+    if(!(fabs(ov) <= 1.0))
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "output volts > 1 (>100%% of max) or NaN: %f", ov);
+            otherErrmsg("tmcController::pz_set_outputlut", msg, __FILE__, __LINE__-6);
+        }
+        return fail(ErrorCategory::range, 0, "tmcController::pz_set_outputlut", __LINE__);
+    }
+
+    if(ov > 0)
+    {
+        iov = ov*32767;
+    }
+    else
+    {
+        iov = ov*32768;
+    }
+
+    TMCC_CHECK_CONNECTED("pz_set_outputlut")
+
+    typedef tmcApt::PZ_SET_OUTPUTLUT msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01, index, iov);
+
+    lutCacheInvalidate();
+
+    TMCC_WRITE_COMMAND("pz_set_outputlut", msgT)
+
+    return 0;
+}
+
+inline
+int tmcController::pz_set_outputlutparams( const LUTParams & lutp,
+                                           bool errmsg
+                                         )
+{
+    if(lutp.Mode == LUTMode::INVALID || lutp.CycleLength == 0 || lutp.CycleLength > lutMaxEntries)
+    {
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::pz_set_outputlutparams", "LUT mode or cycle length is invalid", __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::pz_set_outputlutparams", __LINE__);
+    }
+
+    TMCC_CHECK_CONNECTED("pz_set_outputlutparams")
+
+    lutParamsFrame(m_sndbuf, lutp);
+
+    lutCacheInvalidate();
+
+    TMCC_WRITE_COMMAND("pz_set_outputlutparams", tmcApt::PZ_SET_OUTPUTLUTPARAMS)
+
+    return 0;
+}
+
+inline
+int tmcController::pz_req_outputlutparams( LUTParams & lutp,
+                                           bool errmsg
+                                         )
+{
+    TMCC_CHECK_CONNECTED("pz_req_outputlutparams")
+
+    typedef tmcApt::PZ_REQ_OUTPUTLUTPARAMS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_req_outputlutparams", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_outputlutparams", msgT::response::size)
+
+    lutParamsParse(lutp, m_rdbuf);
+
+    return 0;
+}
+
+inline
+int tmcController::pz_start_lutoutput( bool errmsg )
+{
+    TMCC_CHECK_CONNECTED("pz_start_lutoutput")
+
+    typedef tmcApt::PZ_START_LUTOUTPUT msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_start_lutoutput", msgT)
+
+    return 0;
+}
+
+inline
+int tmcController::pz_stop_lutoutput( bool errmsg )
+{
+    TMCC_CHECK_CONNECTED("pz_stop_lutoutput")
+
+    typedef tmcApt::PZ_STOP_LUTOUTPUT msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("pz_stop_lutoutput", msgT)
+
+    return 0;
+}
+
+inline
+int tmcController::lutVerifyEntries( uint16_t n,
+                                     bool probe,
+                                     bool errmsg
+                                   )
+{
+    typedef tmcApt::PZ_REQ_OUTPUTLUT msgT;
+
+    uint16_t ns = (n < lutVerifySamples) ? n : lutVerifySamples;
+
+    for(uint16_t k = 0; k < ns; ++k)
+    {
+        uint16_t index = (ns > 1) ? (static_cast<uint32_t>(k)*(n - 1))/(ns - 1) : 0;
+
+        tmcApt::encode<msgT>(m_sndbuf, 0x01, index);
+
+        TMCC_WRITE_REQUEST("pz_upload_outputlut", msgT)
+
+        TMCC_READ_RESPONSE("pz_upload_outputlut", msgT::response::size)
+
+        //m_lutcounts is already in APT byte order
+        int16_t sent = tmcApt::loadLE<int16_t>(reinterpret_cast<const unsigned char *>(&m_lutcounts[index]));
+
+        if(tmcApt::get<msgT::response::Index>(m_rdbuf) != index || tmcApt::get<msgT::response::Output>(m_rdbuf) != sent)
+        {
+            if(probe)
+            {
+                return 1;
+            }
+
+            if(errmsg)
+            {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "LUT entry %d readback does not match", index);
+                otherErrmsg("tmcController::pz_upload_outputlut", msg, __FILE__, __LINE__-6);
+            }
+            return fail(ErrorCategory::mismatch, 0, "tmcController::pz_upload_outputlut", __LINE__);
+        }
+    }
+
+    return 0;
+}
+
+inline
+int tmcController::pz_upload_outputlut( const float * ov,
+                                        uint16_t n,
+                                        const LUTParams & lutp,
+                                        LUTUploadStats * stats,
+                                        bool errmsg
+                                      )
+{
+    if(n == 0 || n > lutMaxEntries || lutp.Mode == LUTMode::INVALID)
+    {
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::pz_upload_outputlut", "LUT length or mode is invalid", __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::parameter, 0, "tmcController::pz_upload_outputlut", __LINE__);
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    int nsat = volts2counts(m_lutcounts, ov, n);
+    if(nsat != 0)
+    {
+        if(errmsg)
+        {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "output volts > 1 (>100%% of max) or NaN in %d entries", nsat);
+            otherErrmsg("tmcController::pz_upload_outputlut", msg, __FILE__, __LINE__-6);
+        }
+        return fail(ErrorCategory::range, 0, "tmcController::pz_upload_outputlut", __LINE__);
+    }
+
+    typedef tmcApt::PZ_SET_OUTPUTLUT entT;
+    typedef tmcApt::PZ_SET_OUTPUTLUTPARAMS parT;
+    typedef tmcApt::PZ_REQ_OUTPUTLUTPARAMS reqT;
+
+    //Pack every frame up front so the writes are back to back.  The counts are already little-endian.
+    for(uint16_t i = 0; i < n; ++i)
+    {
+        tmcApt::encode<entT>(&m_lutbuf[i*entT::size], 0x01, i, int16_t(0));
+        tmcApt::putWire<entT::Output>(&m_lutbuf[i*entT::size], &m_lutcounts[i]);
+    }
+
+    LUTParams sentp = lutp;
+    sentp.CycleLength = n;
+    lutParamsFrame(&m_lutbuf[n*entT::size], sentp);
+
+    //FNV-1a over the packed entry and parameter frames
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < n*entT::size + parT::size; ++i)
+    {
+        hash ^= m_lutbuf[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    TMCC_CHECK_CONNECTED("pz_upload_outputlut")
+
+    //The serial number may have changed since the record was loaded
+    if(m_lutCache.serial != m_serial)
+    {
+        lutCacheLoad();
+    }
+
+    if(m_lutCache.valid && m_lutCache.serial == m_serial && m_lutCache.hash == hash && m_lutCache.entries == n &&
+          lutParamsMatch(m_lutCache.params, sentp))
+    {
+        bool hit = true;
+
+        if(m_lutCacheVerify)
+        {
+            LUTParams devp;
+            int rv = pz_req_outputlutparams(devp, errmsg);
+            if(rv < 0)
+            {
+                return rv;
+            }
+
+            hit = lutParamsMatch(devp, sentp);
+
+            //m_lutcounts holds this table, which the record says is on the device
+            if(hit)
+            {
+                rv = lutVerifyEntries(n, true, errmsg);
+                if(rv < 0)
+                {
+                    return rv;
+                }
+
+                hit = (rv == 0);
+            }
+        }
 
-    /// Set top panel wheel and display parameters
-    /** Sends the MGMSG_KPZ_SET_KCUBEMMIPARAMS message (0x07F0).
-      * See page 235 of the APT manual.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns -666 if device not available in either \ftdi_write_data  
-      */
-    int kpz_set_kcubemmiparams( const KMMIParams & kmp, ///< [in] the \ref KMMIParams to set
-                                bool errmsg = true      ///< [in] [optional] flag controlling if an error message is printed on failure
-                              );
+        if(hit)
+        {
+            if(stats)
+            {
+                stats->entries = n;
+                stats->bytes = 0;
+                stats->writes = 0;
+                stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                stats->entriesPerSec = 0;
+                stats->skipped = true;
+            }
 
-    /// Get top panel wheel and display parameters
-    /** Sends the MGMSG_KPZ_REQ_KCUBEMMIPARAMS message (0x07F1) and parses the results.
-      * See page 235 of the APT manual.
-      * 
-      * \returns 0 on succcess
-      * \returns <0 on error from connect
-      * \returns <-100 on error from \ftdi_write_data (see also \libusb_bulk_transfer)
-      * \returns <-200 on error from \ftdi_read_data (see also \libusb_bulk_transfer)
-      * \returns -300 if not enough data read
-      * \returns -666 if device not available in either \ftdi_write_data or \ftdi_read_data 
-      */
-    int kpz_req_kcubemmiparams( KMMIParams & kmp,  ///< [out] the \ref KMMIParams structure to populate
-                                bool errmsg = true ///< [in] [optional] flag controlling if an error message is printed on failure
-                              );
+            return 0;
+        }
+    }
 
+    //The table on the device is about to change
+    lutCacheInvalidate();
 
-///@}
+    tmcApt::encode<reqT>(&m_lutbuf[n*entT::size + parT::size], 0x01);
 
-/** \name Error Handling
-  * @{ 
-  */
+    int totsz = n*entT::size + parT::size + reqT::size;
 
-public:
+    //One flush for the whole table, not one per entry
+    int rv = flushData();
+    countSleep(m_postFlushSleep);
+    std::this_thread::sleep_for(std::chrono::milliseconds(m_postFlushSleep));
 
-    /// Print a message to std::cerr describing an error from an \libftdi1 function
-    /** Intended to be overriden in a derived class to provide custom error messaging.
-      */
-    virtual void ftdiErrmsg( const std::string & src,  ///< [in] The source of the error (the tmcController function)
-                             const std::string & msg,  ///< [in] The message describing the error
-                             int rv,                   ///< [in] The return value of the \libftdi1 function
-                             const std::string & file, ///< [in] The file name of this file
-                             int line                  ///< [in] The line number at which the error was recorded
-                           );
+    //The throughput is that of the transfer, not of the fixed delays before it
+    t0 = std::chrono::steady_clock::now();
 
-    /// Print a message to std::cerr describing an error 
-    /** Intended to be overriden in a derived class to provide custom error messaging.
-      */
-    virtual void otherErrmsg( const std::string & src,  ///< [in] The source of the error (the tmcController function)
-                              const std::string & msg,  ///< [in] The message describing the error
-                              const std::string & file, ///< [in] The file name of this file
-                              int line                  ///< [in] The line number at which the error was recorded
-                            );
+    int nwrites = 0;
+    int chunksz = m_lutChunkEntries*entT::size;
+    int sent = 0;
+    while(sent < totsz)
+    {
+        int wsz = totsz - sent;
+        if(wsz > chunksz)
+        {
+            wsz = chunksz;
+        }
 
- ///@}                   
+        if((rv = writeData(m_lutbuf + sent, wsz)) < 0)
+        {
+            if(errmsg)
+            {
+                ftdiErrmsg("tmcController::pz_upload_outputlut", "unable to write data", rv, __FILE__, __LINE__-4);
+            }
+            //record the error before waking the reconnect thread, which may close m_ftdi
+            rv = fail((rv == -666) ? ErrorCategory::unavailable : ErrorCategory::write, rv,
+                                                                   "tmcController::pz_upload_outputlut", __LINE__);
+            linkDown();
+            return rv;
+        }
 
+        sent += wsz;
+        ++nwrites;
+    }
 
-};
+    TMCC_READ_RESPONSE("pz_upload_outputlut", reqT::response::size)
 
-inline
-tmcController::tmcController()
-{
-    m_ftdi = ftdi_new();
+    LUTParams devp;
+    lutParamsParse(devp, m_rdbuf);
 
-    ///\todo throw on failure
-}
+    if(!lutParamsMatch(devp, sentp))
+    {
+        if(errmsg)
+        {
+            otherErrmsg("tmcController::pz_upload_outputlut", "LUT parameter readback does not match", __FILE__, __LINE__-4);
+        }
+        return fail(ErrorCategory::mismatch, 0, "tmcController::pz_upload_outputlut", __LINE__);
+    }
 
-inline
-tmcController::~tmcController()
-{
-    close();
-    ftdi_free(m_ftdi);
-}
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
 
-inline
-const ftdi_context * tmcController::ftdi() const
-{
-    return m_ftdi;
-}
+    rv = lutVerifyEntries(n, false, errmsg);
+    if(rv < 0)
+    {
+        return rv;
+    }
 
-inline
-void tmcController::vendor( uint16_t v )
-{
-    m_vendor = v;
+    m_lutCache.valid = true;
+    m_lutCache.serial = m_serial;
+    m_lutCache.hash = hash;
+    m_lutCache.entries = n;
+    m_lutCache.params = sentp;
+    lutCacheSave();
+
+    if(stats)
+    {
+        stats->entries = n;
+        stats->bytes = totsz;
+        stats->writes = nwrites;
+        stats->seconds = seconds;
+        stats->entriesPerSec = (stats->seconds > 0) ? n / stats->seconds : 0;
+        stats->skipped = false;
+    }
+
+    return 0;
 }
 
 inline
-uint16_t tmcController::vendor()
+int tmcController::pz_set_tpz_dispsettings( const uint16_t & dispint,
+                                            bool errmsg
+                                          )
 {
-    return m_vendor;
-}
+    TMCC_CHECK_CONNECTED("pz_set_tpz_dispsettings")
 
-inline   
-void tmcController::product( uint16_t p )
-{
-    m_product = p;
-}
+    typedef tmcApt::PZ_SET_TPZ_DISPSETTINGS msgT;
 
-inline   
-uint16_t tmcController::product()
-{
-    return m_product;
-}
+    tmcApt::encode<msgT>(m_sndbuf, dispint);
 
-inline    
-void tmcController::serial(const std::string & s )
-{
-    m_serial = s;
-}
+    TMCC_WRITE_COMMAND("pz_set_tpz_dispsettings", msgT)
 
-inline    
-std::string tmcController::serial()
-{
-    return m_serial;
-}
+    m_applied.dispIntensity = dispint;
+    journalApplied();
 
-inline
-void tmcController::baud( uint32_t b /* [in] the new baud rate*/ )
-{
-    m_baud = b;
+    return 0;
 }
 
 inline
-uint32_t tmcController::baud()
+int tmcController::pz_req_tpz_dispsettings( uint16_t & dispint,
+                                            bool errmsg
+                                          )
 {
-    return m_baud;
-}
+    TMCC_CHECK_CONNECTED("pz_req_tpz_dispsettings")
 
-inline
-void tmcController::preFlushSleep( uint32_t s /* [in] the pre-flush sleep time in ms */ )
-{
-    m_preFlushSleep = s;
-}
+    typedef tmcApt::PZ_REQ_TPZ_DISPSETTINGS msgT;
 
-inline
-uint32_t tmcController::preFlushSleep()
-{
-    return m_preFlushSleep;
-}
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
 
-inline
-void tmcController::postFlushSleep( uint32_t s /* [in] the post-flush sleep time in ms */ )
-{
-    m_postFlushSleep = s;
+    TMCC_WRITE_REQUEST("pz_req_tpz_dispsettings", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_tpz_dispsettings", msgT::response::size)
+
+    dispint = tmcApt::get<msgT::response::DispIntensity>(m_rdbuf);
+
+    return 0;
 }
 
-inline
-uint32_t tmcController::postFlushSleep()
+int tmcController::pz_set_tpz_iosettings( const TPZIOSettings & tios,
+                                          bool errmsg       
+                                        )
 {
-    return m_postFlushSleep;
+    if(tios.VoltageLimit == VoltLimit::INVALID)
+    {
+        return fail(ErrorCategory::parameter, 0, "tmcController::pz_set_tpz_iosettings", __LINE__);
+    }
+
+    TMCC_CHECK_CONNECTED("pz_set_tpz_iosettings")
+
+    typedef tmcApt::PZ_SET_TPZ_IOSETTINGS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01, static_cast<uint16_t>(tios.VoltageLimit), tios.HubAnalogInput);
+
+    TMCC_WRITE_COMMAND("pz_set_tpz_iosettings", msgT)
+
+    m_voltLimit = tios.VoltageLimit;
+    m_applied.ioSettings = tios;
+    journalApplied();
+
+    return 0;
 }
 
-inline
-int tmcController::open(bool errmsg /*default=true*/)
+int tmcController::pz_req_tpz_iosettings( TPZIOSettings & tios, 
+                                          bool errmsg   
+                                        )
 {
-    int rv;
+    TMCC_CHECK_CONNECTED("pz_req_tpz_iosettings")
 
-    if((rv = ftdi_usb_open_desc_index(m_ftdi, m_vendor, m_product, NULL, m_serial.c_str(), 0)) < 0)
-    {
-        if(errmsg)
-        {
-            ftdiErrmsg("tmcController::open", "unable to open ftdi device", rv, __FILE__, __LINE__-4);
-        }
+    typedef tmcApt::PZ_REQ_TPZ_IOSETTINGS msgT;
 
-        m_opened = false;
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
 
-        return rv;
+    TMCC_WRITE_REQUEST("pz_req_tpz_iosettings", msgT)
+
+    TMCC_READ_RESPONSE("pz_req_tpz_iosettings", msgT::response::size)
+
+    uint16_t vl = tmcApt::get<msgT::response::VoltageLimit>(m_rdbuf);
+    if(vl == 0x01)
+    {
+        tios.VoltageLimit = VoltLimit::V75;
+    }
+    else if (vl == 0x02)
+    {
+        tios.VoltageLimit = VoltLimit::V100;
+    }
+    else if(vl == 0x03)
+    {
+        tios.VoltageLimit = VoltLimit::V150;
+    }
+    else
+    {
+        tios.VoltageLimit = VoltLimit::INVALID;
     }
 
-    m_opened = true;
+    tios.HubAnalogInput = tmcApt::get<msgT::response::HubAnalogInput>(m_rdbuf);
+
+    m_voltLimit = tios.VoltageLimit;
 
     return 0;
+    
 }
 
-inline
-int tmcController::open( const std::string & s,
-                         bool errmsg /*default=true*/
-                       )
+int tmcController::kpz_set_kcubemmiparams( const KMMIParams & kmp,
+                                           bool errmsg /*default = true*/ 
+                                         )
 {
-    serial(s);
-    return open(errmsg);
+    TMCC_CHECK_CONNECTED("kpz_set_kcubemmiparams")
+
+    typedef tmcApt::KPZ_SET_KCUBEMMIPARAMS msgT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01, kmp.JSMode, kmp.JSVoltGearBox, kmp.JSVoltStep, kmp.DirSense, kmp.PresetVolt1,
+                                               kmp.PresetVolt2, kmp.DispBrightness, kmp.DispTimeout, kmp.DispDimLevel);
+
+    TMCC_WRITE_COMMAND("kpz_set_kcubemmiparams", msgT)
+
+    m_applied.mmiParams = kmp;
+    journalApplied();
+
+    return 0;
+
 }
 
-inline
-int tmcController::open( uint16_t v,
-                         uint16_t p,
-                         const std::string & s,
-                         bool errmsg /*default=true*/
-                       )
+int tmcController::kpz_req_kcubemmiparams( KMMIParams & kmp,
+                                           bool errmsg /*default = true*/ 
+                                         )
 {
-    vendor(v);
-    product(p);
-    serial(s);
-    return open(errmsg);
+    TMCC_CHECK_CONNECTED("kpz_req_kcubemmiparams")
+
+    typedef tmcApt::KPZ_REQ_KCUBEMMIPARAMS msgT;
+    typedef msgT::response respT;
+
+    tmcApt::encode<msgT>(m_sndbuf, 0x01);
+
+    TMCC_WRITE_REQUEST("kpz_req_kcubemmiparams", msgT)
+
+    TMCC_READ_RESPONSE("kpz_req_kcubemmiparams", respT::size)
+
+    kmp.JSMode = tmcApt::get<respT::JSMode>(m_rdbuf);
+    kmp.JSVoltGearBox = tmcApt::get<respT::JSVoltGearBox>(m_rdbuf);
+    kmp.JSVoltStep = tmcApt::get<respT::JSVoltStep>(m_rdbuf);
+    kmp.DirSense = tmcApt::get<respT::DirSense>(m_rdbuf);
+    kmp.PresetVolt1 = tmcApt::get<respT::PresetVolt1>(m_rdbuf);
+    kmp.PresetVolt2 = tmcApt::get<respT::PresetVolt2>(m_rdbuf);
+    kmp.DispBrightness = tmcApt::get<respT::DispBrightness>(m_rdbuf);
+    kmp.DispTimeout = tmcApt::get<respT::DispTimeout>(m_rdbuf);
+    kmp.DispDimLevel = tmcApt::get<respT::DispDimLevel>(m_rdbuf);
+
+    return 0;
+
 }
 
+
+//Check that the response at m_rdbuf[off] is the expected message
+#define TMCC_CHECK_RESPONSE(fxn, respT)                                                                   \
+    if(tmcApt::messageID(&m_rdbuf[off]) != respT::ID)                                                      \
+    {                                                                                                      \
+        if(errmsg)                                                                                         \
+        {                                                                                                  \
+            char msg[128];                                                                                 \
+            snprintf(msg, sizeof(msg), "unexpected response %d", tmcApt::messageID(&m_rdbuf[off]));        \
+            otherErrmsg("tmcController::" fxn, msg, __FILE__, __LINE__);                                   \
+        }                                                                                                  \
+        return fail(ErrorCategory::response, 0, "tmcController::" fxn, __LINE__);                          \
+    }
+
 inline
-int tmcController::close( bool errmsg /*default=true*/)
+int tmcController::restoreState( int & checked,
+                                 int & restored,
+                                 bool errmsg
+                               )
 {
-    if(!m_opened) 
+    typedef tmcApt::PZ_REQ_TPZ_IOSETTINGS ioReqT;
+    typedef tmcApt::KPZ_REQ_KCUBEMMIPARAMS mmiReqT;
+    typedef tmcApt::PZ_REQ_TPZ_DISPSETTINGS dispReqT;
+    typedef tmcApt::PZ_REQ_POSCONTROLMODE pcmReqT;
+    typedef tmcApt::PZ_REQ_OUTPUTVOLTS voltsReqT;
+    typedef tmcApt::PZ_REQ_OUTPUTPOS posReqT;
+    typedef tmcApt::MOD_REQ_CHANENABLESTATE ceReqT;
+
+    checked = 0;
+    restored = 0;
+
+    //Pack the requests, in the order the settings are reapplied.  Update messages are stopped first so they
+    //can't be interleaved with the responses.
+    int sz = 0;
+    int esz = 0;
+
+    if(m_applied.updatesStopped)
     {
-        return 0;
+        tmcApt::encode<tmcApt::HW_STOP_UPDATEMSGS>(&m_sndbuf[sz]);
+        sz += tmcApt::HW_STOP_UPDATEMSGS::size;
     }
 
-    int rv;
-    if((rv = ftdi_usb_close(m_ftdi)) < 0)
+    if(m_applied.ioSettings)
     {
-        if(errmsg)
-        {
-            ftdiErrmsg("tmcController::close", "unable to close device", rv, __FILE__, __LINE__-4);
-        }
-        return rv;
+        tmcApt::encode<ioReqT>(&m_sndbuf[sz], 0x01);
+        sz += ioReqT::size;
+        esz += ioReqT::response::size;
     }
 
-    m_opened = false;
-    m_connected = false;
-
-    return 0;
-}
+    if(m_applied.mmiParams)
+    {
+        tmcApt::encode<mmiReqT>(&m_sndbuf[sz], 0x01);
+        sz += mmiReqT::size;
+        esz += mmiReqT::response::size;
+    }
 
-inline
-int tmcController::connect(bool errmsg /*default=true*/)
-{
-    if(!m_opened)
+    if(m_applied.dispIntensity)
     {
-        int rv = open();
-        if( (rv < 0) || !m_opened)
-        {
-            if(errmsg)
-            {
-                ftdiErrmsg("tmcController::connect", "open failed", rv, __FILE__, __LINE__-5);
-            }
-            return rv;
-        }
+        tmcApt::encode<dispReqT>(&m_sndbuf[sz], 0x01);
+        sz += dispReqT::size;
+        esz += dispReqT::response::size;
     }
 
-    int rv;
-    if((rv = ftdi_read_chipid(m_ftdi, &m_chipid)) < 0)
+    if(m_applied.posControlMode)
     {
-        if(errmsg)
-        {
-            ftdiErrmsg("tmcController::connect", "unable to read chip id", rv, __FILE__, __LINE__-4);
-        }
-        return -20 + rv;
+        tmcApt::encode<pcmReqT>(&m_sndbuf[sz], 0x01);
+        sz += pcmReqT::size;
+        esz += pcmReqT::response::size;
     }
 
-    if((rv = ftdi_set_baudrate(m_ftdi, m_baud)) < 0)
+    if(m_applied.outputVolts)
     {
-        if(errmsg)
-        {
-            ftdiErrmsg("tmcController::connect", "unable to set baud rate", rv, __FILE__, __LINE__-4);
-        }
-        return -30 + rv;
+        tmcApt::encode<voltsReqT>(&m_sndbuf[sz], 0x01);
+        sz += voltsReqT::size;
+        esz += voltsReqT::response::size;
     }
 
-    if((rv = ftdi_set_line_property(m_ftdi, BITS_8, STOP_BIT_1, NONE)) < 0)
+    if(m_applied.outputPos)
     {
-        if(errmsg)
-        {
-            ftdiErrmsg("tmcController::connect", "unable to set line property", rv, __FILE__, __LINE__-4);
-        }
-        return -40 + rv;
+        tmcApt::encode<posReqT>(&m_sndbuf[sz], 0x01);
+        sz += posReqT::size;
+        esz += posReqT::response::size;
     }
 
-    try
+    if(m_applied.chanEnable)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(m_preFlushSleep));
+        tmcApt::encode<ceReqT>(&m_sndbuf[sz], m_applied.chanIdent);
+        sz += ceReqT::size;
+        esz += ceReqT::response::size;
     }
-    catch(const std::exception& e)
+
+    if(sz == 0)
     {
-        if(errmsg)
-        {
-            otherErrmsg("tmcController::connect", std::string("exception from sleep_for: ") + e.what(), __FILE__, __LINE__-6);
-        }
-        return -49;
+        return 0;
     }
 
-    if((rv = ftdi_tcioflush(m_ftdi)) < 0)
+    int rv;
+    if((rv = writeData(m_sndbuf, sz)) < 0)
     {
         if(errmsg)
         {
-            ftdiErrmsg("tmcController::connect", "unable to tcio flush", rv, __FILE__, __LINE__-4);
+            ftdiErrmsg("tmcController::restoreState", "unable to write data", rv, __FILE__, __LINE__-4);
         }
-        return -50 + rv;
+        if(rv == -666) return fail(ErrorCategory::unavailable, rv, "tmcController::restoreState", __LINE__);
+        else return fail(ErrorCategory::write, rv, "tmcController::restoreState", __LINE__);
     }
 
-    try
+    if(esz == 0)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(m_postFlushSleep));
+        return 0;
     }
-    catch(const std::exception& e)
+
+    TMCC_READ_RESPONSE("restoreState", esz)
+
+    //Compare each response, and mark every setting the device lost
+    int off = 0;
+    uint32_t lost = 0;
+
+    if(m_applied.ioSettings)
     {
-        if(errmsg)
+        typedef ioReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
+
+        const TPZIOSettings & tios = *m_applied.ioSettings;
+        if(tmcApt::get<respT::VoltageLimit>(&m_rdbuf[off]) != static_cast<uint16_t>(tios.VoltageLimit) ||
+               tmcApt::get<respT::HubAnalogInput>(&m_rdbuf[off]) != tios.HubAnalogInput)
         {
-            otherErrmsg("tmcController::connect", std::string("exception from sleep_for: ") + e.what(), __FILE__, __LINE__-6);
+            lost |= applyIOSettings;
         }
-        return -59;
+        off += respT::size;
     }
 
-    if((rv = ftdi_usb_reset(m_ftdi)) < 0)
+    if(m_applied.mmiParams)
     {
-        if(errmsg)
+        typedef mmiReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
+
+        const KMMIParams & kmp = *m_applied.mmiParams;
+        if(tmcApt::get<respT::JSMode>(&m_rdbuf[off]) != kmp.JSMode ||
+               tmcApt::get<respT::JSVoltGearBox>(&m_rdbuf[off]) != kmp.JSVoltGearBox ||
+                  tmcApt::get<respT::JSVoltStep>(&m_rdbuf[off]) != kmp.JSVoltStep ||
+                     tmcApt::get<respT::DirSense>(&m_rdbuf[off]) != kmp.DirSense ||
+                        tmcApt::get<respT::PresetVolt1>(&m_rdbuf[off]) != kmp.PresetVolt1 ||
+                           tmcApt::get<respT::PresetVolt2>(&m_rdbuf[off]) != kmp.PresetVolt2 ||
+                              tmcApt::get<respT::DispBrightness>(&m_rdbuf[off]) != kmp.DispBrightness ||
+                                 tmcApt::get<respT::DispTimeout>(&m_rdbuf[off]) != kmp.DispTimeout ||
+                                    tmcApt::get<respT::DispDimLevel>(&m_rdbuf[off]) != kmp.DispDimLevel)
         {
-            ftdiErrmsg("tmcController::connect", "unable to reset device", rv, __FILE__, __LINE__-4);
+            lost |= applyMMIParams;
         }
-        return -60 + rv;
+        off += respT::size;
     }
 
-    if((rv = ftdi_setflowctrl(m_ftdi, SIO_RTS_CTS_HS)) < 0)
+    if(m_applied.dispIntensity)
     {
-        if(errmsg)
+        typedef dispReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
+
+        if(tmcApt::get<respT::DispIntensity>(&m_rdbuf[off]) != *m_applied.dispIntensity)
         {
-            ftdiErrmsg("tmcController::connect", "unable to set flow control", rv, __FILE__, __LINE__-4);
+            lost |= applyDispIntensity;
         }
-        return -70 + rv;
+        off += respT::size;
     }
 
-
-    if((rv = ftdi_setrts(m_ftdi, 1)) < 0 )
+    if(m_applied.posControlMode)
     {
-        if(errmsg)
+        typedef pcmReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
+
+        if(tmcApt::get<respT::Mode>(&m_rdbuf[off]) != static_cast<uint8_t>(*m_applied.posControlMode))
         {
-            ftdiErrmsg("tmcController::connect", "unable to set RTS", rv, __FILE__, __LINE__-4);
+            lost |= applyPosControlMode;
         }
-        return -80 + rv;
+        off += respT::size;
     }
 
-    m_connected = true;
-
-    return 0;
-}
-
-inline
-int tmcController::connect( const std::string & s,
-                            bool errmsg /*default=true*/
-                          )
-{
-    serial(s);
-    return connect(errmsg);
-}
-
-inline
-int tmcController::connect( uint16_t v,
-                            uint16_t p,
-                            const std::string & s,
-                            bool errmsg /*default=true*/
-                          )
-{
-    vendor(v);
-    product(p);
-    serial(s);
-    return connect(errmsg);
-}
-
-inline
-bool tmcController::opened()
-{
-    return m_opened;
-}
-
-inline
-bool tmcController::connected()
-{
-    return m_connected;
-}
-
-inline
-unsigned int tmcController::chipid()
-{
-    return m_chipid;
-}
-
-inline
-int tmcController::totrd()
-{
-    return m_totrd;
-}
-
-inline
-void tmcController::postChanEnableSleep( uint32_t s )
-{
-    m_postChanEnableSleep = s;
-}
-
-inline
-uint32_t tmcController::postChanEnableSleep()
-{
-    return m_postChanEnableSleep;
-}
-
-#define TMCC_CHECK_CONNECTED(fxn)                                                                \
-    if(!m_connected)                                                                             \
-    {                                                                                            \
-        int rv = connect(errmsg);                                                                \
-        if( (rv < 0) || !m_connected)                                                            \
-        {                                                                                        \
-            if(errmsg)                                                                           \
-            {                                                                                    \
-                otherErrmsg("tmcController::" fxn, "connect failed", __FILE__, __LINE__);        \
-            }                                                                                    \
-            return rv;                                                                           \
-        }                                                                                        \
-    }             
-
-template<class streamT>
-void tmcController::HWInfo::dump(streamT & ios)
-{
-    ios << "Connected to: \n";
-    ios << "      Model: " << modelNumber << "\n";
-    ios << "       Type: " << type << "\n";
-    ios << "    Ser Num: " << serialNumber << "\n";
-    ios << "     HW Ver: " << hwVer << "\n";
-    ios << "     HW Mod: " << hwMod << "\n";
-    ios << "   Num. Ch.: " << nChannels << "\n";
-    ios << "   F/W Ver.: " << fwMaj << "." << fwMin << "." << fwInt << "\n";
-}
-
-double tmcController::PZStatus::age()
-{
-  timespec tsp;
-  clock_gettime(CLOCK_REALTIME, &tsp);
-  return (tsp.tv_sec + ((1.0*tsp.tv_nsec)/1e9)) - (statusTime.tv_sec + ((1.0*statusTime.tv_nsec)/1e9));
-}
-
-template<class streamT>
-void tmcController::PZStatus::dump(streamT & ios)
-{
-    ios << "PZ Status: \n";
-    ios << "    Voltage: " << voltage << "\n";
-    ios << "   Position: " << voltage << "\n";
-    ios << "  Connected: " << connected << "\n";
-    ios << "     Zeroed: " << zeroed << "\n";
-    ios << "    Zeroing: " << zeroing << "\n";
-    ios << "   SG Conn.: " << sgConnected << "\n";
-    ios << "  P.C. Mode: " << pcMode << "\n";
-    ios << "        Age: " << age() << " sec\n";
-}
-
-template<class streamT>
-void tmcController::TPZIOSettings::dump(streamT & ios)
-{
-    ios << "TPZ IO Settings: \n";
-    int vl;
-    if(VoltageLimit == VoltLimit::V75) vl = 75;
-    if(VoltageLimit == VoltLimit::V100) vl = 100;
-    if(VoltageLimit == VoltLimit::V150) vl = 150;
-
-    ios << "     VoltageLimit: " << vl << "\n";
-    ios << "   HubAnalogInput: " << HubAnalogInput << "\n";
-}
+    if(m_applied.outputVolts)
+    {
+        typedef voltsReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
 
-template<class streamT>
-void tmcController::KMMIParams::dump(streamT & ios)
-{
-    ios << "K-Cube MMI Params: \n";
-    ios << "             JSMode: " << JSMode << "\n";
-    ios << "      JSVoltGearBox: " << JSVoltGearBox << "\n";
-    ios << "         JSVoltStep: " << JSVoltStep << "\n";
-    ios << "           DirSense: " << DirSense << "\n";
-    ios << "        PresetVolt1: " << PresetVolt1 << "\n";
-    ios << "        PresetVolt2: " << PresetVolt2 << "\n";
-    ios << "     DispBrightness: " << DispBrightness << "\n";
-    ios << "        DispTimeout: " << DispTimeout << "\n";
-    ios << "       DispDimLevel: " << DispDimLevel << "\n";
-}
+        if(tmcApt::get<respT::Voltage>(&m_rdbuf[off]) != *m_applied.outputVolts)
+        {
+            lost |= applyOutputVolts;
+        }
+        off += respT::size;
+    }
 
-#define TMCC_SNDBUF_HEAD(b0,b1,b2,b3,b4,b5) \
-    m_sndbuf[0] = b0;                       \
-    m_sndbuf[1] = b1;                       \
-    m_sndbuf[2] = b2;                       \
-    m_sndbuf[3] = b3;                       \
-    m_sndbuf[4] = b4;                       \
-    m_sndbuf[5] = b5;
-
-#define TMCC_WRITE_REQUEST(fxn)                                                                 \
-    int rv;                                                                                     \
-    if((rv = ftdi_write_data(m_ftdi, m_sndbuf, 6))  < 0)                                        \
-    {                                                                                           \
-        if(errmsg)                                                                              \
-        {                                                                                       \
-            ftdiErrmsg("tmcController::" fxn, "unable to write data", rv, __FILE__, __LINE__);  \
-        }                                                                                       \
-        if(rv == -666) return rv;                                                               \
-        else return -100 + rv;                                                                  \
-    } 
+    if(m_applied.outputPos)
+    {
+        typedef posReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
 
-#define TMCC_WRITE_COMMAND(fxn, esz)                                                            \
-    int rv;                                                                                     \
-    rv = ftdi_tcioflush(m_ftdi); \
-    std::this_thread::sleep_for(std::chrono::milliseconds(m_postFlushSleep));\
-    if((rv = ftdi_write_data(m_ftdi, m_sndbuf, esz))  < 0)                                      \
-    {                                                                                           \
-        if(errmsg)                                                                              \
-        {                                                                                       \
-            ftdiErrmsg("tmcController::" fxn, "unable to write data", rv, __FILE__, __LINE__);  \
-        }                                                                                       \
-        if(rv == -666) return rv;                                                               \
-        else return -100 + rv;                                                                  \
+        if(tmcApt::get<respT::Position>(&m_rdbuf[off]) != *m_applied.outputPos)
+        {
+            lost |= applyOutputPos;
+        }
+        off += respT::size;
     }
 
-#define TMCC_READ_RESPONSE(fxn, esz)                                                                           \
-    {                                                                                                          \
-        /** \todo this needs a timeout, and/or look for ftdi function to manage this*/                         \
-        m_totrd = 0;                                                                                           \
-        do                                                                                                     \
-        {                                                                                                      \
-            int rd = ftdi_read_data(m_ftdi, m_rdbuf + m_totrd, sizeof(m_rdbuf)-m_totrd);                       \
-            if(rd < 0)                                                                                         \
-            {                                                                                                  \
-                if(errmsg)                                                                                     \
-                {                                                                                              \
-                    ftdiErrmsg("tmcController::" fxn, "unable to read data", rd, __FILE__, __LINE__);          \
-                }                                                                                              \
-                if(rd == -666) return rd;                                                                      \
-                return -200+rd;                                                                                \
-            }                                                                                                  \
-            m_totrd += rd;                                                                                     \
-        }                                                                                                      \
-        while(m_totrd < esz);                                                                                  \
-                                                                                                               \
-        if(m_totrd != esz && esz > 0)                                                                          \
-        {                                                                                                      \
-            if(errmsg)                                                                                         \
-            {                                                                                                  \
-                otherErrmsg("tmcController::" fxn, "did not read correct amount of data, got " +               \
-                                                                  std::to_string(m_totrd), __FILE__, __LINE__);\
-            }                                                                                                  \
-            return -300;                                                                                       \
-        }                                                                                                      \
-    } /*TMCC_READ_RESPONSE(fxn, esz)*/
+    if(m_applied.chanEnable)
+    {
+        typedef ceReqT::response respT;
+        TMCC_CHECK_RESPONSE("restoreState", respT)
+        ++checked;
 
-inline
-int tmcController::mod_identify(bool errmsg /*default=true*/)
-{
-    TMCC_CHECK_CONNECTED("mod_identify")
+        if(tmcApt::get<respT::EnableState>(&m_rdbuf[off]) != static_cast<uint8_t>(*m_applied.chanEnable))
+        {
+            lost |= applyChanEnable;
+        }
+        off += respT::size;
+    }
 
-    TMCC_SNDBUF_HEAD(0x23,0x02,0x00,0x00,0x50,0x01)
-    
-    TMCC_WRITE_REQUEST("mod_identify")
+    for(uint32_t m = lost; m; m &= m - 1)
+    {
+        ++restored;
+    }
 
-    return 0;
+    return writeApplied(lost, errmsg);
 }
 
 inline
-int tmcController::mod_set_chanenablestate( const uint8_t & chnum,
-                                            const EnableState & ces,
-                                            bool errmsg
-                                          )
+int tmcController::writeApplied( uint32_t items,
+                                 bool errmsg
+                               )
 {
-    if(ces == EnableState::invalid)
-    {
-        if(errmsg)
-        {
-            otherErrmsg("tmcController::mod_set_chanenablestate", "EnableState is invalid", __FILE__, __LINE__-4);
-        }
-        return -1000;
-    }
-
-    TMCC_CHECK_CONNECTED("mod_set_chanenablestate")
-
-    TMCC_SNDBUF_HEAD(0x10,0x02,chnum,static_cast<uint8_t>(ces),0x50,0x01)
-    
-    TMCC_WRITE_REQUEST("mod_set_chanenablestate")
+    int sz = 0;
 
-    //Sleep to let the device send the undocumented 10 character response on a state change
-    try
+    if((items & applyStopUpdates) && m_applied.updatesStopped)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(m_postChanEnableSleep));
+        tmcApt::encode<tmcApt::HW_STOP_UPDATEMSGS>(&m_sndbuf[sz]);
+        sz += tmcApt::HW_STOP_UPDATEMSGS::size;
     }
-    catch(const std::exception& e)
+
+    if((items & applyIOSettings) && m_applied.ioSettings)
     {
-        if(errmsg)
-        {
-            otherErrmsg("tmcController::mod_set_chanenablestate", std::string("exception from sleep_for: ") + e.what(), __FILE__, __LINE__-6);
-        }
-        return -700;
+        const TPZIOSettings & tios = *m_applied.ioSettings;
+        tmcApt::encode<tmcApt::PZ_SET_TPZ_IOSETTINGS>(&m_sndbuf[sz], 0x01, static_cast<uint16_t>(tios.VoltageLimit), tios.HubAnalogInput);
+        sz += tmcApt::PZ_SET_TPZ_IOSETTINGS::size;
     }
 
-    //Now do a 0 read to flush the line
-    TMCC_READ_RESPONSE("pz_set_outputvolts", 0) 
-
-    return 0;
-}
+    if((items & applyMMIParams) && m_applied.mmiParams)
+    {
+        const KMMIParams & kmp = *m_applied.mmiParams;
+        tmcApt::encode<tmcApt::KPZ_SET_KCUBEMMIPARAMS>(&m_sndbuf[sz], 0x01, kmp.JSMode, kmp.JSVoltGearBox, kmp.JSVoltStep,
+                                                           kmp.DirSense, kmp.PresetVolt1, kmp.PresetVolt2, kmp.DispBrightness,
+                                                              kmp.DispTimeout, kmp.DispDimLevel);
+        sz += tmcApt::KPZ_SET_KCUBEMMIPARAMS::size;
+    }
 
-inline   
-int tmcController::mod_req_chanenablestate( EnableState & ces,
-                                            const uint8_t & chnum,     
-                                            bool errmsg
-                                          )
-{
-    TMCC_CHECK_CONNECTED("mod_req_chanenablestate")
+    if((items & applyDispIntensity) && m_applied.dispIntensity)
+    {
+        tmcApt::encode<tmcApt::PZ_SET_TPZ_DISPSETTINGS>(&m_sndbuf[sz], *m_applied.dispIntensity);
+        sz += tmcApt::PZ_SET_TPZ_DISPSETTINGS::size;
+    }
 
-    TMCC_SNDBUF_HEAD(0x11,0x02,chnum,0x00,0x50,0x01)
+    if((items & applyPosControlMode) && m_applied.posControlMode)
+    {
+        tmcApt::encode<tmcApt::PZ_SET_POSCONTROLMODE>(&m_sndbuf[sz], 0x01, static_cast<uint8_t>(*m_applied.posControlMode));
+        sz += tmcApt::PZ_SET_POSCONTROLMODE::size;
+    }
 
-    TMCC_WRITE_REQUEST("mod_req_chanenablestate")
+    if((items & applyOutputVolts) && m_applied.outputVolts)
+    {
+        tmcApt::encode<tmcApt::PZ_SET_OUTPUTVOLTS>(&m_sndbuf[sz], 0x01, *m_applied.outputVolts);
+        sz += tmcApt::PZ_SET_OUTPUTVOLTS::size;
+    }
 
-    TMCC_READ_RESPONSE("mod_req_chanenablestate", 6);
+    if((items & applyOutputPos) && m_applied.outputPos)
+    {
+        tmcApt::encode<tmcApt::PZ_SET_OUTPUTPOS>(&m_sndbuf[sz], 0x01, *m_applied.outputPos);
+        sz += tmcApt::PZ_SET_OUTPUTPOS::size;
+    }
 
-    if(m_rdbuf[3] == 0x01)
+    bool enableChanged = false;
+    if((items & applyChanEnable) && m_applied.chanEnable)
     {
-        ces = EnableState::enabled;
+        tmcApt::encode<tmcApt::MOD_SET_CHANENABLESTATE>(&m_sndbuf[sz], m_applied.chanIdent, static_cast<uint8_t>(*m_applied.chanEnable));
+        sz += tmcApt::MOD_SET_CHANENABLESTATE::size;
+        enableChanged = true;
     }
-    else if(m_rdbuf[3] == 0x02)
+
+    if(sz == 0)
     {
-        ces = EnableState::disabled;
+        return 0;
     }
-    else
+
+    int rv;
+    if((rv = writeData(m_sndbuf, sz)) < 0)
     {
-        ces = EnableState::invalid;
         if(errmsg)
         {
-            otherErrmsg("tmcController::mod_req_chanenablestate", "EnableState is invalid", __FILE__, __LINE__-5);
+            ftdiErrmsg("tmcController::writeApplied", "unable to write data", rv, __FILE__, __LINE__-4);
         }
-        return -1000;
+        if(rv == -666) return fail(ErrorCategory::unavailable, rv, "tmcController::writeApplied", __LINE__);
+        else return fail(ErrorCategory::write, rv, "tmcController::writeApplied", __LINE__);
+    }
+
+    if(enableChanged)
+    {
+        //Let the device send the undocumented response to a state change, and discard it.
+        //See mod_set_chanenablestate.
+        countSleep(m_postChanEnableSleep);
+        try
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(m_postChanEnableSleep));
+        }
+        catch(const std::exception& e)
+        {
+            if(errmsg)
+            {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "exception from sleep_for: %s", e.what());
+                otherErrmsg("tmcController::writeApplied", msg, __FILE__, __LINE__-8);
+            }
+            return fail(ErrorCategory::exception, 0, "tmcController::writeApplied", __LINE__);
+        }
+
+        TMCC_READ_RESPONSE("writeApplied", 0)
     }
 
     return 0;
 }
 
 inline
-int tmcController::hw_stop_updatemsgs( bool errmsg )
+int tmcController::reapplyState( bool errmsg )
 {
-    TMCC_CHECK_CONNECTED("hw_stop_updatemsgs")
+    TMCC_CHECK_CONNECTED("reapplyState")
 
-    TMCC_SNDBUF_HEAD(0x12,0x00,0x00,0x00,0x50,0x01)
-    
-    TMCC_WRITE_REQUEST("hw_stop_updatemsgs")
-
-    return 0;
+    return writeApplied(applyAll, errmsg);
 }
 
 inline
-int tmcController::hw_req_info( HWInfo & hwi,
-                                bool errmsg /*default=true*/
-                              )
+int tmcController::seedState( bool errmsg )
 {
-    TMCC_CHECK_CONNECTED("hw_req_info")
-
-    TMCC_SNDBUF_HEAD(0x05,0x00,0x00,0x00,0x50,0x01)
+    typedef tmcApt::PZ_REQ_OUTPUTVOLTS voltsReqT;
+    typedef tmcApt::MOD_REQ_CHANENABLESTATE ceReqT;
+    typedef tmcApt::PZ_REQ_POSCONTROLMODE pcmReqT;
+    typedef tmcApt::PZ_REQ_TPZ_IOSETTINGS ioReqT;
 
-    TMCC_WRITE_REQUEST("hw_req_info")
+    int sz = 0;
 
-    TMCC_READ_RESPONSE("hw_req_info", 90);
+    tmcApt::encode<voltsReqT>(&m_sndbuf[sz], 0x01);
+    sz += voltsReqT::size;
 
-    hwi.serialNumber = *((uint32_t*)&m_rdbuf[6]);
-    char modnum[9];
-    memcpy(modnum, &m_rdbuf[10], 8);
-    modnum[8] = '\0';
-    hwi.modelNumber = modnum;
-
-    hwi.type = *((uint16_t*)&m_rdbuf[18]);
-    hwi.fwMin  = m_rdbuf[20];
-    hwi.fwInt = m_rdbuf[21];
-    hwi.fwMaj = m_rdbuf[22];
-    hwi.hwVer = *((uint16_t*)&m_rdbuf[84]);
-    hwi.hwMod = *((uint16_t*)&m_rdbuf[86]);
-    hwi.nChannels = *((uint16_t*)&m_rdbuf[88]);
+    tmcApt::encode<ceReqT>(&m_sndbuf[sz], m_applied.chanIdent);
+    sz += ceReqT::size;
 
-    return 0;
+    tmcApt::encode<pcmReqT>(&m_sndbuf[sz], 0x01);
+    sz += pcmReqT::size;
 
-}
+    tmcApt::encode<ioReqT>(&m_sndbuf[sz], 0x01);
+    sz += ioReqT::size;
 
-inline
-int tmcController::pz_set_outputvolts( const float & ov, 
-                                       bool errmsg
-                                     )
-{
-    int16_t iov = 0x00;
+    int esz = voltsReqT::response::size + ceReqT::response::size + pcmReqT::response::size + ioReqT::response::size;
 
-    if(fabs(ov) > 1.0)
+    int rv;
+    if((rv = writeData(m_sndbuf, sz)) < 0)
     {
         if(errmsg)
         {
-            otherErrmsg("tmcController::pz_set_outputvolts", "output volts > 1 (>100% of max): " + std::to_string(ov), __FILE__, __LINE__-2);
+            ftdiErrmsg("tmcController::seedState", "unable to write data", rv, __FILE__, __LINE__-4);
         }
-        return -980;
+        if(rv == -666) return fail(ErrorCategory::unavailable, rv, "tmcController::seedState", __LINE__);
+        else return fail(ErrorCategory::write, rv, "tmcController::seedState", __LINE__);
     }
 
-    if(ov > 0)
+    TMCC_READ_RESPONSE("seedState", esz)
+
+    int off = 0;
+
+    TMCC_CHECK_RESPONSE("seedState", voltsReqT::response)
+    m_applied.outputVolts = tmcApt::get<voltsReqT::response::Voltage>(&m_rdbuf[off]);
+    m_applied.outputPos.reset();
+    off += voltsReqT::response::size;
+
+    TMCC_CHECK_RESPONSE("seedState", ceReqT::response)
+    //The KPZ101 answers 0x01 (enabled) whatever its state, so only a disabled answer means anything.  Seeding an
+    //enable which may not be true would have restoreState and the journal re-assert it.
+    uint8_t st = tmcApt::get<ceReqT::response::EnableState>(&m_rdbuf[off]);
+    if(st == 0x02)
     {
-        iov = ov*32767;
+        m_applied.chanEnable = EnableState::disabled;
     }
     else
     {
-        iov = ov*32768;
+        m_applied.chanEnable.reset();
     }
+    off += ceReqT::response::size;
 
-    TMCC_CHECK_CONNECTED("pz_set_outputvolts")
-
-    TMCC_SNDBUF_HEAD(0x43,0x06,0x04,0x00, 0x50 | 0x80,0x01)
+    TMCC_CHECK_RESPONSE("seedState", pcmReqT::response)
+    uint8_t md = tmcApt::get<pcmReqT::response::Mode>(&m_rdbuf[off]);
+    if(md >= 0x01 && md <= 0x04)
+    {
+        m_applied.posControlMode = static_cast<PosControlMode>(md);
+    }
+    else
+    {
+        m_applied.posControlMode.reset();
+    }
+    off += pcmReqT::response::size;
 
-    m_sndbuf[6] = 0x01;
-    m_sndbuf[7] = 0x00;
-    *((int16_t*) &m_sndbuf[8]) = iov;
+    TMCC_CHECK_RESPONSE("seedState", ioReqT::response)
+    uint16_t vl = tmcApt::get<ioReqT::response::VoltageLimit>(&m_rdbuf[off]);
+    if(vl >= 0x01 && vl <= 0x03)
+    {
+        TPZIOSettings tios;
+        tios.VoltageLimit = static_cast<VoltLimit>(vl);
+        tios.HubAnalogInput = tmcApt::get<ioReqT::response::HubAnalogInput>(&m_rdbuf[off]);
+        m_applied.ioSettings = tios;
+        m_voltLimit = tios.VoltageLimit;
+    }
+    else
+    {
+        m_applied.ioSettings.reset();
+        m_voltLimit = VoltLimit::INVALID;
+    }
 
-    TMCC_WRITE_COMMAND("pz_set_outputvolts",10)
+    journalApplied();
 
     return 0;
 }
 
-inline  
-int tmcController::pz_req_outputvolts( float & ov, 
-                                       bool errmsg
-                                     )
-{
-    
-
-    TMCC_CHECK_CONNECTED("pz_req_outputvolts")
-
-    TMCC_SNDBUF_HEAD(0x44,0x06,0x01,0x00,0x50,0x01)
-
-    TMCC_WRITE_REQUEST("pz_req_outputvolts")
+#undef TMCC_CHECK_RESPONSE
 
-    TMCC_READ_RESPONSE("pz_req_outputvolts", 10)
-
-    int16_t iov = *((int16_t *) &m_rdbuf[8]);
+inline
+int tmcController::connect( std::optional<session> & ses,
+                            bool errmsg /*default=true*/
+                          )
+{
+    ses.reset();
 
-    if(iov > 0)
-    {
-        ov = iov/32767.0;
-    }
-    else
+    if(!m_connected)
     {
-        ov = iov/32768.0;
+        int rv = connect(errmsg);
+        if(rv < 0)
+        {
+            return rv;
+        }
     }
 
-    return 0;
+    ses.emplace(*this, sessionKey());
 
+    return 0;
 }
 
+//The session commands do not connect, they only refuse to use a device handed to the reconnection thread
+#define TMCC_SESSION_CHECK_CONNECTED(fxn)                                                                   \
+    if(!m_tmcc->m_connected.load(std::memory_order_relaxed))                                                \
+    {                                                                                                       \
+        return m_tmcc->fail(ErrorCategory::disconnected, 0, "tmcController::session::" fxn, __LINE__);      \
+    }
+
 inline
-int tmcController::pz_req_pzstatusupdate( PZStatus & pzs,
-                                          bool errmsg /*default=true*/
-                                        )
+int tmcController::session::pz_set_outputvolts( const float & ov,
+                                                bool errmsg /*default=true*/
+                                              ) noexcept
 {
-    TMCC_CHECK_CONNECTED("pz_req_pzstatusupdate")
+    TMCC_SESSION_CHECK_CONNECTED("pz_set_outputvolts")
 
-    TMCC_SNDBUF_HEAD(0x60,0x06,0x01,0x00,0x50,0x01)
+    return m_tmcc->do_pz_set_outputvolts(ov, errmsg, false);
+}
 
-    TMCC_WRITE_REQUEST("pz_req_pzstatusupdate")
+inline
+int tmcController::session::pz_req_outputvolts( float & ov,
+                                                bool errmsg /*default=true*/
+                                              ) noexcept
+{
+    TMCC_SESSION_CHECK_CONNECTED("pz_req_outputvolts")
 
-    TMCC_READ_RESPONSE("pz_req_pzstatusupdate", 16)
+    return m_tmcc->do_pz_req_outputvolts(ov, errmsg);
+}
 
-    clock_gettime(CLOCK_REALTIME, &pzs.statusTime);
+inline
+int tmcController::session::pz_set_outputpos( const float & pos,
+                                              bool errmsg /*default=true*/
+                                            ) noexcept
+{
+    TMCC_SESSION_CHECK_CONNECTED("pz_set_outputpos")
 
-    pzs.voltage = *((int16_t *) &m_rdbuf[8]);
-    pzs.position = *((int16_t *) &m_rdbuf[10]);
+    return m_tmcc->do_pz_set_outputpos(pos, errmsg, false);
+}
 
-    uint32_t bits = *((uint32_t *) &m_rdbuf[12]);
+inline
+int tmcController::session::pz_req_outputpos( float & pos,
+                                              bool errmsg /*default=true*/
+                                            ) noexcept
+{
+    TMCC_SESSION_CHECK_CONNECTED("pz_req_outputpos")
 
-    pzs.connected = bits & 0x00000001;
-    pzs.zeroed = bits & 0x00000010;
-    pzs.zeroing = bits & 0x00000020;
-    pzs.sgConnected = bits & 0x00000100;
-    pzs.pcMode = bits & 0x00000400;
+    return m_tmcc->do_pz_req_outputpos(pos, errmsg);
+}
 
-    return 0;
+inline
+int tmcController::session::pz_req_pzstatusupdate( PZStatus & pzs,
+                                                   bool errmsg /*default=true*/
+                                                 ) noexcept
+{
+    TMCC_SESSION_CHECK_CONNECTED("pz_req_pzstatusupdate")
 
+    return m_tmcc->do_pz_req_pzstatusupdate(pzs, errmsg);
 }
 
+#undef TMCC_SESSION_CHECK_CONNECTED
+
 inline
-int tmcController::pz_set_tpz_dispsettings( const uint16_t & dispint,
-                                            bool errmsg
-                                          )
+const char * tmcController::errorCategoryName( ErrorCategory cat )
 {
-    TMCC_CHECK_CONNECTED("pz_set_tpz_dispsettings")
-
-    TMCC_SNDBUF_HEAD(0xD1,0x07,0x02,0x00, 0x50 | 0x80,0x01)
+    switch(cat)
+    {
+        case ErrorCategory::none: return "no error";
+        case ErrorCategory::open: return "open failed";
+        case ErrorCategory::close: return "close failed";
+        case ErrorCategory::connect: return "connect failed";
+        case ErrorCategory::write: return "write failed";
+        case ErrorCategory::read: return "read failed";
+        case ErrorCategory::response: return "bad response";
+        case ErrorCategory::timeout: return "read timed out";
+        case ErrorCategory::unavailable: return "device unavailable";
+        case ErrorCategory::exception: return "exception";
+        case ErrorCategory::disconnected: return "not connected";
+        case ErrorCategory::range: return "value out of range";
+        case ErrorCategory::parameter: return "invalid parameter";
+        case ErrorCategory::mismatch: return "readback mismatch";
+        case ErrorCategory::file: return "file error";
+        case ErrorCategory::busy: return "queue full";
+    }
 
-    *((uint16_t*) &m_sndbuf[6]) = dispint;
+    return "unknown error";
+}
 
-    TMCC_WRITE_COMMAND("pz_set_tpz_dispsettings",8)
+inline
+int tmcController::Error::legacy() const noexcept
+{
+    switch(category)
+    {
+        case ErrorCategory::none: return 0;
+        case ErrorCategory::open: return code;
+        case ErrorCategory::close: return code;
+        case ErrorCategory::connect: return -10*step + code;
+        case ErrorCategory::write: return -100 + code;
+        case ErrorCategory::read: return -200 + code;
+        case ErrorCategory::response: return -300;
+        case ErrorCategory::timeout: return -320;
+        case ErrorCategory::unavailable: return -666;
+        case ErrorCategory::exception: return (step > 0) ? -10*step + 1 : -700;
+        case ErrorCategory::disconnected: return -900;
+        case ErrorCategory::range: return -980;
+        case ErrorCategory::parameter: return -1000;
+        case ErrorCategory::mismatch: return -1010;
+        case ErrorCategory::file: return -1;
+        case ErrorCategory::busy: return -950;
+    }
 
-    return 0;
+    return -1;
 }
 
 inline
-int tmcController::pz_req_tpz_dispsettings( uint16_t & dispint,
-                                            bool errmsg
-                                          )
+std::string tmcController::Error::message() const
 {
-    TMCC_CHECK_CONNECTED("pz_req_tpz_dispsettings")
+    if(category == ErrorCategory::none)
+    {
+        return errorCategoryName(category);
+    }
 
-    TMCC_SNDBUF_HEAD(0xD2,0x07,0x01,0x00,0x50,0x01)
+    std::string msg = (src ? src : "tmcController");
+    msg += ": ";
+    msg += errorCategoryName(category);
 
-    TMCC_WRITE_REQUEST("pz_req_tpz_dispsettings")
+    if(step > 0)
+    {
+        msg += " at step " + std::to_string(step);
+    }
 
-    TMCC_READ_RESPONSE("pz_req_tpz_dispsettings", 8)
+    if(code != 0)
+    {
+        msg += " [" + std::to_string(code);
+        if(ftdiStr)
+        {
+            msg += std::string(":") + ftdiStr;
+        }
+        msg += "]";
+    }
 
-    dispint = *((uint16_t *) &m_rdbuf[6]);
+    msg += " (" + std::to_string(legacy()) + ") at line " + std::to_string(line);
 
-    return 0;
+    return msg;
 }
 
-int tmcController::pz_set_tpz_iosettings( const TPZIOSettings & tios,
-                                          bool errmsg       
-                                        )
+inline
+int tmcController::fail( ErrorCategory cat,
+                         int code,
+                         const char * src,
+                         int line,
+                         uint8_t step
+                       ) noexcept
 {
-    if(tios.VoltageLimit == VoltLimit::INVALID)
+    Error e;
+    e.category = cat;
+    e.step = step;
+    e.code = code;
+    e.src = src;
+    e.ftdiStr = (code != 0) ? ftdi_get_error_string(m_ftdi) : nullptr;
+    e.line = line;
+
+    if(std::this_thread::get_id() != m_reconnectThreadId.load(std::memory_order_relaxed))
     {
-        return -1000;
+        m_lastError = e;
     }
 
-    TMCC_CHECK_CONNECTED("pz_set_tpz_iosettings")
-
-    TMCC_SNDBUF_HEAD(0xD4,0x07,0x0A,0x00, 0x50 | 0x80,0x01)
-
-    m_sndbuf[6] = 0x01;
-    m_sndbuf[7] = 0x00;
-    *((uint16_t*) &m_sndbuf[8]) = static_cast<uint16_t>(tios.VoltageLimit);
-    *((uint16_t*) &m_sndbuf[10]) = tios.HubAnalogInput;
-    m_sndbuf[12] = 0x00;
-    m_sndbuf[13] = 0x00;
-    m_sndbuf[14] = 0x00;
-    m_sndbuf[15] = 0x00;
+    int rv = e.legacy();
+    TMCC_PROBE3(error, rv, static_cast<int>(cat), line);
 
-    TMCC_WRITE_COMMAND("pz_set_tpz_iosettings",16)
+    return rv;
+}
 
-    return 0;
+inline
+tmcController::Error tmcController::lastError()
+{
+    return m_lastError;
 }
 
-int tmcController::pz_req_tpz_iosettings( TPZIOSettings & tios, 
-                                          bool errmsg   
-                                        )
+inline
+void tmcController::clearError()
 {
-    TMCC_CHECK_CONNECTED("pz_req_tpz_iosettings")
+    m_lastError = Error();
+}
 
-    TMCC_SNDBUF_HEAD(0xD5,0x07,0x01,0x00,0x50,0x01)
+inline
+void tmcController::logEvent( const char * src,
+                              const char * msg
+                            ) noexcept
+{
+    if(m_logSink && m_logSink->running())
+    {
+        tmcLogRecord rec;
+        rec.event = true;
+        rec.set(src, msg, __FILE__, __LINE__);
+        m_logSink->push(rec);
+    }
+}
 
-    TMCC_WRITE_REQUEST("pz_req_tpz_iosettings")
+inline
+void tmcController::logSink( tmcLog * ls )
+{
+    m_logSink = ls;
+}
 
-    TMCC_READ_RESPONSE("pz_req_tpz_iosettings", 16)
+inline
+tmcLog * tmcController::logSink()
+{
+    return m_logSink;
+}
 
-    uint16_t vl = *((uint16_t*) &m_rdbuf[8]);
-    if(vl == 0x01)
+inline
+int tmcController::writeData( const unsigned char * buf,
+                              int sz
+                            ) noexcept
+{
+    int rv;
+    if(m_replay)
     {
-        tios.VoltageLimit = VoltLimit::V75;
+        rv = m_replay->write(buf, sz);
     }
-    else if (vl == 0x02)
+    else
     {
-        tios.VoltageLimit = VoltLimit::V100;
+        rv = ftdi_write_data(m_ftdi, buf, sz);
     }
-    else if(vl == 0x03)
+
+    TMCC_PROBE3(write, (sz >= 2) ? (buf[0] | (buf[1] << 8)) : 0, sz, rv);
+
+    if(rv > 0)
     {
-        tios.VoltageLimit = VoltLimit::V150;
+        bump(m_bytesSent, rv);
+        countFrames(buf, rv, true);
     }
-    else
+
+    if(m_wireTrace && rv > 0)
     {
-        tios.VoltageLimit = VoltLimit::INVALID;
+        m_wireTrace->record(tmcTrace::dirWrite, m_serial.c_str(), buf, rv);
     }
 
-    tios.HubAnalogInput = *((uint16_t*) &m_rdbuf[10]);
-
-    return 0;
-    
+    return rv;
 }
 
-int tmcController::kpz_set_kcubemmiparams( const KMMIParams & kmp,
-                                           bool errmsg /*default = true*/ 
-                                         )
+inline
+int tmcController::readData( unsigned char * buf,
+                             int sz
+                           ) noexcept
 {
-    TMCC_CHECK_CONNECTED("kpz_set_kcubemmiparams")
+    int rv;
+    if(m_replay)
+    {
+        rv = m_replay->read(buf, sz);
+    }
+    else
+    {
+        rv = ftdi_read_data(m_ftdi, buf, sz);
+    }
 
-    TMCC_SNDBUF_HEAD(0xF0,0x07,0x22,0x00, 0x50 | 0x80,0x01)
-
-    m_sndbuf[6] = 0x01;
-    m_sndbuf[7] = 0x00;
-    *((uint16_t*) &m_sndbuf[8]) = kmp.JSMode;
-    *((uint16_t*) &m_sndbuf[10]) = kmp.JSVoltGearBox;
-    *((int32_t*) &m_sndbuf[12]) = kmp.JSVoltStep;
-    *((uint16_t*) &m_sndbuf[16]) = kmp.DirSense;
-    *((int32_t*) &m_sndbuf[18]) = kmp.PresetVolt1;
-    *((int32_t*) &m_sndbuf[22]) = kmp.PresetVolt2;
-    *((uint16_t*) &m_sndbuf[26]) = kmp.DispBrightness;
-    *((uint16_t*) &m_sndbuf[28]) = kmp.DispTimeout;
-    *((uint16_t*) &m_sndbuf[30]) = kmp.DispDimLevel;
-    m_sndbuf[34] = 0;
-    m_sndbuf[35] = 0;
-    m_sndbuf[36] = 0;
-    m_sndbuf[37] = 0;
-    m_sndbuf[38] = 0;
-    m_sndbuf[39] = 0;
-
-    TMCC_WRITE_COMMAND("kpz_set_kcubemmiparams",40)
+    TMCC_PROBE2(read, sz, rv);
 
-    return 0;
+    if(rv > 0)
+    {
+        bump(m_bytesReceived, rv);
+    }
+
+    if(m_wireTrace && rv > 0)
+    {
+        m_wireTrace->record(tmcTrace::dirRead, m_serial.c_str(), buf, rv);
+    }
 
+    return rv;
 }
 
-int tmcController::kpz_req_kcubemmiparams( KMMIParams & kmp,
-                                           bool errmsg /*default = true*/ 
-                                         )
+inline
+int tmcController::flushData() noexcept
 {
-    TMCC_CHECK_CONNECTED("kpz_req_kcubemmiparams")
-
-    TMCC_SNDBUF_HEAD(0xF1,0x07,0x01,0x00,0x50,0x01)
+    if(m_replay)
+    {
+        return 0;
+    }
 
-    TMCC_WRITE_REQUEST("kpz_req_kcubemmiparams")
+    int rv = ftdi_tcioflush(m_ftdi);
+    countFlush(rv);
 
-    TMCC_READ_RESPONSE("kpz_req_kcubemmiparams", 40)
+    return rv;
+}
 
-    kmp.JSMode = *((uint16_t*) &m_rdbuf[8]);
-    kmp.JSVoltGearBox = *((uint16_t*) &m_rdbuf[10]);
-    kmp.JSVoltStep = *((int32_t*) &m_rdbuf[12]);
-    kmp.DirSense = *((uint16_t*) &m_rdbuf[16]);
-    kmp.PresetVolt1 = *((int32_t*) &m_rdbuf[18]);
-    kmp.PresetVolt2 = *((int32_t*) &m_rdbuf[22]);
-    kmp.DispBrightness = *((uint16_t*) &m_rdbuf[26]);
-    kmp.DispTimeout = *((uint16_t*) &m_rdbuf[28]);
-    kmp.DispDimLevel = *((uint16_t*) &m_rdbuf[30]);
+inline
+void tmcController::wireTrace( tmcTrace * wt )
+{
+    m_wireTrace = wt;
+}
 
-    return 0;
+inline
+tmcTrace * tmcController::wireTrace()
+{
+    return m_wireTrace;
+}
 
+inline
+void tmcController::replay( tmcReplay * rp )
+{
+    m_replay = rp;
+    m_connected = (rp != nullptr);
 }
 
+inline
+tmcReplay * tmcController::replay()
+{
+    return m_replay;
+}
 
 inline
-void tmcController::ftdiErrmsg( const std::string & src,
-                                const std::string & msg,
+void tmcController::ftdiErrmsg( const char * src,
+                                const char * msg,
                                 int rv,
-                                const std::string & file,
+                                const char * file,
                                 int line
                               )
 {
+    if(m_logSink && m_logSink->running())
+    {
+        tmcLogRecord rec;
+        rec.ftdi = true;
+        rec.rv = rv;
+        rec.ftdiStr = ftdi_get_error_string(m_ftdi);
+        rec.set(src, msg, file, line);
+        m_logSink->push(rec);
+        return;
+    }
+
     std::cerr << src << ": " << msg << " [" << rv << ":" << ftdi_get_error_string(m_ftdi) << "]\n";
     std::cerr << "in " << file << " at line " << line << "\n";
 }
 
 inline
-void tmcController::otherErrmsg( const std::string & src,
-                                 const std::string & msg,
-                                 const std::string & file,
+void tmcController::otherErrmsg( const char * src,
+                                 const char * msg,
+                                 const char * file,
                                  int line
                                )
 {
+    if(m_logSink && m_logSink->running())
+    {
+        tmcLogRecord rec;
+        rec.set(src, msg, file, line);
+        m_logSink->push(rec);
+        return;
+    }
+
     std::cerr << src << ": " << msg << "\n";
     std::cerr << "in " << file << " at line " << line << "\n";
 }
@@ -0,0 +1,1248 @@
+/** \file tmcDaemon.hpp
+ *  \brief Declare and define the tmcDaemon shared-memory device server and its tmcClient
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcDaemon_hpp
+#define tmcDaemon_hpp
+
+#include <climits>
+#include <new>
+
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "tmcController.hpp"
+
+/// Owns a set of devices and shares them with any number of processes through a memory-mapped file
+/** Only one process can open the USB interface of a k-cube.  A tmcDaemon runs in that process, with a
+  * tmcController for each device, and publishes a shared region which other processes open with \ref tmcClient:
+  *
+  * - a command ring per device, to which clients append commands such as \ref opSetOutputVolts by writing
+  *   directly into the next slot.  Any number of clients may append concurrently.
+  * - a status block per device, which the daemon rewrites after each command and every \ref statusPeriod ms from
+  *   \ref tmcController::pz_req_pzstatusupdate.  Clients read it directly, under a sequence lock.
+  *
+  * Neither path uses a socket or copies data through the kernel.  One thread per device consumes its ring, so
+  * devices are commanded concurrently and commands to one device are executed in order.  An idle thread sleeps on a
+  * futex in the shared region, which a client wakes only if the thread is asleep, so a command costs the client
+  * a few atomic operations and at most one futex wake.
+  *
+  * The region lives in a file, normally under /dev/shm, which is recreated by \ref start and removed by \ref stop.
+  * Anyone who can write the file can drive the piezos, so it is created with \ref regionMode (owner and group by
+  * default) less the umask; run the daemon and its clients in a common group.
+  * A client which dies between claiming a ring slot and publishing it stalls that device's ring, so clients should
+  * not be killed while in \ref tmcClient::submit.
+  */
+class tmcDaemon
+{
+public:
+
+    static constexpr uint32_t maxDevices = 16;  ///< The maximum number of devices in a region
+    static constexpr uint32_t ringSlots = 256;  ///< The number of slots in each command ring, a power of 2
+
+    static constexpr uint32_t opSetOutputVolts = 1; ///< Call \ref tmcController::pz_set_outputvolts with the value
+    static constexpr uint32_t opSetOutputPos = 2;   ///< Call \ref tmcController::pz_set_outputpos with the value
+    static constexpr uint32_t opEnable = 3;         ///< Enable channel 1 with \ref tmcController::mod_set_chanenablestate
+    static constexpr uint32_t opDisable = 4;        ///< Disable channel 1 with \ref tmcController::mod_set_chanenablestate
+    static constexpr uint32_t opRequestStatus = 5;  ///< Update the status now, rather than at the next \ref statusPeriod
+
+    /// The status of a device, as published in the shared region
+    struct Status
+    {
+        int16_t voltage {0};         ///< The output voltage from the last status, -32768 to 32767 for -100% to 100%
+        int16_t position {0};        ///< The position from the last status, 0 to 32767 for 0 to 100%
+        uint8_t connected {0};       ///< Whether the piezo actuator is connected, from the last status
+        uint8_t zeroed {0};          ///< Whether the piezo actuator has been zeroed, from the last status
+        uint8_t zeroing {0};         ///< Whether the piezo actuator is being zeroed, from the last status
+        uint8_t sgConnected {0};     ///< Whether a strain gauge is connected, from the last status
+        uint8_t pcMode {0};          ///< The position control mode from the last status, 1 for closed-loop
+        uint8_t linked {0};          ///< Whether the daemon is connected to the device, \ref tmcController::connected
+        uint8_t haveStatus {0};      ///< Whether a status has been read since the daemon started
+        uint8_t reserved0 {0};       ///< Padding
+        float outputVolts {0};       ///< The output volts last set successfully with \ref opSetOutputVolts
+        int32_t lastError {0};       ///< The return value of the last command or status update which failed
+        int64_t statusTimeNs {0};    ///< The realtime clock time of the last status, in ns since the epoch
+        uint64_t commands {0};       ///< The number of commands executed
+        uint64_t errors {0};         ///< The number of commands and status updates which failed
+
+        /// Get the age of the status
+        /**
+          * \returns the age in seconds
+          */
+        double age() const;
+
+        /// Dump details to a stream
+        /**
+          * \tparam streamT is an std::iostream like class
+          */
+        template<class streamT>
+        void dump( streamT & ios /**< [out] the stream to dump to*/) const;
+    };
+
+    /// The header of the shared region
+    struct header
+    {
+        char magic[8];                    ///< Always "TMCDAEMN"
+        uint32_t version;                 ///< The layout version, currently 2
+        uint32_t nDevices;                ///< The number of devices
+        uint32_t ringSlots;               ///< The number of slots in each ring
+        uint32_t deviceSize;              ///< The size of a \ref device block
+        int32_t pid;                      ///< The process ID of the daemon
+        std::atomic<uint32_t> running;    ///< 1 while the daemon is running, 0 after \ref stop
+        char reserved[96];                ///< Padding to 128 bytes
+    };
+
+    static_assert(sizeof(header) == 128, "tmcDaemon header must be 128 bytes");
+
+    /// A slot in a command ring
+    /** A slot with sequence s is free for the command numbered s, and holds command s-ringSlots+1 once published.
+      */
+    struct command
+    {
+        std::atomic<uint64_t> seq; ///< The sequence number of the slot
+        uint32_t op;               ///< The operation, e.g. \ref opSetOutputVolts
+        float value;               ///< The argument of the operation
+    };
+
+    /// The shared block of one device
+    struct device
+    {
+        char serial[16];                   ///< The name of the device, normally its USB serial number
+
+        std::atomic<uint32_t> statusSeq;   ///< The sequence lock of \ref status, odd while being written
+        Status status;                     ///< The status of the device
+        std::atomic<int64_t> heartbeatNs;  ///< The realtime clock time at which the daemon thread last ran, in ns
+        std::atomic<int64_t> maxGapNs;     ///< The longest the thread can go between heartbeats while working, 0 if unbounded
+
+        alignas(64) std::atomic<uint64_t> enqueue;    ///< The number of the next command to be claimed by a client
+        alignas(64) std::atomic<uint64_t> completed;  ///< The number of commands completed
+        std::atomic<uint32_t> done;                   ///< The low 32 bits of completed, the futex for \ref tmcClient::wait
+        std::atomic<uint32_t> doneWaiters;            ///< The number of clients sleeping on done
+        std::atomic<uint32_t> doorbell;               ///< Incremented by clients after publishing, the daemon's futex
+        std::atomic<uint32_t> sleeping;               ///< 1 while the daemon thread may sleep on doorbell
+
+        alignas(64) std::atomic<int32_t> results[ringSlots]; ///< The return value of each command, by slot
+        alignas(64) command ring[ringSlots];                  ///< The command ring
+    };
+
+protected:
+
+    /// A device being served
+    struct served
+    {
+        tmcController * tmcc {nullptr}; ///< The controller, not owned
+        std::string name;               ///< The name published for the device
+    };
+
+    /// The devices being served
+    std::vector<served> m_served;
+
+    /// The path of the region file
+    std::string m_path;
+
+    /// The file descriptor of the region file
+    int m_fd {-1};
+
+    /// The size of the mapping
+    size_t m_mapSize {0};
+
+    /// The mapped header
+    header * m_header {nullptr};
+
+    /// The mapped device blocks
+    device * m_devices {nullptr};
+
+    /// The per-device threads
+    std::vector<std::thread> m_threads;
+
+    /// Flag indicating that the daemon is running
+    std::atomic<bool> m_running {false};
+
+    /// Flag telling the threads to stop
+    std::atomic<bool> m_stop {false};
+
+    /// The period between status updates, in ms.  Default is 100 ms.
+    std::atomic<uint32_t> m_statusPeriod {100};
+
+    /// The permissions of the region file, less the umask.  Default is 0660.
+    mode_t m_regionMode {0660};
+
+    /// The main loop of a device thread
+    void serve( size_t d /**< [in] the index of the device*/);
+
+    /// Read the status of a device and publish it
+    void updateStatus( size_t d,  ///< [in] the index of the device
+                       Status & st ///< [in/out] the thread's copy of the status
+                     );
+
+    /// Publish a status under the sequence lock
+    void publish( size_t d,        ///< [in] the index of the device
+                  const Status & st ///< [in] the status to publish
+                );
+
+public:
+
+    /// Get the realtime clock time
+    /**
+      * \returns the time in ns since the epoch
+      */
+    static int64_t realtimeNs();
+
+    /// Sleep on a futex in the shared region while it holds a value
+    static void futexWait( std::atomic<uint32_t> & f, ///< [in] the futex
+                           uint32_t val,              ///< [in] the value to sleep while held
+                           int64_t ns                 ///< [in] the maximum time to sleep, in ns
+                         );
+
+    /// Wake the processes sleeping on a futex in the shared region
+    static void futexWake( std::atomic<uint32_t> & f /**< [in] the futex */);
+
+    /// D'tor, stops the threads
+    ~tmcDaemon();
+
+    /// Add a device to serve
+    /** Must be called before \ref start.  The controller must outlive the daemon, or be served only while it exists,
+      * and should not be commanded by other threads while served.
+      *
+      * \returns 0 on success
+      * \returns -1000 if the daemon is running, tmcc is null, or \ref maxDevices have been added
+      */
+    int add( tmcController * tmcc,    ///< [in] the controller
+             const std::string & name ///< [in] the name published for the device, normally the serial number
+           );
+
+    /// Create the shared region and start serving
+    /** A region file left at the path by a daemon which is no longer running is recreated, so clients of a previous
+      * daemon must reopen it.  Any other file at the path is left alone, and is an error.
+      *
+      * \returns 0 on success
+      * \returns -1 if the path holds a file which is not a region, or the region of a running daemon
+      * \returns -1 if the region file can not be created or mapped
+      * \returns -700 if a thread can not be started
+      * \returns -1000 if already running or no devices have been added
+      */
+    int start( const std::string & path, ///< [in] the path of the region file, e.g. /dev/shm/tmcDaemon
+               bool errmsg = true        ///< [in] [optional] flag controlling if an error message is printed on failure
+             );
+
+    /// Stop serving, unmap and remove the region file
+    void stop();
+
+    /// Check if the daemon is running
+    /**
+      * \returns true if running
+      */
+    bool running();
+
+    /// Get the path of the region file
+    /** \see m_path
+      *
+      * \returns the current value of m_path
+      */
+    std::string path();
+
+    /// Set the period between status updates
+    /** \see m_statusPeriod
+      */
+    void statusPeriod( uint32_t ms /**< [in] the new period in ms, must be > 0 */ );
+
+    /// Get the period between status updates
+    /** \see m_statusPeriod
+      *
+      * \returns the current value of m_statusPeriod
+      */
+    uint32_t statusPeriod();
+
+    /// Set the permissions of the region file
+    /** Takes effect at the next \ref start.  The umask still applies.
+      *
+      * \see m_regionMode
+      */
+    void regionMode( mode_t mode /**< [in] the new permissions, e.g. 0600 for the owner only */ );
+
+    /// Get the permissions of the region file
+    /** \see m_regionMode
+      *
+      * \returns the current value of m_regionMode
+      */
+    mode_t regionMode();
+};
+
+/// A client of a \ref tmcDaemon, in any process
+/** Commands are appended directly to the shared ring of a device, and status is read directly from the shared
+  * region, so neither needs a socket or a system call.  All methods are safe to call from any thread.
+  */
+class tmcClient
+{
+protected:
+
+    /// The path of the region file, empty if none is open
+    std::string m_path;
+
+    /// The file descriptor of the region file
+    int m_fd {-1};
+
+    /// The size of the mapping
+    size_t m_mapSize {0};
+
+    /// The mapped header
+    tmcDaemon::header * m_header {nullptr};
+
+    /// The mapped device blocks
+    tmcDaemon::device * m_devices {nullptr};
+
+public:
+
+    /// D'tor, closes the region
+    ~tmcClient();
+
+    /// Open the region of a running daemon
+    /**
+      * \returns 0 on success
+      * \returns -1 if the file can not be opened or mapped, or is not a daemon region
+      */
+    int open( const std::string & path, ///< [in] the path of the region file
+              bool errmsg = true        ///< [in] [optional] flag controlling if an error message is printed on failure
+            );
+
+    /// Unmap and close the region
+    void close();
+
+    /// Check if a region is open
+    /**
+      * \returns true if open
+      */
+    bool isOpen();
+
+    /// Get the path of the region file
+    /** \see m_path
+      *
+      * \returns the current value of m_path
+      */
+    std::string path();
+
+    /// Get the number of devices in the region
+    /**
+      * \returns the number of devices, 0 if no region is open
+      */
+    size_t devices();
+
+    /// Get the name of a device
+    /**
+      * \returns the name, empty if \p d is invalid
+      */
+    std::string name( size_t d /**< [in] the index of the device */);
+
+    /// Find a device by name
+    /**
+      * \returns the index of the device
+      * \returns -1000 if not found
+      */
+    int find( const std::string & name /**< [in] the name of the device, normally its serial number */);
+
+    /// Check if the daemon is serving a device
+    /** The daemon thread of a device runs at least every \ref tmcDaemon::statusPeriod ms, or once per command, which
+      * can take the read timeout of the device plus its sleeps.  The daemon publishes the longer of the two, and by
+      * default a thread is alive if it ran within twice that.  If the read timeout is 0 a command has no bound, and
+      * by default the thread is alive until it exits.
+      *
+      * \returns true if the daemon is running and its thread for the device ran within maxAge
+      */
+    bool alive( size_t d,         ///< [in] the index of the device
+                double maxAge = 0 ///< [in] [optional] the maximum time since the thread ran, in seconds, 0 for the default
+              );
+
+    /// Append a command to the ring of a device
+    /** Does not wait for the command to execute, see \ref wait.
+      *
+      * \returns 0 on success
+      * \returns -950 if the ring is full (ErrorCategory::busy)
+      * \returns -900 if no region is open or the daemon has stopped
+      * \returns -1000 if \p d is invalid
+      */
+    int submit( size_t d,                  ///< [in] the index of the device
+                uint32_t op,               ///< [in] the operation, e.g. \ref tmcDaemon::opSetOutputVolts
+                float value,               ///< [in] the argument of the operation
+                uint64_t * ticket = nullptr ///< [out] [optional] the number of the command, for \ref wait
+              ) noexcept;
+
+    /// Set the output volts of a device
+    /** See \ref submit and \ref tmcController::pz_set_outputvolts.
+      *
+      * \returns as for \ref submit
+      */
+    int setOutputVolts( size_t d,                  ///< [in] the index of the device
+                        float ov,                  ///< [in] the output volts, as a fraction of maximum (-1 to 1)
+                        uint64_t * ticket = nullptr ///< [out] [optional] the number of the command, for \ref wait
+                      ) noexcept;
+
+    /// Set the position of a device
+    /** See \ref submit and \ref tmcController::pz_set_outputpos.
+      *
+      * \returns as for \ref submit
+      */
+    int setOutputPos( size_t d,                  ///< [in] the index of the device
+                      float pos,                 ///< [in] the position, as a fraction of maximum travel (0 to 1)
+                      uint64_t * ticket = nullptr ///< [out] [optional] the number of the command, for \ref wait
+                    ) noexcept;
+
+    /// Wait for a command to complete
+    /** The result is available until the ring has wrapped, i.e. until command ticket + \ref tmcDaemon::ringSlots is
+      * submitted, which reuses its slot.
+      *
+      * \returns 0 on success, with result set
+      * \returns -320 if the command did not complete within the timeout
+      * \returns -900 if no region is open
+      * \returns -1000 if \p d is invalid, or the result is no longer available
+      */
+    int wait( size_t d,          ///< [in] the index of the device
+              uint64_t ticket,   ///< [in] the number of the command, from \ref submit
+              int & result,      ///< [out] the return value of the command in the daemon
+              uint32_t timeoutMs ///< [in] the maximum time to wait, in ms
+            );
+
+    /// Read the status of a device
+    /**
+      * \returns 0 on success
+      * \returns -900 if no region is open
+      * \returns -1000 if \p d is invalid
+      */
+    int status( size_t d,                ///< [in] the index of the device
+                tmcDaemon::Status & st   ///< [out] the status
+              ) noexcept;
+};
+
+inline
+double tmcDaemon::Status::age() const
+{
+    return 1e-9*(realtimeNs() - statusTimeNs);
+}
+
+template<class streamT>
+void tmcDaemon::Status::dump( streamT & ios ) const
+{
+    ios << "Linked:       " << (linked ? "yes" : "no") << "\n";
+    ios << "Status:       " << (haveStatus ? "" : "none") << "\n";
+    if(haveStatus)
+    {
+        ios << "  voltage:    " << voltage/32767.0 << "\n";
+        ios << "  position:   " << position/32767.0 << "\n";
+        ios << "  connected:  " << (connected ? "yes" : "no") << "\n";
+        ios << "  zeroed:     " << (zeroed ? "yes" : "no") << "\n";
+        ios << "  zeroing:    " << (zeroing ? "yes" : "no") << "\n";
+        ios << "  SG conn:    " << (sgConnected ? "yes" : "no") << "\n";
+        ios << "  PC mode:    " << (pcMode ? "closed-loop" : "open-loop") << "\n";
+        ios << "  age:        " << age() << " s\n";
+    }
+    ios << "Output volts: " << outputVolts << "\n";
+    ios << "Commands:     " << commands << "\n";
+    ios << "Errors:       " << errors << "\n";
+    ios << "Last error:   " << lastError << "\n";
+}
+
+inline
+int64_t tmcDaemon::realtimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+                                                                          "futexes require plain 32 bit atomics");
+
+inline
+void tmcDaemon::futexWait( std::atomic<uint32_t> & f,
+                           uint32_t val,
+                           int64_t ns
+                         )
+{
+    if(ns <= 0)
+    {
+        return;
+    }
+
+    timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+
+    //not FUTEX_PRIVATE, the futex is shared between processes
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&f), FUTEX_WAIT, val, &ts, nullptr, 0);
+}
+
+inline
+void tmcDaemon::futexWake( std::atomic<uint32_t> & f )
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&f), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline
+tmcDaemon::~tmcDaemon()
+{
+    stop();
+}
+
+inline
+int tmcDaemon::add( tmcController * tmcc,
+                    const std::string & name
+                  )
+{
+    if(m_running || tmcc == nullptr || m_served.size() >= maxDevices)
+    {
+        return -1000;
+    }
+
+    served s;
+    s.tmcc = tmcc;
+    s.name = name;
+    m_served.push_back(s);
+
+    return 0;
+}
+
+inline
+int tmcDaemon::start( const std::string & path,
+                      bool errmsg
+                    )
+{
+    if(m_running || m_served.size() == 0)
+    {
+        return -1000;
+    }
+
+    //Remove the region of a daemon which is no longer running, so its clients keep their old mapping rather than
+    //sharing this one.  Never remove anything else.
+    struct stat st;
+    if(lstat(path.c_str(), &st) == 0)
+    {
+        bool stale = false;
+
+        int ofd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+        if(ofd >= 0)
+        {
+            header hdr;
+            if(S_ISREG(st.st_mode) && pread(ofd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+                                                                             memcmp(hdr.magic, "TMCDAEMN", 8) == 0)
+            {
+                stale = (hdr.running.load() == 0 || (kill(hdr.pid, 0) < 0 && errno == ESRCH));
+            }
+            ::close(ofd);
+        }
+
+        if(!stale)
+        {
+            if(errmsg)
+            {
+                std::cerr << "tmcDaemon::start: " << path << " exists and is not the region of a stopped daemon\n";
+                std::cerr << "in " << __FILE__ << " at line " << __LINE__-21 << "\n";
+            }
+            return -1;
+        }
+
+        unlink(path.c_str());
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, m_regionMode);
+    if(fd < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcDaemon::start: unable to create " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+
+    size_t mapSize = sizeof(header) + m_served.size()*sizeof(device);
+
+    if(ftruncate(fd, mapSize) < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcDaemon::start: unable to resize " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-4 << "\n";
+        }
+        ::close(fd);
+        unlink(path.c_str());
+        return -1;
+    }
+
+    void * map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcDaemon::start: unable to map " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        ::close(fd);
+        unlink(path.c_str());
+        return -1;
+    }
+
+    m_fd = fd;
+    m_mapSize = mapSize;
+    m_path = path;
+
+    //the file is zero filled by ftruncate, construct in place for the atomics
+    m_header = new (map) header;
+    m_devices = reinterpret_cast<device *>(static_cast<char *>(map) + sizeof(header));
+
+    for(size_t d = 0; d < m_served.size(); ++d)
+    {
+        device * dev = new (&m_devices[d]) device;
+
+        size_t slen = std::min(m_served[d].name.size(), sizeof(dev->serial) - 1);
+        memcpy(dev->serial, m_served[d].name.data(), slen);
+        dev->serial[slen] = '\0';
+
+        dev->statusSeq = 0;
+        dev->status = Status();
+        dev->heartbeatNs = realtimeNs();
+        dev->maxGapNs = 0;
+        dev->enqueue = 0;
+        dev->completed = 0;
+        dev->done = 0;
+        dev->doneWaiters = 0;
+        dev->doorbell = 0;
+        dev->sleeping = 0;
+
+        for(uint32_t n = 0; n < ringSlots; ++n)
+        {
+            dev->results[n] = 0;
+            dev->ring[n].seq = n;
+            dev->ring[n].op = 0;
+            dev->ring[n].value = 0;
+        }
+    }
+
+    m_header->version = 2;
+    m_header->nDevices = m_served.size();
+    m_header->ringSlots = ringSlots;
+    m_header->deviceSize = sizeof(device);
+    m_header->pid = getpid();
+    m_header->running = 1;
+
+    //written last, so a client never sees a partly initialized region as valid
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(m_header->magic, "TMCDAEMN", 8);
+
+    m_stop = false;
+
+    try
+    {
+        for(size_t d = 0; d < m_served.size(); ++d)
+        {
+            m_threads.emplace_back(&tmcDaemon::serve, this, d);
+        }
+    }
+    catch(const std::exception & e)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcDaemon::start: exception starting thread: " << e.what() << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-9 << "\n";
+        }
+
+        m_running = true;
+        stop();
+        return -700;
+    }
+
+    m_running = true;
+
+    return 0;
+}
+
+inline
+void tmcDaemon::stop()
+{
+    if(!m_running)
+    {
+        return;
+    }
+
+    m_stop = true;
+
+    for(size_t d = 0; d < m_threads.size(); ++d)
+    {
+        m_devices[d].doorbell.fetch_add(1);
+        futexWake(m_devices[d].doorbell);
+    }
+
+    for(size_t d = 0; d < m_threads.size(); ++d)
+    {
+        if(m_threads[d].joinable())
+        {
+            m_threads[d].join();
+        }
+    }
+    m_threads.clear();
+
+    m_header->running = 0;
+
+    munmap(m_header, m_mapSize);
+    ::close(m_fd);
+    unlink(m_path.c_str());
+
+    m_header = nullptr;
+    m_devices = nullptr;
+    m_mapSize = 0;
+    m_fd = -1;
+
+    m_running = false;
+}
+
+inline
+bool tmcDaemon::running()
+{
+    return m_running;
+}
+
+inline
+std::string tmcDaemon::path()
+{
+    return m_path;
+}
+
+inline
+void tmcDaemon::statusPeriod( uint32_t ms )
+{
+    m_statusPeriod = std::max<uint32_t>(ms, 1);
+}
+
+inline
+uint32_t tmcDaemon::statusPeriod()
+{
+    return m_statusPeriod;
+}
+
+inline
+void tmcDaemon::regionMode( mode_t mode )
+{
+    m_regionMode = mode;
+}
+
+inline
+mode_t tmcDaemon::regionMode()
+{
+    return m_regionMode;
+}
+
+inline
+void tmcDaemon::publish( size_t d,
+                         const Status & st
+                       )
+{
+    device & dev = m_devices[d];
+
+    uint32_t seq = dev.statusSeq.load(std::memory_order_relaxed);
+    dev.statusSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    dev.status = st;
+
+    dev.statusSeq.store(seq + 2, std::memory_order_release);
+}
+
+inline
+void tmcDaemon::updateStatus( size_t d,
+                              Status & st
+                            )
+{
+    tmcController * tmcc = m_served[d].tmcc;
+
+    tmcController::PZStatus pzs;
+    int rv = tmcc->pz_req_pzstatusupdate(pzs, false);
+
+    if(rv < 0)
+    {
+        st.lastError = rv;
+        ++st.errors;
+    }
+    else
+    {
+        st.voltage = pzs.voltage;
+        st.position = pzs.position;
+        st.connected = pzs.connected;
+        st.zeroed = pzs.zeroed;
+        st.zeroing = pzs.zeroing;
+        st.sgConnected = pzs.sgConnected;
+        st.pcMode = pzs.pcMode;
+        st.statusTimeNs = pzs.statusTime.tv_sec*1000000000LL + pzs.statusTime.tv_nsec;
+        st.haveStatus = 1;
+    }
+
+    st.linked = tmcc->connected();
+
+    publish(d, st);
+}
+
+inline
+void tmcDaemon::serve( size_t d )
+{
+    device & dev = m_devices[d];
+    tmcController * tmcc = m_served[d].tmcc;
+
+    Status st;
+
+    uint64_t next = 0;
+    auto nextStatus = std::chrono::steady_clock::now();
+
+    while(!m_stop)
+    {
+        //Between heartbeats the thread either sleeps until the next status update, or runs one command or status
+        //request, which may take the post-flush sleep, the channel enable sleep, and the read timeout
+        uint32_t to = tmcc->readTimeout();
+        uint32_t gapMs = std::max(m_statusPeriod.load(), tmcc->postFlushSleep() + tmcc->postChanEnableSleep() + to);
+        dev.maxGapNs.store((to == 0) ? 0 : gapMs*1000000LL, std::memory_order_relaxed);
+
+        dev.heartbeatNs.store(realtimeNs(), std::memory_order_relaxed);
+
+        command & cmd = dev.ring[next & (ringSlots - 1)];
+
+        if(cmd.seq.load(std::memory_order_acquire) == next + 1)
+        {
+            uint32_t op = cmd.op;
+            float value = cmd.value;
+
+            int rv;
+            switch(op)
+            {
+                case opSetOutputVolts:
+                    rv = tmcc->pz_set_outputvolts(value, false);
+                    if(rv == 0)
+                    {
+                        st.outputVolts = value;
+                    }
+                    break;
+                case opSetOutputPos:
+                    rv = tmcc->pz_set_outputpos(value, false);
+                    break;
+                case opEnable:
+                    rv = tmcc->mod_set_chanenablestate(1, tmcController::EnableState::enabled, false);
+                    break;
+                case opDisable:
+                    rv = tmcc->mod_set_chanenablestate(1, tmcController::EnableState::disabled, false);
+                    break;
+                case opRequestStatus:
+                    rv = 0;
+                    nextStatus = std::chrono::steady_clock::now();
+                    break;
+                default:
+                    rv = -1000;
+            }
+
+            ++st.commands;
+            if(rv < 0)
+            {
+                st.lastError = rv;
+                ++st.errors;
+            }
+            st.linked = tmcc->connected();
+            publish(d, st);
+
+            //the result must be visible before completed, and completed before the slot is reused
+            dev.results[next & (ringSlots - 1)].store(rv, std::memory_order_release);
+            dev.completed.store(next + 1, std::memory_order_release);
+            cmd.seq.store(next + ringSlots, std::memory_order_release);
+            ++next;
+
+            dev.done.store(static_cast<uint32_t>(next), std::memory_order_seq_cst);
+            if(dev.doneWaiters.load(std::memory_order_seq_cst) > 0)
+            {
+                futexWake(dev.done);
+            }
+
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(now >= nextStatus)
+        {
+            updateStatus(d, st);
+            nextStatus = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_statusPeriod.load());
+            continue;
+        }
+
+        //Sleep until the next status update or a client rings.  sleeping is set before the doorbell is read, so a
+        //client which publishes after the read sees it and wakes us, and one which publishes before changes the
+        //doorbell so the futex returns at once.
+        dev.sleeping.store(1, std::memory_order_seq_cst);
+        uint32_t db = dev.doorbell.load(std::memory_order_seq_cst);
+
+        if(cmd.seq.load(std::memory_order_acquire) != next + 1 && !m_stop)
+        {
+            futexWait(dev.doorbell, db, std::chrono::duration_cast<std::chrono::nanoseconds>(nextStatus - now).count());
+        }
+
+        dev.sleeping.store(0, std::memory_order_relaxed);
+    }
+
+    dev.heartbeatNs.store(0, std::memory_order_relaxed);
+}
+
+inline
+tmcClient::~tmcClient()
+{
+    close();
+}
+
+inline
+int tmcClient::open( const std::string & path,
+                     bool errmsg
+                   )
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDWR);
+    if(fd < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcClient::open: unable to open " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(tmcDaemon::header) + sizeof(tmcDaemon::device))
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcClient::open: " << path << " is not a daemon region\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    void * map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcClient::open: unable to map " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    tmcDaemon::header * hdr = static_cast<tmcDaemon::header *>(map);
+
+    if(memcmp(hdr->magic, "TMCDAEMN", 8) != 0 || hdr->version != 2 || hdr->ringSlots != tmcDaemon::ringSlots ||
+           hdr->deviceSize != sizeof(tmcDaemon::device) || hdr->nDevices == 0 || hdr->nDevices > tmcDaemon::maxDevices ||
+              static_cast<size_t>(st.st_size) != sizeof(tmcDaemon::header) + hdr->nDevices*sizeof(tmcDaemon::device))
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcClient::open: " << path << " is not a daemon region\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-7 << "\n";
+        }
+        munmap(map, st.st_size);
+        ::close(fd);
+        return -1;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    m_fd = fd;
+    m_mapSize = st.st_size;
+    m_header = hdr;
+    m_devices = reinterpret_cast<tmcDaemon::device *>(static_cast<char *>(map) + sizeof(tmcDaemon::header));
+    m_path = path;
+
+    return 0;
+}
+
+inline
+void tmcClient::close()
+{
+    if(m_header)
+    {
+        munmap(m_header, m_mapSize);
+    }
+
+    if(m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+
+    m_header = nullptr;
+    m_devices = nullptr;
+    m_mapSize = 0;
+    m_fd = -1;
+    m_path.clear();
+}
+
+inline
+bool tmcClient::isOpen()
+{
+    return (m_header != nullptr);
+}
+
+inline
+std::string tmcClient::path()
+{
+    return m_path;
+}
+
+inline
+size_t tmcClient::devices()
+{
+    return m_header ? m_header->nDevices : 0;
+}
+
+inline
+std::string tmcClient::name( size_t d )
+{
+    if(d >= devices())
+    {
+        return "";
+    }
+
+    return std::string(m_devices[d].serial, strnlen(m_devices[d].serial, sizeof(m_devices[d].serial)));
+}
+
+inline
+int tmcClient::find( const std::string & name )
+{
+    for(size_t d = 0; d < devices(); ++d)
+    {
+        if(this->name(d) == name)
+        {
+            return d;
+        }
+    }
+
+    return -1000;
+}
+
+inline
+bool tmcClient::alive( size_t d,
+                       double maxAge
+                     )
+{
+    if(d >= devices() || m_header->running.load(std::memory_order_relaxed) == 0)
+    {
+        return false;
+    }
+
+    int64_t hb = m_devices[d].heartbeatNs.load(std::memory_order_relaxed);
+    if(hb == 0)
+    {
+        return false;
+    }
+
+    if(maxAge <= 0)
+    {
+        int64_t gap = m_devices[d].maxGapNs.load(std::memory_order_relaxed);
+        if(gap == 0)
+        {
+            return true;
+        }
+
+        maxAge = 2e-9*gap;
+    }
+
+    return (1e-9*(tmcDaemon::realtimeNs() - hb) <= maxAge);
+}
+
+inline
+int tmcClient::submit( size_t d,
+                       uint32_t op,
+                       float value,
+                       uint64_t * ticket
+                     ) noexcept
+{
+    if(m_header == nullptr || m_header->running.load(std::memory_order_relaxed) == 0)
+    {
+        return -900;
+    }
+
+    if(d >= m_header->nDevices)
+    {
+        return -1000;
+    }
+
+    tmcDaemon::device & dev = m_devices[d];
+
+    //claim the next slot, as in a bounded multi-producer queue
+    uint64_t pos = dev.enqueue.load(std::memory_order_relaxed);
+    tmcDaemon::command * cmd;
+    while(true)
+    {
+        cmd = &dev.ring[pos & (tmcDaemon::ringSlots - 1)];
+        uint64_t seq = cmd->seq.load(std::memory_order_acquire);
+
+        if(seq == pos)
+        {
+            if(dev.enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(seq < pos)
+        {
+            return -950; //the slot still holds the command from one lap ago
+        }
+        else
+        {
+            pos = dev.enqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    cmd->op = op;
+    cmd->value = value;
+    cmd->seq.store(pos + 1, std::memory_order_seq_cst);
+
+    //see tmcDaemon::serve for the other half of this handshake
+    dev.doorbell.fetch_add(1, std::memory_order_seq_cst);
+    if(dev.sleeping.load(std::memory_order_seq_cst))
+    {
+        tmcDaemon::futexWake(dev.doorbell);
+    }
+
+    if(ticket)
+    {
+        *ticket = pos;
+    }
+
+    return 0;
+}
+
+inline
+int tmcClient::setOutputVolts( size_t d,
+                               float ov,
+                               uint64_t * ticket
+                             ) noexcept
+{
+    return submit(d, tmcDaemon::opSetOutputVolts, ov, ticket);
+}
+
+inline
+int tmcClient::setOutputPos( size_t d,
+                             float pos,
+                             uint64_t * ticket
+                           ) noexcept
+{
+    return submit(d, tmcDaemon::opSetOutputPos, pos, ticket);
+}
+
+inline
+int tmcClient::wait( size_t d,
+                     uint64_t ticket,
+                     int & result,
+                     uint32_t timeoutMs
+                   )
+{
+    if(m_header == nullptr)
+    {
+        return -900;
+    }
+
+    if(d >= m_header->nDevices)
+    {
+        return -1000;
+    }
+
+    tmcDaemon::device & dev = m_devices[d];
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while(dev.completed.load(std::memory_order_acquire) <= ticket)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if(now >= deadline)
+        {
+            return -320;
+        }
+
+        dev.doneWaiters.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t done = dev.done.load(std::memory_order_seq_cst);
+
+        if(dev.completed.load(std::memory_order_acquire) <= ticket)
+        {
+            tmcDaemon::futexWait(dev.done, done, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count());
+        }
+
+        dev.doneWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if(dev.completed.load(std::memory_order_acquire) - ticket > tmcDaemon::ringSlots)
+    {
+        return -1000; //the slot has been reused
+    }
+
+    tmcDaemon::command & cmd = dev.ring[ticket & (tmcDaemon::ringSlots - 1)];
+
+    int rv = dev.results[ticket & (tmcDaemon::ringSlots - 1)].load(std::memory_order_acquire);
+
+    //A result of the command in the next lap is stored after that command is published, so if it is not published
+    //yet the result read is this one
+    if(cmd.seq.load(std::memory_order_acquire) > ticket + tmcDaemon::ringSlots)
+    {
+        return -1000;
+    }
+
+    result = rv;
+
+    return 0;
+}
+
+inline
+int tmcClient::status( size_t d,
+                       tmcDaemon::Status & st
+                     ) noexcept
+{
+    if(m_header == nullptr)
+    {
+        return -900;
+    }
+
+    if(d >= m_header->nDevices)
+    {
+        return -1000;
+    }
+
+    tmcDaemon::device & dev = m_devices[d];
+
+    uint32_t seq0, seq1;
+    do
+    {
+        seq0 = dev.statusSeq.load(std::memory_order_acquire);
+        if(seq0 & 1)
+        {
+            continue;
+        }
+
+        st = dev.status;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = dev.statusSeq.load(std::memory_order_relaxed);
+    } while((seq0 & 1) || seq0 != seq1);
+
+    return 0;
+}
+
+#endif //tmcDaemon_hpp
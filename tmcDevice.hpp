@@ -0,0 +1,589 @@
+/** \file tmcDevice.hpp
+ *  \brief tmcController specialized at compile time for a specific controller model
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcDevice_hpp
+#define tmcDevice_hpp
+
+#include <tuple>
+#include <type_traits>
+
+#include "tmcController.hpp"
+
+/// Traits of the Thorlabs controller models supported by \ref tmcDevice
+/** Each model type lists the APT messages the device accepts in \c messages, using the descriptors in
+  * \ref tmcApt, and gives its number of channels.
+  */
+namespace tmcModel
+{
+
+/// The messages accepted by every APT controller
+typedef std::tuple< tmcApt::MOD_IDENTIFY,
+                    tmcApt::MOD_SET_CHANENABLESTATE,
+                    tmcApt::MOD_REQ_CHANENABLESTATE,
+                    tmcApt::HW_STOP_UPDATEMSGS,
+                    tmcApt::HW_REQ_INFO > genericMessages;
+
+/// The messages accepted by the piezo drivers
+typedef std::tuple< tmcApt::PZ_SET_POSCONTROLMODE,
+                    tmcApt::PZ_REQ_POSCONTROLMODE,
+                    tmcApt::PZ_SET_OUTPUTVOLTS,
+                    tmcApt::PZ_REQ_OUTPUTVOLTS,
+                    tmcApt::PZ_SET_OUTPUTPOS,
+                    tmcApt::PZ_REQ_OUTPUTPOS,
+                    tmcApt::PZ_REQ_PZSTATUSUPDATE,
+                    tmcApt::PZ_SET_OUTPUTLUT,
+                    tmcApt::PZ_REQ_OUTPUTLUT,
+                    tmcApt::PZ_SET_OUTPUTLUTPARAMS,
+                    tmcApt::PZ_REQ_OUTPUTLUTPARAMS,
+                    tmcApt::PZ_START_LUTOUTPUT,
+                    tmcApt::PZ_STOP_LUTOUTPUT,
+                    tmcApt::PZ_SET_TPZ_IOSETTINGS,
+                    tmcApt::PZ_REQ_TPZ_IOSETTINGS > piezoMessages;
+
+/// KPZ101 K-Cube piezo driver
+struct KPZ101
+{
+    static constexpr const char * name = "KPZ101"; ///< The model name
+    static constexpr uint16_t nChannels = 1;       ///< The number of channels
+
+    /// The supported messages
+    typedef decltype(std::tuple_cat( genericMessages{},
+                                     piezoMessages{},
+                                     std::tuple< tmcApt::KPZ_SET_KCUBEMMIPARAMS,
+                                                 tmcApt::KPZ_REQ_KCUBEMMIPARAMS >{} )) messages;
+};
+
+/// TPZ001 T-Cube piezo driver
+struct TPZ001
+{
+    static constexpr const char * name = "TPZ001"; ///< The model name
+    static constexpr uint16_t nChannels = 1;       ///< The number of channels
+
+    /// The supported messages
+    typedef decltype(std::tuple_cat( genericMessages{},
+                                     piezoMessages{},
+                                     std::tuple< tmcApt::PZ_SET_TPZ_DISPSETTINGS,
+                                                 tmcApt::PZ_REQ_TPZ_DISPSETTINGS >{} )) messages;
+};
+
+/// KSG101 K-Cube strain gauge reader
+/** Only the generic messages are implemented in tmcController for this device so far.
+  */
+struct KSG101
+{
+    static constexpr const char * name = "KSG101"; ///< The model name
+    static constexpr uint16_t nChannels = 1;       ///< The number of channels
+
+    /// The supported messages
+    typedef genericMessages messages;
+};
+
+/// Test whether a message type is in a tuple of messages, implementation of \ref supports
+template<class msgT, class... msgTs>
+constexpr bool inMessages( std::tuple<msgTs...> * )
+{
+    return (std::is_same<msgT, msgTs>::value || ...);
+}
+
+/// True if the model \p modelT accepts the message \p msgT
+template<class modelT, class msgT>
+constexpr bool supports = inMessages<msgT>(static_cast<typename modelT::messages *>(nullptr));
+
+} // namespace tmcModel
+
+/// A tmcController for a specific controller model
+/** Exposes only the commands the model supports, as listed in its \ref tmcModel traits.  Calling a command the
+  * device does not accept is a compile error, e.g. \c kpz_set_kcubemmiparams on a \c tmcDevice<tmcModel::TPZ001>.
+  * The commands forward inline to tmcController, so there is no runtime cost and no runtime capability check.
+  * The commands of the real-time \ref session are checked the same way.
+  *
+  * Connection management and configuration are the same as tmcController.
+  *
+  * \tparam modelT one of the model types in \ref tmcModel
+  */
+template<class modelT>
+class tmcDevice : protected tmcController
+{
+public:
+
+    typedef modelT model; ///< The model traits
+
+    static constexpr uint16_t nChannels = modelT::nChannels; ///< The number of channels
+
+    /// True if this model accepts the message \p msgT
+    template<class msgT>
+    static constexpr bool supports = tmcModel::supports<modelT, msgT>;
+
+    using tmcController::EnableState;
+    using tmcController::HWInfo;
+    using tmcController::PZStatus;
+    using tmcController::PosControlMode;
+    using tmcController::LUTMode;
+    using tmcController::LUTParams;
+    using tmcController::lutMaxEntries;
+    using tmcController::VoltLimit;
+    using tmcController::TPZIOSettings;
+    using tmcController::KMMIParams;
+    using tmcController::LUTUploadStats;
+    using tmcController::LUTCacheRecord;
+
+    using tmcController::ftdi;
+    using tmcController::vendor;
+    using tmcController::product;
+    using tmcController::serial;
+    using tmcController::baud;
+    using tmcController::preFlushSleep;
+    using tmcController::postFlushSleep;
+    using tmcController::open;
+    using tmcController::close;
+    using tmcController::connect;
+    using tmcController::opened;
+    using tmcController::connected;
+    using tmcController::totrd;
+    using tmcController::postChanEnableSleep;
+    using tmcController::LinkState;
+    using tmcController::failFast;
+    using tmcController::reconnectMinBackoff;
+    using tmcController::reconnectMaxBackoff;
+    using tmcController::breakerThreshold;
+    using tmcController::breakerCoolDown;
+    using tmcController::startReconnect;
+    using tmcController::stopReconnect;
+    using tmcController::linkState;
+    using tmcController::reconnectAttempts;
+    using tmcController::breakerTrips;
+    using tmcController::AppliedState;
+    using tmcController::ReconnectReport;
+    using tmcController::restoreOnReconnect;
+    using tmcController::appliedState;
+    using tmcController::clearAppliedState;
+    using tmcController::lastReconnect;
+    using tmcController::totalDowntime;
+    using tmcController::bumplessRestart;
+    using tmcController::lastOutputVolts;
+    using tmcController::reapplyState;
+    using tmcController::journalOpen;
+    using tmcController::journalClose;
+    using tmcController::journalPath;
+    using tmcController::ErrorCategory;
+    using tmcController::errorCategoryName;
+    using tmcController::Error;
+    using tmcController::lastError;
+    using tmcController::clearError;
+    using tmcController::logSink;
+    using tmcController::wireTrace;
+    using tmcController::replay;
+    using tmcController::latencySubBuckets;
+    using tmcController::latencyBuckets;
+    using tmcController::latencySlots;
+    using tmcController::LatencyHistogram;
+    using tmcController::latencySnapshot;
+    using tmcController::latencyReset;
+    using tmcController::Phase;
+    using tmcController::phaseCount;
+    using tmcController::phaseName;
+    using tmcController::PhaseTimes;
+    using tmcController::phaseTiming;
+    using tmcController::lastPhases;
+    using tmcController::worstPhases;
+    using tmcController::connectPhases;
+    using tmcController::phaseReset;
+    using tmcController::timeline;
+    using tmcController::counterSlots;
+    using tmcController::MessageCounters;
+    using tmcController::Counters;
+    using tmcController::counters;
+    using tmcController::messageCounters;
+    using tmcController::countersReset;
+    using tmcController::readTimeout;
+    using tmcController::lastStatus;
+
+    /// Get the underlying tmcController
+    /** For code written against tmcController.  This bypasses the compile-time checks.
+      *
+      * \returns a reference to this object as a tmcController
+      */
+    tmcController & controller()
+    {
+        return *this;
+    }
+
+/** \name Generic Commands
+  * @{
+  */
+
+    /// Identify the device by flashing the front panel LEDs. See \ref tmcController::mod_identify
+    int mod_identify( bool errmsg = true )
+    {
+        static_assert(supports<tmcApt::MOD_IDENTIFY>, "MGMSG_MOD_IDENTIFY is not supported by this device");
+        return tmcController::mod_identify(errmsg);
+    }
+
+    /// Set the channel enable state. See \ref tmcController::mod_set_chanenablestate
+    int mod_set_chanenablestate( const uint8_t & chnum,
+                                 const EnableState & ces,
+                                 bool errmsg = true
+                               )
+    {
+        static_assert(supports<tmcApt::MOD_SET_CHANENABLESTATE>, "MGMSG_MOD_SET_CHANENABLESTATE is not supported by this device");
+        return tmcController::mod_set_chanenablestate(chnum, ces, errmsg);
+    }
+
+    /// Get the channel enable state. See \ref tmcController::mod_req_chanenablestate
+    int mod_req_chanenablestate( EnableState & ces,
+                                 const uint8_t & chnum,
+                                 bool errmsg = true
+                               )
+    {
+        static_assert(supports<tmcApt::MOD_REQ_CHANENABLESTATE>, "MGMSG_MOD_REQ_CHANENABLESTATE is not supported by this device");
+        return tmcController::mod_req_chanenablestate(ces, chnum, errmsg);
+    }
+
+    /// Stop automatic update messages. See \ref tmcController::hw_stop_updatemsgs
+    int hw_stop_updatemsgs( bool errmsg = true )
+    {
+        static_assert(supports<tmcApt::HW_STOP_UPDATEMSGS>, "MGMSG_HW_STOP_UPDATEMSGS is not supported by this device");
+        return tmcController::hw_stop_updatemsgs(errmsg);
+    }
+
+    /// Get the hardware information. See \ref tmcController::hw_req_info
+    int hw_req_info( HWInfo & hwi,
+                     bool errmsg = true
+                   )
+    {
+        static_assert(supports<tmcApt::HW_REQ_INFO>, "MGMSG_HW_REQ_INFO is not supported by this device");
+        return tmcController::hw_req_info(hwi, errmsg);
+    }
+
+///@}
+
+/** \name Piezo Commands
+  * @{
+  */
+
+    /// Set the position control mode. See \ref tmcController::pz_set_poscontrolmode
+    int pz_set_poscontrolmode( const PosControlMode & pcm,
+                               bool errmsg = true
+                             )
+    {
+        static_assert(supports<tmcApt::PZ_SET_POSCONTROLMODE>, "MGMSG_PZ_SET_POSCONTROLMODE is not supported by this device");
+        return tmcController::pz_set_poscontrolmode(pcm, errmsg);
+    }
+
+    /// Get the position control mode. See \ref tmcController::pz_req_poscontrolmode
+    int pz_req_poscontrolmode( PosControlMode & pcm,
+                               bool errmsg = true
+                             )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_POSCONTROLMODE>, "MGMSG_PZ_REQ_POSCONTROLMODE is not supported by this device");
+        return tmcController::pz_req_poscontrolmode(pcm, errmsg);
+    }
+
+    /// Set the output voltage. See \ref tmcController::pz_set_outputvolts
+    int pz_set_outputvolts( const float & ov,
+                            bool errmsg = true
+                          )
+    {
+        static_assert(supports<tmcApt::PZ_SET_OUTPUTVOLTS>, "MGMSG_PZ_SET_OUTPUTVOLTS is not supported by this device");
+        return tmcController::pz_set_outputvolts(ov, errmsg);
+    }
+
+    /// Get the output voltage. See \ref tmcController::pz_req_outputvolts
+    int pz_req_outputvolts( float & ov,
+                            bool errmsg = true
+                          )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_OUTPUTVOLTS>, "MGMSG_PZ_REQ_OUTPUTVOLTS is not supported by this device");
+        return tmcController::pz_req_outputvolts(ov, errmsg);
+    }
+
+    /// Set the closed loop position. See \ref tmcController::pz_set_outputpos
+    int pz_set_outputpos( const float & pos,
+                          bool errmsg = true
+                        )
+    {
+        static_assert(supports<tmcApt::PZ_SET_OUTPUTPOS>, "MGMSG_PZ_SET_OUTPUTPOS is not supported by this device");
+        return tmcController::pz_set_outputpos(pos, errmsg);
+    }
+
+    /// Get the closed loop position. See \ref tmcController::pz_req_outputpos
+    int pz_req_outputpos( float & pos,
+                          bool errmsg = true
+                        )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_OUTPUTPOS>, "MGMSG_PZ_REQ_OUTPUTPOS is not supported by this device");
+        return tmcController::pz_req_outputpos(pos, errmsg);
+    }
+
+    /// Get the piezo status. See \ref tmcController::pz_req_pzstatusupdate
+    int pz_req_pzstatusupdate( PZStatus & pzs,
+                               bool errmsg = true
+                             )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_PZSTATUSUPDATE>, "MGMSG_PZ_REQ_PZSTATUSUPDATE is not supported by this device");
+        return tmcController::pz_req_pzstatusupdate(pzs, errmsg);
+    }
+
+///@}
+
+/** \name Output LUT Commands
+  * @{
+  */
+
+    using tmcController::volts2counts;
+    using tmcController::voltLimit;
+    using tmcController::voltLimitVolts;
+    using tmcController::lutChunkEntries;
+    using tmcController::lutCachePath;
+    using tmcController::lutCacheVerify;
+    using tmcController::lutCache;
+    using tmcController::lutCacheClear;
+
+    /// Set one entry of the output LUT. See \ref tmcController::pz_set_outputlut
+    int pz_set_outputlut( const uint16_t & index,
+                          const float & ov,
+                          bool errmsg = true
+                        )
+    {
+        static_assert(supports<tmcApt::PZ_SET_OUTPUTLUT>, "MGMSG_PZ_SET_OUTPUTLUT is not supported by this device");
+        return tmcController::pz_set_outputlut(index, ov, errmsg);
+    }
+
+    /// Set the output LUT parameters. See \ref tmcController::pz_set_outputlutparams
+    int pz_set_outputlutparams( const LUTParams & lutp,
+                                bool errmsg = true
+                              )
+    {
+        static_assert(supports<tmcApt::PZ_SET_OUTPUTLUTPARAMS>, "MGMSG_PZ_SET_OUTPUTLUTPARAMS is not supported by this device");
+        return tmcController::pz_set_outputlutparams(lutp, errmsg);
+    }
+
+    /// Get the output LUT parameters. See \ref tmcController::pz_req_outputlutparams
+    int pz_req_outputlutparams( LUTParams & lutp,
+                                bool errmsg = true
+                              )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_OUTPUTLUTPARAMS>, "MGMSG_PZ_REQ_OUTPUTLUTPARAMS is not supported by this device");
+        return tmcController::pz_req_outputlutparams(lutp, errmsg);
+    }
+
+    /// Start the LUT output. See \ref tmcController::pz_start_lutoutput
+    int pz_start_lutoutput( bool errmsg = true )
+    {
+        static_assert(supports<tmcApt::PZ_START_LUTOUTPUT>, "MGMSG_PZ_START_LUTOUTPUT is not supported by this device");
+        return tmcController::pz_start_lutoutput(errmsg);
+    }
+
+    /// Stop the LUT output. See \ref tmcController::pz_stop_lutoutput
+    int pz_stop_lutoutput( bool errmsg = true )
+    {
+        static_assert(supports<tmcApt::PZ_STOP_LUTOUTPUT>, "MGMSG_PZ_STOP_LUTOUTPUT is not supported by this device");
+        return tmcController::pz_stop_lutoutput(errmsg);
+    }
+
+    /// Upload the complete output LUT and its parameters. See \ref tmcController::pz_upload_outputlut
+    int pz_upload_outputlut( const float * ov,
+                             uint16_t n,
+                             const LUTParams & lutp,
+                             LUTUploadStats * stats = nullptr,
+                             bool errmsg = true
+                           )
+    {
+        static_assert(supports<tmcApt::PZ_SET_OUTPUTLUT> && supports<tmcApt::PZ_SET_OUTPUTLUTPARAMS>,
+                                                                      "the output LUT is not supported by this device");
+        return tmcController::pz_upload_outputlut(ov, n, lutp, stats, errmsg);
+    }
+
+///@}
+
+/** \name Device Settings Commands
+  * @{
+  */
+
+    /// Set the TPZ display intensity. See \ref tmcController::pz_set_tpz_dispsettings
+    int pz_set_tpz_dispsettings( const uint16_t & dispint,
+                                 bool errmsg = true
+                               )
+    {
+        static_assert(supports<tmcApt::PZ_SET_TPZ_DISPSETTINGS>, "MGMSG_PZ_SET_TPZ_DISPSETTINGS is not supported by this device");
+        return tmcController::pz_set_tpz_dispsettings(dispint, errmsg);
+    }
+
+    /// Get the TPZ display intensity. See \ref tmcController::pz_req_tpz_dispsettings
+    int pz_req_tpz_dispsettings( uint16_t & dispint,
+                                 bool errmsg = true
+                               )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_TPZ_DISPSETTINGS>, "MGMSG_PZ_REQ_TPZ_DISPSETTINGS is not supported by this device");
+        return tmcController::pz_req_tpz_dispsettings(dispint, errmsg);
+    }
+
+    /// Set the I/O settings. See \ref tmcController::pz_set_tpz_iosettings
+    int pz_set_tpz_iosettings( const TPZIOSettings & tios,
+                               bool errmsg = true
+                             )
+    {
+        static_assert(supports<tmcApt::PZ_SET_TPZ_IOSETTINGS>, "MGMSG_PZ_SET_TPZ_IOSETTINGS is not supported by this device");
+        return tmcController::pz_set_tpz_iosettings(tios, errmsg);
+    }
+
+    /// Get the I/O settings. See \ref tmcController::pz_req_tpz_iosettings
+    int pz_req_tpz_iosettings( TPZIOSettings & tios,
+                               bool errmsg = true
+                             )
+    {
+        static_assert(supports<tmcApt::PZ_REQ_TPZ_IOSETTINGS>, "MGMSG_PZ_REQ_TPZ_IOSETTINGS is not supported by this device");
+        return tmcController::pz_req_tpz_iosettings(tios, errmsg);
+    }
+
+    /// Set the K-Cube MMI parameters. See \ref tmcController::kpz_set_kcubemmiparams
+    int kpz_set_kcubemmiparams( const KMMIParams & kmp,
+                                bool errmsg = true
+                              )
+    {
+        static_assert(supports<tmcApt::KPZ_SET_KCUBEMMIPARAMS>, "MGMSG_KPZ_SET_KCUBEMMIPARAMS is not supported by this device");
+        return tmcController::kpz_set_kcubemmiparams(kmp, errmsg);
+    }
+
+    /// Get the K-Cube MMI parameters. See \ref tmcController::kpz_req_kcubemmiparams
+    int kpz_req_kcubemmiparams( KMMIParams & kmp,
+                                bool errmsg = true
+                              )
+    {
+        static_assert(supports<tmcApt::KPZ_REQ_KCUBEMMIPARAMS>, "MGMSG_KPZ_REQ_KCUBEMMIPARAMS is not supported by this device");
+        return tmcController::kpz_req_kcubemmiparams(kmp, errmsg);
+    }
+
+///@}
+
+/** \name Real-Time Session
+  * @{
+  */
+
+    /// Handle to a connected device, for use in control loops. See \ref tmcController::session
+    /** Wraps tmcController::session so that its commands have the same compile-time checks as those of tmcDevice.
+      * Can only be obtained from \ref connect(std::optional<session>&, bool).
+      */
+    class session
+    {
+    protected:
+        tmcController::session m_ses; ///< The session of the underlying tmcController
+
+        /// C'tor, only callable by tmcDevice
+        explicit session( const tmcController::session & ses /**< [in] the session of the underlying tmcController */) : m_ses(ses)
+        {
+        }
+
+        friend class tmcDevice;
+
+    public:
+
+        /// Get the underlying tmcController
+        /** This bypasses the compile-time checks.
+          *
+          * \returns a reference to the controller
+          */
+        tmcController & controller()
+        {
+            return m_ses.controller();
+        }
+
+        /// Set the output voltage. See \ref tmcController::session::pz_set_outputvolts
+        int pz_set_outputvolts( const float & ov,
+                                bool errmsg = true
+                              ) noexcept
+        {
+            static_assert(supports<tmcApt::PZ_SET_OUTPUTVOLTS>, "MGMSG_PZ_SET_OUTPUTVOLTS is not supported by this device");
+            return m_ses.pz_set_outputvolts(ov, errmsg);
+        }
+
+        /// Get the output voltage. See \ref tmcController::session::pz_req_outputvolts
+        int pz_req_outputvolts( float & ov,
+                                bool errmsg = true
+                              ) noexcept
+        {
+            static_assert(supports<tmcApt::PZ_REQ_OUTPUTVOLTS>, "MGMSG_PZ_REQ_OUTPUTVOLTS is not supported by this device");
+            return m_ses.pz_req_outputvolts(ov, errmsg);
+        }
+
+        /// Set the closed loop position. See \ref tmcController::session::pz_set_outputpos
+        int pz_set_outputpos( const float & pos,
+                              bool errmsg = true
+                            ) noexcept
+        {
+            static_assert(supports<tmcApt::PZ_SET_OUTPUTPOS>, "MGMSG_PZ_SET_OUTPUTPOS is not supported by this device");
+            return m_ses.pz_set_outputpos(pos, errmsg);
+        }
+
+        /// Get the closed loop position. See \ref tmcController::session::pz_req_outputpos
+        int pz_req_outputpos( float & pos,
+                              bool errmsg = true
+                            ) noexcept
+        {
+            static_assert(supports<tmcApt::PZ_REQ_OUTPUTPOS>, "MGMSG_PZ_REQ_OUTPUTPOS is not supported by this device");
+            return m_ses.pz_req_outputpos(pos, errmsg);
+        }
+
+        /// Get the piezo status. See \ref tmcController::session::pz_req_pzstatusupdate
+        int pz_req_pzstatusupdate( PZStatus & pzs,
+                                   bool errmsg = true
+                                 ) noexcept
+        {
+            static_assert(supports<tmcApt::PZ_REQ_PZSTATUSUPDATE>, "MGMSG_PZ_REQ_PZSTATUSUPDATE is not supported by this device");
+            return m_ses.pz_req_pzstatusupdate(pzs, errmsg);
+        }
+    };
+
+    /// Connect to the device and obtain a \ref session handle. See \ref tmcController::connect(std::optional<session>&, bool)
+    /**
+      * \returns 0 on success
+      * \returns < 0 on error from \ref tmcController::connect(bool)
+      */
+    int connect( std::optional<session> & ses,
+                 bool errmsg = true
+               )
+    {
+        std::optional<tmcController::session> cses;
+
+        int rv = tmcController::connect(cses, errmsg);
+        if(rv < 0)
+        {
+            ses.reset();
+            return rv;
+        }
+
+        ses = session(*cses);
+
+        return 0;
+    }
+
+    /// The unchecked session of the underlying tmcController is not available, use \ref session
+    int connect( std::optional<tmcController::session> & ses,
+                 bool errmsg = true
+               ) = delete;
+
+///@}
+
+};
+
+#endif //tmcDevice_hpp
@@ -0,0 +1,580 @@
+/** \file tmcExporter.hpp
+ *  \brief Declare and define the tmcExporter metrics exporter
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcExporter_hpp
+#define tmcExporter_hpp
+
+#include <sstream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tmcController.hpp"
+
+/// Serves the counters, latency histograms, and last status of devices as Prometheus text metrics
+/** A background thread listens on a Unix domain socket.  Each connection receives the current metrics in the
+  * Prometheus text exposition format, and is closed.  A client which sends an HTTP GET request first receives an HTTP
+  * response, so the socket can be scraped through an HTTP-to-Unix-socket proxy, while a plain client such as
+  * `socat - UNIX-CONNECT:path` receives just the text.
+  *
+  * The metrics are built from \ref tmcController::counters, \ref tmcController::messageCounters,
+  * \ref tmcController::latencySnapshot, and \ref tmcController::lastStatus, which read atomics written by the
+  * command threads.  A scrape never touches the USB link and never takes a lock held by a command.
+  */
+class tmcExporter
+{
+protected:
+
+    /// A device being exported
+    struct device
+    {
+        tmcController * tmcc {nullptr}; ///< The controller, not owned
+        std::string name;               ///< The value of the device label
+    };
+
+    /// The devices being exported
+    std::vector<device> m_devices;
+
+    /// The path of the socket
+    std::string m_path;
+
+    /// The listening socket
+    int m_fd {-1};
+
+    /// The thread serving the socket
+    std::thread m_thread;
+
+    /// Flag indicating that the thread is running
+    std::atomic<bool> m_running {false};
+
+    /// Flag telling the thread to stop
+    std::atomic<bool> m_stop {false};
+
+    /// The number of scrapes served
+    std::atomic<uint64_t> m_scrapes {0};
+
+    /// The time in ms to wait for a client to send its request.  Default is 50 ms.
+    int m_requestWait {50};
+
+    /// The main loop of the serving thread
+    void run();
+
+    /// Serve one connection
+    void serve( int cfd /**< [in] the connected socket */);
+
+    /// Escape a label value
+    /**
+      * \returns the escaped value
+      */
+    static std::string escape( const std::string & s /**< [in] the label value */);
+
+public:
+
+    /// D'tor, stops the thread
+    ~tmcExporter();
+
+    /// Add a device to export
+    /** Must be called before \ref start.  The controller must outlive the exporter or be exported only while it
+      * exists.
+      *
+      * \returns 0 on success
+      * \returns -1000 if the exporter is running or tmcc is null
+      */
+    int add( tmcController * tmcc,     ///< [in] the controller
+             const std::string & name  ///< [in] the value of the device label, e.g. the serial number
+           );
+
+    /// Start serving on a Unix domain socket
+    /** A stale socket at the path is removed first.  Any other kind of file at the path is left alone, and is an
+      * error.
+      *
+      * \returns 0 on success
+      * \returns -1 on error creating, binding, or listening on the socket, or if the path exists and is not a socket
+      * \returns -700 if the thread can not be started
+      * \returns -1000 if already running
+      */
+    int start( const std::string & path, ///< [in] the path of the socket
+               bool errmsg = true        ///< [in] [optional] flag controlling if an error message is printed on failure
+             );
+
+    /// Stop serving, close and remove the socket
+    void stop();
+
+    /// Check if the exporter is running
+    /**
+      * \returns true if running
+      */
+    bool running();
+
+    /// Get the path of the socket
+    /** \see m_path
+      *
+      * \returns the current value of m_path
+      */
+    std::string path();
+
+    /// Get the number of scrapes served
+    /**
+      * \returns the current value of m_scrapes
+      */
+    uint64_t scrapes();
+
+    /// Write the metrics of all devices in the Prometheus text exposition format
+    /**
+      * \tparam streamT is an std::iostream like class
+      */
+    template<class streamT>
+    void metrics( streamT & ios /**< [out] the stream to write to*/);
+};
+
+inline
+tmcExporter::~tmcExporter()
+{
+    stop();
+}
+
+inline
+int tmcExporter::add( tmcController * tmcc,
+                      const std::string & name
+                    )
+{
+    if(m_running || tmcc == nullptr)
+    {
+        return -1000;
+    }
+
+    device d;
+    d.tmcc = tmcc;
+    d.name = name;
+    m_devices.push_back(d);
+
+    return 0;
+}
+
+inline
+int tmcExporter::start( const std::string & path,
+                        bool errmsg
+                      )
+{
+    if(m_running)
+    {
+        return -1000;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcExporter::start: socket path too long: " << path << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcExporter::start: unable to create socket: " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+
+    //remove a stale socket left by a previous exporter, but never any other kind of file
+    struct stat st;
+    if(lstat(path.c_str(), &st) == 0)
+    {
+        if(!S_ISSOCK(st.st_mode))
+        {
+            if(errmsg)
+            {
+                std::cerr << "tmcExporter::start: " << path << " exists and is not a socket\n";
+                std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+            }
+            ::close(fd);
+            return -1;
+        }
+
+        unlink(path.c_str());
+    }
+
+    if(bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 8) < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcExporter::start: unable to listen on " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    m_fd = fd;
+    m_path = path;
+    m_stop = false;
+
+    try
+    {
+        m_thread = std::thread(&tmcExporter::run, this);
+    }
+    catch(const std::exception & e)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcExporter::start: exception starting thread: " << e.what() << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-8 << "\n";
+        }
+        ::close(m_fd);
+        m_fd = -1;
+        unlink(m_path.c_str());
+        return -700;
+    }
+
+    m_running = true;
+
+    return 0;
+}
+
+inline
+void tmcExporter::stop()
+{
+    if(!m_running)
+    {
+        return;
+    }
+
+    m_stop = true;
+
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+
+    ::close(m_fd);
+    m_fd = -1;
+    unlink(m_path.c_str());
+
+    m_running = false;
+}
+
+inline
+bool tmcExporter::running()
+{
+    return m_running;
+}
+
+inline
+std::string tmcExporter::path()
+{
+    return m_path;
+}
+
+inline
+uint64_t tmcExporter::scrapes()
+{
+    return m_scrapes;
+}
+
+inline
+void tmcExporter::run()
+{
+    while(!m_stop)
+    {
+        pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        //wake up periodically to check m_stop
+        if(poll(&pfd, 1, 100) <= 0)
+        {
+            continue;
+        }
+
+        int cfd = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(cfd < 0)
+        {
+            continue;
+        }
+
+        try
+        {
+            serve(cfd);
+        }
+        catch(...)
+        {
+            //a failed scrape must not stop the exporter
+        }
+
+        ::close(cfd);
+    }
+}
+
+inline
+void tmcExporter::serve( int cfd )
+{
+    bool http = false;
+
+    pollfd pfd;
+    pfd.fd = cfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if(poll(&pfd, 1, m_requestWait) > 0)
+    {
+        char req[1024];
+        ssize_t rd = recv(cfd, req, sizeof(req), 0);
+        http = (rd >= 4 && strncmp(req, "GET ", 4) == 0);
+    }
+
+    std::ostringstream body;
+    metrics(body);
+    std::string out = body.str();
+
+    if(http)
+    {
+        std::string hdr = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+        hdr += std::to_string(out.size()) + "\r\n\r\n";
+        out = hdr + out;
+    }
+
+    size_t sent = 0;
+    while(sent < out.size())
+    {
+        ssize_t wr = send(cfd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if(wr <= 0)
+        {
+            return;
+        }
+        sent += wr;
+    }
+
+    ++m_scrapes;
+}
+
+inline
+std::string tmcExporter::escape( const std::string & s )
+{
+    std::string e;
+    for(size_t n = 0; n < s.size(); ++n)
+    {
+        if(s[n] == '\\' || s[n] == '"')
+        {
+            e += '\\';
+            e += s[n];
+        }
+        else if(s[n] == '\n')
+        {
+            e += "\\n";
+        }
+        else
+        {
+            e += s[n];
+        }
+    }
+
+    return e;
+}
+
+template<class streamT>
+void tmcExporter::metrics( streamT & ios )
+{
+    //The latency histogram bucket bounds, in seconds
+    static constexpr double les[] = {1e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25,
+                                                                                                           0.5, 1, 2.5};
+
+    //Take all snapshots first, so each family is written from the same data
+    size_t nd = m_devices.size();
+    std::vector<std::string> labels(nd);
+    std::vector<bool> up(nd);
+    std::vector<tmcController::Counters> ctrs(nd);
+    std::vector<std::vector<tmcController::MessageCounters>> mcs(nd);
+    std::vector<std::vector<tmcController::LatencyHistogram>> hists(nd);
+    std::vector<tmcController::PZStatus> stats(nd);
+    std::vector<bool> haveStat(nd);
+
+    for(size_t d = 0; d < nd; ++d)
+    {
+        tmcController * tmcc = m_devices[d].tmcc;
+        labels[d] = "device=\"" + escape(m_devices[d].name) + "\"";
+        up[d] = tmcc->connected();
+        ctrs[d] = tmcc->counters();
+        mcs[d] = tmcc->messageCounters();
+        hists[d] = tmcc->latencySnapshot();
+        haveStat[d] = (tmcc->lastStatus(stats[d]) == 0);
+    }
+
+    char idstr[16];
+
+    auto family = [&ios](const char * name, const char * type, const char * help)
+    {
+        ios << "# HELP " << name << " " << help << "\n";
+        ios << "# TYPE " << name << " " << type << "\n";
+    };
+
+    family("tmcc_up", "gauge", "Whether the device is connected.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        ios << "tmcc_up{" << labels[d] << "} " << (up[d] ? 1 : 0) << "\n";
+    }
+
+    #define TMCC_EXPORT_COUNTER(metric, field, help)                                                    \
+        family(metric, "counter", help);                                                                \
+        for(size_t d = 0; d < nd; ++d)                                                                  \
+        {                                                                                               \
+            ios << metric << "{" << labels[d] << "} " << ctrs[d].field << "\n";                         \
+        }
+
+    TMCC_EXPORT_COUNTER("tmcc_frames_sent_total", framesSent, "Frames sent to the device.")
+    TMCC_EXPORT_COUNTER("tmcc_bytes_sent_total", bytesSent, "Bytes sent to the device.")
+    TMCC_EXPORT_COUNTER("tmcc_frames_received_total", framesReceived, "Frames received in responses.")
+    TMCC_EXPORT_COUNTER("tmcc_bytes_received_total", bytesReceived, "Bytes read from the device.")
+    TMCC_EXPORT_COUNTER("tmcc_flushes_total", flushes, "Flushes of the device buffers.")
+    TMCC_EXPORT_COUNTER("tmcc_read_timeouts_total", timeouts, "Reads which timed out.")
+    TMCC_EXPORT_COUNTER("tmcc_reconnects_total", reconnects, "Successful reconnections.")
+    TMCC_EXPORT_COUNTER("tmcc_reconnect_attempts_total", reconnectAttempts, "Reconnection attempts.")
+
+    #undef TMCC_EXPORT_COUNTER
+
+    family("tmcc_sleep_seconds_total", "counter", "Time requested in sleeps.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        ios << "tmcc_sleep_seconds_total{" << labels[d] << "} " << 1e-9*ctrs[d].sleepNs << "\n";
+    }
+
+    family("tmcc_link_send_utilization", "gauge", "Average fraction of the link baud rate used for sending.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        ios << "tmcc_link_send_utilization{" << labels[d] << "} " << ctrs[d].sendUtilization() << "\n";
+    }
+
+    family("tmcc_link_receive_utilization", "gauge", "Average fraction of the link baud rate used for receiving.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        ios << "tmcc_link_receive_utilization{" << labels[d] << "} " << ctrs[d].receiveUtilization() << "\n";
+    }
+
+    #define TMCC_EXPORT_MESSAGE(metric, field, help)                                                    \
+        family(metric, "counter", help);                                                                \
+        for(size_t d = 0; d < nd; ++d)                                                                  \
+        {                                                                                               \
+            for(size_t m = 0; m < mcs[d].size(); ++m)                                                   \
+            {                                                                                           \
+                snprintf(idstr, sizeof(idstr), "0x%04X", mcs[d][m].id);                                 \
+                ios << metric << "{" << labels[d] << ",id=\"" << idstr << "\"} " << mcs[d][m].field << "\n"; \
+            }                                                                                           \
+        }
+
+    TMCC_EXPORT_MESSAGE("tmcc_message_frames_sent_total", framesSent, "Frames sent, by APT message ID.")
+    TMCC_EXPORT_MESSAGE("tmcc_message_bytes_sent_total", bytesSent, "Bytes sent, by APT message ID.")
+    TMCC_EXPORT_MESSAGE("tmcc_message_frames_received_total", framesReceived, "Frames received, by APT message ID.")
+    TMCC_EXPORT_MESSAGE("tmcc_message_bytes_received_total", bytesReceived, "Bytes received, by APT message ID.")
+
+    #undef TMCC_EXPORT_MESSAGE
+
+    family("tmcc_command_latency_seconds", "histogram", "Command latency, by APT message ID.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        for(size_t h = 0; h < hists[d].size(); ++h)
+        {
+            const tmcController::LatencyHistogram & hist = hists[d][h];
+            snprintf(idstr, sizeof(idstr), "0x%04X", hist.id);
+
+            //the snapshot reads count and the buckets separately, so count the buckets to keep +Inf consistent
+            uint64_t count = 0;
+            for(uint32_t b = 0; b < tmcController::latencyBuckets; ++b)
+            {
+                count += hist.buckets[b];
+            }
+
+            for(size_t l = 0; l < sizeof(les)/sizeof(les[0]); ++l)
+            {
+                ios << "tmcc_command_latency_seconds_bucket{" << labels[d] << ",id=\"" << idstr << "\",le=\"" << les[l];
+                ios << "\"} " << hist.countBelow(les[l]) << "\n";
+            }
+            ios << "tmcc_command_latency_seconds_bucket{" << labels[d] << ",id=\"" << idstr << "\",le=\"+Inf\"} ";
+            ios << count << "\n";
+            ios << "tmcc_command_latency_seconds_sum{" << labels[d] << ",id=\"" << idstr << "\"} " << 1e-9*hist.totalNs;
+            ios << "\n";
+            ios << "tmcc_command_latency_seconds_count{" << labels[d] << ",id=\"" << idstr << "\"} " << count << "\n";
+        }
+    }
+
+    family("tmcc_output_voltage_ratio", "gauge", "Output voltage from the last status, as a fraction of maximum.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        if(haveStat[d])
+        {
+            ios << "tmcc_output_voltage_ratio{" << labels[d] << "} " << stats[d].voltage/32767.0 << "\n";
+        }
+    }
+
+    family("tmcc_position_ratio", "gauge", "Position from the last status, as a fraction of maximum travel.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        if(haveStat[d])
+        {
+            ios << "tmcc_position_ratio{" << labels[d] << "} " << stats[d].position/32767.0 << "\n";
+        }
+    }
+
+    family("tmcc_actuator_connected", "gauge", "Whether the piezo actuator is connected, from the last status.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        if(haveStat[d])
+        {
+            ios << "tmcc_actuator_connected{" << labels[d] << "} " << (stats[d].connected ? 1 : 0) << "\n";
+        }
+    }
+
+    family("tmcc_closed_loop", "gauge", "Whether the position control mode is closed-loop, from the last status.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        if(haveStat[d])
+        {
+            ios << "tmcc_closed_loop{" << labels[d] << "} " << (stats[d].pcMode ? 1 : 0) << "\n";
+        }
+    }
+
+    family("tmcc_status_age_seconds", "gauge", "Age of the last status.");
+    for(size_t d = 0; d < nd; ++d)
+    {
+        if(haveStat[d])
+        {
+            ios << "tmcc_status_age_seconds{" << labels[d] << "} " << stats[d].age() << "\n";
+        }
+    }
+
+    family("tmcc_exporter_scrapes_total", "counter", "Scrapes served by this exporter.");
+    ios << "tmcc_exporter_scrapes_total " << m_scrapes << "\n";
+}
+
+#endif //tmcExporter_hpp
@@ -0,0 +1,512 @@
+/** \file tmcLog.hpp
+ *  \brief Declare and define the tmcLog asynchronous log sink
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcLog_hpp
+#define tmcLog_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+/// A log record, small and trivially copyable so it can be passed through the \ref tmcLog ring
+struct tmcLogRecord
+{
+    std::chrono::system_clock::time_point time; ///< The time at which the record was made
+    char src[64] {};                            ///< The source of the record (the tmcController function), copied and truncated if needed
+    char file[64] {};                           ///< The file name, copied and truncated at the start if needed
+    int line {0};                               ///< The line number
+    int rv {0};                                 ///< The return value of the \libftdi1 function, if ftdi is true
+    bool ftdi {false};                          ///< Whether this record describes an error from a \libftdi1 function
+    bool event {false};                         ///< Whether this record is an event rather than an error
+    const char * ftdiStr {nullptr};             ///< The \libftdi1 error string, if ftdi is true.  These are string literals in \libftdi1.
+    char msg[104] {};                           ///< The message, copied and truncated if needed
+
+    /// Fill in the record
+    /** The strings are copied, so they need only be valid during the call.  A long file name keeps its end, which
+      * names the file.
+      */
+    void set( const char * s,   ///< [in] the source of the record
+              const char * m,   ///< [in] the message
+              const char * f,   ///< [in] the file name
+              int l             ///< [in] the line number
+            ) noexcept;
+};
+
+/// Writes the records of a \ref tmcLog
+/** The default prints the same text as tmcController's synchronous messages to std::cerr.  Derive from this and
+  * override \ref write to log elsewhere, and pass it to the tmcLog c'tor.
+  */
+class tmcLogWriter
+{
+public:
+
+    /// D'tor
+    virtual ~tmcLogWriter() = default;
+
+    /// Write a record
+    /** Called only by the background thread of the tmcLog, or by \ref tmcLog::stop for the records left in the ring.
+      */
+    virtual void write( const tmcLogRecord & rec /**< [in] the record to write */ );
+};
+
+/// Asynchronous log sink for tmcController error messages and events
+/** Records are pushed into a fixed-size lock-free ring by any thread, and formatted and written by a background
+  * thread, so a thread reporting an error never waits on terminal or file I/O.  Pushing copies the record and
+  * makes no system call.
+  *
+  * If the ring is full the record is dropped and counted.  The number of records accepted per second is also
+  * limited, so that a storm of USB errors cannot flood the output, and records over the limit are dropped and
+  * counted.  The background thread reports the drops in its output.
+  *
+  * The output is written by a \ref tmcLogWriter, which prints to std::cerr by default.  tmcLog itself is final, so
+  * its d'tor always stops the background thread before anything the thread uses is destroyed.  A writer passed
+  * to the c'tor must outlive the tmcLog.  One tmcLog can be shared by several tmcControllers, see \ref
+  * tmcController::logSink.
+  */
+class tmcLog final
+{
+public:
+
+    /// The number of records in the ring, a power of 2
+    static constexpr uint32_t ringSize = 256;
+
+protected:
+
+    /// A slot in the ring
+    struct slot
+    {
+        std::atomic<uint64_t> seq {0}; ///< Equal to the position for an empty slot, and the position + 1 for a full one
+        tmcLogRecord rec;              ///< The record
+    };
+
+    /// The ring of records
+    slot m_ring[ringSize];
+
+    /// The position of the next record to push
+    std::atomic<uint64_t> m_head {0};
+
+    /// The position of the next record to pop, only used by the background thread
+    uint64_t m_tail {0};
+
+    /// The maximum number of records accepted per second, 0 for no limit.  Default is 100.
+    std::atomic<uint32_t> m_rateLimit {100};
+
+    /// The start of the current rate limiting window, in steady_clock nanoseconds
+    std::atomic<int64_t> m_windowStart {0};
+
+    /// The number of records offered in the current rate limiting window
+    std::atomic<uint32_t> m_windowCount {0};
+
+    /// The period at which the background thread empties the ring, in milliseconds.  Default is 50.
+    uint32_t m_period {50};
+
+    /// The number of records written
+    std::atomic<uint64_t> m_written {0};
+
+    /// The number of records dropped because the ring was full
+    std::atomic<uint64_t> m_droppedFull {0};
+
+    /// The number of records dropped by the rate limit
+    std::atomic<uint64_t> m_droppedRate {0};
+
+    /// The value of m_droppedFull at the last drop report, only used by the background thread
+    uint64_t m_reportedFull {0};
+
+    /// The value of m_droppedRate at the last drop report, only used by the background thread
+    uint64_t m_reportedRate {0};
+
+    /// The writer used if none is passed to the c'tor
+    tmcLogWriter m_defaultWriter;
+
+    /// The writer of the records, only used by the background thread and \ref stop
+    tmcLogWriter * m_writer {nullptr};
+
+    /// The background thread
+    std::thread m_thread;
+
+    /// Flag indicating that the background thread is running
+    std::atomic<bool> m_running {false};
+
+    /// Flag telling the background thread to exit
+    std::atomic<bool> m_stop {false};
+
+    /// Take the next record from the ring
+    /**
+      * \returns true if a record was taken
+      * \returns false if the ring is empty
+      */
+    bool pop( tmcLogRecord & rec /**< [out] the record */ );
+
+    /// Write every record in the ring, and report any new drops
+    void drain();
+
+    /// The background thread's loop
+    void logLoop();
+
+public:
+
+    /// C'tor
+    explicit tmcLog( tmcLogWriter * writer = nullptr /**< [in] [optional] the writer, which must outlive this tmcLog, nullptr for std::cerr */ );
+
+    /// D'tor, stops the background thread after writing the records in the ring
+    ~tmcLog();
+
+    /// Push a record into the ring
+    /** Lock-free and allocation free, safe to call from any thread.
+      *
+      * \returns true if the record was accepted
+      * \returns false if it was dropped, because of the rate limit or because the ring was full
+      */
+    bool push( const tmcLogRecord & rec /**< [in] the record */ ) noexcept;
+
+    /// Start the background thread
+    /**
+      * \returns 0 on success, or if already running
+      * \returns -700 if starting the thread throws an exception
+      */
+    int start();
+
+    /// Stop the background thread, after writing the records in the ring
+    void stop();
+
+    /// Check if the background thread is running
+    /** Safe to call from any thread.
+      *
+      * \returns true if running
+      */
+    bool running();
+
+    /// Set the maximum number of records accepted per second
+    /** \see m_rateLimit
+      */
+    void rateLimit( uint32_t r /**< [in] the new limit, 0 for no limit */ );
+
+    /// Get the maximum number of records accepted per second
+    /** \see m_rateLimit
+      *
+      * \returns the current value of m_rateLimit
+      */
+    uint32_t rateLimit();
+
+    /// Set the period at which the background thread empties the ring
+    /** Takes effect at the next \ref start.
+      *
+      * \see m_period
+      */
+    void period( uint32_t ms /**< [in] the new period in milliseconds, minimum 1 */ );
+
+    /// Get the period at which the background thread empties the ring
+    /** \see m_period
+      *
+      * \returns the current value of m_period
+      */
+    uint32_t period();
+
+    /// Get the number of records written
+    /**
+      * \returns the current value of m_written
+      */
+    uint64_t written();
+
+    /// Get the number of records dropped because the ring was full
+    /**
+      * \returns the current value of m_droppedFull
+      */
+    uint64_t droppedFull();
+
+    /// Get the number of records dropped by the rate limit
+    /**
+      * \returns the current value of m_droppedRate
+      */
+    uint64_t droppedRate();
+};
+
+inline
+void tmcLogRecord::set( const char * s,
+                        const char * m,
+                        const char * f,
+                        int l
+                      ) noexcept
+{
+    time = std::chrono::system_clock::now();
+    line = l;
+
+    size_t n = strnlen(s, sizeof(src) - 1);
+    memcpy(src, s, n);
+    src[n] = '\0';
+
+    n = strlen(f);
+    if(n > sizeof(file) - 1)
+    {
+        f += n - (sizeof(file) - 1);
+        n = sizeof(file) - 1;
+    }
+    memcpy(file, f, n);
+    file[n] = '\0';
+
+    n = strnlen(m, sizeof(msg) - 1);
+    memcpy(msg, m, n);
+    msg[n] = '\0';
+}
+
+inline
+tmcLog::tmcLog( tmcLogWriter * writer ) : m_writer(writer ? writer : &m_defaultWriter)
+{
+    for(uint32_t n = 0; n < ringSize; ++n)
+    {
+        m_ring[n].seq.store(n, std::memory_order_relaxed);
+    }
+}
+
+inline
+tmcLog::~tmcLog()
+{
+    stop();
+}
+
+inline
+bool tmcLog::push( const tmcLogRecord & rec ) noexcept
+{
+    //Rate limit over one second windows
+    uint32_t limit = m_rateLimit.load(std::memory_order_relaxed);
+    if(limit > 0)
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                      std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t ws = m_windowStart.load(std::memory_order_relaxed);
+        if(now - ws >= 1000000000 && m_windowStart.compare_exchange_strong(ws, now, std::memory_order_relaxed))
+        {
+            m_windowCount.store(0, std::memory_order_relaxed);
+        }
+
+        if(m_windowCount.fetch_add(1, std::memory_order_relaxed) >= limit)
+        {
+            m_droppedRate.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    //Bounded multi-producer ring: claim a position whose slot is empty
+    uint64_t pos = m_head.load(std::memory_order_relaxed);
+    slot * s;
+    for(;;)
+    {
+        s = &m_ring[pos & (ringSize - 1)];
+        uint64_t seq = s->seq.load(std::memory_order_acquire);
+        int64_t dif = static_cast<int64_t>(seq - pos);
+
+        if(dif == 0)
+        {
+            if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(dif < 0)
+        {
+            m_droppedFull.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    s->rec = rec;
+    s->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+inline
+bool tmcLog::pop( tmcLogRecord & rec )
+{
+    slot & s = m_ring[m_tail & (ringSize - 1)];
+
+    if(s.seq.load(std::memory_order_acquire) != m_tail + 1)
+    {
+        return false;
+    }
+
+    rec = s.rec;
+    s.seq.store(m_tail + ringSize, std::memory_order_release);
+    ++m_tail;
+
+    return true;
+}
+
+inline
+void tmcLog::drain()
+{
+    tmcLogRecord rec;
+    while(pop(rec))
+    {
+        m_writer->write(rec);
+        m_written.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t full = m_droppedFull.load(std::memory_order_relaxed);
+    uint64_t rate = m_droppedRate.load(std::memory_order_relaxed);
+
+    if(full != m_reportedFull || rate != m_reportedRate)
+    {
+        char msg[sizeof(rec.msg)];
+        snprintf(msg, sizeof(msg), "dropped %llu records (ring full) and %llu records (rate limit)",
+                                   static_cast<unsigned long long>(full - m_reportedFull),
+                                       static_cast<unsigned long long>(rate - m_reportedRate));
+        rec = tmcLogRecord();
+        rec.event = true;
+        rec.set("tmcLog", msg, __FILE__, __LINE__);
+        m_writer->write(rec);
+
+        m_reportedFull = full;
+        m_reportedRate = rate;
+    }
+}
+
+inline
+void tmcLog::logLoop()
+{
+    while(!m_stop.load(std::memory_order_relaxed))
+    {
+        drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_period));
+    }
+
+    drain();
+}
+
+inline
+void tmcLogWriter::write( const tmcLogRecord & rec )
+{
+    if(rec.ftdi)
+    {
+        std::cerr << rec.src << ": " << rec.msg << " [" << rec.rv << ":" << (rec.ftdiStr ? rec.ftdiStr : "") << "]\n";
+    }
+    else
+    {
+        std::cerr << rec.src << ": " << rec.msg << "\n";
+    }
+
+    if(!rec.event)
+    {
+        std::cerr << "in " << rec.file << " at line " << rec.line << "\n";
+    }
+}
+
+inline
+int tmcLog::start()
+{
+    if(m_thread.joinable())
+    {
+        return 0;
+    }
+
+    m_stop = false;
+
+    try
+    {
+        m_thread = std::thread(&tmcLog::logLoop, this);
+    }
+    catch(...)
+    {
+        return -700;
+    }
+
+    m_running = true;
+
+    return 0;
+}
+
+inline
+void tmcLog::stop()
+{
+    if(!m_thread.joinable())
+    {
+        return;
+    }
+
+    m_stop = true;
+    m_thread.join();
+    m_running = false;
+}
+
+inline
+bool tmcLog::running()
+{
+    return m_running.load(std::memory_order_relaxed);
+}
+
+inline
+void tmcLog::rateLimit( uint32_t r )
+{
+    m_rateLimit = r;
+}
+
+inline
+uint32_t tmcLog::rateLimit()
+{
+    return m_rateLimit;
+}
+
+inline
+void tmcLog::period( uint32_t ms )
+{
+    if(ms < 1)
+    {
+        ms = 1;
+    }
+
+    m_period = ms;
+}
+
+inline
+uint32_t tmcLog::period()
+{
+    return m_period;
+}
+
+inline
+uint64_t tmcLog::written()
+{
+    return m_written;
+}
+
+inline
+uint64_t tmcLog::droppedFull()
+{
+    return m_droppedFull;
+}
+
+inline
+uint64_t tmcLog::droppedRate()
+{
+    return m_droppedRate;
+}
+
+#endif //tmcLog_hpp
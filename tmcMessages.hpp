@@ -0,0 +1,586 @@
+/** \file tmcMessages.hpp
+ *  \brief Compile-time descriptors of the APT messages used by tmcController
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcMessages_hpp
+#define tmcMessages_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if !defined(__BYTE_ORDER__) || !defined(__ORDER_LITTLE_ENDIAN__) || !defined(__ORDER_BIG_ENDIAN__)
+#error "tmcMessages.hpp requires the __BYTE_ORDER__ predefined macros"
+#endif
+
+/// Compile-time schema of the Thorlabs APT Host-Controller Communications Protocol
+/** Each message is described by a type giving its message ID, data packet length, and the offset and type of
+  * each field.  Frames are assembled with \ref encode and fields read back with \ref get, which are generated
+  * from the descriptors by templates.  Field placement and frame sizes are checked with static_assert, and each
+  * encode compiles to a handful of stores.
+  *
+  * APT data is little-endian.  All access to frames goes through memcpy, so there is no type punning of the byte
+  * buffers, and the byte order is fixed at compile time: on a little-endian host the copies compile to single
+  * (unaligned) loads and stores, and on a big-endian host a byte swap is added.
+  *
+  * Every APT frame starts with a 6 byte header:
+  *  - bytes 0-1: the message ID
+  *  - bytes 2-3: two 1 byte parameters for a header-only message, or the data packet length
+  *  - byte 4: the destination, with 0x80 set if a data packet follows
+  *  - byte 5: the source
+  */
+namespace tmcApt
+{
+
+/// The size of the APT message header
+constexpr size_t headerSize = 6;
+
+/// The size of the frame buffers in tmcController, the largest message that can be sent or received
+constexpr size_t maxFrameSize = 256;
+
+/// The destination byte for a generic USB unit
+constexpr uint8_t destination = 0x50;
+
+/// The flag or'ed with the destination byte when a data packet follows the header
+constexpr uint8_t dataFlag = 0x80;
+
+/// The source byte for the host
+constexpr uint8_t source = 0x01;
+
+/// True if the host is little-endian, the APT byte order
+constexpr bool hostLittleEndian = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+static_assert(hostLittleEndian || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__, "unsupported host byte order");
+
+/// Reverse the byte order of an integer
+/**
+  * \returns \p v with its bytes reversed
+  */
+template<typename T>
+inline T byteSwap( T v /**< [in] the value to swap */ )
+{
+    static_assert(std::is_integral<T>::value, "APT fields are integers");
+
+    if constexpr(sizeof(T) == 1)
+    {
+        return v;
+    }
+    else if constexpr(sizeof(T) == 2)
+    {
+        uint16_t u;
+        memcpy(&u, &v, sizeof(u));
+        u = __builtin_bswap16(u);
+        memcpy(&v, &u, sizeof(u));
+        return v;
+    }
+    else
+    {
+        static_assert(sizeof(T) == 4, "APT fields are 1, 2, or 4 bytes");
+        uint32_t u;
+        memcpy(&u, &v, sizeof(u));
+        u = __builtin_bswap32(u);
+        memcpy(&v, &u, sizeof(u));
+        return v;
+    }
+}
+
+/// Store an integer at an arbitrary position in a frame in APT (little-endian) byte order
+template<typename T>
+inline void storeLE( unsigned char * p, ///< [out] the position to store at, need not be aligned
+                     T v                ///< [in] the value to store
+                   )
+{
+    if constexpr(!hostLittleEndian)
+    {
+        v = byteSwap(v);
+    }
+
+    memcpy(p, &v, sizeof(T));
+}
+
+/// Load an integer from an arbitrary position in a frame in APT (little-endian) byte order
+/**
+  * \returns the value
+  */
+template<typename T>
+inline T loadLE( const unsigned char * p /**< [in] the position to load from, need not be aligned */ )
+{
+    T v;
+    memcpy(&v, p, sizeof(T));
+
+    if constexpr(!hostLittleEndian)
+    {
+        v = byteSwap(v);
+    }
+
+    return v;
+}
+
+/// A field in the data packet of an APT message
+/**
+  * \tparam T the type of the field
+  * \tparam off the byte offset of the field from the start of the frame
+  * \tparam dataLen the data packet length of the message, used to check the field placement
+  */
+template<typename T, size_t off, uint16_t dataLen>
+struct field
+{
+    static_assert(dataLen > 0, "APT data fields require a data packet");
+    static_assert(off >= headerSize && off + sizeof(T) <= headerSize + dataLen, "APT field lies outside the data packet");
+
+    typedef T type;                       ///< The type of the field
+    static constexpr size_t offset = off; ///< The byte offset from the start of the frame
+};
+
+/// One of the two 1 byte parameters in the header of a header-only APT message
+/**
+  * \tparam off the byte offset, 2 for param1 or 3 for param2
+  */
+template<size_t off>
+struct param
+{
+    static_assert(off == 2 || off == 3, "APT header parameters are at bytes 2 and 3");
+
+    typedef uint8_t type;                 ///< The type of the parameter
+    static constexpr size_t offset = off; ///< The byte offset from the start of the frame
+};
+
+/// Descriptor of an APT message
+/** Specific messages derive from this, and add a typedef for each field and a \c fields tuple listing the fields
+  * in the order they are passed to \ref encode.
+  *
+  * \tparam id the message ID
+  * \tparam dataLen the length of the data packet, 0 for a header-only message
+  */
+template<uint16_t id, uint16_t dataLen = 0>
+struct message
+{
+    static_assert(headerSize + dataLen <= maxFrameSize, "APT message is larger than the frame buffers");
+
+    static constexpr uint16_t ID = id;                    ///< The message ID
+    static constexpr uint16_t dataLength = dataLen;       ///< The length of the data packet
+    static constexpr int size = headerSize + dataLen;     ///< The total size of the frame
+
+    typedef std::tuple<> fields; ///< The fields set by \ref encode, none by default
+};
+
+/// Store a field into a frame
+/**
+  * \tparam fieldT the field descriptor, a \ref field or \ref param
+  */
+template<class fieldT>
+inline void put( unsigned char * frame,          ///< [out] the frame
+                 typename fieldT::type v         ///< [in] the value to store
+               )
+{
+    storeLE<typename fieldT::type>(&frame[fieldT::offset], v);
+}
+
+/// Store a field which is already in APT (little-endian) byte order into a frame
+/** Copies the bytes without conversion, for values prepared in wire order such as the output of
+  * tmcController::volts2counts.
+  *
+  * \tparam fieldT the field descriptor, a \ref field or \ref param
+  */
+template<class fieldT>
+inline void putWire( unsigned char * frame, ///< [out] the frame
+                     const void * wire      ///< [in] sizeof(fieldT::type) bytes in APT byte order
+                   )
+{
+    memcpy(&frame[fieldT::offset], wire, sizeof(typename fieldT::type));
+}
+
+/// Read a field from a frame
+/**
+  * \tparam fieldT the field descriptor, a \ref field or \ref param
+  *
+  * \returns the value of the field
+  */
+template<class fieldT>
+inline typename fieldT::type get( const unsigned char * frame /**< [in] the frame */ )
+{
+    return loadLE<typename fieldT::type>(&frame[fieldT::offset]);
+}
+
+/// Read the message ID of a frame
+/**
+  * \returns the message ID
+  */
+inline uint16_t messageID( const unsigned char * frame /**< [in] the frame */ )
+{
+    return loadLE<uint16_t>(&frame[0]);
+}
+
+/// Store the fields of a message, implementation of \ref encode
+template<class msgT, size_t... I, class... argTs>
+inline void encodeFields( [[maybe_unused]] unsigned char * frame,
+                          std::index_sequence<I...>,
+                          const argTs &... args
+                        )
+{
+    (put<typename std::tuple_element<I, typename msgT::fields>::type>(frame, args), ...);
+}
+
+/// Assemble a complete frame for a message
+/** Writes the header, zeroes the data packet, and stores \p args into the fields listed in \c msgT::fields
+  * in order.  For a header-only message the fields are the header parameters, which are zero if not listed.
+  *
+  * \tparam msgT the message descriptor
+  */
+template<class msgT, class... argTs>
+inline void encode( unsigned char * frame, ///< [out] the frame, at least msgT::size bytes
+                    const argTs &... args  ///< [in] the field values, one for each of msgT::fields
+                  )
+{
+    static_assert(sizeof...(argTs) == std::tuple_size<typename msgT::fields>::value, "wrong number of fields for APT message");
+
+    storeLE<uint16_t>(&frame[0], msgT::ID);
+
+    if constexpr(msgT::dataLength > 0)
+    {
+        storeLE<uint16_t>(&frame[2], msgT::dataLength);
+        frame[4] = destination | dataFlag;
+        memset(&frame[headerSize], 0, msgT::dataLength);
+    }
+    else
+    {
+        frame[2] = 0x00;
+        frame[3] = 0x00;
+        frame[4] = destination;
+    }
+
+    frame[5] = source;
+
+    encodeFields<msgT>(frame, std::index_sequence_for<argTs...>{}, args...);
+}
+
+/** \name Generic Messages
+  * @{
+  */
+
+/// MGMSG_MOD_IDENTIFY (0x0223)
+struct MOD_IDENTIFY : public message<0x0223>
+{
+};
+
+/// MGMSG_MOD_SET_CHANENABLESTATE (0x0210) and MGMSG_MOD_GET_CHANENABLESTATE (0x0212)
+template<uint16_t id>
+struct chanEnableState : public message<id>
+{
+    typedef param<2> ChanIdent;   ///< The channel
+    typedef param<3> EnableState; ///< 0x01 enabled, 0x02 disabled
+
+    typedef std::tuple<ChanIdent, EnableState> fields;
+};
+
+typedef chanEnableState<0x0210> MOD_SET_CHANENABLESTATE; ///< MGMSG_MOD_SET_CHANENABLESTATE (0x0210)
+typedef chanEnableState<0x0212> MOD_GET_CHANENABLESTATE; ///< MGMSG_MOD_GET_CHANENABLESTATE (0x0212)
+
+/// MGMSG_MOD_REQ_CHANENABLESTATE (0x0211)
+struct MOD_REQ_CHANENABLESTATE : public message<0x0211>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef MOD_GET_CHANENABLESTATE response; ///< The response message
+};
+
+/// MGMSG_HW_STOP_UPDATEMSGS (0x0012)
+struct HW_STOP_UPDATEMSGS : public message<0x0012>
+{
+};
+
+/// MGMSG_HW_GET_INFO (0x0006)
+struct HW_GET_INFO : public message<0x0006, 84>
+{
+    typedef field<uint32_t, 6, 84> SerialNumber; ///< The serial number
+    typedef field<char[8], 10, 84> ModelNumber;  ///< The model number, not null terminated
+    typedef field<uint16_t, 18, 84> Type;        ///< The hardware type
+    typedef field<uint8_t, 20, 84> FWMinor;      ///< The firmware minor version
+    typedef field<uint8_t, 21, 84> FWInterim;    ///< The firmware interim version
+    typedef field<uint8_t, 22, 84> FWMajor;      ///< The firmware major version
+    typedef field<uint16_t, 84, 84> HWVersion;   ///< The hardware version
+    typedef field<uint16_t, 86, 84> ModState;    ///< The hardware modification state
+    typedef field<uint16_t, 88, 84> NumChannels; ///< The number of channels
+};
+
+/// MGMSG_HW_REQ_INFO (0x0005)
+struct HW_REQ_INFO : public message<0x0005>
+{
+    typedef HW_GET_INFO response; ///< The response message
+};
+
+///@}
+
+/** \name Piezo Messages
+  * @{
+  */
+
+/// MGMSG_PZ_SET_POSCONTROLMODE (0x0640) and MGMSG_PZ_GET_POSCONTROLMODE (0x0642)
+template<uint16_t id>
+struct posControlMode : public message<id>
+{
+    typedef param<2> ChanIdent; ///< The channel
+    typedef param<3> Mode;      ///< The position control mode
+
+    typedef std::tuple<ChanIdent, Mode> fields;
+};
+
+typedef posControlMode<0x0640> PZ_SET_POSCONTROLMODE; ///< MGMSG_PZ_SET_POSCONTROLMODE (0x0640)
+typedef posControlMode<0x0642> PZ_GET_POSCONTROLMODE; ///< MGMSG_PZ_GET_POSCONTROLMODE (0x0642)
+
+/// MGMSG_PZ_REQ_POSCONTROLMODE (0x0641)
+struct PZ_REQ_POSCONTROLMODE : public message<0x0641>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_POSCONTROLMODE response; ///< The response message
+};
+
+/// MGMSG_PZ_SET_OUTPUTVOLTS (0x0643) and MGMSG_PZ_GET_OUTPUTVOLTS (0x0645)
+template<uint16_t id>
+struct outputVolts : public message<id, 4>
+{
+    typedef field<uint16_t, 6, 4> ChanIdent; ///< The channel
+    typedef field<int16_t, 8, 4> Voltage;    ///< The output voltage, -32768 to 32767 for -100% to 100%
+
+    typedef std::tuple<ChanIdent, Voltage> fields;
+};
+
+typedef outputVolts<0x0643> PZ_SET_OUTPUTVOLTS; ///< MGMSG_PZ_SET_OUTPUTVOLTS (0x0643)
+typedef outputVolts<0x0645> PZ_GET_OUTPUTVOLTS; ///< MGMSG_PZ_GET_OUTPUTVOLTS (0x0645)
+
+/// MGMSG_PZ_REQ_OUTPUTVOLTS (0x0644)
+struct PZ_REQ_OUTPUTVOLTS : public message<0x0644>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_OUTPUTVOLTS response; ///< The response message
+};
+
+/// MGMSG_PZ_SET_OUTPUTPOS (0x0646) and MGMSG_PZ_GET_OUTPUTPOS (0x0648)
+template<uint16_t id>
+struct outputPos : public message<id, 4>
+{
+    typedef field<uint16_t, 6, 4> ChanIdent; ///< The channel
+    typedef field<uint16_t, 8, 4> Position;  ///< The position, 0 to 32767 for 0 to 100% of travel
+
+    typedef std::tuple<ChanIdent, Position> fields;
+};
+
+typedef outputPos<0x0646> PZ_SET_OUTPUTPOS; ///< MGMSG_PZ_SET_OUTPUTPOS (0x0646)
+typedef outputPos<0x0648> PZ_GET_OUTPUTPOS; ///< MGMSG_PZ_GET_OUTPUTPOS (0x0648)
+
+/// MGMSG_PZ_REQ_OUTPUTPOS (0x0647)
+struct PZ_REQ_OUTPUTPOS : public message<0x0647>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_OUTPUTPOS response; ///< The response message
+};
+
+/// MGMSG_PZ_GET_PZSTATUSUPDATE (0x0661)
+struct PZ_GET_PZSTATUSUPDATE : public message<0x0661, 10>
+{
+    typedef field<uint16_t, 6, 10> ChanIdent;    ///< The channel
+    typedef field<int16_t, 8, 10> OutputVoltage; ///< The output voltage
+    typedef field<int16_t, 10, 10> Position;     ///< The position
+    typedef field<uint32_t, 12, 10> StatusBits;  ///< The status bits
+};
+
+/// MGMSG_PZ_REQ_PZSTATUSUPDATE (0x0660)
+struct PZ_REQ_PZSTATUSUPDATE : public message<0x0660>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_PZSTATUSUPDATE response; ///< The response message
+};
+
+/// MGMSG_PZ_SET_OUTPUTLUT (0x0700) and MGMSG_PZ_GET_OUTPUTLUT (0x0702)
+template<uint16_t id>
+struct outputLUT : public message<id, 6>
+{
+    typedef field<uint16_t, 6, 6> ChanIdent; ///< The channel
+    typedef field<uint16_t, 8, 6> Index;     ///< The LUT index
+    typedef field<int16_t, 10, 6> Output;    ///< The output voltage of this entry
+
+    typedef std::tuple<ChanIdent, Index, Output> fields;
+};
+
+typedef outputLUT<0x0700> PZ_SET_OUTPUTLUT; ///< MGMSG_PZ_SET_OUTPUTLUT (0x0700)
+typedef outputLUT<0x0702> PZ_GET_OUTPUTLUT; ///< MGMSG_PZ_GET_OUTPUTLUT (0x0702)
+
+/// MGMSG_PZ_REQ_OUTPUTLUT (0x0701)
+/** Unlike the other requests this has a data packet, since the index of the entry does not fit in the header.
+  */
+struct PZ_REQ_OUTPUTLUT : public message<0x0701, 4>
+{
+    typedef field<uint16_t, 6, 4> ChanIdent; ///< The channel
+    typedef field<uint16_t, 8, 4> Index;     ///< The LUT index
+
+    typedef std::tuple<ChanIdent, Index> fields;
+
+    typedef PZ_GET_OUTPUTLUT response; ///< The response message
+};
+
+/// MGMSG_PZ_SET_OUTPUTLUTPARAMS (0x0703) and MGMSG_PZ_GET_OUTPUTLUTPARAMS (0x0705)
+template<uint16_t id>
+struct outputLUTParams : public message<id, 30>
+{
+    typedef field<uint16_t, 6, 30> ChanIdent;     ///< The channel
+    typedef field<uint16_t, 8, 30> Mode;          ///< The output mode
+    typedef field<uint16_t, 10, 30> CycleLength;  ///< The number of entries in a cycle
+    typedef field<int32_t, 12, 30> NumCycles;     ///< The number of cycles in fixed mode
+    typedef field<int32_t, 16, 30> DelayTime;     ///< The sample interval
+    typedef field<int32_t, 20, 30> PreCycleRest;  ///< The delay before each cycle
+    typedef field<int32_t, 24, 30> PostCycleRest; ///< The delay after each cycle
+    typedef field<uint16_t, 28, 30> OPTrigStart;  ///< The index of the output trigger
+    typedef field<int32_t, 30, 30> OPTrigWidth;   ///< The output trigger width
+    typedef field<uint16_t, 34, 30> TrigRepCycle; ///< The cycles between output triggers
+
+    typedef std::tuple<ChanIdent, Mode, CycleLength, NumCycles, DelayTime, PreCycleRest, PostCycleRest,
+                                                             OPTrigStart, OPTrigWidth, TrigRepCycle> fields;
+};
+
+typedef outputLUTParams<0x0703> PZ_SET_OUTPUTLUTPARAMS; ///< MGMSG_PZ_SET_OUTPUTLUTPARAMS (0x0703)
+typedef outputLUTParams<0x0705> PZ_GET_OUTPUTLUTPARAMS; ///< MGMSG_PZ_GET_OUTPUTLUTPARAMS (0x0705)
+
+/// MGMSG_PZ_REQ_OUTPUTLUTPARAMS (0x0704)
+struct PZ_REQ_OUTPUTLUTPARAMS : public message<0x0704>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_OUTPUTLUTPARAMS response; ///< The response message
+};
+
+/// MGMSG_PZ_START_LUTOUTPUT (0x0706)
+struct PZ_START_LUTOUTPUT : public message<0x0706>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+};
+
+/// MGMSG_PZ_STOP_LUTOUTPUT (0x0707)
+struct PZ_STOP_LUTOUTPUT : public message<0x0707>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+};
+
+/// MGMSG_PZ_SET_TPZ_DISPSETTINGS (0x07D1) and MGMSG_PZ_GET_TPZ_DISPSETTINGS (0x07D3)
+template<uint16_t id>
+struct tpzDispSettings : public message<id, 2>
+{
+    typedef field<uint16_t, 6, 2> DispIntensity; ///< The display intensity
+
+    typedef std::tuple<DispIntensity> fields;
+};
+
+typedef tpzDispSettings<0x07D1> PZ_SET_TPZ_DISPSETTINGS; ///< MGMSG_PZ_SET_TPZ_DISPSETTINGS (0x07D1)
+typedef tpzDispSettings<0x07D3> PZ_GET_TPZ_DISPSETTINGS; ///< MGMSG_PZ_GET_TPZ_DISPSETTINGS (0x07D3)
+
+/// MGMSG_PZ_REQ_TPZ_DISPSETTINGS (0x07D2)
+struct PZ_REQ_TPZ_DISPSETTINGS : public message<0x07D2>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_TPZ_DISPSETTINGS response; ///< The response message
+};
+
+/// MGMSG_PZ_SET_TPZ_IOSETTINGS (0x07D4) and MGMSG_PZ_GET_TPZ_IOSETTINGS (0x07D6)
+template<uint16_t id>
+struct tpzIOSettings : public message<id, 10>
+{
+    typedef field<uint16_t, 6, 10> ChanIdent;       ///< The channel
+    typedef field<uint16_t, 8, 10> VoltageLimit;    ///< The voltage limit
+    typedef field<uint16_t, 10, 10> HubAnalogInput; ///< The hub feedback setup
+
+    typedef std::tuple<ChanIdent, VoltageLimit, HubAnalogInput> fields;
+};
+
+typedef tpzIOSettings<0x07D4> PZ_SET_TPZ_IOSETTINGS; ///< MGMSG_PZ_SET_TPZ_IOSETTINGS (0x07D4)
+typedef tpzIOSettings<0x07D6> PZ_GET_TPZ_IOSETTINGS; ///< MGMSG_PZ_GET_TPZ_IOSETTINGS (0x07D6)
+
+/// MGMSG_PZ_REQ_TPZ_IOSETTINGS (0x07D5)
+struct PZ_REQ_TPZ_IOSETTINGS : public message<0x07D5>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef PZ_GET_TPZ_IOSETTINGS response; ///< The response message
+};
+
+/// MGMSG_KPZ_SET_KCUBEMMIPARAMS (0x07F0) and MGMSG_KPZ_GET_KCUBEMMIPARAMS (0x07F2)
+template<uint16_t id>
+struct kcubeMMIParams : public message<id, 34>
+{
+    typedef field<uint16_t, 6, 34> ChanIdent;      ///< The channel
+    typedef field<uint16_t, 8, 34> JSMode;         ///< The wheel mode
+    typedef field<uint16_t, 10, 34> JSVoltGearBox; ///< The wheel voltage adjustment rate
+    typedef field<int32_t, 12, 34> JSVoltStep;     ///< The wheel voltage step
+    typedef field<int16_t, 16, 34> DirSense;       ///< The wheel direction sense
+    typedef field<int32_t, 18, 34> PresetVolt1;    ///< Preset voltage 1
+    typedef field<int32_t, 22, 34> PresetVolt2;    ///< Preset voltage 2
+    typedef field<uint16_t, 26, 34> DispBrightness; ///< The display brightness
+    typedef field<uint16_t, 28, 34> DispTimeout;   ///< The display timeout
+    typedef field<uint16_t, 30, 34> DispDimLevel;  ///< The display dim level
+
+    typedef std::tuple<ChanIdent, JSMode, JSVoltGearBox, JSVoltStep, DirSense, PresetVolt1, PresetVolt2,
+                                                    DispBrightness, DispTimeout, DispDimLevel> fields;
+};
+
+typedef kcubeMMIParams<0x07F0> KPZ_SET_KCUBEMMIPARAMS; ///< MGMSG_KPZ_SET_KCUBEMMIPARAMS (0x07F0)
+typedef kcubeMMIParams<0x07F2> KPZ_GET_KCUBEMMIPARAMS; ///< MGMSG_KPZ_GET_KCUBEMMIPARAMS (0x07F2)
+
+/// MGMSG_KPZ_REQ_KCUBEMMIPARAMS (0x07F1)
+struct KPZ_REQ_KCUBEMMIPARAMS : public message<0x07F1>
+{
+    typedef param<2> ChanIdent; ///< The channel
+
+    typedef std::tuple<ChanIdent> fields;
+
+    typedef KPZ_GET_KCUBEMMIPARAMS response; ///< The response message
+};
+
+///@}
+
+} //namespace tmcApt
+
+#endif //tmcMessages_hpp
@@ -0,0 +1,195 @@
+/** \file tmcTestDevice.hpp
+ *  \brief Declare and define the tmcTestDevice synthetic device used by the tests
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcTestDevice_hpp
+#define tmcTestDevice_hpp
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "tmcController.hpp"
+
+/// A synthetic device for the tests, so that no device is needed
+/** The frames the device should see and answer with are recorded into a temporary \ref tmcTrace, which is then
+  * loaded into a \ref tmcReplay and set on a controller with \ref tmcController::replay.  The trace file is
+  * recreated by \ref open and removed by the d'tor.
+  *
+  * The trace can also be set on a controller with \ref tmcController::wireTrace to record a session, and then be
+  * loaded to replay it.
+  */
+class tmcTestDevice
+{
+protected:
+
+    std::string m_serial; ///< The USB serial number recorded with each frame
+
+    tmcTrace m_trace; ///< The trace of the frames
+
+    tmcReplay m_replay; ///< The replay, loaded from m_trace by \ref load
+
+public:
+
+    /// C'tor setting the serial number
+    explicit tmcTestDevice( const std::string & serial /**< [in] the USB serial number recorded with each frame */);
+
+    /// D'tor, closes and removes the trace file
+    ~tmcTestDevice();
+
+    /// Create the trace file, removing any file already at the path
+    /**
+      * \returns 0 on success
+      * \returns -1 on error, from \ref tmcTrace::open
+      */
+    int open( const std::string & path, ///< [in] the path of the trace file
+              uint64_t nSlots = 4096    ///< [in] [optional] the number of slots in the trace
+            );
+
+    /// Record a frame written to the device
+    /** \tparam msgT the message descriptor
+      */
+    template<class msgT, class... argTs>
+    void write( const argTs &... args /**< [in] the field values, as for \ref tmcApt::encode */);
+
+    /// Record a response read from the device
+    /** \tparam msgT the message descriptor
+      */
+    template<class msgT, class... argTs>
+    void read( const argTs &... args /**< [in] the field values, as for \ref tmcApt::encode */);
+
+    /// Record bytes written to or read from the device
+    void record( uint8_t dir,                ///< [in] the direction, \ref tmcTrace::dirWrite or \ref tmcTrace::dirRead
+                 const unsigned char * data, ///< [in] the bytes
+                 int len                     ///< [in] the number of bytes
+               );
+
+    /// Load the recorded frames into the replay, and rewind it
+    /**
+      * \returns the number of events loaded
+      * \returns -1 if the trace is not open
+      */
+    int load();
+
+    /// Get the trace
+    /**
+      * \returns a reference to m_trace
+      */
+    tmcTrace & trace();
+
+    /// Get the replay, to set on a controller after \ref load
+    /**
+      * \returns a reference to m_replay
+      */
+    tmcReplay & replay();
+};
+
+inline
+tmcTestDevice::tmcTestDevice( const std::string & serial ) : m_serial(serial)
+{
+}
+
+inline
+tmcTestDevice::~tmcTestDevice()
+{
+    std::string path = m_trace.path();
+
+    m_trace.close();
+
+    if(path != "")
+    {
+        unlink(path.c_str());
+    }
+}
+
+inline
+int tmcTestDevice::open( const std::string & path,
+                         uint64_t nSlots
+                       )
+{
+    //an existing trace with the same layout would be appended to
+    unlink(path.c_str());
+
+    return m_trace.open(path, nSlots);
+}
+
+template<class msgT, class... argTs>
+void tmcTestDevice::write( const argTs &... args )
+{
+    unsigned char frame[tmcApt::maxFrameSize];
+    tmcApt::encode<msgT>(frame, args...);
+
+    record(tmcTrace::dirWrite, frame, msgT::size);
+}
+
+template<class msgT, class... argTs>
+void tmcTestDevice::read( const argTs &... args )
+{
+    unsigned char frame[tmcApt::maxFrameSize];
+    tmcApt::encode<msgT>(frame, args...);
+
+    record(tmcTrace::dirRead, frame, msgT::size);
+}
+
+inline
+void tmcTestDevice::record( uint8_t dir,
+                            const unsigned char * data,
+                            int len
+                          )
+{
+    m_trace.record(dir, m_serial.c_str(), data, len);
+}
+
+inline
+int tmcTestDevice::load()
+{
+    return m_replay.load(m_trace, m_serial);
+}
+
+inline
+tmcTrace & tmcTestDevice::trace()
+{
+    return m_trace;
+}
+
+inline
+tmcReplay & tmcTestDevice::replay()
+{
+    return m_replay;
+}
+
+/// Print the outcome of a test
+/**
+  * \returns EXIT_SUCCESS if pass is true
+  * \returns EXIT_FAILURE otherwise
+  */
+inline
+int tmcTestResult( bool pass /**< [in] whether the test passed */)
+{
+    std::cout << (pass ? "PASS\n" : "FAIL\n");
+
+    return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif //tmcTestDevice_hpp
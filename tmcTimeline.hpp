@@ -0,0 +1,318 @@
+/** \file tmcTimeline.hpp
+ *  \brief Declare and define the tmcTimeline trace-event exporter
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcTimeline_hpp
+#define tmcTimeline_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+
+/// A span of time on a device timeline, as recorded by \ref tmcTimeline::span
+struct tmcTimelineSpan
+{
+    uint64_t startNs {0};       ///< The steady_clock time at which the span started, in ns
+    uint64_t durNs {0};         ///< The duration of the span, in ns
+    const char * name {nullptr}; ///< The name of the span, a string literal, or nullptr for a command
+    uint16_t id {0};            ///< The APT message ID of the command, if a command
+    uint8_t cat {0};            ///< The category, \ref tmcTimeline::catCommand, catConnect, or catPhase
+    char serial[13] {};         ///< The USB serial number of the device, truncated to 12 characters
+};
+
+/// Collects the command and phase spans of one or more devices, and exports them as Chrome trace-event JSON
+/** Each tmcController with this timeline set (see \ref tmcController::timeline) records a span for each command, for
+  * \ref tmcController::connect, and for each phase within them: flushes, sleeps, writes, reads, and decoding (see
+  * \ref tmcController::Phase).  The exported file loads in chrome://tracing or the Perfetto UI, with one track per
+  * device, so concurrency, skew, and idle gaps across devices can be seen.
+  *
+  * Spans are appended to a preallocated array with one atomic increment, from any thread.  When the array is full
+  * further spans are dropped and counted.  \ref dump, \ref write, and \ref clear should be called while no spans
+  * are being recorded.
+  */
+class tmcTimeline
+{
+public:
+
+    static constexpr uint8_t catCommand = 1; ///< A command, from the start of its write to its return
+    static constexpr uint8_t catConnect = 2; ///< A call to \ref tmcController::connect
+    static constexpr uint8_t catPhase = 3;   ///< A phase within a command or connect
+
+protected:
+
+    /// A slot in the span array
+    struct slot
+    {
+        std::atomic<bool> ready {false}; ///< Set once the span is complete
+        tmcTimelineSpan span;            ///< The span
+    };
+
+    /// The span array
+    std::unique_ptr<slot[]> m_slots;
+
+    /// The capacity of the span array
+    size_t m_capacity {0};
+
+    /// The number of spans claimed, including those dropped
+    std::atomic<uint64_t> m_next {0};
+
+public:
+
+    /// C'tor
+    explicit tmcTimeline( size_t capacity = 65536 /**< [in] [optional] the number of spans which can be recorded */ );
+
+    /// Record a span
+    /** Safe to call from any thread.  Does not block.
+      */
+    void span( uint8_t cat,              ///< [in] the category
+               const char * name,        ///< [in] the name, a string literal, or nullptr for a command
+               uint16_t id,              ///< [in] the APT message ID, if a command
+               const char * serial,      ///< [in] the USB serial number of the device
+               uint64_t startNs,         ///< [in] the steady_clock start time in ns
+               uint64_t endNs            ///< [in] the steady_clock end time in ns
+             ) noexcept;
+
+    /// Get the capacity of the span array
+    /**
+      * \returns the value of m_capacity
+      */
+    size_t capacity();
+
+    /// Get the number of spans recorded
+    /**
+      * \returns the number of spans in the array
+      */
+    size_t recorded();
+
+    /// Get the number of spans dropped because the array was full
+    /**
+      * \returns the number of spans dropped
+      */
+    uint64_t dropped();
+
+    /// Remove all spans
+    void clear();
+
+    /// Write the spans as Chrome trace-event JSON to a stream
+    /** Each device is a process named by its serial number.  Times are in microseconds from the earliest span.
+      *
+      * \tparam streamT is an std::iostream like class
+      */
+    template<class streamT>
+    void dump( streamT & ios /**< [out] the stream to write to*/);
+
+    /// Write the spans as Chrome trace-event JSON to a file
+    /** See \ref dump.
+      *
+      * \returns 0 on success
+      * \returns -1 if the file can not be written
+      */
+    int write( const std::string & path, ///< [in] the path of the file
+               bool errmsg = true        ///< [in] [optional] flag controlling if an error message is printed on failure
+             );
+};
+
+inline
+tmcTimeline::tmcTimeline( size_t capacity ) : m_slots(new slot[capacity]), m_capacity(capacity)
+{
+}
+
+inline
+void tmcTimeline::span( uint8_t cat,
+                        const char * name,
+                        uint16_t id,
+                        const char * serial,
+                        uint64_t startNs,
+                        uint64_t endNs
+                      ) noexcept
+{
+    uint64_t n = m_next.fetch_add(1, std::memory_order_relaxed);
+    if(n >= m_capacity)
+    {
+        return;
+    }
+
+    tmcTimelineSpan & s = m_slots[n].span;
+    s.startNs = startNs;
+    s.durNs = (endNs > startNs) ? endNs - startNs : 0;
+    s.name = name;
+    s.id = id;
+    s.cat = cat;
+    size_t slen = strnlen(serial, sizeof(s.serial) - 1);
+    memcpy(s.serial, serial, slen);
+    s.serial[slen] = '\0';
+
+    m_slots[n].ready.store(true, std::memory_order_release);
+}
+
+inline
+size_t tmcTimeline::capacity()
+{
+    return m_capacity;
+}
+
+inline
+size_t tmcTimeline::recorded()
+{
+    return std::min<uint64_t>(m_next.load(std::memory_order_relaxed), m_capacity);
+}
+
+inline
+uint64_t tmcTimeline::dropped()
+{
+    uint64_t n = m_next.load(std::memory_order_relaxed);
+    return (n > m_capacity) ? n - m_capacity : 0;
+}
+
+inline
+void tmcTimeline::clear()
+{
+    size_t n = recorded();
+    for(size_t i = 0; i < n; ++i)
+    {
+        m_slots[i].ready.store(false, std::memory_order_relaxed);
+    }
+
+    m_next.store(0, std::memory_order_release);
+}
+
+template<class streamT>
+void tmcTimeline::dump( streamT & ios )
+{
+    size_t n = recorded();
+
+    std::vector<const tmcTimelineSpan *> spans;
+    spans.reserve(n);
+
+    uint64_t t0 = UINT64_MAX;
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(!m_slots[i].ready.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        spans.push_back(&m_slots[i].span);
+        t0 = std::min(t0, m_slots[i].span.startNs);
+    }
+
+    //each device is a process
+    std::vector<std::string> devices;
+
+    char buf[64];
+
+    ios << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    bool first = true;
+    for(size_t i = 0; i < spans.size(); ++i)
+    {
+        const tmcTimelineSpan & s = *spans[i];
+
+        size_t pid = std::find(devices.begin(), devices.end(), s.serial) - devices.begin();
+        if(pid == devices.size())
+        {
+            devices.push_back(s.serial);
+
+            ios << (first ? "\n" : ",\n");
+            ios << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid + 1 << ",\"tid\":1,\"args\":{\"name\":\"";
+            ios << ((s.serial[0] == '\0') ? "default device" : s.serial) << "\"}}";
+            first = false;
+        }
+
+        ios << (first ? "\n" : ",\n");
+        first = false;
+
+        ios << "{\"name\":\"";
+        if(s.name)
+        {
+            ios << s.name;
+        }
+        else
+        {
+            snprintf(buf, sizeof(buf), "0x%04X", s.id);
+            ios << buf;
+        }
+
+        ios << "\",\"cat\":\"";
+        switch(s.cat)
+        {
+            case catCommand: ios << "command"; break;
+            case catConnect: ios << "connect"; break;
+            default: ios << "phase";
+        }
+
+        snprintf(buf, sizeof(buf), "%.3f", 1e-3*(s.startNs - t0));
+        ios << "\",\"ph\":\"X\",\"ts\":" << buf;
+        snprintf(buf, sizeof(buf), "%.3f", 1e-3*s.durNs);
+        ios << ",\"dur\":" << buf << ",\"pid\":" << pid + 1 << ",\"tid\":1";
+
+        if(s.cat == catCommand)
+        {
+            snprintf(buf, sizeof(buf), "0x%04X", s.id);
+            ios << ",\"args\":{\"id\":\"" << buf << "\"}";
+        }
+
+        ios << "}";
+    }
+
+    ios << "\n]}\n";
+}
+
+inline
+int tmcTimeline::write( const std::string & path,
+                        bool errmsg
+                      )
+{
+    std::ofstream fout(path);
+    if(!fout)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcTimeline::write: unable to open " << path << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+
+    dump(fout);
+
+    if(!fout)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcTimeline::write: error writing " << path << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif //tmcTimeline_hpp
@@ -0,0 +1,997 @@
+/** \file tmcTrace.hpp
+ *  \brief Declare and define the tmcTrace wire-level tracer and the tmcReplay trace replay
+ */
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef tmcTrace_hpp
+#define tmcTrace_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// One record of the wire trace, as returned by \ref tmcTrace::snapshot
+struct tmcTraceRecord
+{
+    uint64_t number {0};          ///< The record number, counting from 0 since the file was created
+    uint64_t timeNs {0};          ///< The steady_clock time in ns
+    char serial[13] {};           ///< The USB serial number of the device, truncated to 12 characters
+    uint8_t dir {0};              ///< The direction, \ref tmcTrace::dirWrite or \ref tmcTrace::dirRead
+    uint16_t offset {0};          ///< The offset of these bytes in the frame or chunk
+    uint16_t total {0};           ///< The size of the whole frame or chunk
+    uint8_t len {0};              ///< The number of bytes in data
+    unsigned char data[92] {};    ///< The bytes
+
+    /// Dump details to a stream
+    /**
+      * \tparam streamT is an std::iostream like class
+      */
+    template<class streamT>
+    void dump(streamT & ios /**< [out] the stream to dump to*/);
+};
+
+/// Wire-level trace of the bytes written to and read from devices, in a memory-mapped ring file
+/** Every frame written with \ftdi_write_data, and every chunk returned by \ftdi_read_data, is copied into a slot of a
+  * preallocated ring in a memory-mapped file, with a monotonic timestamp, the direction, and the device serial
+  * number.  A slot holds up to 92 bytes, which is larger than any APT frame used, and longer chunks take several
+  * slots.  When the ring is full the oldest slots are overwritten.
+  *
+  * Recording claims a slot with one atomic increment and copies the bytes with no lock and no system call, so it
+  * never blocks the I/O path.  Each slot is protected by a sequence lock, so \ref snapshot, possibly in another
+  * process with the same file open, skips slots being written.  One tmcTrace can be shared by several
+  * tmcControllers, see \ref tmcController::wireTrace.
+  */
+class tmcTrace
+{
+public:
+
+    static constexpr uint8_t dirWrite = 1; ///< Bytes written to the device
+    static constexpr uint8_t dirRead = 2;  ///< Bytes read from the device
+
+protected:
+
+    /// A slot in the ring, one cache line pair
+    struct slot
+    {
+        std::atomic<uint64_t> seq;  ///< 2*number + 1 while being written, 2*number + 2 when complete, 0 if never written
+        uint64_t timeNs;            ///< The steady_clock time in ns
+        char serial[12];            ///< The USB serial number, not null terminated if 12 characters
+        uint8_t dir;                ///< The direction
+        uint8_t len;                ///< The number of bytes in data
+        uint16_t offset;            ///< The offset of these bytes in the frame or chunk
+        uint16_t total;             ///< The size of the whole frame or chunk
+        uint16_t reserved;          ///< Padding, always 0
+        unsigned char data[92];     ///< The bytes
+    };
+
+    static_assert(sizeof(slot) == 128, "tmcTrace slot must be 128 bytes");
+
+    /// The header of the ring file
+    struct header
+    {
+        char magic[8];              ///< Always "TMCTRACE"
+        uint32_t version;           ///< The layout version, currently 1
+        uint32_t slotSize;          ///< The size of a slot
+        uint64_t nSlots;            ///< The number of slots
+        int64_t realtimeOffsetNs;   ///< system_clock minus steady_clock when the file was created, in ns
+        std::atomic<uint64_t> head; ///< The number of the next record
+        char reserved[88];          ///< Padding to 128 bytes
+    };
+
+    static_assert(sizeof(header) == 128, "tmcTrace header must be 128 bytes");
+
+    /// The path of the ring file, empty if none is open
+    std::string m_path;
+
+    /// The file descriptor of the ring file
+    int m_fd {-1};
+
+    /// The size of the mapping
+    size_t m_mapSize {0};
+
+    /// The header at the start of the mapping
+    header * m_header {nullptr};
+
+    /// The slots, following the header
+    slot * m_slots {nullptr};
+
+    /// The number of slots
+    uint64_t m_nSlots {0};
+
+    /// Copy one piece of a frame or chunk into the next slot
+    void put( uint8_t dir,                ///< [in] the direction
+              const char * serial,        ///< [in] the serial number
+              uint64_t timeNs,            ///< [in] the time
+              const unsigned char * data, ///< [in] the bytes
+              uint16_t offset,            ///< [in] the offset of the bytes in the frame or chunk
+              uint16_t len,               ///< [in] the number of bytes, at most 92
+              uint16_t total              ///< [in] the size of the frame or chunk
+            ) noexcept;
+
+public:
+
+    /// D'tor, closes the file
+    ~tmcTrace();
+
+    /// Open the ring file, creating it if needed
+    /** An existing file with the same layout and number of slots is appended to, otherwise the file is recreated.
+      * If nSlots is 0 an existing trace file is opened as is, for instance to read it with \ref snapshot.  Closes
+      * any file already open.
+      *
+      * \returns 0 on success
+      * \returns -1 on error opening, resizing, or mapping the file, or if nSlots is 0 and the file is not a trace
+      */
+    int open( const std::string & path, ///< [in] the path of the ring file
+              uint64_t nSlots = 65536,  ///< [in] [optional] the number of slots, 8 MB of file by default, 0 to open an existing file
+              bool errmsg = true        ///< [in] [optional] flag controlling if an error message is printed on failure
+            );
+
+    /// Close the ring file
+    void close();
+
+    /// Check if a ring file is open
+    /**
+      * \returns true if open
+      */
+    bool isOpen();
+
+    /// Get the path of the ring file
+    /** \see m_path
+      *
+      * \returns the current value of m_path
+      */
+    std::string path();
+
+    /// Record bytes written to or read from a device
+    /** Written bytes are split into APT frames, each recorded separately.  Read chunks are recorded as returned.
+      * Does nothing if no file is open.  Safe to call from any thread.
+      */
+    void record( uint8_t dir,                ///< [in] the direction, \ref dirWrite or \ref dirRead
+                 const char * serial,        ///< [in] the USB serial number of the device
+                 const unsigned char * data, ///< [in] the bytes
+                 int len                     ///< [in] the number of bytes
+               ) noexcept;
+
+    /// Get the number of records made since the file was created
+    /**
+      * \returns the number of records, 0 if no file is open
+      */
+    uint64_t records();
+
+    /// Get the offset of system_clock from steady_clock when the file was created
+    /** Add this to tmcTraceRecord::timeNs to get the wall clock time in ns since the epoch.
+      *
+      * \returns the offset in ns
+      */
+    int64_t realtimeOffset();
+
+    /// Copy the complete records in the ring, oldest first
+    /** Slots being written are skipped.
+      *
+      * \returns the number of records copied
+      */
+    size_t snapshot( std::vector<tmcTraceRecord> & recs /**< [out] the records */ );
+};
+
+template<class streamT>
+void tmcTraceRecord::dump(streamT & ios)
+{
+    ios << number << " " << timeNs << " " << serial << " " << ((dir == tmcTrace::dirWrite) ? "W" : "R");
+    ios << " " << offset << "/" << total << ":" << std::hex << std::setfill('0');
+    for(uint8_t n = 0; n < len; ++n)
+    {
+        ios << " " << std::setw(2) << static_cast<int>(data[n]);
+    }
+    ios << std::dec << std::setfill(' ') << "\n";
+}
+
+inline
+tmcTrace::~tmcTrace()
+{
+    close();
+}
+
+inline
+int tmcTrace::open( const std::string & path,
+                    uint64_t nSlots,
+                    bool errmsg
+                  )
+{
+    close();
+
+    bool existing = (nSlots == 0);
+
+    int fd = ::open(path.c_str(), existing ? O_RDWR : (O_RDWR | O_CREAT), 0644);
+    if(fd < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcTrace::open: unable to open " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcTrace::open: unable to stat " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-4 << "\n";
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    if(existing)
+    {
+        if(static_cast<size_t>(st.st_size) <= sizeof(header) || (st.st_size - sizeof(header)) % sizeof(slot) != 0)
+        {
+            if(errmsg)
+            {
+                std::cerr << "tmcTrace::open: " << path << " is not a trace file\n";
+                std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+            }
+            ::close(fd);
+            return -1;
+        }
+
+        nSlots = (st.st_size - sizeof(header)) / sizeof(slot);
+    }
+
+    size_t mapSize = sizeof(header) + nSlots*sizeof(slot);
+
+    bool init = (static_cast<size_t>(st.st_size) != mapSize);
+
+    if(init && ftruncate(fd, mapSize) < 0)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcTrace::open: unable to resize " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-4 << "\n";
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    void * map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        if(errmsg)
+        {
+            std::cerr << "tmcTrace::open: unable to map " << path << ": " << strerror(errno) << "\n";
+            std::cerr << "in " << __FILE__ << " at line " << __LINE__-5 << "\n";
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    m_fd = fd;
+    m_mapSize = mapSize;
+    m_header = static_cast<header *>(map);
+    m_slots = reinterpret_cast<slot *>(static_cast<char *>(map) + sizeof(header));
+    m_nSlots = nSlots;
+    m_path = path;
+
+    if(!init && (memcmp(m_header->magic, "TMCTRACE", 8) != 0 || m_header->version != 1 ||
+                    m_header->slotSize != sizeof(slot) || m_header->nSlots != nSlots))
+    {
+        if(existing)
+        {
+            if(errmsg)
+            {
+                std::cerr << "tmcTrace::open: " << path << " is not a trace file\n";
+                std::cerr << "in " << __FILE__ << " at line " << __LINE__-7 << "\n";
+            }
+            close();
+            return -1;
+        }
+
+        init = true;
+    }
+
+    if(init)
+    {
+        memset(map, 0, mapSize);
+        memcpy(m_header->magic, "TMCTRACE", 8);
+        m_header->version = 1;
+        m_header->slotSize = sizeof(slot);
+        m_header->nSlots = nSlots;
+        m_header->realtimeOffsetNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch()).count() -
+                                            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                               std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    return 0;
+}
+
+inline
+void tmcTrace::close()
+{
+    if(m_header)
+    {
+        munmap(m_header, m_mapSize);
+        m_header = nullptr;
+        m_slots = nullptr;
+        m_nSlots = 0;
+        m_mapSize = 0;
+    }
+
+    if(m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    m_path = "";
+}
+
+inline
+bool tmcTrace::isOpen()
+{
+    return m_header != nullptr;
+}
+
+inline
+std::string tmcTrace::path()
+{
+    return m_path;
+}
+
+inline
+void tmcTrace::put( uint8_t dir,
+                    const char * serial,
+                    uint64_t timeNs,
+                    const unsigned char * data,
+                    uint16_t offset,
+                    uint16_t len,
+                    uint16_t total
+                  ) noexcept
+{
+    uint64_t number = m_header->head.fetch_add(1, std::memory_order_relaxed);
+    slot & s = m_slots[number % m_nSlots];
+
+    s.seq.store(2*number + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s.timeNs = timeNs;
+    size_t slen = strnlen(serial, sizeof(s.serial));
+    memcpy(s.serial, serial, slen);
+    memset(s.serial + slen, 0, sizeof(s.serial) - slen);
+    s.dir = dir;
+    s.len = len;
+    s.offset = offset;
+    s.total = total;
+    memcpy(s.data, data, len);
+
+    s.seq.store(2*number + 2, std::memory_order_release);
+}
+
+inline
+void tmcTrace::record( uint8_t dir,
+                       const char * serial,
+                       const unsigned char * data,
+                       int len
+                     ) noexcept
+{
+    if(m_header == nullptr || len <= 0)
+    {
+        return;
+    }
+
+    uint64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                     std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    int start = 0;
+    while(start < len)
+    {
+        //Written data is split at the APT frame boundaries
+        int flen = len - start;
+        if(dir == dirWrite && flen >= 6)
+        {
+            const unsigned char * h = data + start;
+            int fsz = 6 + ((h[4] & 0x80) ? (h[2] | (h[3] << 8)) : 0);
+            if(fsz < flen)
+            {
+                flen = fsz;
+            }
+        }
+
+        for(int off = 0; off < flen; off += sizeof(slot::data))
+        {
+            int plen = std::min<int>(flen - off, sizeof(slot::data));
+            put(dir, serial, timeNs, data + start + off, off, plen, flen);
+        }
+
+        start += flen;
+    }
+}
+
+inline
+uint64_t tmcTrace::records()
+{
+    if(m_header == nullptr)
+    {
+        return 0;
+    }
+
+    return m_header->head.load(std::memory_order_relaxed);
+}
+
+inline
+int64_t tmcTrace::realtimeOffset()
+{
+    if(m_header == nullptr)
+    {
+        return 0;
+    }
+
+    return m_header->realtimeOffsetNs;
+}
+
+inline
+size_t tmcTrace::snapshot( std::vector<tmcTraceRecord> & recs )
+{
+    recs.clear();
+
+    if(m_header == nullptr)
+    {
+        return 0;
+    }
+
+    uint64_t head = m_header->head.load(std::memory_order_acquire);
+    uint64_t first = (head > m_nSlots) ? head - m_nSlots : 0;
+
+    recs.reserve(head - first);
+
+    for(uint64_t number = first; number < head; ++number)
+    {
+        const slot & s = m_slots[number % m_nSlots];
+
+        uint64_t seq = s.seq.load(std::memory_order_acquire);
+        if(seq != 2*number + 2)
+        {
+            continue;
+        }
+
+        tmcTraceRecord rec;
+        rec.number = number;
+        rec.timeNs = s.timeNs;
+        memcpy(rec.serial, s.serial, sizeof(s.serial));
+        rec.dir = s.dir;
+        rec.len = std::min<uint8_t>(s.len, sizeof(rec.data));
+        rec.offset = s.offset;
+        rec.total = s.total;
+        memcpy(rec.data, s.data, rec.len);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(s.seq.load(std::memory_order_relaxed) != seq)
+        {
+            continue;
+        }
+
+        recs.push_back(rec);
+    }
+
+    return recs.size();
+}
+
+/// Replay of a wire trace in place of a device
+/** Loads the frames and chunks recorded for one device by a \ref tmcTrace, and stands in for the device when set
+  * with \ref tmcController::replay.  Each write by the controller is matched against the next recorded write, and
+  * each read returns the next recorded read chunk, so the controller's command, decode, and error paths run on
+  * recorded traffic without hardware.  Recorded writes which differ from those made are counted as mismatches.
+  *
+  * Events are delivered either as fast as possible, or with the recorded timing scaled by \ref speed.  See
+  * traceReplay.cpp for a tool which reissues the recorded commands.
+  */
+class tmcReplay
+{
+public:
+
+    /// A frame written or a chunk read, reassembled from the trace
+    struct event
+    {
+        uint64_t timeNs {0}; ///< The steady_clock time it was recorded, in ns
+        uint8_t dir {0};     ///< The direction, \ref tmcTrace::dirWrite or \ref tmcTrace::dirRead
+        size_t start {0};    ///< The offset of the bytes in \ref m_bytes
+        size_t size {0};     ///< The number of bytes
+    };
+
+protected:
+
+    /// The bytes of all events
+    std::vector<unsigned char> m_bytes;
+
+    /// The events, in recorded order
+    std::vector<event> m_events;
+
+    /// The index of the next event
+    size_t m_next {0};
+
+    /// The number of bytes of the next event already returned by \ref read
+    size_t m_readPos {0};
+
+    /// The number of consecutive reads which found no recorded read next
+    int m_emptyReads {0};
+
+    /// Flag controlling whether events are delivered with the recorded timing
+    bool m_realtime {false};
+
+    /// The factor by which the recorded timing is sped up
+    double m_speed {1.0};
+
+    /// The time at which the first event was delivered
+    std::chrono::steady_clock::time_point m_start;
+
+    /// The recorded time of the first event delivered, in ns
+    uint64_t m_startNs {0};
+
+    /// Whether an event has been delivered since loading or rewinding
+    bool m_started {false};
+
+    uint64_t m_writes {0};      ///< The number of recorded writes matched
+    uint64_t m_mismatches {0};  ///< The number of recorded writes which differed from those made
+    uint64_t m_reads {0};       ///< The number of recorded reads returned
+    uint64_t m_skipped {0};     ///< The number of recorded events skipped
+    uint64_t m_underruns {0};   ///< The number of writes and reads made with no recorded event to match
+
+    /// Wait until the next event is due, if delivering with the recorded timing
+    void pace() noexcept;
+
+public:
+
+    /// Load the events recorded for a device
+    /** Frames and chunks with pieces lost to overwriting in the ring are dropped.  Rewinds.
+      *
+      * \returns the number of events loaded
+      * \returns -1 if the trace is not open
+      */
+    int load( tmcTrace & tr,                  ///< [in] the trace, opened with \ref tmcTrace::open
+              const std::string & serial = "" ///< [in] [optional] the USB serial number, if empty that of the first record
+            );
+
+    /// Restart delivery from the first event, and zero the counters
+    void rewind();
+
+    /// Set whether events are delivered with the recorded timing
+    /** \see m_realtime
+      */
+    void realtime( bool rt /**< [in] true for the recorded timing, false for as fast as possible */ );
+
+    /// Get whether events are delivered with the recorded timing
+    /** \see m_realtime
+      *
+      * \returns the current value of m_realtime
+      */
+    bool realtime();
+
+    /// Set the factor by which the recorded timing is sped up
+    /** \see m_speed
+      */
+    void speed( double sp /**< [in] the new speed factor, must be > 0 */ );
+
+    /// Get the factor by which the recorded timing is sped up
+    /** \see m_speed
+      *
+      * \returns the current value of m_speed
+      */
+    double speed();
+
+    /// Get the number of events loaded
+    /**
+      * \returns the size of m_events
+      */
+    size_t events();
+
+    /// Check if all events have been delivered
+    /**
+      * \returns true if there are no more events
+      */
+    bool done();
+
+    /// Get the next recorded write, skipping any recorded reads before it
+    /** Used to decide which command to issue next.
+      *
+      * \returns a pointer to the next event, which is a write
+      * \returns nullptr if there are no more writes
+      */
+    const event * nextWrite();
+
+    /// Get the bytes of an event
+    /**
+      * \returns a pointer to the first byte
+      */
+    const unsigned char * bytes( const event & ev /**< [in] the event */);
+
+    /// Skip the next recorded write and the reads following it
+    /** Used for commands which are not reissued.
+      */
+    void skip();
+
+    /// Stand in for \ftdi_write_data
+    /** Consumes one recorded write for each frame in buf, comparing the bytes.
+      *
+      * \returns sz on success
+      * \returns -666 if there are no more recorded writes
+      */
+    int write( const unsigned char * buf, ///< [in] the bytes written
+               int sz                     ///< [in] the number of bytes
+             ) noexcept;
+
+    /// Stand in for \ftdi_read_data
+    /** Returns up to sz bytes of the next recorded read chunk.  If the next event is not a read, the first such
+      * read returns 0 as a device with nothing to send would, and following ones fail.
+      *
+      * \returns the number of bytes read
+      * \returns -666 if the replay has run out of recorded reads
+      */
+    int read( unsigned char * buf, ///< [out] the buffer to read into
+              int sz               ///< [in] the size of the buffer
+            ) noexcept;
+
+    /// Get the number of recorded writes matched
+    uint64_t writes();
+
+    /// Get the number of recorded writes which differed from those made
+    uint64_t mismatches();
+
+    /// Get the number of recorded reads returned
+    uint64_t reads();
+
+    /// Get the number of recorded events skipped
+    uint64_t skipped();
+
+    /// Get the number of writes and reads made with no recorded event to match
+    uint64_t underruns();
+
+    /// Dump the counters to a stream
+    /**
+      * \tparam streamT is an std::iostream like class
+      */
+    template<class streamT>
+    void dump(streamT & ios /**< [out] the stream to dump to*/);
+};
+
+inline
+int tmcReplay::load( tmcTrace & tr,
+                     const std::string & serial
+                   )
+{
+    if(!tr.isOpen())
+    {
+        return -1;
+    }
+
+    std::vector<tmcTraceRecord> recs;
+    tr.snapshot(recs);
+
+    m_bytes.clear();
+    m_events.clear();
+
+    std::string ser = serial;
+    if(ser == "" && recs.size() > 0)
+    {
+        ser = recs[0].serial;
+    }
+
+    bool open = false; //whether the last event is still being assembled
+    for(size_t n = 0; n < recs.size(); ++n)
+    {
+        const tmcTraceRecord & rec = recs[n];
+        if(ser != rec.serial)
+        {
+            continue;
+        }
+
+        if(rec.offset == 0)
+        {
+            if(open)
+            {
+                //the previous event lost its last pieces
+                m_bytes.resize(m_events.back().start);
+                m_events.pop_back();
+            }
+
+            event ev;
+            ev.timeNs = rec.timeNs;
+            ev.dir = rec.dir;
+            ev.start = m_bytes.size();
+            m_events.push_back(ev);
+            open = true;
+        }
+        else if(!open || m_events.back().dir != rec.dir || m_events.back().size != rec.offset)
+        {
+            //a piece of an event which lost its first pieces
+            if(open)
+            {
+                m_bytes.resize(m_events.back().start);
+                m_events.pop_back();
+                open = false;
+            }
+            continue;
+        }
+
+        m_bytes.insert(m_bytes.end(), rec.data, rec.data + rec.len);
+        m_events.back().size += rec.len;
+
+        if(m_events.back().size >= rec.total)
+        {
+            open = false;
+        }
+    }
+
+    if(open)
+    {
+        m_bytes.resize(m_events.back().start);
+        m_events.pop_back();
+    }
+
+    rewind();
+
+    return m_events.size();
+}
+
+inline
+void tmcReplay::rewind()
+{
+    m_next = 0;
+    m_readPos = 0;
+    m_emptyReads = 0;
+    m_started = false;
+    m_writes = 0;
+    m_mismatches = 0;
+    m_reads = 0;
+    m_skipped = 0;
+    m_underruns = 0;
+}
+
+inline
+void tmcReplay::realtime( bool rt )
+{
+    m_realtime = rt;
+}
+
+inline
+bool tmcReplay::realtime()
+{
+    return m_realtime;
+}
+
+inline
+void tmcReplay::speed( double sp )
+{
+    if(sp > 0)
+    {
+        m_speed = sp;
+    }
+}
+
+inline
+double tmcReplay::speed()
+{
+    return m_speed;
+}
+
+inline
+size_t tmcReplay::events()
+{
+    return m_events.size();
+}
+
+inline
+bool tmcReplay::done()
+{
+    return m_next >= m_events.size();
+}
+
+inline
+const tmcReplay::event * tmcReplay::nextWrite()
+{
+    while(m_next < m_events.size() && m_events[m_next].dir != tmcTrace::dirWrite)
+    {
+        ++m_next;
+        m_readPos = 0;
+        ++m_skipped;
+    }
+
+    if(m_next >= m_events.size())
+    {
+        return nullptr;
+    }
+
+    return &m_events[m_next];
+}
+
+inline
+const unsigned char * tmcReplay::bytes( const event & ev )
+{
+    return m_bytes.data() + ev.start;
+}
+
+inline
+void tmcReplay::skip()
+{
+    if(nextWrite() == nullptr)
+    {
+        return;
+    }
+
+    ++m_next;
+    ++m_skipped;
+    while(m_next < m_events.size() && m_events[m_next].dir == tmcTrace::dirRead)
+    {
+        ++m_next;
+        ++m_skipped;
+    }
+    m_readPos = 0;
+}
+
+inline
+void tmcReplay::pace() noexcept
+{
+    const event & ev = m_events[m_next];
+
+    if(!m_started)
+    {
+        m_start = std::chrono::steady_clock::now();
+        m_startNs = ev.timeNs;
+        m_started = true;
+        return;
+    }
+
+    if(m_realtime && ev.timeNs > m_startNs)
+    {
+        std::chrono::nanoseconds due(static_cast<int64_t>((ev.timeNs - m_startNs)/m_speed));
+        std::this_thread::sleep_until(m_start + due);
+    }
+}
+
+inline
+int tmcReplay::write( const unsigned char * buf,
+                      int sz
+                    ) noexcept
+{
+    m_emptyReads = 0;
+
+    int pos = 0;
+    while(pos < sz)
+    {
+        if(nextWrite() == nullptr)
+        {
+            ++m_underruns;
+            return -666;
+        }
+
+        pace();
+
+        const event & ev = m_events[m_next];
+        size_t n = std::min<size_t>(ev.size, sz - pos);
+        if(n != ev.size || memcmp(buf + pos, m_bytes.data() + ev.start, n) != 0)
+        {
+            ++m_mismatches;
+        }
+
+        ++m_writes;
+        ++m_next;
+        m_readPos = 0;
+        pos += n;
+    }
+
+    return sz;
+}
+
+inline
+int tmcReplay::read( unsigned char * buf,
+                     int sz
+                   ) noexcept
+{
+    if(m_next >= m_events.size() || m_events[m_next].dir != tmcTrace::dirRead)
+    {
+        if(m_emptyReads > 0)
+        {
+            ++m_underruns;
+            return -666;
+        }
+
+        ++m_emptyReads;
+        return 0;
+    }
+
+    m_emptyReads = 0;
+
+    if(m_readPos == 0)
+    {
+        pace();
+    }
+
+    const event & ev = m_events[m_next];
+    size_t n = std::min<size_t>(ev.size - m_readPos, sz);
+    memcpy(buf, m_bytes.data() + ev.start + m_readPos, n);
+
+    m_readPos += n;
+    if(m_readPos >= ev.size)
+    {
+        ++m_reads;
+        ++m_next;
+        m_readPos = 0;
+    }
+
+    return n;
+}
+
+inline
+uint64_t tmcReplay::writes()
+{
+    return m_writes;
+}
+
+inline
+uint64_t tmcReplay::mismatches()
+{
+    return m_mismatches;
+}
+
+inline
+uint64_t tmcReplay::reads()
+{
+    return m_reads;
+}
+
+inline
+uint64_t tmcReplay::skipped()
+{
+    return m_skipped;
+}
+
+inline
+uint64_t tmcReplay::underruns()
+{
+    return m_underruns;
+}
+
+template<class streamT>
+void tmcReplay::dump(streamT & ios)
+{
+    ios << "events:     " << m_events.size() << "\n";
+    ios << "writes:     " << m_writes << "\n";
+    ios << "mismatches: " << m_mismatches << "\n";
+    ios << "reads:      " << m_reads << "\n";
+    ios << "skipped:    " << m_skipped << "\n";
+    ios << "underruns:  " << m_underruns << "\n";
+}
+
+#endif //tmcTrace_hpp
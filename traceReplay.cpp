@@ -0,0 +1,233 @@
+/** \file traceReplay.cpp
+  *  \brief A program to replay a wire trace through tmcController
+  *
+  * This program reissues the commands recorded in a wire trace (see \ref tmcTrace) with a \ref tmcReplay standing
+  * in for the device, so the command, decode, and error paths can be exercised and benchmarked without hardware.
+  *
+  * Compile with
+  * \verbatim
+    g++ -O2 -o traceReplay traceReplay.cpp -I/usr/include/libftdi1/ -lftdi1 -lpthread
+    \endverbatim
+  * (change the include path as needed.  you may also need to add the -L library path)
+  *
+  * Run with
+  * \verbatim
+    ./traceReplay trace.bin [serial] [speed]
+   \endverbatim
+  * where serial selects the device in the trace (the first one by default, or "-"), and speed is the factor by
+  * which the recorded timing is sped up (0, the default, for as fast as possible).
+  *
+  */
+
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#include <cstdlib>
+
+#include "tmcController.hpp"
+
+/// Reissue the command which wrote a recorded frame
+/**
+  * \returns the return value of the command
+  * \returns 1 if the command is not reissued
+  */
+int reissue( tmcController & tmcc,  ///< [in] the controller, with the replay set
+             const unsigned char * f ///< [in] the recorded frame
+           )
+{
+    uint16_t id = f[0] | (f[1] << 8);
+
+    switch(id)
+    {
+        case tmcApt::HW_REQ_INFO::ID:
+        {
+            tmcController::HWInfo hwi;
+            return tmcc.hw_req_info(hwi, false);
+        }
+        case tmcApt::MOD_IDENTIFY::ID:
+            return tmcc.mod_identify(false);
+        case tmcApt::HW_STOP_UPDATEMSGS::ID:
+            return tmcc.hw_stop_updatemsgs(false);
+        case tmcApt::MOD_SET_CHANENABLESTATE::ID:
+            return tmcc.mod_set_chanenablestate(f[2], static_cast<tmcController::EnableState>(f[3]), false);
+        case tmcApt::MOD_REQ_CHANENABLESTATE::ID:
+        {
+            tmcController::EnableState ces;
+            return tmcc.mod_req_chanenablestate(ces, f[2], false);
+        }
+        case tmcApt::PZ_SET_POSCONTROLMODE::ID:
+            return tmcc.pz_set_poscontrolmode(static_cast<tmcController::PosControlMode>(f[3]), false);
+        case tmcApt::PZ_REQ_POSCONTROLMODE::ID:
+        {
+            tmcController::PosControlMode pcm;
+            return tmcc.pz_req_poscontrolmode(pcm, false);
+        }
+        case tmcApt::PZ_SET_OUTPUTVOLTS::ID:
+        {
+            //invert the truncating conversion in pz_set_outputvolts
+            int16_t iov = tmcApt::get<tmcApt::PZ_SET_OUTPUTVOLTS::Voltage>(f);
+            float ov = (iov > 0) ? std::min(1.0f, (iov + 0.5f)/32767) : std::max(-1.0f, (iov - 0.5f)/32768);
+            return tmcc.pz_set_outputvolts(ov, false);
+        }
+        case tmcApt::PZ_REQ_OUTPUTVOLTS::ID:
+        {
+            float ov;
+            return tmcc.pz_req_outputvolts(ov, false);
+        }
+        case tmcApt::PZ_SET_OUTPUTPOS::ID:
+        {
+            uint16_t ipos = tmcApt::get<tmcApt::PZ_SET_OUTPUTPOS::Position>(f);
+            return tmcc.pz_set_outputpos(std::min(1.0f, (ipos + 0.5f)/32767), false);
+        }
+        case tmcApt::PZ_REQ_OUTPUTPOS::ID:
+        {
+            float pos;
+            return tmcc.pz_req_outputpos(pos, false);
+        }
+        case tmcApt::PZ_REQ_PZSTATUSUPDATE::ID:
+        {
+            tmcController::PZStatus pzs;
+            return tmcc.pz_req_pzstatusupdate(pzs, false);
+        }
+        case tmcApt::PZ_REQ_OUTPUTLUTPARAMS::ID:
+        {
+            tmcController::LUTParams lutp;
+            return tmcc.pz_req_outputlutparams(lutp, false);
+        }
+        case tmcApt::PZ_START_LUTOUTPUT::ID:
+            return tmcc.pz_start_lutoutput(false);
+        case tmcApt::PZ_STOP_LUTOUTPUT::ID:
+            return tmcc.pz_stop_lutoutput(false);
+        case tmcApt::PZ_SET_TPZ_DISPSETTINGS::ID:
+            return tmcc.pz_set_tpz_dispsettings(tmcApt::get<tmcApt::PZ_SET_TPZ_DISPSETTINGS::DispIntensity>(f), false);
+        case tmcApt::PZ_REQ_TPZ_DISPSETTINGS::ID:
+        {
+            uint16_t dispint;
+            return tmcc.pz_req_tpz_dispsettings(dispint, false);
+        }
+        case tmcApt::PZ_REQ_TPZ_IOSETTINGS::ID:
+        {
+            tmcController::TPZIOSettings tios;
+            return tmcc.pz_req_tpz_iosettings(tios, false);
+        }
+        case tmcApt::KPZ_REQ_KCUBEMMIPARAMS::ID:
+        {
+            tmcController::KMMIParams kmp;
+            return tmcc.kpz_req_kcubemmiparams(kmp, false);
+        }
+        default:
+            return 1;
+    }
+}
+
+/** The trace replay main program.
+  */
+int main( int argc,    ///< [in] the number of command line arguments, 2 to 4
+          char **argv  ///< [in] the command line arguments. argv[1] is the trace file, then the optional serial and speed.
+        )
+{
+    if(argc < 2 || argc > 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " trace-file [serial] [speed]\n";
+        return EXIT_FAILURE;
+    }
+
+    std::string serial;
+    if(argc > 2 && std::string(argv[2]) != "-")
+    {
+        serial = argv[2];
+    }
+
+    double speed = 0;
+    if(argc > 3)
+    {
+        speed = atof(argv[3]);
+    }
+
+    tmcTrace trace;
+    if(trace.open(argv[1], 0) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    tmcReplay rp;
+    if(rp.load(trace, serial) <= 0)
+    {
+        std::cerr << "No events found in " << argv[1] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    if(speed > 0)
+    {
+        rp.realtime(true);
+        rp.speed(speed);
+    }
+
+    tmcController tmcc;
+    tmcc.preFlushSleep(0);
+    tmcc.postFlushSleep(0);
+    tmcc.postChanEnableSleep(0); //the recorded timing includes the sleeps
+    tmcc.replay(&rp);
+
+    long commands = 0;
+    long errors = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    const tmcReplay::event * ev;
+    while((ev = rp.nextWrite()) != nullptr)
+    {
+        int rv = reissue(tmcc, rp.bytes(*ev));
+        if(rv == 1)
+        {
+            rp.skip();
+            continue;
+        }
+
+        ++commands;
+        if(rv < 0)
+        {
+            ++errors;
+            tmcc.replay(&rp); //mark connected again after an error
+        }
+    }
+
+    double et = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    tmcc.replay(nullptr);
+
+    rp.dump(std::cout);
+    std::cout << "commands:   " << commands << "\n";
+    std::cout << "errors:     " << errors << "\n";
+    std::cout << "time:       " << et << " s\n";
+    if(et > 0)
+    {
+        std::cout << "rate:       " << commands/et << " commands/s\n";
+    }
+
+    std::vector<tmcController::LatencyHistogram> hists = tmcc.latencySnapshot();
+    for(size_t n = 0; n < hists.size(); ++n)
+    {
+        std::cout << "\n";
+        hists[n].dump(std::cout);
+    }
+
+    return EXIT_SUCCESS;
+}
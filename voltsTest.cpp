@@ -0,0 +1,179 @@
+/** \file voltsTest.cpp
+  *  \brief A test that the vectorized volts2counts matches the scalar conversion
+  *
+  * This program converts random and edge case values with \ref tmcController::volts2counts, at every length up to
+  * several vector blocks, at unaligned offsets, and in place, and compares each count and the saturation count to
+  * a plain scalar conversion.  No device is needed.
+  *
+  * Compile with
+  * \verbatim
+    g++ -O2 -mavx2 -o voltsTest voltsTest.cpp -I/usr/include/libftdi1/ -lftdi1 -lpthread
+    \endverbatim
+  * (change the include path as needed.  you may also need to add the -L library path)
+  * Build it again without -mavx2 to test the SSE2 path, and with -U__SSE2__ added to test the scalar path.
+  *
+  * Run with
+  * \verbatim
+    ./voltsTest
+   \endverbatim
+  * The exit status is 0 if the test passes.
+  *
+  */
+
+
+//***********************************************************************//
+// Copyright 2023 Jared R. Males (jaredmales@pm.me)
+//
+// This file is part of tmcController.
+//
+// tmcController is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// tmcController is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with mxlib.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
+
+#include "tmcController.hpp"
+
+/// Convert one value the way pz_set_outputvolts does
+/**
+  * \returns the count
+  */
+int16_t scalarCounts( float x,    ///< [in] the value, as a fraction of max
+                      bool & sat  ///< [out] set to true if the value was out of range or NaN
+                    )
+{
+    sat = !(x >= -1.0f && x <= 1.0f);
+
+    if(x != x)
+    {
+        return 0;
+    }
+
+    x = std::min(std::max(x, -1.0f), 1.0f);
+
+    if(x > 0)
+    {
+        return x*32767;
+    }
+
+    return x*32768;
+}
+
+/// Convert a block with volts2counts and compare it to the scalar conversion
+/**
+  * \returns the number of values which differ, plus 1 if the saturation count differs
+  */
+int check( tmcController & tmcc,        ///< [in] the controller
+           const std::vector<float> & v, ///< [in] the values
+           size_t off,                   ///< [in] the offset of the first value converted, to test unaligned access
+           size_t n,                     ///< [in] the number of values converted
+           bool inPlace                  ///< [in] if true convert in place
+         )
+{
+    std::vector<float> buf(v);
+    std::vector<int16_t> out(v.size() + 8);
+
+    int16_t * iov = inPlace ? reinterpret_cast<int16_t *>(buf.data() + off) : out.data() + off;
+
+    int nsat = tmcc.volts2counts(iov, buf.data() + off, n);
+
+    int nsatRef = 0;
+    int bad = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        bool sat;
+        int16_t ref = scalarCounts(v[off + i], sat);
+        nsatRef += sat;
+
+        //the counts are stored little-endian
+        const unsigned char * b = reinterpret_cast<const unsigned char *>(iov + i);
+        int16_t c = static_cast<int16_t>(b[0] | (b[1] << 8));
+
+        if(c != ref)
+        {
+            if(bad == 0)
+            {
+                std::cerr << "  n=" << n << " off=" << off << " inPlace=" << inPlace << ": " << v[off + i];
+                std::cerr << " gave " << c << " expected " << ref << "\n";
+            }
+            ++bad;
+        }
+    }
+
+    if(nsat != nsatRef)
+    {
+        std::cerr << "  n=" << n << " off=" << off << " inPlace=" << inPlace << ": saturated " << nsat;
+        std::cerr << " expected " << nsatRef << "\n";
+        ++bad;
+    }
+
+    return bad;
+}
+
+/** The volts conversion test main program.
+  */
+int main()
+{
+#if defined(__AVX2__)
+    std::cout << "testing the AVX2 path\n";
+#elif defined(__SSE2__)
+    std::cout << "testing the SSE2 path\n";
+#else
+    std::cout << "testing the scalar path\n";
+#endif
+
+    tmcController tmcc;
+
+    //edge cases first, then random values covering the range and a bit beyond
+    std::vector<float> v = { 0.0f, -0.0f, 1.0f, -1.0f, 1.0000001f, -1.0000001f, 0.5f, -0.5f,
+                             std::nextafter(1.0f, 0.0f), std::nextafter(-1.0f, 0.0f), 1.0f/32767, -1.0f/32768,
+                             std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(),
+                             -std::numeric_limits<float>::infinity(), 1e30f, -1e30f, 1e-30f };
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-1.2f, 1.2f);
+    while(v.size() < 4096)
+    {
+        v.push_back(dist(gen));
+    }
+
+    int bad = 0;
+    for(size_t n = 0; n <= 67; ++n)
+    {
+        for(size_t off = 0; off < 4; ++off)
+        {
+            bad += check(tmcc, v, off, n, false);
+            bad += check(tmcc, v, off, n, true);
+        }
+    }
+
+    bad += check(tmcc, v, 0, v.size(), false);
+    bad += check(tmcc, v, 1, v.size() - 1, true);
+
+    //absolute volts need the voltage limit of the device
+    float ov = 10;
+    int16_t iov;
+    int rv = tmcc.volts2counts(&iov, &ov, 1, true);
+    if(rv != -1000)
+    {
+        std::cerr << "  absolute with no voltage limit returned " << rv << "\n";
+        ++bad;
+    }
+
+    std::cout << (bad == 0 ? "PASS\n" : "FAIL\n");
+
+    return (bad == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}